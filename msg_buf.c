@@ -3,15 +3,50 @@
 
 #include <stdlib.h>      // malloc(), free()
 #include <string.h>      // memcpy()
+#include <time.h>        // clock_gettime()
+#include <stdio.h>
 #include <assert.h>
 #include "msg_buf.h"
 
+// Смещение сообщения от начала блока памяти пула (сообщение начинается
+// со строки кэша, а перед ним лежит счетчик ссылок)
+#define MSG_BUFFER_POOL_DATA 64
+
+// Выравнивание сообщений в теле пачки и в блоке памяти пачки: как у
+// столбцов атрибутов облака, чтобы столбцы сообщений из пачки тоже были
+// выровнены в памяти
+#define MSG_BATCH_ALIGN MSG_CLOUD_ALIGN
+
+
+// Функция проходит столбцы атрибутов облака точек по порядку и возвращает
+// смещение столбца attr от начала сообщения или, если attr = 0, конец
+// последнего столбца (то есть размер сообщения).
+static size_t MsgCalcCloudLayout(const MsgHeader* msg, unsigned attr)
+{
+    size_t npts = msg->uni.cloud.npts;
+    size_t offset = sizeof(MsgHeader) +
+        npts * MsgCalcPointSize(msg->uni.cloud.pointFormat);
+
+    for (unsigned bit = 1; bit <= MSG_POINT_ATTR_ALL; bit <<= 1)
+    {
+        if (!(msg->uni.cloud.attributes & bit))
+            continue;
+        offset = (offset + MSG_CLOUD_ALIGN - 1) &
+            ~(size_t) (MSG_CLOUD_ALIGN - 1);
+        if (bit == attr)
+            break;
+        offset += npts * MsgCalcAttributeSize((MsgPointAttribute) bit);
+    }
+    return offset;
+}
+
 
 // Функция вычисляет размер буфера сообщения по данным заголовка сообщения
 size_t MsgCalcSize(const MsgHeader* msg)
 {
     size_t nelems = 0;     // количество точек облака или пикселей кадра
     size_t elem_size = 0;
+    size_t attr_size = 0;  // столбцы атрибутов точек облака с выравниванием
     size_t buf_size = 0;   // размер буфера сообщения
 
     // Проверяем контрольный код структуры заголовка сообщения
@@ -22,15 +57,38 @@ size_t MsgCalcSize(const MsgHeader* msg)
     {
     case MsgTypePointCloud:
         nelems = msg->uni.cloud.npts; // количество точек
-        elem_size = 12; // 3 координаты типа float каждая
+        // Заголовок мог прийти из сети: точка со всеми атрибутами занимает
+        // меньше 32 байт, и при большем количестве точек размер
+        // переполнился бы
+        if (nelems > ((size_t) -1 - sizeof(MsgHeader) -
+            MSG_CLOUD_ALIGN * 4) / 32)
+            return (size_t) -1;
+        elem_size = MsgCalcPointSize(msg->uni.cloud.pointFormat);
+        attr_size = MsgCalcCloudLayout(msg, 0) - sizeof(MsgHeader) -
+            nelems * elem_size;
         break;
     case MsgTypeImage:
         nelems = msg->uni.image.width * msg->uni.image.height;
         switch (msg->uni.image.format)
         {
         case MsgImageFormatGray:
+        case MsgImageFormatBayerRGGB:
+        case MsgImageFormatBayerBGGR:
+        case MsgImageFormatBayerGRBG:
+        case MsgImageFormatBayerGBRG:
             elem_size = 1;
             break;
+        case MsgImageFormatNV12:
+        case MsgImageFormatI420:
+            // Плоскость яркости и две плоскости цветности с половинным
+            // разрешением по каждой оси (1.5 байта на пиксель)
+            nelems += 2 * ((msg->uni.image.width + 1) / 2) *
+                ((msg->uni.image.height + 1) / 2);
+            elem_size = 1;
+            break;
+        case MsgImageFormatDepth16:
+            elem_size = 2;
+            break;
         case MsgImageFormatRGB:
             elem_size = 3;
             break;
@@ -44,6 +102,19 @@ size_t MsgCalcSize(const MsgHeader* msg)
             break;
         }
         break;
+    case MsgTypeFeatures:
+        // Столбцы x, y, size, angle, response (float) и octave (int32), а
+        // за ними дескрипторы
+        nelems = msg->uni.features.count;
+        elem_size = 5 * sizeof(float) + sizeof(int32_t) +
+            msg->uni.features.descriptorSize;
+        // Заголовок мог прийти из сети: при недопустимом размере
+        // дескриптора или переполнении возвращаем размер, которого нет
+        // ни у одного буфера
+        if (msg->uni.features.descriptorSize > MSG_DESCRIPTOR_SIZE_MAX ||
+            nelems > ((size_t) -1 - sizeof(MsgHeader)) / elem_size)
+            return (size_t) -1;
+        break;
     default:
         // Недопустимое значение типа сообщения!
         assert(TRUE == FALSE);
@@ -51,11 +122,63 @@ size_t MsgCalcSize(const MsgHeader* msg)
         elem_size = 0;
         break;
     }
-    buf_size = nelems * elem_size + sizeof(MsgHeader);
+    buf_size = nelems * elem_size + attr_size + sizeof(MsgHeader);
     return buf_size;
 }
 
 
+// Функция возвращает размер одной точки облака в байтах для заданного
+// формата представления координат.
+size_t MsgCalcPointSize(MsgPointFormat format)
+{
+    switch (format)
+    {
+    case MsgPointFormatFloat32:
+        return 12; // 3 координаты типа float каждая
+    case MsgPointFormatFloat16:
+    case MsgPointFormatInt16:
+        return 6;  // 3 координаты по 2 байта каждая
+    default:
+        // Недопустимый формат точек в сообщении!
+        assert(TRUE == FALSE);
+        return 0;
+    }
+}
+
+
+// Функция возвращает размер атрибута одной точки облака в байтах.
+size_t MsgCalcAttributeSize(MsgPointAttribute attr)
+{
+    switch (attr)
+    {
+    case MsgPointAttrColor:
+        return 3;  // компоненты R, G, B по байту
+    case MsgPointAttrIntensity:
+        return sizeof(float);
+    case MsgPointAttrNormal:
+        return 3 * sizeof(int16_t);
+    case MsgPointAttrConfidence:
+        return 1;
+    default:
+        // Недопустимый атрибут точек облака!
+        assert(TRUE == FALSE);
+        return 0;
+    }
+}
+
+
+// Функция возвращает смещение столбца атрибута от начала сообщения.
+size_t MsgCalcAttributeOffset(const MsgHeader* msg, MsgPointAttribute attr)
+{
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+
+    if (!(msg->uni.cloud.attributes & attr & MSG_POINT_ATTR_ALL))
+        return 0;
+    return MsgCalcCloudLayout(msg, attr);
+}
+
+
 // Функция инициализирует структуру буфера сообщения по структуре заголовка
 // отдельного пакета из этого сообщения (удобно для принимающей стороны).
 BOOL MsgBufferInitFromPkt(MsgBuffer* buf, const MsgPacketHeader* pkt)
@@ -70,6 +193,11 @@ BOOL MsgBufferInitFromPkt(MsgBuffer* buf, const MsgPacketHeader* pkt)
     buf->chunkSizeMax = pkt->chunkSizeMax;
     buf->status = (unsigned char*) malloc(pkt->msgChunksCount);
     buf->data = (unsigned char*) malloc(pkt->msgSize);
+    buf->refCount = NULL;
+    buf->pool = NULL;
+    buf->sendTimeNs = 0;
+    buf->recvTimeNs = 0;
+    buf->batched = FALSE;
     bzero(buf->status, pkt->msgChunksCount);
 
     // Формируем контрольный код структуры буфера
@@ -113,10 +241,16 @@ BOOL MsgBufferInit(MsgBuffer* buf, const MsgHeader* msg, size_t mtu)
     buf->chunkSizeMax = chunk_size;
     buf->status = (unsigned char*) malloc(nchunks);
     buf->data = (unsigned char*) malloc(buf_size);
+    buf->refCount = (size_t*) malloc(sizeof(size_t));
+    buf->pool = NULL;
+    buf->sendTimeNs = 0;
+    buf->recvTimeNs = 0;
+    buf->batched = FALSE;
     
     // Формируем контрольный код структуры буфера
-    if (buf->status && buf->data)
+    if (buf->status && buf->data && buf->refCount)
     {
+        *buf->refCount = 1;
         buf->magicNumber = MSG_BUFFER_MAGIC;
         return TRUE;
     }
@@ -128,21 +262,206 @@ BOOL MsgBufferInit(MsgBuffer* buf, const MsgHeader* msg, size_t mtu)
 }
 
 
+// Функция возвращает блок памяти в пул (или освобождает его, если в пуле
+// уже хранится capacity свободных блоков).
+static void MsgBufferPoolPut(MsgBufferPool* pool, unsigned char* block)
+{
+    assert(pool->outstanding > 0);
+    pool->outstanding--;
+    if (pool->count < pool->capacity)
+        pool->blocks[pool->count++] = block;
+    else
+        free(block);
+}
+
+
+// Функция инициализирует пул блоков памяти для буферов сообщений.
+BOOL MsgBufferPoolInit(MsgBufferPool* pool, size_t maxMsgSize, size_t mtu,
+    size_t capacity)
+{
+    size_t chunk_size = mtu - sizeof(MsgPacketHeader);
+    size_t nchunks = (maxMsgSize + chunk_size - 1) / chunk_size;
+
+    assert(mtu > sizeof(MsgPacketHeader));
+
+    // Блок: счетчик ссылок, сообщение (с начала строки кэша) и массив
+    // состояний фрагментов
+    pool->mtu = mtu;
+    pool->maxMsgSize = maxMsgSize;
+    pool->blockSize = MSG_BUFFER_POOL_DATA + nchunks * chunk_size + nchunks;
+    pool->capacity = capacity;
+    pool->count = 0;
+    pool->outstanding = 0;
+    pool->blocks = (unsigned char**) malloc(
+        (capacity ? capacity : 1) * sizeof(unsigned char*));
+    return pool->blocks != NULL;
+}
+
+
+// Функция освобождает пул.
+void MsgBufferPoolFree(MsgBufferPool* pool)
+{
+    assert(pool->outstanding == 0);
+    while (pool->count > 0)
+        free(pool->blocks[--pool->count]);
+    free(pool->blocks);
+    pool->blocks = NULL;
+    pool->capacity = 0;
+}
+
+
+// Функция инициализирует буфер сообщения в памяти из пула.
+BOOL MsgBufferInitPooled(MsgBuffer* buf, const MsgHeader* msg,
+    MsgBufferPool* pool)
+{
+    size_t chunk_size = pool->mtu - sizeof(MsgPacketHeader);
+    size_t msg_size = 0;   // размер самого сообщения
+    size_t nchunks = 0;    // на сколько фрагментов будет нарезано сообщение
+    unsigned char* block = NULL;
+
+    // Проверяем контрольный код структуры заголовка сообщения
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+
+    buf->magicNumber = -1;
+    msg_size = MsgCalcSize(msg);
+    if (msg_size > pool->maxMsgSize)
+    {
+        printf("Message is too large for buffer pool!\n");
+        return FALSE;
+    }
+    nchunks = (msg_size + chunk_size - 1) / chunk_size;
+
+    // Берем свободный блок из пула или выделяем новый
+    if (pool->count > 0)
+        block = pool->blocks[--pool->count];
+    else
+        block = (unsigned char*) malloc(pool->blockSize);
+    if (!block)
+        return FALSE;
+    pool->outstanding++;
+
+    // Инициализируем все поля структуры буфера
+    buf->msgIndex = msg->index;
+    buf->size = nchunks * chunk_size;
+    buf->chunksCount = nchunks;
+    buf->chunkSizeMax = chunk_size;
+    buf->refCount = (size_t*) block;
+    buf->data = block + MSG_BUFFER_POOL_DATA;
+    buf->status = block + pool->blockSize - nchunks;
+    buf->pool = pool;
+    buf->sendTimeNs = 0;
+    buf->recvTimeNs = 0;
+    buf->batched = FALSE;
+    *buf->refCount = 1;
+    buf->magicNumber = MSG_BUFFER_MAGIC;
+
+    // Блок из пула хранит данные прошлого сообщения: обнуляем дополнение
+    // последнего фрагмента, чтобы они не ушли в сеть
+    memset(buf->data + msg_size, 0, buf->size - msg_size);
+    return TRUE;
+}
+
+
 // Функция освобождает память, выделенную для буфера сообщения и для
 // массива состояний пакета сообщения.
 void MsgBufferFree(MsgBuffer* buf)
 {
+    size_t* block = NULL;  // блок пачки, освобождаемый последним
+
     // Проверяем контрольный код структуры буфера сообщения
     assert(buf->magicNumber == MSG_BUFFER_MAGIC);
 
-    free(buf->status);  buf->status = NULL;
-    free(buf->data);    buf->data = NULL;
+    // Память освобождается (или возвращается в пул) только вместе с
+    // последней ссылкой на нее. Блок пачки может содержать и сам буфер,
+    // поэтому он освобождается после очистки полей буфера, а его счетчик
+    // изменяется атомарно: сообщения одной пачки могут освобождаться в
+    // разных потоках (см. MsgShardBufferRelease)
+    if (buf->batched)
+    {
+        if (__atomic_sub_fetch(buf->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+            block = buf->refCount;
+    }
+    else if (buf->pool && --(*buf->refCount) == 0)
+        MsgBufferPoolPut(buf->pool, (unsigned char*) buf->refCount);
+    else if (!buf->pool && (buf->refCount == NULL || --(*buf->refCount) == 0))
+    {
+        free(buf->status);
+        free(buf->data);
+        free(buf->refCount);
+    }
+    buf->status = NULL;
+    buf->data = NULL;
+    buf->refCount = NULL;
+    buf->pool = NULL;
     buf->msgIndex = -1;
     buf->size = 0;
     buf->chunksCount = 0;
     buf->chunkSizeMax = 0;
+    buf->sendTimeNs = 0;
+    buf->recvTimeNs = 0;
+    buf->batched = FALSE;
     
     buf->magicNumber = -1;
+    free(block);
+}
+
+
+// Функция добавляет ссылку ref на память буфера buf.
+BOOL MsgBufferRetain(const MsgBuffer* buf, MsgBuffer* ref)
+{
+    // Проверяем контрольный код структуры буфера сообщения
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    if (buf->refCount == NULL)
+        return FALSE;
+    if (buf->batched)
+        __atomic_add_fetch(buf->refCount, 1, __ATOMIC_RELAXED);
+    else
+        (*buf->refCount)++;
+    *ref = *buf;
+    return TRUE;
+}
+
+
+// Функция создает в buf копию сообщения из буфера src.
+BOOL MsgBufferClone(MsgBuffer* buf, const MsgBuffer* src)
+{
+    // Проверяем контрольный код структуры буфера сообщения
+    assert(src->magicNumber == MSG_BUFFER_MAGIC);
+
+    // Инициализируем все поля структуры буфера
+    buf->msgIndex = src->msgIndex;
+    buf->size = src->size;
+    buf->chunksCount = src->chunksCount;
+    buf->chunkSizeMax = src->chunkSizeMax;
+    buf->status = (unsigned char*) malloc(src->chunksCount);
+    buf->data = (unsigned char*) malloc(src->size);
+    buf->refCount = (size_t*) malloc(sizeof(size_t));
+    buf->pool = NULL;
+    buf->sendTimeNs = src->sendTimeNs;
+    buf->recvTimeNs = src->recvTimeNs;
+    buf->batched = FALSE;
+
+    // Копируем сообщение и формируем контрольный код структуры буфера
+    if (buf->status && buf->data && buf->refCount)
+    {
+        memset(buf->status, 1, src->chunksCount);
+        memcpy(buf->data, src->data, src->size);
+        *buf->refCount = 1;
+        buf->magicNumber = MSG_BUFFER_MAGIC;
+        return TRUE;
+    }
+    else
+    {
+        free(buf->status);
+        free(buf->data);
+        free(buf->refCount);
+        buf->status = NULL;
+        buf->data = NULL;
+        buf->refCount = NULL;
+        buf->magicNumber = -1;
+        return FALSE;
+    }
 }
 
 
@@ -174,6 +493,8 @@ void MsgBufferPutPacket(MsgBuffer* buf, const MsgPacketHeader* pkt,
 
     // Отмечаем в списке статусов фрагментов, что фрагмент принят
     buf->status[pkt->chunkIndex] = 1;
+    if (pkt->sendTimeNs > buf->sendTimeNs)
+        buf->sendTimeNs = pkt->sendTimeNs;
 }
 
 
@@ -212,6 +533,9 @@ void MsgPacketHeaderInit(MsgPacketHeader* pkt,
     //else
         pkt->chunkSize = buf->chunkSizeMax;
     pkt->chunkSizeMax = buf->chunkSizeMax;  
+    pkt->sendTimeNs = 0;
+    pkt->echoTimeNs = 0;
+    pkt->echoHoldNs = 0;
     pkt->magicNumber = MSG_PACKET_MAGIC;
 }
 
@@ -242,8 +566,11 @@ MsgBuffer* MsgListFind(MsgList* list, size_t id)
 MsgBuffer* MsgListCreate(MsgList** plist)
 {
     MsgList* node = (MsgList*) malloc(sizeof(MsgList));
+    struct timespec ts;
     if (node)
     {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        node->createTime = ts.tv_sec + ts.tv_nsec * 1.0e-9;
         node->next = *plist;
         *plist = node;
     }
@@ -271,8 +598,7 @@ BOOL MsgListDelete(MsgList** plist, size_t id)
         // Удаляем самый первый элемент в списке
         found = TRUE;
         *plist = head->next;
-        MsgBufferFree(&head->buf);
-        free(head);  
+        MsgListNodeFree(head);
         head = NULL;
     }
     else
@@ -293,8 +619,7 @@ BOOL MsgListDelete(MsgList** plist, size_t id)
             target = parent->next;
             parent->next = target->next;
             // Освобождаем память, выделенную под удаляемый элемент
-            MsgBufferFree(&target->buf);
-            free(target);  
+            MsgListNodeFree(target);
             target = NULL;
         }
     }
@@ -302,6 +627,21 @@ BOOL MsgListDelete(MsgList** plist, size_t id)
 }
 
 
+// Функция исключает из списка узел буфера, не освобождая его.
+BOOL MsgListUnlink(MsgList** plist, MsgBuffer* buf)
+{
+    MsgList* node = (MsgList*) buf; // узел начинается с буфера
+
+    while (*plist && *plist != node)
+        plist = &(*plist)->next;
+    if (*plist == NULL)
+        return FALSE;
+    *plist = node->next;
+    node->next = NULL;
+    return TRUE;
+}
+
+
 // Функция удаляет из списка все узлы и особождает память, выделенную
 // под них.
 void MsgListClear(MsgList** plist)
@@ -327,3 +667,181 @@ size_t MsgListGetLength(const MsgList* list)
 }
 
 
+// Функция удаляет из списка узлы несобранных сообщений старше maxAge
+// секунд.
+size_t MsgListExpire(MsgList** plist, double maxAge)
+{
+    MsgList** link = plist; // указатель на ссылку на текущий узел
+    MsgList* node = NULL;
+    size_t count = 0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double now = ts.tv_sec + ts.tv_nsec * 1.0e-9;
+    while ((node = *link) != NULL)
+    {
+        if (now - node->createTime > maxAge && !MsgBufferIsFull(&node->buf))
+        {
+            // Исключаем узел из списка и освобождаем его память
+            *link = node->next;
+            MsgListNodeFree(node);
+            count++;
+        }
+        else
+            link = &node->next;
+    }
+    return count;
+}
+
+
+// Функция освобождает буфер узла и сам узел.
+void MsgListNodeFree(MsgList* node)
+{
+    // Узел сообщения из пачки лежит в блоке пачки, который освобождает
+    // MsgBufferFree (поэтому признак читается до ее вызова)
+    BOOL batched = node->buf.batched;
+
+    MsgBufferFree(&node->buf);
+    if (!batched)
+        free(node);
+}
+
+
+// ------------------- Функции для работы с пачками сообщений ---------------
+
+
+// Функция возвращает размер size, округленный вверх до границы
+// выравнивания сообщений пачки.
+static size_t MsgBatchAlign(size_t size)
+{
+    return (size + MSG_BATCH_ALIGN - 1) & ~(size_t) (MSG_BATCH_ALIGN - 1);
+}
+
+
+// Функция начинает пустую пачку.
+void MsgBatchInit(MsgPacketHeader* pkt, size_t chunkSizeMax)
+{
+    pkt->msgIndex = 0;
+    pkt->msgSize = 0;
+    pkt->msgChunksCount = 0;
+    pkt->chunkIndex = 0;
+    pkt->chunkSize = chunkSizeMax;
+    pkt->chunkSizeMax = chunkSizeMax;
+    pkt->sendTimeNs = 0;
+    pkt->echoTimeNs = 0;
+    pkt->echoHoldNs = 0;
+    pkt->magicNumber = MSG_BATCH_MAGIC;
+}
+
+
+// Функция дописывает сообщение в пачку.
+BOOL MsgBatchAdd(MsgPacketHeader* pkt, unsigned char* body,
+    const MsgBuffer* buf)
+{
+    MsgBatchEntry entry;
+    size_t size = 0;       // фактический размер сообщения
+
+    // Проверяем контрольные коды заголовка пачки и буфера сообщения
+    assert(pkt->magicNumber == MSG_BATCH_MAGIC);
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    // Передается только само сообщение, без дополнения буфера до целого
+    // числа фрагментов
+    size = MsgCalcSize((const MsgHeader*) buf->data);
+    if (size > buf->size)
+        size = buf->size;
+    if (pkt->msgSize + sizeof(MsgBatchEntry) + size > pkt->chunkSizeMax)
+        return FALSE;
+
+    entry.msgIndex = buf->msgIndex;
+    entry.size = size;
+    memcpy(body + pkt->msgSize, &entry, sizeof(MsgBatchEntry));
+    memcpy(body + pkt->msgSize + sizeof(MsgBatchEntry), buf->data, size);
+    if (pkt->msgChunksCount == 0)
+        pkt->msgIndex = buf->msgIndex;
+    pkt->msgChunksCount++;
+    pkt->msgSize = MsgBatchAlign(pkt->msgSize + sizeof(MsgBatchEntry) + size);
+    if (pkt->msgSize > pkt->chunkSizeMax)
+        pkt->msgSize = pkt->chunkSizeMax;
+    return TRUE;
+}
+
+
+// Функция раскладывает принятую пачку на отдельные сообщения.
+MsgList* MsgBatchSplit(const MsgPacketHeader* pkt,
+    const unsigned char* body)
+{
+    size_t count = pkt->msgChunksCount;
+    size_t offset = 0;     // смещение заголовка сообщения в теле пачки
+    size_t head = 0;       // размер начала блока: счетчик ссылок и
+                           // состояние фрагментов (общее для всех сообщений)
+    unsigned char* block = NULL;
+    MsgList* nodes = NULL; // узлы сообщений в блоке
+    unsigned char* data = NULL; // копия тела пачки в блоке
+    struct timespec ts;
+
+    // Проверяем контрольный код и размеры пачки
+    assert(pkt->magicNumber == MSG_BATCH_MAGIC);
+    if (count == 0 || pkt->msgSize > pkt->chunkSize ||
+        pkt->chunkSize > pkt->chunkSizeMax)
+        return NULL;
+
+    // Проверяем, что все сообщения целиком лежат в теле пачки и корректны
+    for (size_t i = 0; i < count; i++)
+    {
+        MsgBatchEntry entry;
+        const MsgHeader* msg = NULL;
+
+        if (offset + sizeof(MsgBatchEntry) + sizeof(MsgHeader) > pkt->msgSize)
+            return NULL;
+        memcpy(&entry, body + offset, sizeof(MsgBatchEntry));
+        offset += sizeof(MsgBatchEntry);
+        msg = (const MsgHeader*) (body + offset);
+        if (entry.size < sizeof(MsgHeader) ||
+            entry.size > pkt->msgSize - offset ||
+            msg->magicNumber != MSG_HEADER_MAGIC ||
+            MsgCalcSize(msg) > entry.size)
+            return NULL;
+        offset = MsgBatchAlign(offset + entry.size);
+    }
+
+    // Выделяем один блок на всю пачку и копируем в него тело пачки
+    head = MsgBatchAlign(sizeof(size_t) + 1);
+    block = (unsigned char*) malloc(head +
+        MsgBatchAlign(count * sizeof(MsgList)) + pkt->msgSize);
+    if (!block)
+        return NULL;
+    nodes = (MsgList*) (block + head);
+    data = block + head + MsgBatchAlign(count * sizeof(MsgList));
+    memcpy(data, body, pkt->msgSize);
+    *(size_t*) block = count;          // по ссылке на каждое сообщение
+    block[sizeof(size_t)] = 1;         // каждое сообщение - один фрагмент
+
+    // Заполняем буферы сообщений, которые указывают в копию тела пачки
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        MsgBatchEntry entry;
+        MsgBuffer* buf = &nodes[i].buf;
+
+        memcpy(&entry, data + offset, sizeof(MsgBatchEntry));
+        offset += sizeof(MsgBatchEntry);
+        buf->msgIndex = entry.msgIndex;
+        buf->size = entry.size;
+        buf->chunksCount = 1;
+        buf->chunkSizeMax = entry.size;
+        buf->status = block + sizeof(size_t);
+        buf->data = data + offset;
+        buf->refCount = (size_t*) block;
+        buf->pool = NULL;
+        buf->sendTimeNs = pkt->sendTimeNs;
+        buf->recvTimeNs = 0;
+        buf->batched = TRUE;
+        buf->magicNumber = MSG_BUFFER_MAGIC;
+        nodes[i].createTime = ts.tv_sec + ts.tv_nsec * 1.0e-9;
+        nodes[i].next = (i + 1 < count) ? &nodes[i + 1] : NULL;
+        offset = MsgBatchAlign(offset + entry.size);
+    }
+    return nodes;
+}
@@ -1,20 +1,30 @@
 // msg_list.h: низкоуровневый протокол для разбивки и сборки больших 
 // сообщений, составленных из нескольких IP пакетов.
 
+#ifndef MSG_BUF_H
+#define MSG_BUF_H
+
 #define BOOL unsigned int
 #define TRUE  1
 #define FALSE 0
 
+#include <stdint.h>      // uint64_t
+
 // Контрольные коды зоголовков пакета и сообщения, а также буфера
 #define MSG_PACKET_MAGIC 0x55AAAA55
 #define MSG_HEADER_MAGIC 0x55AA55AA
 #define MSG_BUFFER_MAGIC 0xAA55AA55
 
+// Контрольный код заголовка пакета-пачки небольших сообщений
+#define MSG_BATCH_MAGIC 0x55A55AA5
+
 /* MsgType: Перечисление задает перечень возможных типов сообщений. */
 typedef enum MsgTypeEnum
 {
     MsgTypePointCloud,  // сообщение с координатами точек карты
-    MsgTypeImage        // сообщение с кадром от видеокамеры
+    MsgTypeImage,       // сообщение с кадром от видеокамеры
+    MsgTypeFeatures     // сообщение с особыми точками кадра и их
+                        // двоичными дескрипторами (см. msg_feature.h)
 } MsgType;
 
 
@@ -24,18 +34,86 @@ typedef enum MsgImageFormatEnum
 {
     MsgImageFormatGray, // полутоновое изображение
     MsgImageFormatRGB,  // цветное изображение RGB
-    MsgImageFormatRGBA  // цветное изображение RGBA
+    MsgImageFormatRGBA, // цветное изображение RGBA
+    MsgImageFormatNV12, // YUV 4:2:0: плоскость Y и чередующиеся U,V
+    MsgImageFormatI420, // YUV 4:2:0: плоскости Y, U и V по отдельности
+    MsgImageFormatDepth16,   // карта глубины (uint16 в единицах depthScale)
+    MsgImageFormatBayerRGGB, // сырой кадр с матрицы Байера RGGB
+    MsgImageFormatBayerBGGR, // сырой кадр с матрицы Байера BGGR
+    MsgImageFormatBayerGRBG, // сырой кадр с матрицы Байера GRBG
+    MsgImageFormatBayerGBRG  // сырой кадр с матрицы Байера GBRG
 } MsgImageFormat;
 
 
+/* MsgPointFormat: Перечисление задает формат представления координат
+ * точек в сообщении с облаком точек. */
+typedef enum MsgPointFormatEnum
+{
+    MsgPointFormatFloat32, // 3 координаты типа float (12 байт на точку)
+    MsgPointFormatFloat16, // 3 координаты половинной точности (6 байт)
+    MsgPointFormatInt16    // 3 координаты типа int16 (6 байт), которые
+        // пересчитываются в метры как origin[k] + scale * xyz[k]
+} MsgPointFormat;
+
+
+/* MsgPointAttribute: Перечисление задает необязательные атрибуты точек
+ * облака (флаги поля attributes заголовка сообщения). Каждый атрибут
+ * хранится отдельным столбцом на все точки облака после массива координат,
+ * столбцы идут в порядке значений флагов, а начало каждого выровнено на
+ * MSG_CLOUD_ALIGN байт от начала сообщения (см. MsgCalcAttributeOffset). */
+typedef enum MsgPointAttributeEnum
+{
+    MsgPointAttrColor = 1,      // цвет RGB, 3 байта на точку
+    MsgPointAttrIntensity = 2,  // интенсивность отражения, float (4 байта)
+    MsgPointAttrNormal = 4,     // нормаль, 3 числа int16 в единицах
+                                // 1/32767 (6 байт)
+    MsgPointAttrConfidence = 8  // достоверность точки от 0 до 255 (1 байт)
+} MsgPointAttribute;
+
+// Маска всех атрибутов точек облака
+#define MSG_POINT_ATTR_ALL 0xF
+
+// Выравнивание столбцов атрибутов точек от начала сообщения
+#define MSG_CLOUD_ALIGN 16
+
+
+/* MsgDescriptorType: Перечисление задает вид двоичных дескрипторов
+ * особых точек в сообщении типа MsgTypeFeatures. */
+typedef enum MsgDescriptorTypeEnum
+{
+    MsgDescriptorOrb,   // ORB (256 бит, 32 байта)
+    MsgDescriptorBrisk, // BRISK (512 бит, 64 байта)
+    MsgDescriptorAkaze, // AKAZE/MLDB (486 бит, 61 байт)
+    MsgDescriptorOther  // другой двоичный дескриптор (размер задается
+                        // полем descriptorSize)
+} MsgDescriptorType;
+
+// Наибольший размер дескриптора особой точки в байтах: заголовок с большим
+// значением descriptorSize считается поврежденным
+#define MSG_DESCRIPTOR_SIZE_MAX 4096
+
+
+/* MsgPointOrder: Перечисление задает порядок точек в сообщении с облаком
+ * точек. */
+typedef enum MsgPointOrderEnum
+{
+    MsgPointOrderMemory,     // порядок, в котором точки дало приложение
+    MsgPointOrderProgressive // прогрессивный порядок: любое начало массива
+        // точек - равномерно прореженная копия всего облака (см.
+        // MsgCloudOrderProgressive), так что и несобранное сообщение
+        // дает грубое облако (см. MsgCloudReceivedPoints)
+} MsgPointOrder;
+
+
 /* MsgHeader: Стуктура представляет заголовок сообщения, который
  * передается в первом пакете сообщения и идентифицирует тип
  * сообщения. */
 typedef struct MsgHeaderStruct
 {
     size_t index;  // порядковый номер сообщения (от начала сессии)
-    double timestampNs; // временная метка для момента создания сообщения
-        // в приложении ISAAC (в наносекундах от начала сессии)
+    uint64_t timestampNs; // момент захвата данных сообщения в приложении
+        // ISAAC в наносекундах по часам отправителя (см. MsgClockNs и
+        // config.clock соединения)
     MsgType type;  // тип сообщения
     union          // вариативная часть сообщения зависит от типа
     {
@@ -49,6 +127,11 @@ typedef struct MsgHeaderStruct
             double rotation[4];        // ее ориентация в форме кватерниона
             // Облако точек карты
             size_t npts;         // количество точек в облаке
+            MsgPointFormat pointFormat; // формат координат точек
+            double origin[3];    // начало отсчета (для MsgPointFormatInt16)
+            double scale;        // шаг квантования (для MsgPointFormatInt16)
+            MsgPointOrder pointOrder; // порядок точек в облаке
+            unsigned attributes; // атрибуты точек (флаги MsgPointAttribute)
         } cloud;
         struct // Сообщение типа кадр видеокамеры
         {
@@ -56,7 +139,16 @@ typedef struct MsgHeaderStruct
             MsgImageFormat format;     // формат пикселя изображения
             size_t width;     // ширина кадра в пикселях
             size_t height;    // высота кадра в пикселях
+            double depthScale;// метров на единицу (для MsgImageFormatDepth16)
         } image;
+        struct // Сообщение типа особые точки кадра
+        {
+            size_t count;     // количество особых точек
+            MsgDescriptorType descriptorType; // вид дескрипторов
+            size_t descriptorSize; // размер дескриптора в байтах
+            size_t width;     // ширина кадра, в котором найдены точки
+            size_t height;    // высота этого кадра
+        } features;
     } uni;
     size_t magicNumber; // должно быть равно 0x55AA55AA
 } MsgHeader, *MsgHeaderPtr;
@@ -65,6 +157,18 @@ typedef struct MsgHeaderStruct
 // Функция вычисляет размер сообщения по данным его заголовка
 extern size_t MsgCalcSize(const MsgHeader* msg);
 
+// Функция возвращает размер одной точки облака в байтах для заданного
+// формата представления координат.
+extern size_t MsgCalcPointSize(MsgPointFormat format);
+
+// Функция возвращает размер атрибута одной точки облака в байтах.
+extern size_t MsgCalcAttributeSize(MsgPointAttribute attr);
+
+// Функция возвращает смещение столбца атрибута attr от начала сообщения
+// с облаком точек или 0, если в облаке нет такого атрибута.
+extern size_t MsgCalcAttributeOffset(const MsgHeader* msg,
+    MsgPointAttribute attr);
+
 
 /* MsgPacketHeader: Структура представляет заголовок отдельного пакета,
  * в таких пакетах будут передаваться фрагменты сообщения. */
@@ -79,6 +183,13 @@ typedef struct MsgPacketHeaderStruct
          * равный максимальному размеру chunkSizeMax. */
     size_t chunkSizeMax;  // максимальный размер фрагмента
         /* Значение chunkSizeMax меньше mtu на размер заголовка пакета. */
+    uint64_t sendTimeNs;  // момент отправки пакета по часам отправителя, нс
+        /* (0 - не задан) */
+    uint64_t echoTimeNs;  // момент отправки последнего запроса
+        /* синхронизации часов по часам получателя (MsgPing), на который
+         * отвечает этот пакет (0 - пакет не несет ответа) */
+    uint64_t echoHoldNs;  // сколько наносекунд запрос ждал ответа у
+        /* отправителя (от приема запроса до sendTimeNs) */
     size_t magicNumber;   // должно быть равно 0x55AAAA55
 } MsgPacketHeader, *MsgPacketHeaderPtr;
 
@@ -95,6 +206,23 @@ typedef struct MsgBufferStruct
     unsigned char* status;// указатель на массив состояний всех фрагментов 
         // сообщения: состояние 0 - пока не принят, состояние 1 - уже принят
     unsigned char* data; // указатель на начало буфера сообщения
+    size_t* refCount;    // счетчик ссылок на память буфера (NULL, если
+        /* память не разделяется). Ссылки добавляет MsgBufferRetain, а
+         * снимает MsgBufferFree: память освобождается вместе с последней
+         * ссылкой. Так отправка без копирования (MSG_ZEROCOPY) удерживает
+         * данные, пока ядро их не передаст. */
+    struct MsgBufferPoolStruct* pool; // пул, в который возвращается
+        /* память вместе с последней ссылкой (NULL - память выделена
+         * функцией malloc, см. MsgBufferInitPooled). */
+    uint64_t sendTimeNs; // для принятого сообщения: наибольший момент
+        /* отправки его пакетов по часам отправителя, то есть момент
+         * завершения отправки (0 - не известен) */
+    uint64_t recvTimeNs; // для принятого сообщения: момент сборки по часам
+        /* получателя (0 - не известен) */
+    BOOL batched;        // память буфера - общий блок сообщений одной пачки
+        /* (см. MsgBatchSplit): в блоке лежат счетчик ссылок, узлы списка
+         * и сами сообщения, и блок освобождается вместе с последней
+         * ссылкой на любое из них. */
     size_t magicNumber;  // должно быть равно 0xAA55AA55
 } MsgBuffer, *MsgBufferPtr;
 
@@ -103,14 +231,57 @@ typedef struct MsgBufferStruct
 // самого сообщения (удобно для отправляющей стороны).
 extern BOOL MsgBufferInit(MsgBuffer* buf, const MsgHeader* msg, size_t mtu);
 
+/* MsgBufferPool: Структура представляет пул блоков памяти для буферов
+ * отправляемых сообщений. Блок вмещает счетчик ссылок, сообщение размером
+ * до maxMsgSize байт, нарезанное на пакеты размером mtu, и массив
+ * состояний его фрагментов. Буфер, освобожденный последней ссылкой,
+ * возвращает блок в пул, так что при потоке кадров память не выделяется
+ * заново, а ее страницы уже отображены. */
+typedef struct MsgBufferPoolStruct
+{
+    size_t mtu;          // размер пакета сообщений пула
+    size_t maxMsgSize;   // наибольший размер сообщения в байтах
+    size_t blockSize;    // размер блока памяти в байтах
+    size_t capacity;     // сколько свободных блоков хранит пул
+    size_t count;        // количество свободных блоков в пуле
+    unsigned char** blocks; // свободные блоки
+    size_t outstanding;  // сколько блоков выдано буферам
+} MsgBufferPool, *MsgBufferPoolPtr;
+
+
+// Функция инициализирует пул, который хранит до capacity свободных блоков
+// для сообщений размером до maxMsgSize байт с пакетами размером mtu.
+extern BOOL MsgBufferPoolInit(MsgBufferPool* pool, size_t maxMsgSize,
+    size_t mtu, size_t capacity);
+
+// Функция освобождает пул. Все буферы из пула (в том числе ссылки на них,
+// удерживаемые соединениями) должны быть освобождены до этого.
+extern void MsgBufferPoolFree(MsgBufferPool* pool);
+
+// Функция инициализирует структуру буфера сообщения по структуре заголовка
+// самого сообщения (как MsgBufferInit), но берет память из пула.
+extern BOOL MsgBufferInitPooled(MsgBuffer* buf, const MsgHeader* msg,
+    MsgBufferPool* pool);
+
 // Функция инициализирует структуру буфера сообщения по структуре заголовка
 // отдельного пакета из этого сообщения (удобно для принимающей стороны).
 extern BOOL MsgBufferInitFromPkt(MsgBuffer* buf, const MsgPacketHeader* pkt);
 
 // Функция освобождает память, выделенную для буфера сообщения и для
-// массива состояний пакета сообщения.
+// массива состояний пакета сообщения. Если на память есть другие ссылки,
+// то функция только снимает ссылку buf.
 extern void MsgBufferFree(MsgBuffer* buf);
 
+// Функция добавляет ссылку ref на память буфера buf (ее потом снимает
+// MsgBufferFree(ref)). Возвращает FALSE, если память буфера не
+// разделяется (буфер создан не функцией MsgBufferInit).
+extern BOOL MsgBufferRetain(const MsgBuffer* buf, MsgBuffer* ref);
+
+// Функция создает в buf копию сообщения из буфера src с собственной
+// памятью и счетчиком ссылок (например, для буфера воспроизводимой сессии,
+// который указывает в отображение файла и не может удерживаться).
+extern BOOL MsgBufferClone(MsgBuffer* buf, const MsgBuffer* src);
+
 // Функция записывает в буфер сообщения фрагмент сообщения из полученного 
 // пакета.
 extern void MsgBufferPutPacket(MsgBuffer* buf, const MsgPacketHeader* pkt, 
@@ -131,6 +302,7 @@ extern void MsgPacketHeaderInit(MsgPacketHeader* pkt,
 typedef struct MsgListStruct
 {
     MsgBuffer buf;   // буфер памяти
+    double createTime; // момент создания узла по монотонным часам, с
     struct MsgListStruct* next;  // указатель на следующий элемент списка
 } MsgList, *MsgListPtr;
 
@@ -149,6 +321,13 @@ extern MsgBuffer* MsgListCreate(MsgList** plist);
 // массив состояний пакетов и под тело сообщения. 
 extern BOOL MsgListDelete(MsgList** plist, size_t id);
 
+// Функция исключает из списка узел буфера buf (указатель на буфер в
+// списке), не освобождая его память, и возвращает FALSE, если такого узла
+// в списке нет. Узел после этого освобождается вызовом MsgListNodeFree
+// для указателя на буфер (узел начинается с буфера): узел сообщения из
+// пачки лежит в общем блоке пачки, и free для него недопустим.
+extern BOOL MsgListUnlink(MsgList** plist, MsgBuffer* buf);
+
 // Функция удаляет из списка все узлы и особождает память, выделенную
 // под них.
 extern void MsgListClear(MsgList** plist);
@@ -156,4 +335,49 @@ extern void MsgListClear(MsgList** plist);
 // Функция возвращает текущую длину списка.
 extern size_t MsgListGetLength(const MsgList* list);
 
+// Функция удаляет из списка узлы несобранных сообщений, созданные больше
+// maxAge секунд назад (недостающие пакеты таких сообщений потеряны), и
+// возвращает количество удаленных узлов.
+extern size_t MsgListExpire(MsgList** plist, double maxAge);
+
+// Функция освобождает буфер узла, исключенного из списка, и сам узел
+// (узел сообщения из пачки освобождается вместе с блоком пачки).
+extern void MsgListNodeFree(MsgList* node);
+
+
+/* MsgBatchEntry: Структура представляет заголовок сообщения в пакете-
+ * пачке. Пачка - это пакет с контрольным кодом MSG_BATCH_MAGIC, который
+ * вместо фрагмента одного сообщения несет несколько небольших сообщений
+ * целиком. В заголовке пачки msgIndex - номер первого сообщения,
+ * msgChunksCount - количество сообщений, msgSize - сколько байт тела
+ * пакета занято, а chunkSize, как и у обычного пакета, равен chunkSizeMax
+ * (пачка передается пакетом полного размера). В теле пачки за заголовком
+ * каждого сообщения следует само сообщение, дополненное до границы
+ * MSG_CLOUD_ALIGN байт. */
+typedef struct MsgBatchEntryStruct
+{
+    size_t msgIndex;     // порядковый номер сообщения от начала сессии
+    size_t size;         // размер (заголовок+тело) сообщения в байтах
+} MsgBatchEntry, *MsgBatchEntryPtr;
+
+
+// Функция начинает пустую пачку: инициализирует ее заголовок pkt для тела
+// размером chunkSizeMax байт.
+extern void MsgBatchInit(MsgPacketHeader* pkt, size_t chunkSizeMax);
+
+// Функция дописывает сообщение из буфера buf в пачку с заголовком pkt и
+// телом body. Возвращает FALSE, если сообщение не помещается в свободную
+// часть тела пачки.
+extern BOOL MsgBatchAdd(MsgPacketHeader* pkt, unsigned char* body,
+    const MsgBuffer* buf);
+
+// Функция раскладывает принятую пачку с заголовком pkt и телом body на
+// отдельные сообщения. Сообщения вместе с их узлами списка размещаются в
+// одном блоке памяти (по одному выделению памяти на пачку), а функция
+// возвращает цепочку узлов в порядке пачки или NULL, если пачка
+// повреждена или памяти не хватило. Узлы освобождаются функцией
+// MsgListNodeFree (или MsgListDelete, если узел добавлен в список).
+extern MsgList* MsgBatchSplit(const MsgPacketHeader* pkt,
+    const unsigned char* body);
 
+#endif // MSG_BUF_H
@@ -0,0 +1,71 @@
+// msg_clock.c: Реализация функций для целочисленных временных меток и
+// оценки смещения часов между отправителем и получателем.
+//
+
+#include <string.h>      // bzero()
+#include <time.h>        // clock_gettime()
+#include "msg_clock.h"
+
+
+// Функция возвращает текущее время по часам clock в наносекундах.
+uint64_t MsgClockNs(MsgClock clock)
+{
+    static const clockid_t ids[] =
+        { CLOCK_MONOTONIC, CLOCK_REALTIME, CLOCK_TAI, CLOCK_BOOTTIME };
+    struct timespec ts;
+
+    clock_gettime(ids[(unsigned) clock < 4 ? clock : 0], &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+// Функция переводит момент по системному времени в часы clock.
+uint64_t MsgClockFromRealtime(MsgClock clock, uint64_t realtimeNs)
+{
+    if (clock == MsgClockRealtime)
+        return realtimeNs;
+    return MsgClockNs(clock) - (MsgClockNs(MsgClockRealtime) - realtimeNs);
+}
+
+
+// Функция сбрасывает оценку смещения часов.
+void MsgClockSyncInit(MsgClockSync* sync)
+{
+    bzero(sync, sizeof(MsgClockSync));
+}
+
+
+// Функция учитывает замер смещения часов.
+BOOL MsgClockSyncAdd(MsgClockSync* sync, uint64_t t1, uint64_t t2,
+    uint64_t t3, uint64_t t4)
+{
+    // Разности берутся по модулю 2^64 и переводятся в знаковые, так что
+    // смещение может быть любого знака
+    int64_t rtt = (int64_t) (t4 - t1) - (int64_t) (t3 - t2);
+    int64_t offset = ((int64_t) (t2 - t1) + (int64_t) (t3 - t4)) / 2;
+    size_t best = 0;
+
+    if (rtt < 0)
+        return FALSE;
+    sync->offsets[sync->next] = offset;
+    sync->rtts[sync->next] = rtt;
+    sync->next = (sync->next + 1) % MSG_CLOCK_SAMPLES;
+    if (sync->count < MSG_CLOCK_SAMPLES)
+        sync->count++;
+    sync->sampleCount++;
+
+    // Выбираем замер с наименьшим временем оборота
+    for (size_t i = 1; i < sync->count; i++)
+        if (sync->rtts[i] < sync->rtts[best])
+            best = i;
+    sync->offsetNs = sync->offsets[best];
+    sync->rttNs = sync->rtts[best];
+    return TRUE;
+}
+
+
+// Функция переводит момент по часам партнера в свои часы.
+uint64_t MsgClockSyncToLocal(const MsgClockSync* sync, uint64_t peerNs)
+{
+    return peerNs - (uint64_t) sync->offsetNs;
+}
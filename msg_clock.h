@@ -0,0 +1,71 @@
+// msg_clock.h: Функции для целочисленных временных меток и оценки
+// смещения часов между отправителем и получателем.
+//
+// Временные метки - это целые наносекунды по выбранным часам (по
+// умолчанию монотонным: они не скачут при подстройке системного времени).
+// Часы разных машин отсчитываются от разных моментов и идут с разной
+// скоростью, поэтому получатель периодически оценивает их смещение по
+// обмену метками, как NTP: запрос уходит в момент t1 по часам получателя,
+// приходит к отправителю в момент t2 и отправляется обратно в момент t3
+// по часам отправителя, а ответ принимается в момент t4. Смещение часов
+// отправителя равно ((t2 - t1) + (t3 - t4)) / 2 с ошибкой не больше
+// половины времени оборота, поэтому из последних замеров выбирается замер
+// с наименьшим временем оборота (на него меньше всего повлияли очереди).
+
+#ifndef MSG_CLOCK_H
+#define MSG_CLOCK_H
+
+#include <stdint.h>      // uint64_t, int64_t
+#include "msg_buf.h"   // BOOL
+
+// Количество последних замеров, из которых выбирается оценка смещения
+#define MSG_CLOCK_SAMPLES 8
+
+
+/* MsgClock: Перечисление задает часы для временных меток. */
+typedef enum MsgClockEnum
+{
+    MsgClockMonotonic = 0, // монотонные часы (CLOCK_MONOTONIC)
+    MsgClockRealtime,      // системное время (CLOCK_REALTIME)
+    MsgClockTai,           // международное атомное время (CLOCK_TAI)
+    MsgClockBoottime       // монотонные часы с учетом сна (CLOCK_BOOTTIME)
+} MsgClock;
+
+
+/* MsgClockSync: Структура представляет оценку смещения часов партнера
+ * относительно собственных часов. */
+typedef struct MsgClockSyncStruct
+{
+    int64_t offsets[MSG_CLOCK_SAMPLES]; // смещения последних замеров, нс
+    int64_t rtts[MSG_CLOCK_SAMPLES];    // их время оборота, нс
+    size_t count;        // количество замеров в массивах
+    size_t next;         // индекс для следующего замера
+    int64_t offsetNs;    // оценка смещения: время партнера минус свое, нс
+    int64_t rttNs;       // время оборота выбранного замера, нс
+    size_t sampleCount;  // сколько замеров учтено с начала работы
+} MsgClockSync, *MsgClockSyncPtr;
+
+
+// Функция возвращает текущее время по часам clock в наносекундах.
+extern uint64_t MsgClockNs(MsgClock clock);
+
+// Функция переводит момент realtimeNs по системному времени
+// (CLOCK_REALTIME, например метку приема пакета ядром) в часы clock.
+extern uint64_t MsgClockFromRealtime(MsgClock clock, uint64_t realtimeNs);
+
+// Функция сбрасывает оценку смещения часов.
+extern void MsgClockSyncInit(MsgClockSync* sync);
+
+// Функция учитывает замер: запрос отправлен в момент t1 и ответ принят в
+// момент t4 по своим часам, а партнер принял запрос в момент t2 и
+// отправил ответ в момент t3 по своим часам. Возвращает FALSE, если
+// замер противоречив (отрицательное время оборота) и не учтен.
+extern BOOL MsgClockSyncAdd(MsgClockSync* sync, uint64_t t1, uint64_t t2,
+    uint64_t t3, uint64_t t4);
+
+// Функция переводит момент peerNs по часам партнера в свои часы. Без
+// замеров возвращает peerNs без изменений.
+extern uint64_t MsgClockSyncToLocal(const MsgClockSync* sync, uint64_t peerNs);
+
+
+#endif // MSG_CLOCK_H
@@ -0,0 +1,1095 @@
+// msg_cloud.c: Реализация функций для упаковки и распаковки координат
+// точек облака в сообщении типа MsgTypePointCloud.
+//
+// Преобразование в половинную точность выполняется командами F16C (x86)
+// или NEON (ARM), если они доступны, иначе - побитовыми операциями по
+// схеме из заметки https://gist.github.com/rygorous/2156668
+//
+
+#include <stdint.h>      // uint16_t, int16_t, uint32_t
+#include <stdlib.h>      // malloc(), free()
+#include <string.h>      // memcpy()
+#include <math.h>        // nearbyintf()
+#include <assert.h>
+#include "msg_cloud.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>   // F16C, SSE2
+#define MSG_CLOUD_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MSG_CLOUD_NEON
+#endif
+
+// Границы диапазона квантованных координат формата MsgPointFormatInt16
+#define MSG_INT16_MIN (-32768.0f)
+#define MSG_INT16_MAX ( 32767.0f)
+
+
+// ------------- Скалярное преобразование половинной точности --------------
+
+// Вспомогательная структура для доступа к битам числа float
+typedef union MsgFloatBitsUnion
+{
+    float f;
+    uint32_t u;
+} MsgFloatBits;
+
+
+// Функция переводит число float в число половинной точности с
+// округлением к ближайшему четному.
+static uint16_t MsgFloatToHalf(float value)
+{
+    MsgFloatBits f;
+    uint32_t sign = 0;
+    uint16_t half = 0;
+    uint32_t mantOdd = 0;
+
+    f.f = value;
+    sign = f.u & 0x80000000u;
+    f.u ^= sign;
+
+    if (f.u >= 0x47800000u)
+    {
+        // Переполнение, бесконечность или NaN
+        half = (f.u > 0x7F800000u) ? 0x7E00 : 0x7C00;
+    }
+    else if (f.u < 0x38800000u)
+    {
+        // Денормализованное число половинной точности или ноль:
+        // округление выполняет сам сумматор при сложении с 0.5f
+        MsgFloatBits magic;
+        magic.u = 0x3F000000u;
+        f.f += magic.f;
+        half = (uint16_t)(f.u - magic.u);
+    }
+    else
+    {
+        // Нормализованное число: смещаем порядок и округляем мантиссу
+        mantOdd = (f.u >> 13) & 1;
+        f.u += 0xC8000FFFu + mantOdd;
+        half = (uint16_t)(f.u >> 13);
+    }
+    return half | (uint16_t)(sign >> 16);
+}
+
+
+// Функция переводит число половинной точности в число float.
+static float MsgHalfToFloat(uint16_t half)
+{
+    MsgFloatBits f;
+    MsgFloatBits magic;
+    uint32_t exp = 0;
+
+    magic.u = 113u << 23;
+    f.u = (uint32_t)(half & 0x7FFF) << 13;
+    exp = f.u & 0x0F800000u;
+    f.u += (127 - 15) << 23;
+    if (exp == 0x0F800000u)
+    {
+        f.u += (128 - 16) << 23;  // бесконечность или NaN
+    }
+    else if (exp == 0)
+    {
+        f.u += 1 << 23;           // денормализованное число
+        f.f -= magic.f;
+    }
+    f.u |= (uint32_t)(half & 0x8000) << 16;
+    return f.f;
+}
+
+
+// -------------- Векторное преобразование половинной точности -------------
+
+#ifdef MSG_CLOUD_X86
+
+// Функции используют F16C независимо от флагов компиляции, поэтому
+// перед их вызовом нужно проверить поддержку F16C процессором.
+__attribute__((target("avx,f16c")))
+static size_t MsgHalfEncodeF16C(const float* src, uint16_t* dst, size_t n)
+{
+    size_t i = 0;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(src + i);
+        _mm_storeu_si128((__m128i*) (dst + i),
+            _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t MsgHalfDecodeF16C(const uint16_t* src, float* dst, size_t n)
+{
+    size_t i = 0;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+    }
+    return i;
+}
+
+#endif // MSG_CLOUD_X86
+
+
+// Функция переводит n чисел float в половинную точность.
+static void MsgHalfEncodeArray(const float* src, uint16_t* dst, size_t n)
+{
+    size_t i = 0;
+
+#if defined(MSG_CLOUD_X86)
+    if (__builtin_cpu_supports("f16c"))
+        i = MsgHalfEncodeF16C(src, dst, n);
+#elif defined(MSG_CLOUD_NEON)
+    for (i = 0; i + 4 <= n; i += 4)
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(
+            vld1q_f32(src + i))));
+#endif
+
+    // Оставшиеся числа переводим по одному
+    for (; i < n; i++)
+        dst[i] = MsgFloatToHalf(src[i]);
+}
+
+
+// Функция переводит n чисел половинной точности в числа float.
+static void MsgHalfDecodeArray(const uint16_t* src, float* dst, size_t n)
+{
+    size_t i = 0;
+
+#if defined(MSG_CLOUD_X86)
+    if (__builtin_cpu_supports("f16c"))
+        i = MsgHalfDecodeF16C(src, dst, n);
+#elif defined(MSG_CLOUD_NEON)
+    for (i = 0; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(
+            vld1_u16(src + i))));
+#endif
+
+    // Оставшиеся числа переводим по одному
+    for (; i < n; i++)
+        dst[i] = MsgHalfToFloat(src[i]);
+}
+
+
+// ------------------ Преобразование в формат int16 ------------------------
+
+// Функция квантует одну координату в формат int16.
+static int16_t MsgQuantize(float value, float origin, float invScale)
+{
+    float q = (value - origin) * invScale;
+    if (!(q >= MSG_INT16_MIN)) q = MSG_INT16_MIN;  // в том числе NaN
+    if (q > MSG_INT16_MAX) q = MSG_INT16_MAX;
+    // Округление к ближайшему четному, как в векторных вариантах
+    // (_mm_cvtps_epi32, vcvtnq_s32_f32), чтобы результат не зависел от
+    // того, попала ли координата в векторную часть массива
+    return (int16_t) nearbyintf(q);
+}
+
+
+// Функция квантует npts точек xyz в формат int16. Векторный вариант
+// обрабатывает по 4 точки (12 координат) за итерацию, поэтому начало
+// отсчета раскладывается в три вектора с циклическим сдвигом осей.
+static void MsgInt16EncodeArray(const float* xyz, int16_t* dst, size_t npts,
+    const float origin[3], float scale)
+{
+    size_t i = 0;
+    size_t n = npts * 3;
+    float invScale = 1.0f / scale;
+
+#if defined(MSG_CLOUD_X86) && defined(__SSE2__)
+    __m128 o0 = _mm_setr_ps(origin[0], origin[1], origin[2], origin[0]);
+    __m128 o1 = _mm_setr_ps(origin[1], origin[2], origin[0], origin[1]);
+    __m128 o2 = _mm_setr_ps(origin[2], origin[0], origin[1], origin[2]);
+    __m128 inv = _mm_set1_ps(invScale);
+    __m128 lo = _mm_set1_ps(MSG_INT16_MIN);
+    __m128 hi = _mm_set1_ps(MSG_INT16_MAX);
+    for (i = 0; i + 12 <= n; i += 12)
+    {
+        __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xyz + i), o0), inv);
+        __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xyz + i + 4), o1), inv);
+        __m128 c = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xyz + i + 8), o2), inv);
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+        c = _mm_min_ps(_mm_max_ps(c, lo), hi);
+        __m128i ab = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        __m128i cc = _mm_packs_epi32(_mm_cvtps_epi32(c), _mm_setzero_si128());
+        _mm_storeu_si128((__m128i*) (dst + i), ab);
+        _mm_storel_epi64((__m128i*) (dst + i + 8), cc);
+    }
+#elif defined(MSG_CLOUD_NEON)
+    float32x4_t o0 = { origin[0], origin[1], origin[2], origin[0] };
+    float32x4_t o1 = { origin[1], origin[2], origin[0], origin[1] };
+    float32x4_t o2 = { origin[2], origin[0], origin[1], origin[2] };
+    float32x4_t inv = vdupq_n_f32(invScale);
+    float32x4_t lo = vdupq_n_f32(MSG_INT16_MIN);
+    float32x4_t hi = vdupq_n_f32(MSG_INT16_MAX);
+    for (i = 0; i + 12 <= n; i += 12)
+    {
+        float32x4_t a = vmulq_f32(vsubq_f32(vld1q_f32(xyz + i), o0), inv);
+        float32x4_t b = vmulq_f32(vsubq_f32(vld1q_f32(xyz + i + 4), o1), inv);
+        float32x4_t c = vmulq_f32(vsubq_f32(vld1q_f32(xyz + i + 8), o2), inv);
+        // vmaxnmq_f32 возвращает число, а не NaN: NaN, как и в скалярном
+        // варианте, становится нижней границей (vcvtnq_s32_f32 дал бы 0)
+        a = vminq_f32(vmaxnmq_f32(a, lo), hi);
+        b = vminq_f32(vmaxnmq_f32(b, lo), hi);
+        c = vminq_f32(vmaxnmq_f32(c, lo), hi);
+        vst1_s16(dst + i, vqmovn_s32(vcvtnq_s32_f32(a)));
+        vst1_s16(dst + i + 4, vqmovn_s32(vcvtnq_s32_f32(b)));
+        vst1_s16(dst + i + 8, vqmovn_s32(vcvtnq_s32_f32(c)));
+    }
+#endif
+
+    // Оставшиеся координаты квантуем по одной
+    for (; i < n; i++)
+        dst[i] = MsgQuantize(xyz[i], origin[i % 3], invScale);
+}
+
+
+// Функция восстанавливает координаты npts точек из формата int16.
+static void MsgInt16DecodeArray(const int16_t* src, float* xyz, size_t npts,
+    const float origin[3], float scale)
+{
+    size_t i = 0;
+    size_t n = npts * 3;
+
+#if defined(MSG_CLOUD_X86) && defined(__SSE2__)
+    __m128 o0 = _mm_setr_ps(origin[0], origin[1], origin[2], origin[0]);
+    __m128 o1 = _mm_setr_ps(origin[1], origin[2], origin[0], origin[1]);
+    __m128 o2 = _mm_setr_ps(origin[2], origin[0], origin[1], origin[2]);
+    __m128 s = _mm_set1_ps(scale);
+    for (i = 0; i + 12 <= n; i += 12)
+    {
+        __m128i ab = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i cc = _mm_loadl_epi64((const __m128i*) (src + i + 8));
+        // Расширяем int16 до int32 с сохранением знака
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(ab, ab), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(ab, ab), 16);
+        __m128i c = _mm_srai_epi32(_mm_unpacklo_epi16(cc, cc), 16);
+        _mm_storeu_ps(xyz + i,
+            _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), s), o0));
+        _mm_storeu_ps(xyz + i + 4,
+            _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(b), s), o1));
+        _mm_storeu_ps(xyz + i + 8,
+            _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), s), o2));
+    }
+#elif defined(MSG_CLOUD_NEON)
+    float32x4_t o0 = { origin[0], origin[1], origin[2], origin[0] };
+    float32x4_t o1 = { origin[1], origin[2], origin[0], origin[1] };
+    float32x4_t o2 = { origin[2], origin[0], origin[1], origin[2] };
+    for (i = 0; i + 12 <= n; i += 12)
+    {
+        float32x4_t a = vcvtq_f32_s32(vmovl_s16(vld1_s16(src + i)));
+        float32x4_t b = vcvtq_f32_s32(vmovl_s16(vld1_s16(src + i + 4)));
+        float32x4_t c = vcvtq_f32_s32(vmovl_s16(vld1_s16(src + i + 8)));
+        vst1q_f32(xyz + i, vmlaq_n_f32(o0, a, scale));
+        vst1q_f32(xyz + i + 4, vmlaq_n_f32(o1, b, scale));
+        vst1q_f32(xyz + i + 8, vmlaq_n_f32(o2, c, scale));
+    }
+#endif
+
+    // Оставшиеся координаты восстанавливаем по одной
+    for (; i < n; i++)
+        xyz[i] = origin[i % 3] + scale * src[i];
+}
+
+
+// ------------------ Преобразование байтовых атрибутов --------------------
+
+// Функция переводит n байтов в числа float с множителем scale. Векторный
+// вариант расширяет 16 байтов за итерацию до 16 чисел float.
+static void MsgUint8DecodeArray(const uint8_t* src, float* dst, size_t n,
+    float scale)
+{
+    size_t i = 0;
+
+#if defined(MSG_CLOUD_X86) && defined(__SSE2__)
+    __m128 s = _mm_set1_ps(scale);
+    __m128i zero = _mm_setzero_si128();
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(
+            _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), s));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(
+            _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), s));
+        _mm_storeu_ps(dst + i + 8, _mm_mul_ps(
+            _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), s));
+        _mm_storeu_ps(dst + i + 12, _mm_mul_ps(
+            _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), s));
+    }
+#elif defined(MSG_CLOUD_NEON)
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        vst1q_f32(dst + i, vmulq_n_f32(
+            vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(
+            vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+        vst1q_f32(dst + i + 8, vmulq_n_f32(
+            vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+        vst1q_f32(dst + i + 12, vmulq_n_f32(
+            vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
+    }
+#endif
+
+    // Оставшиеся байты переводим по одному
+    for (; i < n; i++)
+        dst[i] = scale * src[i];
+}
+
+
+// Функция квантует n чисел float, умноженных на invScale, в байты с
+// насыщением до диапазона 0..255.
+static void MsgUint8EncodeArray(const float* src, uint8_t* dst, size_t n,
+    float invScale)
+{
+    size_t i = 0;
+
+#if defined(MSG_CLOUD_X86) && defined(__SSE2__)
+    __m128 inv = _mm_set1_ps(invScale);
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_set1_ps(255.0f);
+    __m128i q[4];
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        // Ограничение снизу нулем заменяет нулем и NaN
+        for (size_t k = 0; k < 4; k++)
+            q[k] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(
+                _mm_mul_ps(_mm_loadu_ps(src + i + 4*k), inv), lo), hi));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(
+            _mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+    }
+#elif defined(MSG_CLOUD_NEON)
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i),
+            invScale));
+        int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4),
+            invScale));
+        vst1_u8(dst + i, vqmovun_s16(vcombine_s16(vqmovn_s32(a),
+            vqmovn_s32(b))));
+    }
+#endif
+
+    // Оставшиеся числа квантуем по одному
+    for (; i < n; i++)
+    {
+        float q = src[i] * invScale;
+        if (!(q > 0)) q = 0;  // в том числе NaN
+        if (q > 255) q = 255;
+        dst[i] = (uint8_t) nearbyintf(q);  // как векторная часть
+    }
+}
+
+
+// ----------------------- Функции из msg_cloud.h ---------------------------
+
+
+// Функция подбирает начало отсчета и шаг квантования для формата
+// MsgPointFormatInt16 по габаритам облака точек.
+void MsgCloudFitInt16(MsgHeader* msg, const float* xyz, size_t npts)
+{
+    float minv[3] = { 0, 0, 0 };
+    float maxv[3] = { 0, 0, 0 };
+    double halfRange = 0;  // наибольшая полуширина облака по осям
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+
+    if (npts > 0)
+    {
+        memcpy(minv, xyz, sizeof(minv));
+        memcpy(maxv, xyz, sizeof(maxv));
+    }
+    for (size_t i = 1; i < npts; i++)
+        for (size_t k = 0; k < 3; k++)
+        {
+            float v = xyz[3*i + k];
+            if (v < minv[k]) minv[k] = v;
+            if (v > maxv[k]) maxv[k] = v;
+        }
+
+    for (size_t k = 0; k < 3; k++)
+    {
+        msg->uni.cloud.origin[k] = 0.5 * ((double)minv[k] + maxv[k]);
+        if (0.5 * ((double)maxv[k] - minv[k]) > halfRange)
+            halfRange = 0.5 * ((double)maxv[k] - minv[k]);
+    }
+    // Запас в одну единицу квантования на ошибки округления
+    msg->uni.cloud.scale = (halfRange > 0) ? halfRange / 32766.0 : 1.0;
+}
+
+
+// Функция возвращает указатель на начало массива точек облака в буфере
+// сообщения.
+void* MsgCloudPoints(const MsgBuffer* buf)
+{
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    return buf->data + sizeof(MsgHeader);
+}
+
+
+// Функция начинает сообщение с облаком точек прямо в буфере отправки.
+void* MsgCloudBuild(MsgBuffer* buf, const MsgHeader* msg, size_t maxPts,
+    size_t mtu, MsgBufferPool* pool)
+{
+    MsgHeader hdr = *msg;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+    assert(pool == NULL || pool->mtu == mtu);
+
+    hdr.uni.cloud.npts = maxPts;
+    if (pool ? !MsgBufferInitPooled(buf, &hdr, pool) :
+        !MsgBufferInit(buf, &hdr, mtu))
+        return NULL;
+    memcpy(buf->data, &hdr, sizeof(MsgHeader));
+    return MsgCloudPoints(buf);
+}
+
+
+// Функция завершает сообщение, начатое функцией MsgCloudBuild.
+void MsgCloudBuildFinish(MsgBuffer* buf, size_t npts)
+{
+    MsgHeader* msg = (MsgHeader*) buf->data;
+    MsgHeader reserved = *msg;  // заголовок с зарезервированными точками
+    size_t msg_size = 0;
+
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    assert(npts <= msg->uni.cloud.npts);
+
+    // Сокращаем сообщение до фактического количества точек (память
+    // буфера остается прежней) и сдвигаем столбцы атрибутов вплотную к
+    // массиву точек; сдвиг идет к началу буфера, поэтому столбцы
+    // переносятся по порядку
+    msg->uni.cloud.npts = npts;
+    for (unsigned bit = 1; bit <= MSG_POINT_ATTR_ALL; bit <<= 1)
+        if (msg->uni.cloud.attributes & bit)
+            memmove(buf->data + MsgCalcAttributeOffset(msg, bit),
+                buf->data + MsgCalcAttributeOffset(&reserved, bit),
+                npts * MsgCalcAttributeSize((MsgPointAttribute) bit));
+    msg_size = MsgCalcSize(msg);
+    buf->chunksCount = (msg_size + buf->chunkSizeMax - 1) / buf->chunkSizeMax;
+    buf->size = buf->chunksCount * buf->chunkSizeMax;
+
+    // Обнуляем дополнение последнего фрагмента: там могли остаться
+    // незаполненные зарезервированные данные или данные прошлого сообщения
+    memset(buf->data + msg_size, 0, buf->size - msg_size);
+}
+
+
+// Функция записывает в память dst координаты точек в формате,
+// заданном заголовком сообщения.
+void MsgCloudEncode(const MsgHeader* msg, const float* xyz, void* dst)
+{
+    size_t npts = msg->uni.cloud.npts;
+    float origin[3];
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+
+    switch (msg->uni.cloud.pointFormat)
+    {
+    case MsgPointFormatFloat32:
+        memcpy(dst, xyz, npts * 3 * sizeof(float));
+        break;
+    case MsgPointFormatFloat16:
+        MsgHalfEncodeArray(xyz, (uint16_t*) dst, npts * 3);
+        break;
+    case MsgPointFormatInt16:
+        assert(msg->uni.cloud.scale > 0);
+        for (size_t k = 0; k < 3; k++)
+            origin[k] = (float) msg->uni.cloud.origin[k];
+        MsgInt16EncodeArray(xyz, (int16_t*) dst, npts, origin,
+            (float) msg->uni.cloud.scale);
+        break;
+    default:
+        // Недопустимый формат точек в сообщении!
+        assert(TRUE == FALSE);
+        break;
+    }
+}
+
+
+// Функция считывает из памяти src координаты точек в формате, заданном
+// заголовком сообщения, и записывает их в массив float.
+void MsgCloudDecode(const MsgHeader* msg, const void* src, float* xyz)
+{
+    size_t npts = msg->uni.cloud.npts;
+    float origin[3];
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+
+    switch (msg->uni.cloud.pointFormat)
+    {
+    case MsgPointFormatFloat32:
+        memcpy(xyz, src, npts * 3 * sizeof(float));
+        break;
+    case MsgPointFormatFloat16:
+        MsgHalfDecodeArray((const uint16_t*) src, xyz, npts * 3);
+        break;
+    case MsgPointFormatInt16:
+        for (size_t k = 0; k < 3; k++)
+            origin[k] = (float) msg->uni.cloud.origin[k];
+        MsgInt16DecodeArray((const int16_t*) src, xyz, npts, origin,
+            (float) msg->uni.cloud.scale);
+        break;
+    default:
+        // Недопустимый формат точек в сообщении!
+        assert(TRUE == FALSE);
+        break;
+    }
+}
+
+
+// Функция возвращает указатель на столбец атрибута точек облака.
+void* MsgCloudAttribute(const MsgBuffer* buf, MsgPointAttribute attr)
+{
+    const MsgHeader* msg = (const MsgHeader*) buf->data;
+    size_t offset = 0;
+
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    // Количество точек пришло из сети: проверяем его делением, чтобы
+    // произведение не могло переполниться
+    offset = MsgCalcAttributeOffset(msg, attr);
+    if (offset == 0 || offset > buf->size || msg->uni.cloud.npts >
+        (buf->size - offset) / MsgCalcAttributeSize(attr))
+        return NULL;
+    return buf->data + offset;
+}
+
+
+// Функция возвращает количество чисел float на точку для атрибута.
+size_t MsgCloudAttributeComponents(MsgPointAttribute attr)
+{
+    switch (attr)
+    {
+    case MsgPointAttrColor:
+    case MsgPointAttrNormal:
+        return 3;
+    case MsgPointAttrIntensity:
+    case MsgPointAttrConfidence:
+        return 1;
+    default:
+        // Недопустимый атрибут точек облака!
+        assert(TRUE == FALSE);
+        return 0;
+    }
+}
+
+
+// Функция записывает в память dst столбец атрибута attr точек облака из
+// массива чисел float.
+void MsgCloudEncodeAttribute(const MsgHeader* msg, MsgPointAttribute attr,
+    const float* src, void* dst)
+{
+    static const float zero[3] = { 0, 0, 0 };
+    size_t npts = msg->uni.cloud.npts;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+
+    switch (attr)
+    {
+    case MsgPointAttrColor:
+        MsgUint8EncodeArray(src, (uint8_t*) dst, npts * 3, 255.0f);
+        break;
+    case MsgPointAttrIntensity:
+        memcpy(dst, src, npts * sizeof(float));
+        break;
+    case MsgPointAttrNormal:
+        // Нормаль квантуется как точка с началом отсчета в нуле
+        MsgInt16EncodeArray(src, (int16_t*) dst, npts, zero,
+            1.0f / MSG_INT16_MAX);
+        break;
+    case MsgPointAttrConfidence:
+        MsgUint8EncodeArray(src, (uint8_t*) dst, npts, 255.0f);
+        break;
+    default:
+        // Недопустимый атрибут точек облака!
+        assert(TRUE == FALSE);
+        break;
+    }
+}
+
+
+// Функция считывает из памяти src столбец атрибута attr точек облака и
+// записывает его в массив чисел float.
+void MsgCloudDecodeAttribute(const MsgHeader* msg, MsgPointAttribute attr,
+    const void* src, float* dst)
+{
+    static const float zero[3] = { 0, 0, 0 };
+    size_t npts = msg->uni.cloud.npts;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+
+    switch (attr)
+    {
+    case MsgPointAttrColor:
+        MsgUint8DecodeArray((const uint8_t*) src, dst, npts * 3,
+            1.0f / 255.0f);
+        break;
+    case MsgPointAttrIntensity:
+        memcpy(dst, src, npts * sizeof(float));
+        break;
+    case MsgPointAttrNormal:
+        MsgInt16DecodeArray((const int16_t*) src, dst, npts, zero,
+            1.0f / MSG_INT16_MAX);
+        break;
+    case MsgPointAttrConfidence:
+        MsgUint8DecodeArray((const uint8_t*) src, dst, npts, 1.0f / 255.0f);
+        break;
+    default:
+        // Недопустимый атрибут точек облака!
+        assert(TRUE == FALSE);
+        break;
+    }
+}
+
+
+// ------------------- Прогрессивный порядок точек облака -------------------
+
+// Количество разрядов кода Мортона на ось и разрядов одного прохода
+// поразрядной сортировки
+#define MSG_MORTON_BITS 21
+#define MSG_RADIX_BITS  16
+
+
+/* MsgMortonKey: Структура связывает код Мортона точки с ее номером. */
+typedef struct MsgMortonKeyStruct
+{
+    uint64_t code;   // код Мортона (чередование разрядов координат)
+    uint32_t index;  // номер точки в исходном массиве
+} MsgMortonKey;
+
+
+// Функция раздвигает младшие 21 разряд числа так, что между ними
+// появляются по два нулевых разряда.
+static uint64_t MsgMortonSpread(uint64_t v)
+{
+    v &= 0x1FFFFF;
+    v = (v | v << 32) & 0x1F00000000FFFFull;
+    v = (v | v << 16) & 0x1F0000FF0000FFull;
+    v = (v | v << 8)  & 0x100F00F00F00F00Full;
+    v = (v | v << 4)  & 0x10C30C30C30C30C3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+
+// Функция сортирует ключи по возрастанию кода Мортона поразрядной
+// сортировкой (по 16 разрядов за проход), используя память tmp того же
+// размера. Возвращает указатель на отсортированный массив (keys или tmp).
+static MsgMortonKey* MsgMortonSort(MsgMortonKey* keys, MsgMortonKey* tmp,
+    size_t n, size_t* counts)
+{
+    const size_t radix = (size_t) 1 << MSG_RADIX_BITS;
+
+    for (unsigned shift = 0; shift < 3 * MSG_MORTON_BITS;
+        shift += MSG_RADIX_BITS)
+    {
+        size_t sum = 0;
+        memset(counts, 0, radix * sizeof(size_t));
+        for (size_t i = 0; i < n; i++)
+            counts[(keys[i].code >> shift) & (radix - 1)]++;
+        for (size_t d = 0; d < radix; d++)
+        {
+            size_t c = counts[d];
+            counts[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            tmp[counts[(keys[i].code >> shift) & (radix - 1)]++] = keys[i];
+        MsgMortonKey* swap = keys;
+        keys = tmp;
+        tmp = swap;
+    }
+    return keys;
+}
+
+
+// Функция переставляет точки облака в прогрессивный порядок.
+BOOL MsgCloudOrderProgressive(MsgHeader* msg, float* xyz, size_t npts)
+{
+    return MsgCloudOrderProgressiveIndex(msg, xyz, npts, NULL);
+}
+
+
+// Функция переставляет точки облака в прогрессивный порядок и сообщает
+// номера точек в исходном порядке.
+BOOL MsgCloudOrderProgressiveIndex(MsgHeader* msg, float* xyz, size_t npts,
+    uint32_t* order)
+{
+    const size_t radix = (size_t) 1 << MSG_RADIX_BITS;
+    float minv[3] = { 0, 0, 0 };
+    float maxv[3] = { 0, 0, 0 };
+    float factor[3];        // перевод координаты в 21-битный индекс
+    MsgMortonKey* keys = NULL;
+    MsgMortonKey* tmp = NULL;
+    MsgMortonKey* sorted = NULL;
+    size_t* counts = NULL;
+    float* copy = NULL;
+    unsigned bits = 0;      // разрядность номера в порядке Мортона
+    size_t out = 0;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+    assert(npts <= UINT32_MAX);
+
+    msg->uni.cloud.pointOrder = MsgPointOrderProgressive;
+    if (npts < 3)
+    {
+        for (size_t i = 0; order && i < npts; i++)
+            order[i] = (uint32_t) i;
+        return TRUE;
+    }
+    keys = (MsgMortonKey*) malloc(npts * sizeof(MsgMortonKey));
+    tmp = (MsgMortonKey*) malloc(npts * sizeof(MsgMortonKey));
+    counts = (size_t*) malloc(radix * sizeof(size_t));
+    copy = (float*) malloc(npts * 3 * sizeof(float));
+    if (!keys || !tmp || !counts || !copy)
+    {
+        free(keys);
+        free(tmp);
+        free(counts);
+        free(copy);
+        msg->uni.cloud.pointOrder = MsgPointOrderMemory;
+        return FALSE;
+    }
+
+    // Вычисляем коды Мортона точек в габаритах облака
+    memcpy(minv, xyz, sizeof(minv));
+    memcpy(maxv, xyz, sizeof(maxv));
+    for (size_t i = 1; i < npts; i++)
+        for (size_t k = 0; k < 3; k++)
+        {
+            float v = xyz[3*i + k];
+            if (v < minv[k]) minv[k] = v;
+            if (v > maxv[k]) maxv[k] = v;
+        }
+    for (size_t k = 0; k < 3; k++)
+        factor[k] = (maxv[k] > minv[k]) ?
+            ((1 << MSG_MORTON_BITS) - 1) / (maxv[k] - minv[k]) : 0;
+    for (size_t i = 0; i < npts; i++)
+    {
+        uint64_t code = 0;
+        for (size_t k = 0; k < 3; k++)
+        {
+            float v = (xyz[3*i + k] - minv[k]) * factor[k];
+            if (!(v >= 0)) v = 0;  // в том числе NaN
+            if (v > (1 << MSG_MORTON_BITS) - 1)
+                v = (1 << MSG_MORTON_BITS) - 1;
+            code |= MsgMortonSpread((uint64_t) v) << k;
+        }
+        keys[i].code = code;
+        keys[i].index = (uint32_t) i;
+    }
+    sorted = MsgMortonSort(keys, tmp, npts, counts);
+
+    // Выводим точки в порядке обращенных разрядов их номера по кривой
+    // Мортона: сначала каждую 2^(bits-1)-ю точку, затем точки между ними
+    // и так далее, так что любое начало массива равномерно покрывает
+    // кривую, а значит, и все облако
+    memcpy(copy, xyz, npts * 3 * sizeof(float));
+    while (((size_t) 1 << bits) < npts)
+        bits++;
+    for (size_t i = 0; i < ((size_t) 1 << bits); i++)
+    {
+        size_t j = 0;  // номер i с обращенным порядком разрядов
+        for (unsigned b = 0; b < bits; b++)
+            j |= ((i >> b) & 1) << (bits - 1 - b);
+        if (j < npts)
+        {
+            memcpy(xyz + 3*out, copy + 3*(size_t) sorted[j].index,
+                3 * sizeof(float));
+            if (order)
+                order[out] = sorted[j].index;
+            out++;
+        }
+    }
+    assert(out == npts);
+
+    free(keys);
+    free(tmp);
+    free(counts);
+    free(copy);
+    return TRUE;
+}
+
+
+// Функция возвращает количество точек облака, принятых без пропусков
+// от начала массива точек.
+size_t MsgCloudReceivedPoints(const MsgBuffer* buf)
+{
+    const MsgHeader* msg = (const MsgHeader*) buf->data;
+    size_t chunks = 0;      // сколько фрагментов принято подряд с начала
+    size_t bytes = 0;
+    size_t pointSize = 0;
+    size_t npts = 0;
+
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    while (chunks < buf->chunksCount && buf->status[chunks])
+        chunks++;
+    bytes = chunks * buf->chunkSizeMax;
+    if (bytes > buf->size)
+        bytes = buf->size;
+    if (bytes < sizeof(MsgHeader) || msg->magicNumber != MSG_HEADER_MAGIC ||
+        msg->type != MsgTypePointCloud ||
+        (msg->uni.cloud.pointFormat != MsgPointFormatFloat32 &&
+         msg->uni.cloud.pointFormat != MsgPointFormatFloat16 &&
+         msg->uni.cloud.pointFormat != MsgPointFormatInt16))
+        return 0;  // заголовок сообщения еще не принят
+
+    pointSize = MsgCalcPointSize(msg->uni.cloud.pointFormat);
+    npts = (bytes - sizeof(MsgHeader)) / pointSize;
+    return (npts < msg->uni.cloud.npts) ? npts : msg->uni.cloud.npts;
+}
+
+
+// --------------- Прореживание облака по воксельной сетке -----------------
+
+// Смещение индекса ячейки, переводящее его в беззнаковый 21-битный код
+#define MSG_VOXEL_BIAS (1 << 20)
+#define MSG_VOXEL_MASK ((1 << 21) - 1)
+
+
+// Функция вычисляет индекс ячейки сетки по координате точки.
+static uint64_t MsgVoxelIndex(float value, float invLeaf)
+{
+    float v = value * invLeaf;
+    long i = 0;
+
+    // Ограничиваем индекс допустимым диапазоном и округляем вниз
+    // (точка с координатой NaN попадает в крайнюю ячейку)
+    if (!(v >= -MSG_VOXEL_BIAS)) v = -MSG_VOXEL_BIAS;
+    if (v > MSG_VOXEL_BIAS - 1) v = MSG_VOXEL_BIAS - 1;
+    i = (long) v;
+    if (v < i) i--;
+    return (uint64_t) (i + MSG_VOXEL_BIAS) & MSG_VOXEL_MASK;
+}
+
+
+// Начальный размер хеш-таблицы фильтра
+#define MSG_VOXEL_TABLE_MIN 4096
+
+
+// Функция вычисляет начальную позицию ячейки в хеш-таблице.
+static size_t MsgVoxelHash(uint64_t key, size_t capacity)
+{
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+
+// Функция увеличивает хеш-таблицу вдвое и переносит в нее ячейки
+// текущего поколения.
+static BOOL MsgVoxelFilterGrow(MsgVoxelFilter* filter)
+{
+    size_t capacity = filter->capacity ? 2 * filter->capacity
+        : MSG_VOXEL_TABLE_MIN;
+    MsgVoxelEntry* table = (MsgVoxelEntry*) calloc(capacity,
+        sizeof(MsgVoxelEntry));
+
+    if (!table)
+        return FALSE;
+    for (size_t i = 0; i < filter->capacity; i++)
+    {
+        MsgVoxelEntry* entry = filter->table + i;
+        if (entry->stamp != filter->generation)
+            continue;
+        size_t pos = MsgVoxelHash(entry->key, capacity);
+        while (table[pos].stamp != 0)
+            pos = (pos + 1) & (capacity - 1);
+        table[pos] = *entry;
+        table[pos].stamp = 1;
+    }
+    free(filter->table);
+    filter->table = table;
+    filter->capacity = capacity;
+    filter->generation = 1;
+    return TRUE;
+}
+
+
+// Функция выделяет память под массивы ячеек так, чтобы в них поместились
+// npts точек (каждая точка может занять свою ячейку), и начинает новое
+// поколение хеш-таблицы. Сама таблица растет по мере заполнения, так что
+// ее размер определяется количеством ячеек, а не точек облака.
+static BOOL MsgVoxelFilterReserve(MsgVoxelFilter* filter, size_t npts)
+{
+    if (npts > UINT32_MAX)
+        return FALSE;
+    if (filter->capacity == 0 && !MsgVoxelFilterGrow(filter))
+        return FALSE;
+    if (npts > filter->maxVoxels)
+    {
+        free(filter->sums);
+        free(filter->counts);
+        filter->sums = (float*) malloc(npts * 3 * sizeof(float));
+        filter->counts = (uint32_t*) malloc(npts * sizeof(uint32_t));
+        filter->maxVoxels = npts;
+        if (!filter->sums || !filter->counts)
+        {
+            filter->maxVoxels = 0;
+            return FALSE;
+        }
+    }
+
+    // Начинаем новое поколение; при переполнении счетчика очищаем таблицу
+    filter->generation++;
+    if (filter->generation == 0)
+    {
+        memset(filter->table, 0, filter->capacity * sizeof(MsgVoxelEntry));
+        filter->generation = 1;
+    }
+    return TRUE;
+}
+
+
+// Функция раскладывает точки облака по ячейкам сетки и записывает в
+// pnvox количество занятых ячеек. Ячейки нумеруются в порядке появления.
+static BOOL MsgVoxelFilterBin(MsgVoxelFilter* filter, const float* xyz,
+    size_t npts, size_t* pnvox)
+{
+    float invLeaf = 1.0f / filter->leafSize;
+    size_t nvox = 0;
+    MsgVoxelEntry* last = NULL;  // ячейка предыдущей точки облака
+
+    for (size_t i = 0; i < npts; i++)
+    {
+        const float* p = xyz + 3 * i;
+        uint64_t key = MsgVoxelIndex(p[0], invLeaf)
+            | (MsgVoxelIndex(p[1], invLeaf) << 21)
+            | (MsgVoxelIndex(p[2], invLeaf) << 42);
+        size_t mask = filter->capacity - 1;
+        size_t pos = MsgVoxelHash(key, filter->capacity);
+
+        // Соседние точки облака обычно попадают в одну ячейку
+        if (last && last->key == key)
+        {
+            if (filter->policy == MsgVoxelPolicyCentroid)
+            {
+                float* sum = filter->sums + 3 * last->slot;
+                sum[0] += p[0];
+                sum[1] += p[1];
+                sum[2] += p[2];
+                filter->counts[last->slot]++;
+            }
+            continue;
+        }
+
+        // Ищем ячейку в таблице методом линейного пробирования
+        for (; ; pos = (pos + 1) & mask)
+        {
+            MsgVoxelEntry* entry = filter->table + pos;
+            last = entry;
+            if (entry->stamp != filter->generation)
+            {
+                // Новая ячейка
+                entry->stamp = filter->generation;
+                entry->key = key;
+                entry->slot = (uint32_t) nvox;
+                memcpy(filter->sums + 3 * nvox, p, 3 * sizeof(float));
+                filter->counts[nvox] = 1;
+                nvox++;
+                break;
+            }
+            if (entry->key == key)
+            {
+                // Ячейка уже занята - накапливаем сумму координат
+                if (filter->policy == MsgVoxelPolicyCentroid)
+                {
+                    float* sum = filter->sums + 3 * entry->slot;
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                    filter->counts[entry->slot]++;
+                }
+                break;
+            }
+        }
+
+        // Заполнение таблицы не должно превышать половины
+        if (2 * nvox > filter->capacity)
+        {
+            if (!MsgVoxelFilterGrow(filter))
+                return FALSE;
+            last = NULL;
+        }
+    }
+    *pnvox = nvox;
+    return TRUE;
+}
+
+
+// Функция инициализирует фильтр с заданным размером ячейки.
+BOOL MsgVoxelFilterInit(MsgVoxelFilter* filter, float leafSize,
+    MsgVoxelPolicy policy)
+{
+    memset(filter, 0, sizeof(MsgVoxelFilter));
+    filter->leafSize = leafSize;
+    filter->policy = policy;
+    return leafSize > 0;
+}
+
+
+// Функция освобождает память, выделенную фильтром.
+void MsgVoxelFilterFree(MsgVoxelFilter* filter)
+{
+    free(filter->table);
+    free(filter->sums);
+    free(filter->counts);
+    memset(filter, 0, sizeof(MsgVoxelFilter));
+}
+
+
+// Функция прореживает облако точек и формирует сообщение в буфере.
+BOOL MsgVoxelFilterCompose(MsgVoxelFilter* filter, MsgBuffer* buf,
+    const MsgHeader* msg, const float* xyz, size_t npts, size_t mtu)
+{
+    MsgHeader hdr = *msg;
+    size_t nvox = 0;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypePointCloud);
+    assert(filter->leafSize > 0);
+
+    // Фильтр прореживает только координаты, атрибуты точек не переносятся
+    hdr.uni.cloud.attributes = 0;
+
+    if (!MsgVoxelFilterReserve(filter, npts) ||
+        !MsgVoxelFilterBin(filter, xyz, npts, &nvox))
+        return FALSE;
+
+    // Переводим суммы координат в центры масс ячеек
+    if (filter->policy == MsgVoxelPolicyCentroid)
+        for (size_t i = 0; i < nvox; i++)
+            if (filter->counts[i] > 1)
+            {
+                float inv = 1.0f / filter->counts[i];
+                filter->sums[3*i + 0] *= inv;
+                filter->sums[3*i + 1] *= inv;
+                filter->sums[3*i + 2] *= inv;
+            }
+
+    // Переставляем точки, если запрошен прогрессивный порядок
+    if (hdr.uni.cloud.pointOrder == MsgPointOrderProgressive &&
+        !MsgCloudOrderProgressive(&hdr, filter->sums, nvox))
+        return FALSE;
+
+    // Формируем сообщение прямо в буфере отправки
+    hdr.uni.cloud.npts = nvox;
+    if (!MsgCloudBuild(buf, &hdr, nvox, mtu, NULL))
+        return FALSE;
+    MsgCloudEncode(&hdr, filter->sums, MsgCloudPoints(buf));
+    return TRUE;
+}
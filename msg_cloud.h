@@ -0,0 +1,168 @@
+// msg_cloud.h: Функции для упаковки и распаковки координат точек облака
+// в сообщении типа MsgTypePointCloud.
+
+#ifndef MSG_CLOUD_H
+#define MSG_CLOUD_H
+
+#include <stddef.h>      // size_t
+#include <stdint.h>      // uint32_t, uint64_t
+#include "msg_buf.h"   // заголовок и буфер сообщения
+
+
+// Функция подбирает начало отсчета и шаг квантования для формата
+// MsgPointFormatInt16 по габаритам облака xyz из npts точек, так чтобы
+// все точки облака попадали в диапазон int16. Результат записывается
+// в поля origin и scale заголовка сообщения.
+extern void MsgCloudFitInt16(MsgHeader* msg, const float* xyz, size_t npts);
+
+// Функция возвращает указатель на начало массива точек облака в буфере
+// сообщения (сразу после заголовка сообщения).
+extern void* MsgCloudPoints(const MsgBuffer* buf);
+
+// Функция начинает сообщение с облаком не более чем из maxPts точек прямо
+// в буфере отправки buf: инициализирует буфер (в памяти из пула pool или,
+// если pool = NULL, как MsgBufferInit с пакетами размером mtu), записывает
+// в него заголовок msg и возвращает указатель на массив точек в буфере.
+// Приложение записывает точки прямо туда в формате, заданном полем
+// msg->uni.cloud.pointFormat (например, по 3 числа float на точку для
+// MsgPointFormatFloat32), а столбцы атрибутов из msg->uni.cloud.attributes
+// - по указателям MsgCloudAttribute, затем вызывает MsgCloudBuildFinish.
+// При ошибке функция возвращает NULL.
+extern void* MsgCloudBuild(MsgBuffer* buf, const MsgHeader* msg,
+    size_t maxPts, size_t mtu, MsgBufferPool* pool);
+
+// Функция завершает сообщение, начатое функцией MsgCloudBuild: записывает
+// в заголовок сообщения фактическое количество точек npts (не больше
+// зарезервированного), сдвигает столбцы атрибутов вслед за точками и
+// отбрасывает лишние пакеты сообщения.
+extern void MsgCloudBuildFinish(MsgBuffer* buf, size_t npts);
+
+// Функция записывает в память dst координаты msg->uni.cloud.npts точек
+// из массива xyz (по 3 числа float на точку) в формате, заданном полем
+// msg->uni.cloud.pointFormat заголовка сообщения.
+extern void MsgCloudEncode(const MsgHeader* msg, const float* xyz, void* dst);
+
+// Функция считывает из памяти src координаты msg->uni.cloud.npts точек
+// в формате msg->uni.cloud.pointFormat и записывает их в массив xyz
+// (по 3 числа float на точку).
+extern void MsgCloudDecode(const MsgHeader* msg, const void* src, float* xyz);
+
+// Функция возвращает указатель на столбец атрибута attr точек облака в
+// буфере сообщения buf (по MsgCalcAttributeSize(attr) байт на точку в
+// порядке точек облака) или NULL, если в облаке нет такого атрибута или
+// столбец не помещается в буфер. Столбцы лежат после всех координат,
+// поэтому получатель, которому нужны только координаты, их не читает.
+// Начало столбца выровнено на MSG_CLOUD_ALIGN байт и в памяти у буферов
+// MsgBufferInit, пула и принятых сообщений (в том числе из пачек), но у
+// сообщений из записи (MsgReplayer) - только на 8 байт, поэтому столбец
+// надежнее читать невыровненными загрузками (как это делает библиотека).
+extern void* MsgCloudAttribute(const MsgBuffer* buf, MsgPointAttribute attr);
+
+// Функция возвращает количество чисел float на точку, которыми атрибут attr
+// представляется в функциях MsgCloudEncodeAttribute и
+// MsgCloudDecodeAttribute: 3 для цвета (компоненты от 0 до 1) и нормали,
+// 1 для интенсивности и достоверности (от 0 до 1).
+extern size_t MsgCloudAttributeComponents(MsgPointAttribute attr);
+
+// Функция записывает в память dst столбец атрибута attr для
+// msg->uni.cloud.npts точек из массива src (по
+// MsgCloudAttributeComponents(attr) чисел float на точку), квантуя его
+// в формат атрибута.
+extern void MsgCloudEncodeAttribute(const MsgHeader* msg,
+    MsgPointAttribute attr, const float* src, void* dst);
+
+// Функция считывает из памяти src столбец атрибута attr для
+// msg->uni.cloud.npts точек и записывает его в массив dst (по
+// MsgCloudAttributeComponents(attr) чисел float на точку). Столбец
+// переводится целиком векторными командами, без разбора по точкам.
+extern void MsgCloudDecodeAttribute(const MsgHeader* msg,
+    MsgPointAttribute attr, const void* src, float* dst);
+
+// Функция переставляет npts точек облака xyz (по 3 числа float на точку)
+// в прогрессивный порядок и отмечает его в поле pointOrder заголовка msg.
+// Точки упорядочиваются по кривой Мортона в габаритах облака и выводятся
+// в порядке обращенных разрядов их номера на кривой, поэтому любое начало
+// массива - равномерно прореженная копия облака, которая уточняется по
+// мере приема остальных пакетов. Вызывается перед MsgCloudEncode (или
+// записью точек в буфер MsgCloudBuild). Возвращает FALSE, если не хватило
+// памяти (точки остаются в прежнем порядке).
+extern BOOL MsgCloudOrderProgressive(MsgHeader* msg, float* xyz,
+    size_t npts);
+
+// Функция работает как MsgCloudOrderProgressive и дополнительно записывает
+// в массив order из npts элементов номер каждой точки в исходном порядке,
+// чтобы приложение переставило так же столбцы атрибутов точек (атрибут
+// точки i берется у точки order[i] исходного облака).
+extern BOOL MsgCloudOrderProgressiveIndex(MsgHeader* msg, float* xyz,
+    size_t npts, uint32_t* order);
+
+// Функция возвращает количество точек облака, принятых без пропусков от
+// начала массива точек, в сообщении buf, которое может быть еще не собрано
+// (см. MsgConnIncomplete), или 0, если заголовок сообщения еще не принят.
+// Эти точки декодируются функцией MsgCloudDecode с копией заголовка, в
+// которой npts заменено результатом функции. Для облака в порядке
+// MsgPointOrderProgressive они образуют грубую копию всего облака.
+// Столбцы атрибутов идут после всех координат и доступны только в
+// собранном сообщении.
+extern size_t MsgCloudReceivedPoints(const MsgBuffer* buf);
+
+
+/* MsgVoxelPolicy: Перечисление задает способ выбора точки, которая
+ * представляет все точки облака, попавшие в одну ячейку воксельной сетки. */
+typedef enum MsgVoxelPolicyEnum
+{
+    MsgVoxelPolicyCentroid, // центр масс точек ячейки
+    MsgVoxelPolicyFirst     // первая точка облака, попавшая в ячейку
+} MsgVoxelPolicy;
+
+
+/* MsgVoxelEntry: Структура представляет элемент хеш-таблицы ячеек
+ * воксельной сетки (все поля элемента лежат в одной строке кэша). */
+typedef struct MsgVoxelEntryStruct
+{
+    uint64_t key;          // упакованные индексы ячейки по трем осям
+    uint32_t stamp;        // номер поколения, в котором занят элемент
+    uint32_t slot;         // номер ячейки в массивах sums и counts
+} MsgVoxelEntry, *MsgVoxelEntryPtr;
+
+
+/* MsgVoxelFilter: Структура представляет фильтр для прореживания облака
+ * точек по воксельной сетке перед отправкой. Ячейки сетки хранятся в
+ * хеш-таблице с открытой адресацией, которая сохраняется между кадрами,
+ * а признаком занятости ячейки служит номер поколения (номер кадра),
+ * поэтому таблицу не нужно очищать перед каждым кадром. */
+typedef struct MsgVoxelFilterStruct
+{
+    float leafSize;        // размер ребра ячейки сетки в метрах
+    MsgVoxelPolicy policy; // способ выбора точки ячейки
+    size_t capacity;       // размер хеш-таблицы (степень двойки)
+    MsgVoxelEntry* table;  // хеш-таблица ячеек сетки
+    uint32_t generation;   // номер текущего поколения
+    size_t maxVoxels;      // размер массивов sums и counts в ячейках
+    float* sums;           // сумма координат точек ячейки (по 3 числа)
+    uint32_t* counts;      // количество точек в ячейке
+} MsgVoxelFilter, *MsgVoxelFilterPtr;
+
+
+// Функция инициализирует фильтр с заданным размером ячейки и способом
+// выбора точки. Память под хеш-таблицу выделяется при первом кадре.
+extern BOOL MsgVoxelFilterInit(MsgVoxelFilter* filter, float leafSize,
+    MsgVoxelPolicy policy);
+
+// Функция освобождает память, выделенную фильтром.
+extern void MsgVoxelFilterFree(MsgVoxelFilter* filter);
+
+// Функция прореживает облако xyz из npts точек и формирует сообщение в
+// буфере buf (буфер инициализируется функцией по аналогии с MsgBufferInit).
+// Заголовок msg задает все поля сообщения, кроме количества точек, которое
+// заменяется количеством занятых ячеек сетки. Точки записываются прямо в
+// буфер сообщения в формате msg->uni.cloud.pointFormat (для формата
+// MsgPointFormatInt16 поля origin и scale должны быть уже заданы) и в
+// порядке msg->uni.cloud.pointOrder (см. MsgCloudOrderProgressive).
+// Атрибуты точек фильтр не переносит: поле attributes сообщения обнуляется.
+// Индексы ячеек по каждой оси ограничены диапазоном +-2^20 шагов сетки.
+extern BOOL MsgVoxelFilterCompose(MsgVoxelFilter* filter, MsgBuffer* buf,
+    const MsgHeader* msg, const float* xyz, size_t npts, size_t mtu);
+
+
+#endif // MSG_CLOUD_H
@@ -8,20 +8,280 @@
 // https://www.gnu.org/software/libc/manual/html_node/Datagrams.html
 //
 
+#define _GNU_SOURCE      // ppoll() (ожидание с точностью до наносекунд)
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>      // memcpy()
-#include <sys/time.h>    // gettimeofday()
+#include <sys/time.h>    // struct timeval (для select)
+#include <time.h>        // clock_gettime()
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>   // ioctl()
+#include <linux/sockios.h> // SIOCOUTQ (размер очереди отправки сокета)
 #include <netinet/in.h>  // sockaddr_in (для TCP сокетов)
+#include <netinet/tcp.h> // TCP_USER_TIMEOUT
+#include <arpa/inet.h>   // inet_pton(), inet_ntoa() (для рассылки UDP)
+#include <fcntl.h>       // fcntl() (неблокирующие сокеты)
 #include <sys/un.h>      // sockaddr_un (для локальных сокетов)
 #include <stddef.h>      // offsetof (для локальных сокетов)
 #include <netdb.h>       // hostent for client (для TCP сокетов)
+#include <poll.h>        // poll(), ppoll() (ожидание данных и уведомлений)
+#include <sys/eventfd.h> // eventfd() (пробуждение ожидающего получателя)
+#include <linux/errqueue.h> // sock_extended_err (уведомления MSG_ZEROCOPY)
 
+#include <errno.h>
+#include <stdint.h>      // uintptr_t
 #include <assert.h>
 #include "msg_conn.h"
+#include "msg_uring.h"   // отправка и прием через io_uring
+#include "msg_trace.h"   // временная шкала отправки и приема
+
+// Размер очереди io_uring и количество приемных буферов в ней
+#define MSG_CONN_URING_ENTRIES 64
+
+// Метки запросов io_uring получателя: прием данных, ожидание пробуждения
+// и ожидание подключения отправителя
+#define MSG_CONN_URING_RECV   0
+#define MSG_CONN_URING_WAKE   1
+#define MSG_CONN_URING_ACCEPT 2
+
+// Сколько пакетов передается одним вызовом sendmsg при отправке без
+// копирования (по два фрагмента на пакет, не больше IOV_MAX = 1024)
+#define MSG_CONN_ZEROCOPY_PACKETS 256
+
+// Сколько сообщений, отправленных без копирования, может ожидать
+// подтверждения от ядра, прежде чем отправитель начнет ждать
+#define MSG_CONN_ZEROCOPY_PINNED 16
+
+// Паузы между попытками восстановить TCP соединение (удваиваются после
+// каждой неудачной попытки), в секундах
+#define MSG_CONN_RETRY_MIN 0.05
+#define MSG_CONN_RETRY_MAX 2.0
+
+// Сколько отправитель ждет завершения connect и сведений о возобновлении
+// сессии (старый получатель их не присылает), в секундах
+#define MSG_CONN_CONNECT_TIMEOUT 1.0
+#define MSG_CONN_RESUME_TIMEOUT  0.5
+
+// Через сколько миллисекунд без подтверждения отправленных данных ядро
+// разрывает TCP соединение (так отправитель замечает обрыв канала)
+#define MSG_CONN_USER_TIMEOUT_MS 2000
+
+// Количество типов сообщений, для каждого из которых есть своя группа
+// многоадресной рассылки
+#define MSG_CONN_MCAST_TYPES (MsgTypeFeatures + 1)
+
+// Размер приемного буфера сокета получателя рассылки: запас на всплеск
+// датаграмм крупного сообщения (ядро может уменьшить его до rmem_max)
+#define MSG_CONN_MCAST_RCVBUF (4 << 20)
+
+// Предельное количество параллельных TCP соединений (основное и полосы)
+#define MSG_CONN_STRIPES_MAX 16
+
+
+// Функция возвращает текущее время по монотонным часам в секундах.
+static double MsgConnNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+// Функция задает ядру предельную скорость отправки для TCP сокета sock
+// (общая скорость cfg->pacingRate делится поровну между полосами).
+static void MsgConnSetPacingRate(const MsgConnConfig* cfg, int sock)
+{
+    double rate = cfg->pacingRate;
+    unsigned int value = 0;
+
+    if (rate <= 0)
+        return;
+    if (cfg->streamCount > 1)
+        rate /= (double) cfg->streamCount;
+    value = (rate < 4.0e9) ? (unsigned int) rate : 0xFFFFFFFFu;
+    if (setsockopt(sock, SOL_SOCKET, SO_MAX_PACING_RATE, &value,
+        sizeof(value)) < 0)
+        printf("SO_MAX_PACING_RATE is not supported!\n");
+}
+
+
+// Функция настраивает подключенный сокет TCP отправителя: ограничивает
+// время ожидания подтверждения данных и разрешает отправку без
+// копирования, если она запрошена.
+static void MsgConnSetupSenderSocket(MsgConn* conn, const MsgConnConfig* cfg)
+{
+    int sock = conn->uni.client.sockfd;
+    unsigned int userTimeout = MSG_CONN_USER_TIMEOUT_MS;
+    int one = 1;
+
+    setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout,
+        sizeof(userTimeout));
+    // Метки приема ядром нужны для запросов синхронизации часов
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+    MsgConnSetPacingRate(cfg, sock);
+    conn->zc.enabled = FALSE;
+    if (cfg->zeroCopyMin > 0 && cfg->engine == MsgConnEngineSocket)
+    {
+        if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+            conn->zc.enabled = TRUE;
+        else
+            printf("MSG_ZEROCOPY is not supported - sending with copy!\n");
+    }
+}
+
+
+// Функция освобождает буферы полос TCP соединения (сокеты полос перед
+// этим закрывает MsgConnStripesClose).
+static void MsgConnStripesFree(MsgConn* conn)
+{
+    MsgConnStripes* stripes = &conn->stripes;
+
+    for (size_t i = 0; stripes->pkts && i < stripes->count; i++)
+        free(stripes->pkts[i]);
+    free(stripes->pkts);
+    free(stripes->fills);
+    free(stripes->fds);
+    bzero(stripes, sizeof(MsgConnStripes));
+}
+
+
+// Функция выделяет массивы полос TCP соединения, если в настройках
+// задано несколько соединений.
+static BOOL MsgConnStripesInit(MsgConn* conn, const MsgConnConfig* cfg)
+{
+    MsgConnStripes* stripes = &conn->stripes;
+    BOOL receiver = (cfg->connRole == MsgConnRoleTcpReceiver);
+
+    bzero(stripes, sizeof(MsgConnStripes));
+    if (cfg->streamCount <= 1 || (!receiver &&
+        cfg->connRole != MsgConnRoleTcpSender))
+        return TRUE;
+    if (cfg->streamCount > MSG_CONN_STRIPES_MAX)
+    {
+        printf("Too many TCP streams (at most %d)!\n", MSG_CONN_STRIPES_MAX);
+        return FALSE;
+    }
+    if (cfg->engine == MsgConnEngineUring)
+    {
+        printf("Striped TCP connections require the socket engine!\n");
+        return FALSE;
+    }
+
+    stripes->count = cfg->streamCount - 1;
+    stripes->fds = (int*) malloc(stripes->count * sizeof(int));
+    if (receiver)
+    {
+        stripes->pkts = (unsigned char**) calloc(stripes->count,
+            sizeof(unsigned char*));
+        stripes->fills = (size_t*) calloc(stripes->count, sizeof(size_t));
+        for (size_t i = 0; stripes->pkts && i < stripes->count; i++)
+            if (!(stripes->pkts[i] = (unsigned char*) malloc(cfg->mtu)))
+                break;
+    }
+    if (!stripes->fds || (receiver && (!stripes->fills || !stripes->pkts ||
+        !stripes->pkts[stripes->count - 1])))
+    {
+        printf("Unable to allocate TCP stream buffers!\n");
+        MsgConnStripesFree(conn);
+        return FALSE;
+    }
+    for (size_t i = 0; i < stripes->count; i++)
+        stripes->fds[i] = -1;
+    return TRUE;
+}
+
+
+// Функция закрывает все полосы TCP соединения (основное соединение
+// закрывает вызывающая функция).
+static void MsgConnStripesClose(MsgConn* conn)
+{
+    for (size_t i = 0; i < conn->stripes.count; i++)
+    {
+        if (conn->stripes.fds[i] >= 0)
+            close(conn->stripes.fds[i]);
+        conn->stripes.fds[i] = -1;
+        if (conn->stripes.fills)
+            conn->stripes.fills[i] = 0;
+    }
+    conn->stripes.next = 0;
+}
+
+
+// Функция начинает неблокирующее подключение полос TCP отправителя к
+// порту полос получателя (portno + 1) после того, как подключено основное
+// соединение. Возвращает FALSE, если начать подключение не удалось (полосы
+// тогда закрыты).
+static BOOL MsgConnStripesConnect(MsgConn* conn)
+{
+    struct sockaddr_in addr = conn->uni.client.serv_addr;
+
+    addr.sin_port = htons(ntohs(addr.sin_port) + 1);
+    for (size_t i = 0; i < conn->stripes.count; i++)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        conn->stripes.fds[i] = sock;
+        if (sock >= 0)
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        if (sock < 0 || (connect(sock, (struct sockaddr *) &addr,
+            sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS))
+        {
+            printf("ERROR connecting TCP stream %d!\n", (int) i + 1);
+            MsgConnStripesClose(conn);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+// Функция проверяет, завершилось ли подключение полос, начатое функцией
+// MsgConnStripesConnect, ожидая его не дольше timeoutMs миллисекунд.
+// Возвращает 1, если все полосы подключены (тогда их сокеты настроены и
+// переведены в блокирующий режим), 0 - если подключение еще идет, или -1,
+// если подключить какую-нибудь полосу не удалось.
+static int MsgConnStripesReady(MsgConn* conn, const MsgConnConfig* cfg,
+    int timeoutMs)
+{
+    struct pollfd pfd[MSG_CONN_STRIPES_MAX];
+    unsigned int userTimeout = MSG_CONN_USER_TIMEOUT_MS;
+    size_t n = conn->stripes.count;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        pfd[i].fd = conn->stripes.fds[i];
+        pfd[i].events = POLLOUT;
+        pfd[i].revents = 0;
+    }
+    if (poll(pfd, n, timeoutMs) < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    // Полоса готова, только когда poll сообщил о завершении подключения,
+    // а SO_ERROR - о его успехе
+    for (size_t i = 0; i < n; i++)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (!pfd[i].revents)
+            return 0;
+        if (getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+            err)
+        {
+            printf("ERROR connecting TCP stream %d!\n", (int) i + 1);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        int sock = pfd[i].fd;
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+        setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout,
+            sizeof(userTimeout));
+        MsgConnSetPacingRate(cfg, sock);
+    }
+    return 1;
+}
 
 
 // Функция устанавливает соединение по TCP для клиентской стороны.
@@ -37,6 +297,8 @@ BOOL MsgConnInitTcpSender(MsgConn* conn, const MsgConnConfig* cfg)
     if (conn->uni.client.server == NULL) 
     {
         printf("ERROR, no such host\n");
+        close(conn->uni.client.sockfd);
+        conn->uni.client.sockfd = -1;
         return FALSE;
     }
     bzero((char *) &conn->uni.client.serv_addr, sizeof(struct sockaddr_in));
@@ -51,24 +313,52 @@ BOOL MsgConnInitTcpSender(MsgConn* conn, const MsgConnConfig* cfg)
     if (errCode < 0)
     {
         printf("ERROR connecting!\n");
+        close(conn->uni.client.sockfd);
+        conn->uni.client.sockfd = -1;
         return FALSE;
     }
-    else
-        return TRUE;
+    MsgConnSetupSenderSocket(conn, cfg);
+
+    // Подключаем полосы, ожидая их не дольше, чем основное соединение
+    // при восстановлении
+    if (conn->stripes.count > 0)
+    {
+        double deadline = MsgConnNow() + MSG_CONN_CONNECT_TIMEOUT;
+        int ready = MsgConnStripesConnect(conn) ? 0 : -1;
+        while (ready == 0 && MsgConnNow() < deadline)
+            ready = MsgConnStripesReady(conn, cfg,
+                (int) ((deadline - MsgConnNow()) * 1000) + 1);
+        if (ready != 1)
+        {
+            printf("ERROR connecting TCP streams!\n");
+            MsgConnStripesClose(conn);
+            close(conn->uni.client.sockfd);
+            conn->uni.client.sockfd = -1;
+            return FALSE;
+        }
+    }
+    conn->link.state = MsgConnStateConnected;
+    return TRUE;
 }
 
 
-// Функция устанавливает соединение по TCP для серверной стороны.
+// Функция устанавливает соединение по TCP для серверной стороны. Клиент
+// подключается позже: подключение принимается без блокировки при приеме
+// сообщений (см. MsgConnAccept).
 BOOL MsgConnInitTcpReceiver(MsgConn* conn, const MsgConnConfig* cfg)
 {
-    socklen_t clilen = sizeof(struct sockaddr_in);
-
+    conn->uni.server.newsockfd = -1;
+    conn->uni.server.stripesockfd = -1;
     conn->uni.server.sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (conn->uni.server.sockfd < 0) 
     {
         printf("ERROR opening socket!\n");
         return FALSE;
     }
+    // Разрешаем сразу занять порт заново после перезапуска получателя
+    int one = 1;
+    setsockopt(conn->uni.server.sockfd, SOL_SOCKET, SO_REUSEADDR,
+        &one, sizeof(one));
     bzero((char *) &conn->uni.server.serv_addr, sizeof(struct sockaddr_in));
     conn->uni.server.serv_addr.sin_family = AF_INET;
     conn->uni.server.serv_addr.sin_addr.s_addr = INADDR_ANY;
@@ -79,21 +369,40 @@ BOOL MsgConnInitTcpReceiver(MsgConn* conn, const MsgConnConfig* cfg)
     if (errCode < 0) 
     {
         printf("ERROR on binding!\n");
+        close(conn->uni.server.sockfd);
         return FALSE;
     }
     printf("listening to port %d...\n", cfg->portno);
-    listen(conn->uni.server.sockfd, 5);
-    conn->uni.server.newsockfd = accept(
-        conn->uni.server.sockfd, 
-        (struct sockaddr *) &conn->uni.server.cli_addr, 
-        &clilen);
-    if (conn->uni.server.newsockfd < 0)
-    { 
-        printf("ERROR on accept!\n");
-        return FALSE;
+    listen(conn->uni.server.sockfd, MSG_CONN_STRIPES_MAX);
+    fcntl(conn->uni.server.sockfd, F_SETFL,
+        fcntl(conn->uni.server.sockfd, F_GETFL) | O_NONBLOCK);
+
+    // Полосы подключаются к соседнему порту, поэтому повторное подключение
+    // основного соединения не спутать с полосой
+    if (conn->stripes.count > 0)
+    {
+        struct sockaddr_in addr = conn->uni.server.serv_addr;
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        addr.sin_port = htons(cfg->portno + 1);
+        if (sock >= 0)
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (sock < 0 || bind(sock, (struct sockaddr *) &addr,
+            sizeof(struct sockaddr_in)) < 0)
+        {
+            printf("ERROR on binding TCP stream port %d!\n",
+                cfg->portno + 1);
+            if (sock >= 0)
+                close(sock);
+            close(conn->uni.server.sockfd);
+            return FALSE;
+        }
+        // (очередь вмещает одновременное подключение всех полос)
+        listen(sock, MSG_CONN_STRIPES_MAX);
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        conn->uni.server.stripesockfd = sock;
     }
-    else
-        return TRUE;
+    conn->link.state = MsgConnStateDisconnected;
+    return TRUE;
 }
 
 
@@ -140,13 +449,18 @@ int make_named_socket(const char *filename)
 // Функция устанавливает соединение для локального клиента
 BOOL MsgConnInitLocalSender(MsgConn* conn, const MsgConnConfig* cfg)
 {
+    int one = 1;
+
     /* Make the socket. */
-    conn->uni.clientLoc.sockfd = make_named_socket(conn->config.clientname);
+    conn->uni.clientLoc.sockfd = make_named_socket(cfg->clientname);
     if (conn->uni.clientLoc.sockfd < 0)
     {
         printf("Failed to make named socket!\n");
         return FALSE;
     }
+    // Метки приема ядром нужны для запросов синхронизации часов
+    setsockopt(conn->uni.clientLoc.sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &one,
+        sizeof(one));
 
     /* Initialize the server socket address. */
     conn->uni.clientLoc.serv_name.sun_family = AF_LOCAL;
@@ -179,11 +493,224 @@ BOOL MsgConnInitLocalReceiver(MsgConn* conn, const MsgConnConfig* cfg)
 }
 
 
+// Функция разбирает адрес группы многоадресной рассылки и адрес сетевого
+// интерфейса из настроек соединения.
+static BOOL MsgConnMcastAddr(MsgConn* conn, const MsgConnConfig* cfg,
+    struct in_addr* iface)
+{
+    bzero((char *) &conn->uni.mcast.group_addr, sizeof(struct sockaddr_in));
+    conn->uni.mcast.group_addr.sin_family = AF_INET;
+    conn->uni.mcast.group_addr.sin_port = htons(cfg->portno);
+    if (inet_pton(AF_INET, cfg->servername,
+            &conn->uni.mcast.group_addr.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(conn->uni.mcast.group_addr.sin_addr.s_addr)))
+    {
+        printf("ERROR, %s is not a multicast group\n", cfg->servername);
+        return FALSE;
+    }
+    iface->s_addr = htonl(INADDR_ANY);
+    if (cfg->clientname[0] && inet_pton(AF_INET, cfg->clientname, iface) != 1)
+    {
+        printf("ERROR, no such interface %s\n", cfg->clientname);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Функция возвращает адрес группы рассылки для сообщений типа type.
+static struct in_addr MsgConnMcastGroup(const MsgConn* conn, unsigned type)
+{
+    struct in_addr group;
+    group.s_addr = htonl(
+        ntohl(conn->uni.mcast.group_addr.sin_addr.s_addr) + type);
+    return group;
+}
+
+
+// Функция закрывает сокет рассылки после ошибки его настройки.
+static void MsgConnMcastClose(MsgConn* conn)
+{
+    close(conn->uni.mcast.sockfd);
+    conn->uni.mcast.sockfd = -1;
+}
+
+
+// Функция создает сокет отправителя многоадресной рассылки по UDP.
+BOOL MsgConnInitMcastSender(MsgConn* conn, const MsgConnConfig* cfg)
+{
+    struct in_addr iface;   // сетевой интерфейс для рассылки
+    unsigned char ttl = 1;  // рассылка не выходит за пределы локальной сети
+    unsigned char loop = 1; // получатели на этом же компьютере тоже
+                            // принимают рассылку
+
+    conn->uni.mcast.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (conn->uni.mcast.sockfd < 0)
+    {
+        printf("ERROR opening socket!\n");
+        return FALSE;
+    }
+    if (!MsgConnMcastAddr(conn, cfg, &iface))
+    {
+        MsgConnMcastClose(conn);
+        return FALSE;
+    }
+    setsockopt(conn->uni.mcast.sockfd, IPPROTO_IP, IP_MULTICAST_TTL,
+        &ttl, sizeof(ttl));
+    setsockopt(conn->uni.mcast.sockfd, IPPROTO_IP, IP_MULTICAST_LOOP,
+        &loop, sizeof(loop));
+    if (cfg->clientname[0] && setsockopt(conn->uni.mcast.sockfd,
+        IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) < 0)
+    {
+        printf("Unable to send multicast via %s!\n", cfg->clientname);
+        MsgConnMcastClose(conn);
+        return FALSE;
+    }
+    conn->uni.mcast.dest_addr = conn->uni.mcast.group_addr;
+    return TRUE;
+}
+
+
+// Функция создает сокет получателя многоадресной рассылки по UDP и
+// вступает в группы выбранных типов сообщений (config.mcastTypes).
+BOOL MsgConnInitMcastReceiver(MsgConn* conn, const MsgConnConfig* cfg)
+{
+    struct in_addr iface;   // сетевой интерфейс для приема рассылки
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    int one = 1;
+    int zero = 0;
+    int rcvbuf = MSG_CONN_MCAST_RCVBUF;
+
+    conn->uni.mcast.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (conn->uni.mcast.sockfd < 0)
+    {
+        printf("ERROR opening socket!\n");
+        return FALSE;
+    }
+    if (!MsgConnMcastAddr(conn, cfg, &iface))
+    {
+        MsgConnMcastClose(conn);
+        return FALSE;
+    }
+
+    // Несколько получателей на одном компьютере слушают один порт, но
+    // каждый принимает только группы, в которые вступил сам (иначе Linux
+    // доставляет ему и датаграммы групп других сокетов)
+    setsockopt(conn->uni.mcast.sockfd, SOL_SOCKET, SO_REUSEADDR,
+        &one, sizeof(one));
+    setsockopt(conn->uni.mcast.sockfd, IPPROTO_IP, IP_MULTICAST_ALL,
+        &zero, sizeof(zero));
+    setsockopt(conn->uni.mcast.sockfd, SOL_SOCKET, SO_RCVBUF,
+        &rcvbuf, sizeof(rcvbuf));
+    bzero((char *) &addr, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(cfg->portno);
+    if (bind(conn->uni.mcast.sockfd, (struct sockaddr *) &addr,
+        sizeof(struct sockaddr_in)) < 0)
+    {
+        printf("ERROR on binding!\n");
+        MsgConnMcastClose(conn);
+        return FALSE;
+    }
+
+    // Вступаем в группы выбранных типов сообщений
+    for (unsigned type = 0; type < MSG_CONN_MCAST_TYPES; type++)
+    {
+        if (cfg->mcastTypes != 0 && !(cfg->mcastTypes & (1u << type)))
+            continue;
+        mreq.imr_multiaddr = MsgConnMcastGroup(conn, type);
+        mreq.imr_interface = iface;
+        if (setsockopt(conn->uni.mcast.sockfd, IPPROTO_IP,
+            IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            printf("Unable to join multicast group %s!\n",
+                inet_ntoa(mreq.imr_multiaddr));
+            MsgConnMcastClose(conn);
+            return FALSE;
+        }
+        printf("listening to group %s port %d...\n",
+            inet_ntoa(mreq.imr_multiaddr), cfg->portno);
+    }
+    return TRUE;
+}
+
+
+// Функция создает очередь io_uring для соединения (и кольцо приемных
+// буферов размером mtu байт для получателя).
+static BOOL MsgConnInitUring(MsgConn* conn, const MsgConnConfig* cfg)
+{
+    BOOL receiver = (cfg->connRole == MsgConnRoleTcpReceiver ||
+        cfg->connRole == MsgConnRoleLocalReceiver ||
+        cfg->connRole == MsgConnRoleMcastReceiver);
+
+    conn->uring = (MsgUring*) malloc(sizeof(MsgUring));
+    if (!conn->uring)
+    {
+        printf("Unable to allocate io_uring!\n");
+        return FALSE;
+    }
+    if (!MsgUringInit(conn->uring, MSG_CONN_URING_ENTRIES) ||
+        (receiver && !MsgUringInitBuffers(conn->uring,
+            MSG_CONN_URING_ENTRIES, cfg->mtu)))
+    {
+        MsgUringFree(conn->uring);
+        free(conn->uring);
+        conn->uring = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Функция пересоздает очередь io_uring: после смены TCP соединения у
+// получателя (запрос многократного приема привязан к прежнему сокету) и
+// после сбоя очереди у отправителя (закрытие io_uring отменяет запросы,
+// завершения которых не удалось дождаться).
+static void MsgConnRestartUring(MsgConn* conn)
+{
+    if (!conn->uring)
+        return;
+    MsgUringFree(conn->uring);
+    free(conn->uring);
+    conn->uring = NULL;
+    if (!MsgConnInitUring(conn, &conn->config))
+        printf("Unable to restart io_uring!\n");
+}
+
+
 // Функция устанавливает соединение по заданным настройкам.
 BOOL MsgConnInit(MsgConn* conn, const MsgConnConfig* cfg)
 {
     BOOL status = FALSE;
 
+    conn->uring = NULL;
+    conn->wakeFd = -1;
+    conn->pktFill = 0;
+    bzero(&conn->zc, sizeof(MsgConnZeroCopy));
+    bzero(&conn->link, sizeof(MsgConnLink));
+    bzero(&conn->credit, sizeof(MsgConnCredit));
+    bzero(&conn->pacing, sizeof(MsgConnPacing));
+    bzero(&conn->clock, sizeof(MsgConnClock));
+    MsgClockSyncInit(&conn->clock.sync);
+    bzero(&conn->batch, sizeof(MsgConnBatch));
+    if (cfg->creditWindow > 0 && cfg->connRole == MsgConnRoleLocalReceiver &&
+        cfg->engine == MsgConnEngineUring)
+    {
+        // Прием через io_uring не сообщает адрес отправителя
+        printf("Credit flow control requires the socket engine!\n");
+        return FALSE;
+    }
+    if (cfg->coalesceSize > 0 && cfg->connRole == MsgConnRoleMcastSender)
+    {
+        // Сообщения разных типов рассылаются в разные группы
+        printf("Message coalescing is not supported for multicast!\n");
+        return FALSE;
+    }
+    if (!MsgConnStripesInit(conn, cfg))
+        return FALSE;
+
     // Инициализируем TCP сокет
     switch (cfg->connRole)
     {
@@ -199,6 +726,12 @@ BOOL MsgConnInit(MsgConn* conn, const MsgConnConfig* cfg)
     case MsgConnRoleLocalReceiver: // Инициализируем локального сервера
         status = MsgConnInitLocalReceiver(conn, cfg);
         break;
+    case MsgConnRoleMcastSender: // Инициализируем отправителя рассылки
+        status = MsgConnInitMcastSender(conn, cfg);
+        break;
+    case MsgConnRoleMcastReceiver: // Инициализируем получателя рассылки
+        status = MsgConnInitMcastReceiver(conn, cfg);
+        break;
     default:
         printf("Wrong connection type!\n");
         status = FALSE;
@@ -219,25 +752,194 @@ BOOL MsgConnInit(MsgConn* conn, const MsgConnConfig* cfg)
             conn->pktBody = conn->pktBuf + sizeof(MsgPacketHeader);
     }
 
+    // Отправитель с объединением сообщений собирает пачку в буфере пакета
+    if (status && cfg->coalesceSize > 0)
+        MsgBatchInit((MsgPacketHeader*) conn->pktBuf,
+            cfg->mtu - sizeof(MsgPacketHeader));
+
+    // Выделяем кольцо сообщений для повторной отправки
+    if (status && cfg->connRole == MsgConnRoleTcpSender &&
+        cfg->resendDepth > 0)
+    {
+        conn->link.history = (MsgBuffer*) calloc(cfg->resendDepth,
+            sizeof(MsgBuffer));
+        if (!conn->link.history)
+        {
+            printf("Unable to allocate resend history!\n");
+            status = FALSE;
+        }
+    }
+
+    // Создаем дескриптор пробуждения получателя
+    if (status && (cfg->connRole == MsgConnRoleTcpReceiver ||
+        cfg->connRole == MsgConnRoleLocalReceiver ||
+        cfg->connRole == MsgConnRoleMcastReceiver))
+    {
+        conn->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (conn->wakeFd < 0)
+        {
+            printf("Unable to create wakeup descriptor!\n");
+            status = FALSE;
+        }
+    }
+
+    // Создаем очередь io_uring, если выбран этот способ ввода-вывода
+    if (status && cfg->engine == MsgConnEngineUring)
+        status = MsgConnInitUring(conn, cfg);
+
     // Инициализируем остальные поля структуры соединения
     conn->config = *cfg;
     conn->list = NULL;
     conn->msgErrorCount = 0;
+    bzero(&conn->rate, sizeof(MsgConnRate));
+
+    // При ошибке освобождаем полосы, выделенные до создания сокетов
+    if (!status)
+    {
+        MsgConnStripesClose(conn);
+        MsgConnStripesFree(conn);
+    }
     return status;
 }
 
 
+// Функция снимает ссылку на сообщение, отправленное без копирования.
+static void MsgConnPinnedRelease(MsgConnPinned* pin)
+{
+    MsgBufferFree(&pin->ref);
+    free(pin->headers);
+    pin->headers = NULL;
+}
+
+
+// Функция разбирает уведомления о завершении отправки без копирования из
+// очереди ошибок сокета и снимает ссылки на сообщения, которые ядро уже
+// передало. Если timeoutMs > 0, то сначала ждет уведомления не дольше
+// timeoutMs миллисекунд.
+static void MsgConnZeroCopyReap(MsgConn* conn, int timeoutMs)
+{
+    MsgConnZeroCopy* zc = &conn->zc;
+    int sock = conn->uni.client.sockfd;
+    char control[128];      // буфер для служебных данных уведомления
+    struct msghdr mh;
+    struct cmsghdr* cm;
+    size_t n = 0;           // количество освобождаемых сообщений
+
+    // Ждем появления уведомлений (poll сообщает о них как о POLLERR)
+    if (timeoutMs > 0)
+    {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = 0;
+        pfd.revents = 0;
+        poll(&pfd, 1, timeoutMs);
+    }
+
+    // Читаем все накопившиеся уведомления
+    for (;;)
+    {
+        bzero(&mh, sizeof(mh));
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;  // очередь ошибок пуста
+        for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+        {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err* serr =
+                (struct sock_extended_err*) CMSG_DATA(cm);
+            if (serr->ee_errno != 0 ||
+                serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // Уведомление подтверждает вызовы с номерами ee_info..ee_data.
+            // Если ядру пришлось копировать данные (например, через
+            // loopback), то закрепление страниц только мешает, поэтому
+            // дальше отправляем обычным образом.
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zc->copiedCount += serr->ee_data - serr->ee_info + 1;
+                zc->enabled = FALSE;
+            }
+            if ((int32_t) (serr->ee_data + 1 - zc->doneSeq) > 0)
+                zc->doneSeq = serr->ee_data + 1;
+        }
+    }
+
+    // Снимаем ссылки на сообщения, все вызовы sendmsg которых завершены
+    while (n < zc->pinnedCount &&
+        (int32_t) (zc->pinned[n].lastSeq - zc->doneSeq) < 0)
+        MsgConnPinnedRelease(&zc->pinned[n++]);
+    if (n > 0)
+    {
+        zc->pinnedCount -= n;
+        memmove(zc->pinned, zc->pinned + n,
+            zc->pinnedCount * sizeof(MsgConnPinned));
+    }
+}
+
+
+// Функция ждет, пока ядро передаст сообщения, отправленные без
+// копирования (не дольше waitCount раз по 100 мс), и снимает ссылки на
+// все удерживаемые сообщения. Нумерация вызовов sendmsg начинается
+// заново (это нужно и при переподключении, так как у нового сокета
+// своя нумерация).
+static void MsgConnZeroCopyFlush(MsgConn* conn, int waitCount)
+{
+    for (int i = 0; i < waitCount && conn->zc.pinnedCount > 0; i++)
+        MsgConnZeroCopyReap(conn, 100);
+    for (size_t i = 0; i < conn->zc.pinnedCount; i++)
+        MsgConnPinnedRelease(&conn->zc.pinned[i]);
+    conn->zc.pinnedCount = 0;
+    conn->zc.nextSeq = 0;
+    conn->zc.doneSeq = 0;
+}
+
+
 // Функция разрывает соединение
 void MsgConnFree(MsgConn* conn)
 {
+    // Отправляем сообщения, ждущие в пачке
+    if (conn->config.coalesceSize > 0 && conn->pktBuf)
+        MsgConnFlush(conn, TRUE);
+
+    // Освобождаем очередь io_uring (это отменяет запросы приема)
+    if (conn->uring)
+    {
+        MsgUringFree(conn->uring);
+        free(conn->uring);
+        conn->uring = NULL;
+    }
+
+    // Дожидаемся, пока ядро передаст сообщения, отправленные без
+    // копирования (но не дольше секунды), и снимаем ссылки на них, а
+    // также на сообщения, хранимые для повторной отправки
+    if (conn->config.connRole == MsgConnRoleTcpSender)
+    {
+        if (conn->uni.client.sockfd >= 0)
+            MsgConnZeroCopyFlush(conn, 10);
+        free(conn->zc.pinned);
+        bzero(&conn->zc, sizeof(MsgConnZeroCopy));
+        for (size_t i = 0; i < conn->link.historyCount; i++)
+            MsgBufferFree(&conn->link.history[(conn->link.historyHead + i) %
+                conn->config.resendDepth]);
+        free(conn->link.history);
+        bzero(&conn->link, sizeof(MsgConnLink));
+    }
+
     // Закрываем TCP сокеты
     switch (conn->config.connRole)
     {
     case MsgConnRoleTcpSender:   // Останавливаем TCP клиент
-        close(conn->uni.client.sockfd);
+        if (conn->uni.client.sockfd >= 0)
+            close(conn->uni.client.sockfd);
         break;
     case MsgConnRoleTcpReceiver: // Останавливаем TCP сервер
-        close(conn->uni.server.newsockfd);
+        if (conn->uni.server.newsockfd >= 0)
+            close(conn->uni.server.newsockfd);
+        if (conn->uni.server.stripesockfd >= 0)
+            close(conn->uni.server.stripesockfd);
         close(conn->uni.server.sockfd);
         break;
     case MsgConnRoleLocalSender: // Останавливаем локальный клиент
@@ -248,71 +950,1036 @@ void MsgConnFree(MsgConn* conn)
         close(conn->uni.serverLoc.sockfd);
         unlink(conn->config.servername);
         break;
+    case MsgConnRoleMcastSender:   // Останавливаем рассылку
+    case MsgConnRoleMcastReceiver: // (группы покидаются при закрытии)
+        close(conn->uni.mcast.sockfd);
+        break;
     default:
         printf("Wrong connection type!\n");
         assert(TRUE == FALSE);
         break;
     }
 
+    // Закрываем полосы TCP соединения и освобождаем их буферы
+    MsgConnStripesClose(conn);
+    MsgConnStripesFree(conn);
+
+    // Закрываем дескриптор пробуждения
+    if (conn->wakeFd >= 0)
+        close(conn->wakeFd);
+    conn->wakeFd = -1;
+
     // Освобождаем память, выделенную для буфера пакета
     free(conn->pktBuf);
     conn->pktBuf = NULL;
     conn->pktBody = NULL;
+    conn->pktFill = 0;
 
-    // Освобождаем память, выделенную под список сообщений
+    // Освобождаем память, выделенную под список сообщений (и под еще не
+    // выданные сообщения принятой пачки)
     MsgListClear(&conn->list);
+    MsgListClear(&conn->batch.pending);
 }
 
 
-// Функция отправляет сообщение через TCP-сокет
-BOOL MsgConnSend(MsgConn* conn, const MsgBuffer* buf)
+// Функция возвращает сокет, через который отправитель передает пакеты.
+static int MsgConnSenderSocket(const MsgConn* conn)
 {
-    unsigned char* pchunk;  // указатель на тек. фрагмент сообщения в буфере
-    size_t index;           // номер текущего фрагмента сообщения
-    int cbret = 0;          // количество переданных байт пакета
-    MsgPacketHeader pkt;    // заголовок текущего пакета
-    size_t pktSize = 0;     // фактический размер пакета
-    BOOL status = FALSE;    // результат отправки сообщения
+    switch (conn->config.connRole)
+    {
+    case MsgConnRoleTcpSender:
+        return conn->uni.client.sockfd;
+    case MsgConnRoleLocalSender:
+        return conn->uni.clientLoc.sockfd;
+    case MsgConnRoleMcastSender:
+        return conn->uni.mcast.sockfd;
+    default:
+        return -1;
+    }
+}
 
-    // Проверяем контрольный код структуры буфера сообщения
-    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
-    assert(conn->pktBuf != NULL && conn->pktBody != NULL);
 
-    pchunk = buf->data;
+// Функция возвращает адрес, по которому отправитель датаграмм передает
+// пакеты сообщения buf, и записывает длину адреса в *plen: имя
+// локального сокета получателя или группу рассылки для типа сообщения.
+// Для TCP отправителя функция возвращает NULL. Сообщение buf нужно только
+// отправителю рассылки (остальным можно передать NULL).
+static struct sockaddr* MsgConnSenderAddr(MsgConn* conn,
+    const MsgBuffer* buf, socklen_t* plen)
+{
+    const MsgHeader* msg = NULL;
+    unsigned type = 0;
+
+    switch (conn->config.connRole)
+    {
+    case MsgConnRoleLocalSender:
+        *plen = conn->uni.clientLoc.serv_name_size;
+        return (struct sockaddr *) &conn->uni.clientLoc.serv_name;
+    case MsgConnRoleMcastSender:
+        msg = (const MsgHeader*) buf->data;
+        type = (unsigned) msg->type;
+        if (type >= MSG_CONN_MCAST_TYPES)
+            type = 0;
+        conn->uni.mcast.dest_addr.sin_addr = MsgConnMcastGroup(conn, type);
+        *plen = sizeof(struct sockaddr_in);
+        return (struct sockaddr *) &conn->uni.mcast.dest_addr;
+    default:
+        *plen = 0;
+        return NULL;
+    }
+}
+
+
+// Функция возвращает сокет, из которого получатель принимает пакеты (для
+// TCP - сокет подключенного отправителя или -1, если его нет).
+static int MsgConnReceiverSocket(const MsgConn* conn)
+{
+    switch (conn->config.connRole)
+    {
+    case MsgConnRoleTcpReceiver:
+        return conn->uni.server.newsockfd;
+    case MsgConnRoleLocalReceiver:
+        return conn->uni.serverLoc.sockfd;
+    case MsgConnRoleMcastReceiver:
+        return conn->uni.mcast.sockfd;
+    default:
+        return -1;
+    }
+}
+
+
+// Функция возвращает количество байт в очереди отправки сокета
+// (для TCP сюда входят и отправленные, но еще не подтвержденные байты).
+static size_t MsgConnQueueBytes(const MsgConn* conn)
+{
+    size_t total = 0;
+    int outq = 0;
+    int sock = MsgConnSenderSocket(conn);
+    if (sock >= 0 && ioctl(sock, SIOCOUTQ, &outq) == 0 && outq > 0)
+        total = (size_t) outq;
+
+    // Учитываем очереди полос TCP соединения
+    for (size_t i = 0; i < conn->stripes.count; i++)
+        if (conn->stripes.fds[i] >= 0 &&
+            ioctl(conn->stripes.fds[i], SIOCOUTQ, &outq) == 0 && outq > 0)
+            total += (size_t) outq;
+    return total;
+}
+
+
+// Функция обновляет оценки пропускной способности канала и задержки в
+// очереди отправки после отправки сообщения размером bytes байт (или
+// без отправки, если bytes = 0).
+static void MsgConnRateUpdate(MsgConn* conn, size_t bytes, double timeEnd)
+{
+    const double alpha = 0.25; // вес новой выборки при сглаживании
+    MsgConnRate* rate = &conn->rate;
+    size_t queueBytes = MsgConnQueueBytes(conn);
+    double interval = timeEnd - rate->lastUpdateTime;
+    double drained = 0;        // сколько байт ушло из очереди за интервал
+    double sample = 0;         // выборка пропускной способности
+
+    if (rate->lastUpdateTime > 0 && interval > 0)
+    {
+        drained = (double) rate->queueBytes + bytes - queueBytes;
+        sample = drained / interval;
+        if (rate->queueBytes > 0 && queueBytes > 0)
+        {
+            // Очередь не опустошалась - канал был загружен полностью,
+            // и скорость ее опустошения равна пропускной способности
+            if (rate->bandwidth > 0)
+                rate->bandwidth = (1 - alpha) * rate->bandwidth +
+                    alpha * sample;
+            else
+                rate->bandwidth = sample;
+        }
+        else if (sample > rate->bandwidth)
+        {
+            // Канал простаивал - выборка дает только нижнюю границу
+            rate->bandwidth = sample;
+        }
+    }
+
+    rate->queueBytes = queueBytes;
+    rate->queueDelay = (rate->bandwidth > 0) ?
+        queueBytes / rate->bandwidth : 0;
+    rate->lastUpdateTime = timeEnd;
+}
+
+
+// Пауза в секундах, после которой локальный отправитель без кредита
+// передает одно пробное сообщение: кредиты могли потеряться, или
+// получатель перезапущен и ничего о прежних сообщениях не знает
+#define MSG_CONN_CREDIT_PROBE 1.0
+
+
+// Функция проверяет, управляется ли соединение кредитами.
+static BOOL MsgConnCreditEnabled(const MsgConn* conn)
+{
+    return conn->config.creditWindow > 0 &&
+        (conn->config.connRole == MsgConnRoleLocalSender ||
+         conn->config.connRole == MsgConnRoleLocalReceiver);
+}
+
+
+// Функция учитывает кредит, который получатель прислал локальному
+// отправителю на его именованный сокет.
+static void MsgConnCreditApply(MsgConn* conn, const MsgCredit* credit)
+{
+    MsgConnCredit* state = &conn->credit;
+    size_t progress = 0;
+
+    // Кредит возвращает все сообщения, собранные после предыдущего
+    // (первый кредит и кредит перезапущенного получателя - все собранные
+    // им сообщения, а кредит за пачку - сразу несколько)
+    if (state->acked && credit->deliveredCount >= state->ackCount)
+        progress = credit->deliveredCount - state->ackCount;
+    else
+        progress = credit->deliveredCount;
+    state->inFlight = (state->inFlight > progress) ?
+        state->inFlight - progress : 0;
+    state->ackCount = credit->deliveredCount;
+    state->acked = TRUE;
+    state->grantTime = MsgConnNow();
+}
+
+
+// Функция запоминает запрос синхронизации часов, принятый отправителем
+// в момент recvNs: ответ на него уйдет в заголовке ближайшего пакета.
+static void MsgConnClockEcho(MsgConn* conn, const MsgPing* ping,
+    uint64_t recvNs)
+{
+    conn->clock.echoTimeNs = ping->timeNs;
+    conn->clock.echoRecvNs = recvNs;
+}
+
+
+// Функция читает без блокировки до size байт обратного пути отправителя
+// и записывает в *recvNs момент их приема ядром (SO_TIMESTAMPNS) по часам
+// соединения: отправитель читает обратный путь только перед отправкой,
+// и момент чтения мог бы отстать от приема на интервал между кадрами.
+static ssize_t MsgConnFeedbackRecv(MsgConn* conn, int sock, void* data,
+    size_t size, uint64_t* recvNs)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr* cmsg = NULL;
+    ssize_t cbret = 0;
+
+    iov.iov_base = data;
+    iov.iov_len = size;
+    bzero(&mh, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    cbret = recvmsg(sock, &mh, MSG_DONTWAIT);
+    *recvNs = 0;
+    for (cmsg = CMSG_FIRSTHDR(&mh); cbret > 0 && cmsg;
+        cmsg = CMSG_NXTHDR(&mh, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            *recvNs = MsgClockFromRealtime(conn->config.clock,
+                (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec);
+        }
+    if (*recvNs == 0)
+        *recvNs = MsgClockNs(conn->config.clock);
+    return cbret;
+}
+
+
+// Функция читает без блокировки то, что получатель передает отправителю
+// по обратному пути: кредиты (датаграммы на именованный сокет локального
+// отправителя) и запросы синхронизации часов (такие же датаграммы или
+// TCP поток после сведений о возобновлении сессии).
+static void MsgConnFeedbackPoll(MsgConn* conn)
+{
+    union
+    {
+        MsgCredit credit;
+        MsgPing ping;
+        MsgResume resume;
+    } fb;
+    ssize_t cbret = 0;
+    uint64_t recvNs = 0;    // момент приема данных ядром
+    int sock = -1;
+
+    if (conn->config.connRole == MsgConnRoleLocalSender)
+    {
+        sock = conn->uni.clientLoc.sockfd;
+        while ((cbret = MsgConnFeedbackRecv(conn, sock, &fb, sizeof(fb),
+            &recvNs)) >= 0)
+        {
+            if (cbret == sizeof(MsgCredit) &&
+                fb.credit.magicNumber == MSG_CREDIT_MAGIC)
+                MsgConnCreditApply(conn, &fb.credit);
+            else if (cbret == sizeof(MsgPing) &&
+                fb.ping.magicNumber == MSG_PING_MAGIC)
+                MsgConnClockEcho(conn, &fb.ping, recvNs);
+        }
+    }
+    else if (conn->config.connRole == MsgConnRoleTcpSender &&
+        conn->link.state == MsgConnStateConnected)
+    {
+        // Читаем только целые записи (остаток дочитаем позже). Кроме
+        // запросов в потоке бывают сведения о возобновлении сессии, не
+        // прочитанные при первом подключении; на непонятном байте поток
+        // сдвигается на один байт до следующей записи
+        sock = conn->uni.client.sockfd;
+        while ((cbret = recv(sock, &fb, sizeof(fb),
+            MSG_DONTWAIT | MSG_PEEK)) > 0)
+        {
+            size_t size = 1;
+            if (cbret >= (ssize_t) sizeof(MsgPing) &&
+                fb.ping.magicNumber == MSG_PING_MAGIC)
+                size = sizeof(MsgPing);
+            else if (cbret < (ssize_t) sizeof(MsgResume))
+                break;
+            else if (fb.resume.magicNumber == MSG_RESUME_MAGIC)
+                size = sizeof(MsgResume);
+            MsgConnFeedbackRecv(conn, sock, &fb, size, &recvNs);
+            if (size == sizeof(MsgPing))
+                MsgConnClockEcho(conn, &fb.ping, recvNs);
+        }
+    }
+}
+
+
+// Функция проверяет, есть ли у локального отправителя кредит на новое
+// сообщение (кредиты перед этим читает MsgConnFeedbackPoll). Если
+// кредитов нет дольше MSG_CONN_CREDIT_PROBE секунд, то отправляется одно
+// пробное сообщение: получатель ответит на него новым кредитом, даже
+// если прежние сообщения или кредиты потерялись.
+static BOOL MsgConnCreditAvailable(MsgConn* conn)
+{
+    if (!MsgConnCreditEnabled(conn) ||
+        conn->config.connRole != MsgConnRoleLocalSender)
+        return TRUE;
+    return conn->credit.inFlight < conn->config.creditWindow ||
+        MsgConnNow() - conn->credit.grantTime >= MSG_CONN_CREDIT_PROBE;
+}
+
+
+// Функция учитывает отправку сообщения локальным отправителем.
+static void MsgConnCreditSent(MsgConn* conn)
+{
+    MsgConnCredit* credit = &conn->credit;
+
+    if (!MsgConnCreditEnabled(conn) ||
+        conn->config.connRole != MsgConnRoleLocalSender)
+        return;
+    if (credit->grantTime <= 0)
+        credit->grantTime = MsgConnNow();  // первое сообщение
+    if (credit->inFlight >= conn->config.creditWindow)
+    {
+        // Пробное сообщение: прежние считаем потерянными
+        credit->inFlight = 0;
+        credit->grantTime = MsgConnNow();
+    }
+    credit->inFlight++;
+}
+
+
+// Функция отправляет локальному отправителю кредит после сборки
+// очередного сообщения (адрес отправителя запомнен при приеме пакета).
+// Сообщения одной пачки возвращают один общий кредит, когда выдано
+// последнее из них. Отправитель без имени сокета кредитов не получает.
+static void MsgConnCreditGrant(MsgConn* conn)
+{
+    MsgCredit credit;
+
+    if (!MsgConnCreditEnabled(conn) ||
+        conn->config.connRole != MsgConnRoleLocalReceiver)
+        return;
+    conn->credit.deliveredCount++;
+    if (conn->batch.pending != NULL ||
+        conn->uni.serverLoc.client_name_size <=
+        offsetof(struct sockaddr_un, sun_path))
+        return;
+    credit.deliveredCount = conn->credit.deliveredCount;
+    credit.magicNumber = MSG_CREDIT_MAGIC;
+
+    // Если очередь сокета отправителя заполнена, то кредит теряется без
+    // последствий: счетчик передаст следующий кредит
+    sendto(conn->uni.serverLoc.sockfd, &credit, sizeof(MsgCredit),
+        MSG_DONTWAIT, (struct sockaddr *) &conn->uni.serverLoc.client_name,
+        conn->uni.serverLoc.client_name_size);
+}
+
+
+// Функция передает отправителю очередной запрос синхронизации часов,
+// если с предыдущего прошло config.clockSyncPeriod секунд. Запрос из
+// нескольких байт уходит в почти пустой буфер сокета целиком; если же
+// буфер заполнен, то запрос пропускается до следующего периода.
+static void MsgConnClockPing(MsgConn* conn)
+{
+    MsgConnClock* clk = &conn->clock;
+    MsgPing ping;
+    ssize_t cbret = -1;
+    double now = 0;
+
+    if (conn->config.clockSyncPeriod <= 0)
+        return;
+    now = MsgConnNow();
+    if (now - clk->pingTime < conn->config.clockSyncPeriod)
+        return;
+    clk->pingTime = now;
+    ping.magicNumber = MSG_PING_MAGIC;
+    ping.timeNs = MsgClockNs(conn->config.clock);
+    if (conn->config.connRole == MsgConnRoleTcpReceiver &&
+        conn->uni.server.newsockfd >= 0)
+        cbret = send(conn->uni.server.newsockfd, &ping, sizeof(MsgPing),
+            MSG_DONTWAIT | MSG_NOSIGNAL);
+    else if (conn->config.connRole == MsgConnRoleLocalReceiver &&
+        conn->uni.serverLoc.client_name_size >
+        offsetof(struct sockaddr_un, sun_path))
+        cbret = sendto(conn->uni.serverLoc.sockfd, &ping, sizeof(MsgPing),
+            MSG_DONTWAIT,
+            (struct sockaddr *) &conn->uni.serverLoc.client_name,
+            conn->uni.serverLoc.client_name_size);
+    if (cbret == sizeof(MsgPing))
+        clk->pingCount++;
+}
+
+
+// Функция ставит в заголовке пакета момент отправки. Если отправитель
+// принял запрос синхронизации часов, то ответ на него передается в этом
+// же заголовке (и в следующих, пока пакет с ним не будет записан в сокет,
+// см. MsgConnEchoSent).
+static void MsgConnPacketStamp(MsgConn* conn, MsgPacketHeader* pkt)
+{
+    MsgConnClock* clk = &conn->clock;
+
+    pkt->sendTimeNs = MsgClockNs(conn->config.clock);
+    if (clk->echoTimeNs != 0)
+    {
+        pkt->echoTimeNs = clk->echoTimeNs;
+        pkt->echoHoldNs = pkt->sendTimeNs - clk->echoRecvNs;
+    }
+}
+
+
+// Функция отмечает, что пакет с заголовком pkt записан в сокет: ответ на
+// запрос синхронизации часов из него больше не повторяется. Заголовок,
+// который не удалось отправить (EAGAIN, ожидание ограничителя скорости),
+// строится заново и снова несет ответ.
+static void MsgConnEchoSent(MsgConn* conn, const MsgPacketHeader* pkt)
+{
+    if (pkt->echoTimeNs != 0 && pkt->echoTimeNs == conn->clock.echoTimeNs)
+        conn->clock.echoTimeNs = 0;
+}
+
+
+// Функция заполняет заголовок пакета index сообщения buf и ставит в нем
+// момент отправки.
+static void MsgConnPacketHeaderInit(MsgConn* conn, MsgPacketHeader* pkt,
+    const MsgBuffer* buf, size_t index)
+{
+    MsgPacketHeaderInit(pkt, buf, index);
+    MsgConnPacketStamp(conn, pkt);
+}
+
+
+// Функция сообщает, успеет ли новое сообщение дойти до получателя за
+// время config.targetLatency при текущей загрузке канала.
+BOOL MsgConnReadyToSend(MsgConn* conn)
+{
+    MsgConnRate* rate = &conn->rate;
+
+    MsgConnFeedbackPoll(conn);
+    // Без кредита на следующее сообщение кадр лучше пропустить
+    if (!MsgConnCreditAvailable(conn))
+    {
+        rate->skipCount++;
+        return FALSE;
+    }
+    if (conn->config.targetLatency <= 0)
+        return TRUE;
+
+    // Уточняем оценки по текущему размеру очереди отправки
+    MsgConnRateUpdate(conn, 0, MsgConnNow());
+    if (rate->queueDelay > conn->config.targetLatency)
+    {
+        rate->skipCount++;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Функция оценивает, сколько байт можно отправить, чтобы сообщение
+// дошло до получателя за время config.targetLatency.
+size_t MsgConnSendBudget(const MsgConn* conn)
+{
+    double budget = 0;
+
+    if (conn->config.targetLatency <= 0 || conn->rate.bandwidth <= 0)
+        return (size_t) -1;
+    budget = conn->rate.bandwidth * conn->config.targetLatency -
+        (double) MsgConnQueueBytes(conn);
+    return (budget > 0) ? (size_t) budget : 0;
+}
+
+
+// Функция пополняет запас ограничителя скорости отправки к моменту now.
+static void MsgConnPaceRefill(MsgConn* conn, double now)
+{
+    MsgConnPacing* pacing = &conn->pacing;
+    double burst = (double) (conn->config.pacingBurst > 0 ?
+        conn->config.pacingBurst : conn->config.mtu);
+
+    if (pacing->lastTime <= 0)
+        pacing->tokens = burst;  // первая отправка
+    else
+        pacing->tokens += conn->config.pacingRate * (now - pacing->lastTime);
+    if (pacing->tokens > burst)
+        pacing->tokens = burst;
+    pacing->lastTime = now;
+}
+
+
+// Функция возвращает, сколько секунд осталось ждать, пока ограничитель
+// скорости не разрешит отправку следующего пакета (0 - можно отправлять).
+static double MsgConnPaceDelay(MsgConn* conn)
+{
+    if (conn->config.pacingRate <= 0)
+        return 0;
+    MsgConnPaceRefill(conn, MsgConnNow());
+    if (conn->pacing.tokens >= 0)
+        return 0;
+    return -conn->pacing.tokens / conn->config.pacingRate;
+}
+
+
+// Функция списывает с запаса ограничителя скорости bytes байт. Отправка
+// без блокировки списывает пакет, только когда сокет принял его начало,
+// так что повторные попытки после EAGAIN не расходуют запас.
+static void MsgConnPaceCharge(MsgConn* conn, size_t bytes)
+{
+    if (conn->config.pacingRate > 0)
+        conn->pacing.tokens -= (double) bytes;
+}
+
+
+// Функция ждет, пока ограничитель скорости не разрешит отправку bytes
+// байт, и списывает их (для блокирующей отправки).
+static void MsgConnPaceWait(MsgConn* conn, size_t bytes)
+{
+    double delay = 0;
+
+    while ((delay = MsgConnPaceDelay(conn)) > 0)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t) delay;
+        ts.tv_nsec = (long) ((delay - ts.tv_sec) * 1.0e9) + 1;
+        nanosleep(&ts, NULL);
+        conn->pacing.waitTime += delay;
+    }
+    MsgConnPaceCharge(conn, bytes);
+}
+
+
+// Функция возвращает, сколько пакетов размером до pktSize байт можно
+// передать одной порцией: с ограничением скорости порция не больше
+// глубины корзины (но не меньше одного пакета).
+static size_t MsgConnPaceBatch(const MsgConn* conn, size_t pktSize,
+    size_t maxCount)
+{
+    size_t burst = conn->config.pacingBurst > 0 ?
+        conn->config.pacingBurst : conn->config.mtu;
+    size_t count = maxCount;
+
+    if (conn->config.pacingRate > 0 && pktSize > 0)
+    {
+        count = burst / pktSize;
+        if (count < 1)
+            count = 1;
+        if (count > maxCount)
+            count = maxCount;
+    }
+    return count;
+}
+
+
+// Функция возвращает суммарный размер count пакетов сообщения buf,
+// начиная с пакета index.
+static size_t MsgConnBatchBytes(const MsgBuffer* buf, size_t index,
+    size_t count)
+{
+    MsgPacketHeader pkt;
+    size_t bytes = 0;
+
+    for (size_t i = index; i < index + count; i++)
+    {
+        MsgPacketHeaderInit(&pkt, buf, i);
+        bytes += sizeof(MsgPacketHeader) + pkt.chunkSize;
+    }
+    return bytes;
+}
+
+
+// Функция отправляет сообщение через io_uring. Каждый пакет описывается
+// двумя фрагментами памяти (заголовок пакета и фрагмент сообщения прямо
+// в буфере сообщения), так что тело сообщения не копируется. Запросы
+// одной порции связываются флагом IOSQE_IO_LINK, чтобы ядро выполняло
+// их строго по порядку, и вся порция передается одним системным вызовом.
+// Связь действует только внутри порции, поэтому следующая порция
+// готовится лишь после завершения всех запросов предыдущей.
+static BOOL MsgConnSendUring(MsgConn* conn, const MsgBuffer* buf)
+{
+    MsgUring* ring = conn->uring;
+    BOOL stream = (conn->config.connRole == MsgConnRoleTcpSender);
+    int sock = MsgConnSenderSocket(conn);
+    size_t index = 0;       // номер первого фрагмента текущей порции
+    size_t batch = 0;       // количество пакетов в текущей порции
+    size_t done = 0;        // количество завершенных запросов порции
+    size_t sentBytes = 0;   // сколько байт сообщения передано в сокет
+    BOOL status = TRUE;     // результат отправки сообщения
+    socklen_t nameLen = 0;  // длина адреса получателя датаграмм
+    struct sockaddr* name = MsgConnSenderAddr(conn, buf, &nameLen);
+
+    while (index < buf->chunksCount && status)
+    {
+        batch = buf->chunksCount - index;
+        if (batch > ring->entries)
+            batch = ring->entries;
+        batch = MsgConnPaceBatch(conn, sizeof(MsgPacketHeader) +
+            buf->chunkSizeMax, batch);
+        MsgConnPaceWait(conn, MsgConnBatchBytes(buf, index, batch));
+
+        // Готовим запросы на отправку пакетов порции
+        for (size_t i = 0; i < batch; i++)
+        {
+            MsgPacketHeader* pkt = ring->sendHdrs + i;
+            struct iovec* iov = ring->sendIov + 2 * i;
+            struct msghdr* mh = ring->sendMsgs + i;
+            struct io_uring_sqe* sqe = MsgUringGetSqe(ring);
+            assert(sqe != NULL);
+
+            MsgConnPacketHeaderInit(conn, pkt, buf, index + i);
+            iov[0].iov_base = pkt;
+            iov[0].iov_len = sizeof(MsgPacketHeader);
+            iov[1].iov_base = buf->data + (index + i) * buf->chunkSizeMax;
+            iov[1].iov_len = pkt->chunkSize;
+            bzero(mh, sizeof(struct msghdr));
+            mh->msg_iov = iov;
+            mh->msg_iovlen = 2;
+            mh->msg_name = name;
+            mh->msg_namelen = nameLen;
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = sock;
+            sqe->addr = (unsigned long) mh;
+            sqe->len = 1;
+            sqe->msg_flags = stream ? MSG_WAITALL | MSG_NOSIGNAL : 0;
+            sqe->user_data = i;
+            if (i + 1 < batch)
+                sqe->flags = IOSQE_IO_LINK;
+        }
+
+        // Передаем порцию ядру и ждем завершения всех ее запросов
+        MSG_TRACE_BEGIN(MsgTraceChunkWrite, buf->msgIndex, index);
+        if (MsgUringSubmit(ring, batch, -1) < 0)
+        {
+            // Запросы, не принятые ядром, ссылаются на буфер сообщения:
+            // отзываем их, а принятые ядром дожидаемся как обычно
+            printf("ERROR submitting to io_uring!\n");
+            status = FALSE;
+            batch -= MsgUringDiscard(ring);
+        }
+        for (done = 0; done < batch; )
+        {
+            struct io_uring_cqe* cqe = MsgUringPeekCqe(ring);
+            if (!cqe && MsgUringSubmit(ring, 1, -1) < 0)
+            {
+                // Дождаться завершения запросов нельзя: пересоздаем
+                // очередь, чтобы ядро не обратилось к буферу сообщения
+                printf("ERROR waiting for io_uring!\n");
+                status = FALSE;
+                MsgConnRestartUring(conn);
+                break;
+            }
+            if (!cqe)
+                continue;
+            size_t pktSize = sizeof(MsgPacketHeader) +
+                ring->sendHdrs[cqe->user_data].chunkSize;
+            if (cqe->res < 0 && status)
+            {
+                printf("ERROR writing to socket!\n");
+                status = FALSE;
+            }
+            else if (cqe->res >= 0 && (size_t) cqe->res != pktSize && status)
+            {
+                printf("Packet fragmentation detected!\n");
+                status = FALSE;
+            }
+            else if (cqe->res >= 0)
+            {
+                sentBytes += pktSize;
+                MsgConnEchoSent(conn, ring->sendHdrs + cqe->user_data);
+            }
+            MsgUringCqeSeen(ring);
+            done++;
+        }
+        MSG_TRACE_END(MsgTraceChunkWrite, buf->msgIndex, index);
+        index += batch;
+    }
+
+    if (status == FALSE)
+        conn->msgErrorCount++; // инкрементируем счетчик сбойных сообщений
+    else
+        MsgConnRateUpdate(conn, sentBytes, MsgConnNow());
+    return status;
+}
+
+
+// Функция отправляет сообщение через TCP-сокет без копирования данных в
+// ядро (MSG_ZEROCOPY). Пакеты описываются парами фрагментов памяти
+// (заголовок пакета и фрагмент прямо в буфере сообщения) и передаются
+// порциями по MSG_CONN_ZEROCOPY_PACKETS пакетов за вызов sendmsg. Память
+// сообщения удерживается ссылкой, пока ядро не подтвердит передачу.
+static BOOL MsgConnSendZeroCopy(MsgConn* conn, const MsgBuffer* buf)
+{
+    MsgConnZeroCopy* zc = &conn->zc;
+    int sock = conn->uni.client.sockfd;
+    struct iovec iov[2 * MSG_CONN_ZEROCOPY_PACKETS];
+    struct msghdr mh;
+    MsgConnPinned* pin = NULL; // удерживаемое сообщение
+    uint32_t firstSeq = zc->nextSeq; // номер первого вызова sendmsg
+    size_t index = 0;       // номер первого фрагмента текущей порции
+    size_t count = 0;       // количество пакетов в текущей порции
+    size_t sentBytes = 0;   // сколько байт сообщения передано в сокет
+    BOOL status = TRUE;     // результат отправки сообщения
+
+    // Если подтверждений ждет слишком много сообщений, то ждем, пока
+    // ядро не освободит часть из них
+    for (int i = 0; i < 10 && zc->pinnedCount >= MSG_CONN_ZEROCOPY_PINNED;
+        i++)
+        MsgConnZeroCopyReap(conn, 100);
+
+    // Добавляем сообщение в очередь удерживаемых
+    if (zc->pinnedCount == zc->pinnedCapacity)
+    {
+        size_t capacity = zc->pinnedCapacity ? 2 * zc->pinnedCapacity :
+            MSG_CONN_ZEROCOPY_PINNED;
+        MsgConnPinned* pinned = (MsgConnPinned*) realloc(zc->pinned,
+            capacity * sizeof(MsgConnPinned));
+        if (!pinned)
+        {
+            printf("Unable to allocate zero-copy queue!\n");
+            conn->msgErrorCount++;
+            return FALSE;
+        }
+        zc->pinned = pinned;
+        zc->pinnedCapacity = capacity;
+    }
+    pin = zc->pinned + zc->pinnedCount;
+    pin->headers = (MsgPacketHeader*) malloc(
+        buf->chunksCount * sizeof(MsgPacketHeader));
+    if (!pin->headers || !MsgBufferRetain(buf, &pin->ref))
+    {
+        printf("Unable to pin message buffer!\n");
+        free(pin->headers);
+        conn->msgErrorCount++;
+        return FALSE;
+    }
+
+    for (index = 0; index < buf->chunksCount && status; index += count)
+    {
+        // Описываем пакеты порции парами фрагментов памяти
+        count = MsgConnPaceBatch(conn, sizeof(MsgPacketHeader) +
+            buf->chunkSizeMax, buf->chunksCount - index);
+        if (count > MSG_CONN_ZEROCOPY_PACKETS)
+            count = MSG_CONN_ZEROCOPY_PACKETS;
+        MsgConnPaceWait(conn, MsgConnBatchBytes(buf, index, count));
+        for (size_t i = 0; i < count; i++)
+        {
+            MsgPacketHeader* pkt = pin->headers + index + i;
+            MsgConnPacketHeaderInit(conn, pkt, buf, index + i);
+            iov[2 * i].iov_base = pkt;
+            iov[2 * i].iov_len = sizeof(MsgPacketHeader);
+            iov[2 * i + 1].iov_base = buf->data + (index + i) *
+                buf->chunkSizeMax;
+            iov[2 * i + 1].iov_len = pkt->chunkSize;
+        }
+        bzero(&mh, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = 2 * count;
+
+        // Передаем порцию (блокирующий сокет может принять ее частично
+        // только при прерывании сигналом - тогда продолжаем с места
+        // остановки)
+        while (mh.msg_iovlen > 0)
+        {
+            MSG_TRACE_BEGIN(MsgTraceChunkWrite, buf->msgIndex, index);
+            ssize_t cbret = sendmsg(sock, &mh, MSG_ZEROCOPY | MSG_NOSIGNAL);
+            if (cbret >= 0)
+                zc->nextSeq++;
+            else if (errno == ENOBUFS) // ядру не хватило памяти для учета
+                cbret = sendmsg(sock, &mh, MSG_NOSIGNAL); // страниц - копируем
+            MSG_TRACE_END(MsgTraceChunkWrite, buf->msgIndex, index);
+            if (cbret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                printf("ERROR writing to socket!\n");
+                status = FALSE;
+                break;
+            }
+            sentBytes += cbret;
+            while (mh.msg_iovlen > 0 && (size_t) cbret >= mh.msg_iov->iov_len)
+            {
+                cbret -= mh.msg_iov->iov_len;
+                mh.msg_iov++;
+                mh.msg_iovlen--;
+            }
+            if (cbret > 0)
+            {
+                mh.msg_iov->iov_base = (char*) mh.msg_iov->iov_base + cbret;
+                mh.msg_iov->iov_len -= cbret;
+            }
+        }
+        if (status)
+            MsgConnEchoSent(conn, pin->headers + index);
+    }
+
+    // Удерживаем сообщение, если ядро еще может читать его память
+    if (zc->nextSeq != firstSeq)
+    {
+        pin->lastSeq = zc->nextSeq - 1;
+        zc->pinnedCount++;
+    }
+    else
+        MsgConnPinnedRelease(pin);
+
+    if (status == FALSE)
+        conn->msgErrorCount++; // инкрементируем счетчик сбойных сообщений
+    else
+        MsgConnRateUpdate(conn, sentBytes, MsgConnNow());
+    return status;
+}
+
+
+// Функция описывает в mh непереданную часть пакета сообщения buf в
+// положении cursor: заголовок пакета cursor->pkt (заполняется в начале
+// пакета) и фрагмент прямо в буфере сообщения (без начальных
+// cursor->pktOffset байт). Возвращает полный размер пакета.
+static size_t MsgConnPacketIov(MsgConn* conn, const MsgBuffer* buf,
+    MsgConnCursor* cursor, struct iovec* iov, struct msghdr* mh)
+{
+    MsgPacketHeader* pkt = &cursor->pkt;
+    size_t skip = cursor->pktOffset;
+
+    if (skip == 0)
+        MsgConnPacketHeaderInit(conn, pkt, buf, cursor->chunkIndex);
+    iov[0].iov_base = pkt;
+    iov[0].iov_len = sizeof(MsgPacketHeader);
+    iov[1].iov_base = buf->data + cursor->chunkIndex * buf->chunkSizeMax;
+    iov[1].iov_len = pkt->chunkSize;
+    mh->msg_iov = iov;
+    mh->msg_iovlen = 2;
+    if (skip >= iov[0].iov_len)
+    {
+        skip -= iov[0].iov_len;
+        mh->msg_iov++;
+        mh->msg_iovlen--;
+    }
+    mh->msg_iov->iov_base = (char*) mh->msg_iov->iov_base + skip;
+    mh->msg_iov->iov_len -= skip;
+    return sizeof(MsgPacketHeader) + pkt->chunkSize;
+}
+
+
+// Функция отправляет сообщение по основному TCP соединению и полосам:
+// пакет с номером i передается по соединению i % n. Каждое соединение
+// получает столько пакетов своей доли, сколько принимает без блокировки,
+// а poll ждет, пока какое-нибудь из них освободится, так что соединения
+// передают сообщение одновременно и каждое со своим окном перегрузки.
+static BOOL MsgConnSendStriped(MsgConn* conn, const MsgBuffer* buf)
+{
+    size_t n = conn->stripes.count + 1; // количество соединений
+    int socks[MSG_CONN_STRIPES_MAX];    // сокеты соединений
+    MsgConnCursor cursors[MSG_CONN_STRIPES_MAX]; // положение отправки
+    struct pollfd pfd[MSG_CONN_STRIPES_MAX];
+    struct iovec iov[2];    // заголовок и фрагмент текущего пакета
+    struct msghdr mh;
+    size_t sentBytes = 0;   // сколько байт сообщения передано в сокеты
+    BOOL status = TRUE;     // результат отправки сообщения
+    nfds_t nfds = 0;        // количество соединений, ждущих места в сокете
+    double paceDelay = 0;   // сколько ждать ограничителя скорости, с
+
+    for (size_t s = 0; s < n; s++)
+    {
+        socks[s] = s ? conn->stripes.fds[s - 1] : conn->uni.client.sockfd;
+        assert(socks[s] >= 0);
+        cursors[s].chunkIndex = s;
+        cursors[s].pktOffset = 0;
+    }
+    bzero(&mh, sizeof(mh));
+
+    do
+    {
+        nfds = 0;
+        paceDelay = 0;
+        for (size_t s = 0; s < n && status; s++)
+        {
+            MsgConnCursor* cursor = &cursors[s];
+            BOOL paced = FALSE; // соединение ждет ограничителя скорости
+
+            // Передаем пакеты доли соединения, пока сокет их принимает
+            while (cursor->chunkIndex < buf->chunksCount)
+            {
+                size_t pktSize = MsgConnPacketIov(conn, buf, cursor, iov,
+                    &mh);
+                double delay = (cursor->pktOffset == 0) ?
+                    MsgConnPaceDelay(conn) : 0;
+                if (delay > 0)
+                {
+                    // Новый пакет начнем после ожидания
+                    if (delay > paceDelay)
+                        paceDelay = delay;
+                    paced = TRUE;
+                    break;
+                }
+                MSG_TRACE_BEGIN(MsgTraceChunkWrite, buf->msgIndex,
+                    cursor->chunkIndex);
+                ssize_t cbret = sendmsg(socks[s], &mh,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+                MSG_TRACE_END(MsgTraceChunkWrite, buf->msgIndex,
+                    cursor->chunkIndex);
+                if (cbret < 0 && (errno == EAGAIN ||
+                    errno == EWOULDBLOCK || errno == EINTR))
+                    break;  // сокет заполнен - продолжим позже
+                if (cbret < 0)
+                {
+                    printf("ERROR writing to socket!\n");
+                    status = FALSE;
+                    break;
+                }
+                if (cursor->pktOffset == 0)
+                {
+                    MsgConnPaceCharge(conn, pktSize);
+                    MsgConnEchoSent(conn, &cursor->pkt);
+                }
+                sentBytes += cbret;
+                cursor->pktOffset += cbret;
+                if (cursor->pktOffset == pktSize)
+                {
+                    cursor->chunkIndex += n;
+                    cursor->pktOffset = 0;
+                }
+            }
+            if (cursor->chunkIndex < buf->chunksCount && !paced)
+            {
+                pfd[nfds].fd = socks[s];
+                pfd[nfds].events = POLLOUT;
+                pfd[nfds].revents = 0;
+                nfds++;
+            }
+        }
+
+        // Ждем, пока освободится место в очереди какого-нибудь сокета
+        // (обрыв канала ядро обнаружит по TCP_USER_TIMEOUT) или пока
+        // ограничитель скорости не пропустит следующий пакет
+        if (status && (nfds > 0 || paceDelay > 0))
+        {
+            struct timespec ts;
+            double waitStart = MsgConnNow();
+            ts.tv_sec = (time_t) paceDelay;
+            ts.tv_nsec = (long) ((paceDelay - ts.tv_sec) * 1.0e9) + 1;
+            if (ppoll(pfd, nfds, (paceDelay > 0) ? &ts : NULL, NULL) < 0 &&
+                errno != EINTR)
+            {
+                printf("ERROR waiting for socket!\n");
+                status = FALSE;
+            }
+            if (paceDelay > 0)
+                conn->pacing.waitTime += MsgConnNow() - waitStart;
+        }
+    } while (status && (nfds > 0 || paceDelay > 0));
+
+    if (status == FALSE)
+        conn->msgErrorCount++; // инкрементируем счетчик сбойных сообщений
+    else
+        MsgConnRateUpdate(conn, sentBytes, MsgConnNow());
+    return status;
+}
+
+
+// Функция отправляет сообщение через сокет выбранным способом. Каждый
+// пакет передается одним вызовом sendmsg из двух фрагментов памяти
+// (заголовок пакета и фрагмент прямо в буфере сообщения), так что тело
+// сообщения не копируется в буфер пакета.
+static BOOL MsgConnSendMessage(MsgConn* conn, const MsgBuffer* buf)
+{
+    size_t index;           // номер текущего фрагмента сообщения
+    int cbret = 0;          // количество переданных байт пакета
+    MsgPacketHeader pkt;    // заголовок текущего пакета
+    size_t pktSize = 0;     // фактический размер пакета
+    size_t sentBytes = 0;   // сколько байт сообщения передано в сокет
+    BOOL status = FALSE;    // результат отправки сообщения
+    int sock = -1;          // сокет отправителя
+    struct iovec iov[2];    // заголовок и фрагмент текущего пакета
+    struct msghdr mh;
+    int flags = 0;          // флаги вызова sendmsg
+
+    // Отправляем сообщение через io_uring, если выбран этот способ
+    if (conn->uring)
+        return MsgConnSendUring(conn, buf);
+
+    // Снимаем ссылки на сообщения, уже переданные ядром без копирования
+    if (conn->zc.pinnedCount > 0)
+        MsgConnZeroCopyReap(conn, 0);
+
+    // Сообщение из нескольких пакетов распределяем по полосам TCP
+    if (conn->stripes.count > 0 && buf->chunksCount > 1)
+        return MsgConnSendStriped(conn, buf);
+
+    // Большие сообщения отправляем без копирования, если это разрешено
+    if (conn->zc.enabled && buf->size >= conn->config.zeroCopyMin &&
+        buf->refCount != NULL)
+        return MsgConnSendZeroCopy(conn, buf);
+
+    // Выбираем сокет и адрес получателя (для датаграмм)
+    sock = MsgConnSenderSocket(conn);
+    if (sock < 0)
+    {
+        printf("Wrong connection type!\n");
+        assert(TRUE == FALSE);
+        return FALSE;
+    }
+    bzero(&mh, sizeof(mh));
+    mh.msg_name = MsgConnSenderAddr(conn, buf, &mh.msg_namelen);
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    // (MSG_NOSIGNAL: обрыв TCP соединения - ошибка, а не SIGPIPE)
+    if (conn->config.connRole == MsgConnRoleTcpSender)
+        flags = MSG_NOSIGNAL;
+
     status = TRUE;
     for (index = 0; index < buf->chunksCount && status; index++) 
     {  /* по фрагментам */
         // Инициализируем заголовок пакета
-        MsgPacketHeaderInit(&pkt, buf, index);
-        
-        // Записываем заголовок и тело пакета в буфер пакета
-        memcpy(conn->pktBuf, &pkt, sizeof(MsgPacketHeader));
-        memcpy(conn->pktBody, pchunk, pkt.chunkSize);
-        pchunk += pkt.chunkSize;
+        MsgConnPacketHeaderInit(conn, &pkt, buf, index);
+
+        // Описываем заголовок и тело пакета
+        iov[0].iov_base = &pkt;
+        iov[0].iov_len = sizeof(MsgPacketHeader);
+        iov[1].iov_base = buf->data + index * buf->chunkSizeMax;
+        iov[1].iov_len = pkt.chunkSize;
             
         // Вычисляем фактический размер пакета
         pktSize = pkt.chunkSize + sizeof(MsgPacketHeader);
+        MsgConnPaceWait(conn, pktSize);
 
         // Выполняем отправку пакета
-        switch (conn->config.connRole)
-        {
-        case MsgConnRoleTcpSender: // используем TCP сокет
-            cbret = write(conn->uni.client.sockfd, conn->pktBuf, pktSize);
-            break;
-        case MsgConnRoleLocalSender: // используем локальный сокет
-            cbret = sendto(conn->uni.clientLoc.sockfd, 
-                conn->pktBuf, 
-                pktSize, 
-                0,
-                (struct sockaddr *) &conn->uni.clientLoc.serv_name, 
-                conn->uni.clientLoc.serv_name_size);
-            break;
-        default:
-            printf("Wrong connection type!\n");
-            cbret = -1;
-            assert(TRUE == FALSE);
-            break;
-        }
+        MSG_TRACE_BEGIN(MsgTraceChunkWrite, buf->msgIndex, index);
+        cbret = sendmsg(sock, &mh, flags);
+        MSG_TRACE_END(MsgTraceChunkWrite, buf->msgIndex, index);
 
         // Анализируем результаты отправки пакета
         if (cbret < 0) 
@@ -325,95 +1992,686 @@ BOOL MsgConnSend(MsgConn* conn, const MsgBuffer* buf)
             printf("Packet fragmentation detected!\n");
             status = FALSE;
         }
+        else
+        {
+            sentBytes += pktSize;
+            MsgConnEchoSent(conn, &pkt);
+        }
     }
 
     if (status == FALSE)
         conn->msgErrorCount++; // инкрементируем счетчик сбойных сообщений
+    else
+        MsgConnRateUpdate(conn, sentBytes, MsgConnNow());
     return status;
 }
 
 
-// Функция получает сообщение через TCP-сокет
-BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
+// Функция назначает следующую попытку подключения TCP отправителя через
+// паузу, которая удваивается после каждой неудачной попытки.
+static void MsgConnRetryLater(MsgConn* conn)
 {
-    int cbret = 0;          // количество принятых байт пакета
-    MsgPacketHeader* pkt;   // заголовок текущего пакета
-    size_t pktSize = 0;     // фактический размер пакета
-    BOOL status = FALSE;    // результат приема пакета
-    MsgBuffer* buf = NULL;  // буфер текущего сообщения в списке
-    BOOL msgIsReady = FALSE;// собрано полное сообщение
-    MsgHeader* msg = NULL;
-    size_t msg_size = 0;    // ожидаемый размер буфера сообщения
+    MsgConnLink* link = &conn->link;
 
-    // Проверяем контрольный код структуры буфера сообщения
-    assert(pbuf != NULL);
-    assert(conn->pktBuf != NULL && conn->pktBody != NULL);
+    if (conn->uni.client.sockfd >= 0)
+        close(conn->uni.client.sockfd);
+    conn->uni.client.sockfd = -1;
+    MsgConnStripesClose(conn);
+    link->backoff = (link->backoff > 0) ? 2 * link->backoff :
+        MSG_CONN_RETRY_MIN;
+    if (link->backoff > MSG_CONN_RETRY_MAX)
+        link->backoff = MSG_CONN_RETRY_MAX;
+    link->state = MsgConnStateDisconnected;
+    link->retryTime = MsgConnNow() + link->backoff;
+}
 
-    // Обнуляем буфер пакета
-    bzero(conn->pktBuf, conn->config.mtu);
 
-    // Проверяем готовность новых данных в сокете
-    static struct timeval timelast;
-    struct timeval timecurr;
-    struct timeval timeout;
-    timeout.tv_sec = 2; // время ожидания в секундах
-    timeout.tv_usec = 0; // время ожидания в сек
+// Функция обрабатывает обрыв соединения TCP отправителя: закрывает сокет
+// и назначает немедленную попытку переподключения.
+static void MsgConnSenderLost(MsgConn* conn)
+{
+    printf("Connection lost - reconnecting in background!\n");
+
+    // Уведомления о сообщениях, отправленных без копирования, приходят
+    // через закрываемый сокет, поэтому ссылки на них снимаем сразу (ядро
+    // само удерживает страницы, пока они ему нужны)
+    MsgConnZeroCopyFlush(conn, 0);
+    close(conn->uni.client.sockfd);
+    conn->uni.client.sockfd = -1;
+    MsgConnStripesClose(conn);
+    bzero(&conn->rate, sizeof(MsgConnRate));
+
+    // Сообщения недоотправленной пачки хранятся для повторной отправки
+    // вместе с остальными, поэтому саму пачку сбрасываем
+    if (conn->config.coalesceSize > 0)
+        MsgBatchInit((MsgPacketHeader*) conn->pktBuf,
+            conn->config.mtu - sizeof(MsgPacketHeader));
+    conn->link.state = MsgConnStateDisconnected;
+    conn->link.backoff = 0;
+    conn->link.retryTime = MsgConnNow();
+}
+
+
+// Функция запоминает ссылку на отправленное сообщение в кольце сообщений
+// для повторной отправки (самое старое сообщение вытесняется).
+static void MsgConnRemember(MsgConn* conn, const MsgBuffer* buf)
+{
+    MsgConnLink* link = &conn->link;
+    size_t depth = conn->config.resendDepth;
+
+    if (!link->history)
+        return;
+    if (link->historyCount == depth)
+    {
+        MsgBufferFree(&link->history[link->historyHead]);
+        link->historyHead = (link->historyHead + 1) % depth;
+        link->historyCount--;
+    }
+    if (MsgBufferRetain(buf,
+        &link->history[(link->historyHead + link->historyCount) % depth]))
+        link->historyCount++;
+}
+
+
+// Функция повторно отправляет хранимые сообщения, которые получатель
+// еще не собрал (по сведениям о возобновлении сессии).
+static void MsgConnResend(MsgConn* conn, const MsgResume* resume)
+{
+    MsgConnLink* link = &conn->link;
+
+    for (size_t i = 0; i < link->historyCount; i++)
+    {
+        const MsgBuffer* buf = &link->history[(link->historyHead + i) %
+            conn->config.resendDepth];
+        if (resume->delivered && buf->msgIndex <= resume->lastIndex)
+            continue;  // это сообщение получатель уже собрал
+        if (!MsgConnSendMessage(conn, buf))
+        {
+            MsgConnSenderLost(conn);
+            return;
+        }
+        link->resentCount++;
+    }
+}
+
+
+// Функция делает очередной шаг восстановления соединения TCP отправителя
+// без блокировки и возвращает TRUE, если соединение установлено:
+// дожидается момента следующей попытки, начинает неблокирующий connect,
+// проверяет его завершение, читает сведения о возобновлении сессии,
+// так же без блокировки подключает полосы и повторяет сообщения, которые
+// получатель не собрал.
+static BOOL MsgConnSenderLinkUp(MsgConn* conn)
+{
+    MsgConnLink* link = &conn->link;
+    double now = MsgConnNow();
     int sock = -1;
-    fd_set socks;
-    FD_ZERO(&socks);
-    if (conn->config.connRole == MsgConnRoleTcpReceiver)
-        sock = conn->uni.server.newsockfd;
+
+    if (link->state == MsgConnStateConnected)
+        return TRUE;
+
+    // Начинаем подключение, когда наступит момент следующей попытки
+    if (link->state == MsgConnStateDisconnected)
+    {
+        if (now < link->retryTime)
+            return FALSE;
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        conn->uni.client.sockfd = sock;
+        if (sock < 0)
+        {
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        if (connect(sock, (struct sockaddr *) &conn->uni.client.serv_addr,
+            sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS)
+        {
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        link->state = MsgConnStateConnecting;
+        link->stateTime = now;
+    }
+    sock = conn->uni.client.sockfd;
+
+    // Проверяем, завершилось ли подключение
+    if (link->state == MsgConnStateConnecting)
+    {
+        struct pollfd pfd;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0)
+        {
+            if (now - link->stateTime > MSG_CONN_CONNECT_TIMEOUT)
+                MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+        {
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        link->state = MsgConnStateResuming;
+        link->stateTime = now;
+    }
+
+    // Читаем сведения о возобновлении сессии (получатель присылает их
+    // сразу после подключения)
+    if (link->state == MsgConnStateResuming)
+    {
+        MsgResume resume;
+        bzero(&resume, sizeof(resume));
+        ssize_t cbret = recv(sock, &resume, sizeof(resume),
+            MSG_DONTWAIT | MSG_PEEK);
+        if (cbret == sizeof(resume))
+            cbret = recv(sock, &resume, sizeof(resume), MSG_DONTWAIT);
+        else if (cbret == 0 || (cbret < 0 && errno != EAGAIN))
+        {
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        else if (now - link->stateTime < MSG_CONN_RESUME_TIMEOUT)
+            return FALSE;  // ждем сведений дальше
+        else if (cbret > 0)
+        {
+            // Сведения пришли не целиком: их остаток придет позже и
+            // рассогласует обратный поток, поэтому подключаемся заново
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        if (resume.magicNumber != MSG_RESUME_MAGIC)
+            printf("No session resume info - lost messages are not "
+                "resent!\n");
+        link->resume = resume;
+
+        // Основное соединение готово: возвращаем сокету блокирующий
+        // режим и начинаем подключать полосы
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+        MsgConnSetupSenderSocket(conn, &conn->config);
+        if (conn->stripes.count > 0 && !MsgConnStripesConnect(conn))
+        {
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        link->state = MsgConnStateStriping;
+        link->stateTime = now;
+    }
+
+    // Проверяем, подключились ли полосы (без полос проверять нечего)
+    if (conn->stripes.count > 0)
+    {
+        int ready = MsgConnStripesReady(conn, &conn->config, 0);
+        if (ready < 0 || (ready == 0 &&
+            now - link->stateTime > MSG_CONN_CONNECT_TIMEOUT))
+        {
+            MsgConnRetryLater(conn);
+            return FALSE;
+        }
+        if (ready == 0)
+            return FALSE;
+    }
+
+    // Соединение восстановлено: повторяем сообщения, которые получатель
+    // не собрал
+    link->state = MsgConnStateConnected;
+    link->backoff = 0;
+    link->reconnectCount++;
+    printf("Connection restored!\n");
+    if (link->resume.magicNumber == MSG_RESUME_MAGIC)
+        MsgConnResend(conn, &link->resume);
+    return link->state == MsgConnStateConnected;
+}
+
+
+// Функция сообщает, истек ли срок ожидания первого сообщения пачки.
+static BOOL MsgConnBatchDue(const MsgConn* conn)
+{
+    const MsgPacketHeader* pkt = (const MsgPacketHeader*) conn->pktBuf;
+
+    return pkt->msgChunksCount > 0 && conn->config.coalesceDelay > 0 &&
+        MsgConnNow() - conn->batch.firstTime >= conn->config.coalesceDelay;
+}
+
+
+// Функция отправляет накопленную пачку одним пакетом полного размера
+// (поток TCP разбирается на пакеты по mtu байт) и начинает новую пачку.
+static BOOL MsgConnBatchSend(MsgConn* conn)
+{
+    MsgPacketHeader* pkt = (MsgPacketHeader*) conn->pktBuf;
+    size_t pktSize = conn->config.mtu;
+    size_t count = pkt->msgChunksCount;
+    int sock = MsgConnSenderSocket(conn);
+    ssize_t cbret = 0;      // количество переданных байт пачки
+    BOOL status = TRUE;     // результат отправки пачки
+    struct iovec iov;
+    struct msghdr mh;
+
+    if (count == 0)
+        return TRUE;
+    bzero(&mh, sizeof(mh));
+    mh.msg_name = MsgConnSenderAddr(conn, NULL, &mh.msg_namelen);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    iov.iov_base = conn->pktBuf;
+    iov.iov_len = pktSize;
+
+    // Свободную часть тела обнуляем, чтобы не передавать остатки
+    // предыдущих пачек
+    bzero(conn->pktBody + pkt->msgSize, pkt->chunkSize - pkt->msgSize);
+    MsgConnPaceWait(conn, pktSize);
+    MsgConnPacketStamp(conn, pkt);
+    MSG_TRACE_BEGIN(MsgTraceChunkWrite, pkt->msgIndex, 0);
+    cbret = sendmsg(sock, &mh,
+        (conn->config.connRole == MsgConnRoleTcpSender) ? MSG_NOSIGNAL : 0);
+    MSG_TRACE_END(MsgTraceChunkWrite, pkt->msgIndex, 0);
+    if (cbret < 0)
+    {
+        printf("ERROR writing to socket!\n");
+        status = FALSE;
+    }
+    else if (cbret != pktSize)
+    {
+        printf("Packet fragmentation detected!\n");
+        status = FALSE;
+    }
+
+    if (status == FALSE)
+        conn->msgErrorCount += count;
     else
-        sock = conn->uni.serverLoc.sockfd;
-    FD_SET(sock, &socks);
-    if (select(sock + 1, &socks, NULL, NULL, &timeout) > 0)
     {
-        // Принимаем один пакет из сокета
-        switch (conn->config.connRole)
+        MsgConnEchoSent(conn, pkt);
+        conn->batch.packetCount++;
+        conn->batch.msgCount += count;
+        MsgConnRateUpdate(conn, pktSize, MsgConnNow());
+    }
+    MsgBatchInit(pkt, conn->config.mtu - sizeof(MsgPacketHeader));
+    return status;
+}
+
+
+// Функция дописывает сообщение в пачку и отправляет пачку, когда в ней
+// набралось config.coalesceSize байт или истек срок ее первого сообщения.
+// Сообщение, которое не помещается и в пустую пачку, отправляется
+// отдельно, но после накопленных, чтобы не нарушить порядок сообщений.
+static BOOL MsgConnCoalesce(MsgConn* conn, const MsgBuffer* buf)
+{
+    MsgPacketHeader* pkt = (MsgPacketHeader*) conn->pktBuf;
+
+    if (!MsgBatchAdd(pkt, conn->pktBody, buf))
+    {
+        if (!MsgConnBatchSend(conn))
+            return FALSE;
+        if (!MsgBatchAdd(pkt, conn->pktBody, buf))
+            return MsgConnSendMessage(conn, buf);
+    }
+    if (pkt->msgChunksCount == 1)
+        conn->batch.firstTime = MsgConnNow();
+    if (pkt->msgSize >= conn->config.coalesceSize || MsgConnBatchDue(conn))
+        return MsgConnBatchSend(conn);
+    return TRUE;
+}
+
+
+// Функция отправляет накопленную пачку небольших сообщений.
+BOOL MsgConnFlush(MsgConn* conn, BOOL force)
+{
+    const MsgPacketHeader* pkt = (const MsgPacketHeader*) conn->pktBuf;
+
+    if (conn->config.coalesceSize == 0 || pkt->msgChunksCount == 0)
+        return TRUE;
+    if (!force && !MsgConnBatchDue(conn))
+        return TRUE;
+    if (conn->config.connRole != MsgConnRoleTcpSender)
+        return MsgConnBatchSend(conn);
+
+    // По TCP пачка уходит только через установленное соединение (при
+    // обрыве она сбрасывается, а ее сообщения отправляются повторно)
+    if (conn->link.state != MsgConnStateConnected)
+        return FALSE;
+    if (MsgConnBatchSend(conn))
+        return TRUE;
+    MsgConnSenderLost(conn);
+    return FALSE;
+}
+
+
+// Функция отправляет сообщение через TCP-сокет
+BOOL MsgConnSend(MsgConn* conn, const MsgBuffer* buf)
+{
+    BOOL status = FALSE;    // результат отправки сообщения
+
+    // Проверяем контрольный код структуры буфера сообщения
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    assert(conn->pktBuf != NULL && conn->pktBody != NULL);
+
+    // Читаем кредиты и запросы синхронизации часов от получателя
+    MsgConnFeedbackPoll(conn);
+
+    if (conn->config.connRole != MsgConnRoleTcpSender)
+    {
+        // Локальный отправитель без кредита отбрасывает сообщение целиком
+        if (!MsgConnCreditAvailable(conn))
         {
-        case MsgConnRoleTcpReceiver: // используем TCP сокет
-            //cbret = read(conn->uni.server.newsockfd,
-            //    conn->pktBuf,
-            //    conn->config.mtu);
-            cbret = recv(sock,
-    	        conn->pktBuf,
-		        conn->config.mtu, 
-    	        MSG_WAITALL);
-            //printf("cbret = %d\n", cbret);
-            gettimeofday(&timecurr, NULL);
-            if (cbret > 0)
-            {
-                timelast = timecurr;
-            }
-            else if (timecurr.tv_sec - timelast.tv_sec > timeout.tv_sec)
-            {
-                printf("Timeout for data expired - resetting connection!\n");
-                MsgConnConfig cfg = conn->config;
-                MsgConnFree(conn);
-                MsgConnInit(conn, &cfg);
-            }
-            break;
-        case MsgConnRoleLocalReceiver: // используем локальный сокет
-            cbret = recvfrom(sock, 
-                conn->pktBuf, 
-                conn->config.mtu, 
-                0,
-                (struct sockaddr *) &conn->uni.serverLoc.client_name, 
-                &conn->uni.serverLoc.client_name_size);
+            conn->credit.dropCount++;
+            return FALSE;
+        }
+        MSG_TRACE_BEGIN(MsgTracePacketize, buf->msgIndex, buf->chunksCount);
+        if (conn->config.coalesceSize > 0)
+            status = MsgConnCoalesce(conn, buf);
+        else
+            status = MsgConnSendMessage(conn, buf);
+        MSG_TRACE_END(MsgTracePacketize, buf->msgIndex, status);
+        if (status)
+            MsgConnCreditSent(conn);
+        // Пачку, сообщение которой заняло последний кредит, отправляем
+        // сразу: получатель вернет кредит только после ее приема
+        if (status && !MsgConnCreditAvailable(conn))
+            status = MsgConnFlush(conn, TRUE);
+        return status;
+    }
+
+    // Отправляем сообщение по TCP, если соединение установлено (после
+    // сбоя отправки поток пакетов рассогласован, и соединение нужно
+    // установить заново)
+    if (MsgConnSenderLinkUp(conn))
+    {
+        MSG_TRACE_BEGIN(MsgTracePacketize, buf->msgIndex, buf->chunksCount);
+        if (conn->config.coalesceSize > 0)
+            status = MsgConnCoalesce(conn, buf);
+        else
+            status = MsgConnSendMessage(conn, buf);
+        MSG_TRACE_END(MsgTracePacketize, buf->msgIndex, status);
+        if (!status)
+            MsgConnSenderLost(conn);
+    }
+    else
+        conn->msgErrorCount++;
+
+    // Запоминаем сообщение для повторной отправки после обрыва
+    MsgConnRemember(conn, buf);
+    return status;
+}
+
+
+// Функция обрабатывает обрыв соединения TCP получателя: закрывает сокет
+// клиента, но сохраняет частично собранные сообщения, так как после
+// переподключения отправитель повторит недостающие пакеты.
+static void MsgConnReceiverLost(MsgConn* conn)
+{
+    printf("Connection lost - waiting for sender to reconnect!\n");
+    if (conn->uni.server.newsockfd >= 0)
+        close(conn->uni.server.newsockfd);
+    conn->uni.server.newsockfd = -1;
+    conn->pktFill = 0;  // начало пакета пришло по прежнему соединению
+    MsgConnStripesClose(conn); // полосы отправитель подключит заново
+    conn->link.state = MsgConnStateDisconnected;
+    conn->link.stateTime = MsgConnNow();
+    MsgConnRestartUring(conn);
+}
+
+
+// Функция принимает подключение полосы отправителя, если оно ожидает в
+// очереди слушающего сокета полос, и занимает им свободное место полосы.
+// Отправитель подключает полосы только после того, как получатель принял
+// основное соединение (и закрыл прежние полосы), поэтому свободное место
+// есть всегда, кроме подключения посторонней программы.
+static BOOL MsgConnAcceptStripe(MsgConn* conn)
+{
+    int sock = accept(conn->uni.server.stripesockfd, NULL, NULL);
+    size_t i = 0;
+
+    if (sock < 0)
+        return FALSE;  // подключений нет
+    for (i = 0; i < conn->stripes.count && conn->stripes.fds[i] >= 0; i++)
+        ;
+    if (i == conn->stripes.count)
+    {
+        printf("Unexpected TCP stream connection - dropped!\n");
+        close(sock);
+        return FALSE;
+    }
+    conn->stripes.fds[i] = sock;
+    conn->stripes.fills[i] = 0;
+    return TRUE;
+}
+
+
+// Функция принимает основное подключение отправителя, если оно ожидает в
+// очереди слушающего сокета, и отправляет ему сведения о возобновлении
+// сессии. Если основное соединение уже занято, то прежнее соединение и
+// его полосы закрываются: раз отправитель подключился заново, то он уже
+// заметил обрыв, которого получатель мог не заметить.
+static BOOL MsgConnAccept(MsgConn* conn)
+{
+    socklen_t clilen = sizeof(struct sockaddr_in);
+    int sock = accept(conn->uni.server.sockfd,
+        (struct sockaddr *) &conn->uni.server.cli_addr, &clilen);
+
+    if (sock < 0)
+        return FALSE;  // подключений нет
+    if (conn->uni.server.newsockfd >= 0)
+    {
+        printf("Sender reconnected - dropping old connection!\n");
+        close(conn->uni.server.newsockfd);
+    }
+    MsgConnStripesClose(conn);
+    conn->uni.server.newsockfd = sock;
+    conn->pktFill = 0;
+    conn->link.resume.magicNumber = MSG_RESUME_MAGIC;
+    if (send(sock, &conn->link.resume, sizeof(MsgResume), MSG_NOSIGNAL) !=
+        sizeof(MsgResume))
+        printf("Unable to send session resume info!\n");
+    if (conn->link.state == MsgConnStateDisconnected &&
+        conn->link.stateTime > 0)
+        conn->link.reconnectCount++;
+    conn->link.state = MsgConnStateConnected;
+    conn->link.stateTime = MsgConnNow();
+    MsgConnRestartUring(conn);
+    printf("Sender connected!\n");
+    return TRUE;
+}
+
+
+// Функция отправляет пакеты сообщения, пока сокет принимает их без
+// блокировки.
+int MsgConnSendNonBlocking(MsgConn* conn, const MsgBuffer* buf,
+    MsgConnCursor* cursor)
+{
+    BOOL stream = (conn->config.connRole == MsgConnRoleTcpSender);
+    int sock = -1;
+    struct iovec iov[2];    // заголовок и фрагмент текущего пакета
+    struct msghdr mh;
+    size_t sentBytes = 0;   // сколько байт сообщения передано в сокет
+    int result = 0;         // результат отправки
+
+    // Проверяем контрольный код структуры буфера сообщения
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    // Не отправляем, пока TCP соединение восстанавливается
+    if (stream && !MsgConnSenderLinkUp(conn))
+        return 0;
+    // Новое сообщение локальный отправитель начинает только по кредиту
+    if (cursor->chunkIndex == 0 && cursor->pktOffset == 0)
+    {
+        MsgConnFeedbackPoll(conn);
+        if (!MsgConnCreditAvailable(conn))
+            return 0;
+    }
+    sock = MsgConnSenderSocket(conn);
+    bzero(&mh, sizeof(mh));
+    mh.msg_name = MsgConnSenderAddr(conn, buf, &mh.msg_namelen);
+
+    while (cursor->chunkIndex < buf->chunksCount)
+    {
+        // Описываем непереданную часть текущего пакета
+        size_t pktSize = MsgConnPacketIov(conn, buf, cursor, iov, &mh);
+
+        // Новый пакет начинаем, только если его пропускает ограничитель
+        if (cursor->pktOffset == 0 && MsgConnPaceDelay(conn) > 0)
             break;
-        default:
-            printf("Wrong connection type!\n");
-            cbret = -1;
-            assert(TRUE == FALSE);
+
+        // Передаем пакет без блокировки
+        MSG_TRACE_BEGIN(MsgTraceChunkWrite, buf->msgIndex,
+            cursor->chunkIndex);
+        ssize_t cbret = sendmsg(sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        MSG_TRACE_END(MsgTraceChunkWrite, buf->msgIndex, cursor->chunkIndex);
+        if (cbret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+            errno == EINTR))
+            break;  // сокет заполнен - продолжим позже
+        if (cbret < 0 || (!stream && (size_t) cbret != pktSize))
+        {
+            printf(cbret < 0 ? "ERROR writing to socket!\n" :
+                "Packet fragmentation detected!\n");
+            conn->msgErrorCount++;
+            cursor->chunkIndex = 0;
+            cursor->pktOffset = 0;
+            if (stream)
+                MsgConnSenderLost(conn);
+            result = -1;
             break;
         }
+        if (cursor->pktOffset == 0)
+        {
+            MsgConnPaceCharge(conn, pktSize);
+            MsgConnEchoSent(conn, &cursor->pkt);
+        }
+        sentBytes += cbret;
+        cursor->pktOffset += cbret;
+        if (cursor->pktOffset == pktSize)
+        {
+            cursor->chunkIndex++;
+            cursor->pktOffset = 0;
+        }
     }
-    else
+
+    if (result == 0 && cursor->chunkIndex == buf->chunksCount)
     {
-        //printf("No data arrived!\n");
-        cbret = 0;
+        MsgConnCreditSent(conn);
+        result = 1;
+    }
+    if (sentBytes > 0)
+        MsgConnRateUpdate(conn, sentBytes, MsgConnNow());
+    return result;
+}
+
+
+// Функция учитывает ответ на запрос синхронизации часов из заголовка
+// принятого пакета. Отправитель повторяет ответ, пока пакет с ним не
+// записан в сокет, поэтому учитывается только первый пакет с каждым
+// ответом. Момент приема t4 берется по часам при разборе пакета, а не
+// по метке ядра, как t2 у отправителя: задержка разбора d увеличивает
+// время оборота замера на d и сдвигает смещение на -d/2. Оценка выбирает
+// замер с наименьшим временем оборота, то есть и с наименьшей d.
+static void MsgConnClockSample(MsgConn* conn, const MsgPacketHeader* pkt)
+{
+    MsgConnClock* clk = &conn->clock;
+
+    if (pkt->echoTimeNs != 0 && pkt->echoTimeNs != clk->sampledEchoNs)
+    {
+        clk->sampledEchoNs = pkt->echoTimeNs;
+        MsgClockSyncAdd(&clk->sync, pkt->echoTimeNs,
+            pkt->sendTimeNs - pkt->echoHoldNs, pkt->sendTimeNs,
+            MsgClockNs(conn->config.clock));
+    }
+}
+
+
+// Функция учитывает выдачу собранного сообщения buf приложению:
+// запоминает его номер для возобновления сессии и возвращает отправителю
+// кредит на следующие сообщения.
+static void MsgConnDelivered(MsgConn* conn, const MsgBuffer* buf)
+{
+    MSG_TRACE_BEGIN(MsgTraceDelivered, buf->msgIndex, 0);
+    if (!conn->link.resume.delivered ||
+        buf->msgIndex > conn->link.resume.lastIndex)
+        conn->link.resume.lastIndex = buf->msgIndex;
+    conn->link.resume.delivered = 1;
+    MsgConnCreditGrant(conn);
+}
+
+
+// Функция выдает приложению очередное сообщение принятой пачки: переносит
+// его узел в список буферов и записывает в *pbuf указатель на буфер.
+// Возвращает FALSE, если невыданных сообщений пачки нет.
+static BOOL MsgConnBatchNext(MsgConn* conn, MsgBuffer** pbuf)
+{
+    MsgList* node = conn->batch.pending;
+
+    if (!node)
+        return FALSE;
+    conn->batch.pending = node->next;
+
+    // Проверяем условие превышения порога буферов
+    if (MsgListGetLength(conn->list) > conn->config.maxListLength)
+    {
+        printf("Message bufer list overrun!\n");
+        MsgListClear(&conn->list);
+    }
+    node->next = conn->list;
+    conn->list = node;
+    *pbuf = &node->buf;
+    MsgConnDelivered(conn, &node->buf);
+    return TRUE;
+}
+
+
+// Функция обрабатывает пачку небольших сообщений размером cbret байт,
+// принятую в память по адресу data: раскладывает ее на сообщения и выдает
+// первое из них, а остальные выдают следующие вызовы функций приема.
+static BOOL MsgConnProcessBatch(MsgConn* conn, const unsigned char* data,
+    int cbret, MsgBuffer** pbuf)
+{
+    const MsgPacketHeader* pkt = (const MsgPacketHeader*) data;
+    uint64_t now = MsgClockNs(conn->config.clock);
+    MsgList* nodes = NULL;  // сообщения пачки
+    MsgList** tail = &conn->batch.pending;
+
+    if (cbret != pkt->chunkSize + sizeof(MsgPacketHeader) ||
+        !(nodes = MsgBatchSplit(pkt, data + sizeof(MsgPacketHeader))))
+    {
+        printf("Corrupted message batch received!\n");
+        conn->msgErrorCount++;
+        return FALSE;
+    }
+    MsgConnClockSample(conn, pkt);
+    for (MsgList* node = nodes; node; node = node->next)
+    {
+        node->buf.recvTimeNs = now;
+        MSG_TRACE_MARK(MsgTraceChunkLast, node->buf.msgIndex, 0);
     }
 
+    // Сообщения пачки выдаются по порядку после уже принятых
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = nodes;
+    MsgConnClockPing(conn);
+    return MsgConnBatchNext(conn, pbuf);
+}
+
+
+// Функция обрабатывает пакет размером cbret байт, принятый в память по
+// адресу data: записывает фрагмент в буфер сообщения и проверяет, собрано
+// ли полное сообщение. Значение cbret = 0 означает, что пакета нет, а
+// значение cbret < 0 - что при приеме произошла ошибка.
+static BOOL MsgConnProcessPacket(MsgConn* conn, const unsigned char* data,
+    int cbret, MsgBuffer** pbuf)
+{
+    const MsgPacketHeader* pkt; // заголовок текущего пакета
+    BOOL status = FALSE;    // результат приема пакета
+    MsgBuffer* buf = NULL;  // буфер текущего сообщения в списке
+    BOOL msgIsReady = FALSE;// собрано полное сообщение
+    MsgHeader* msg = NULL;
+    size_t msg_size = 0;    // ожидаемый размер буфера сообщения
+    size_t expired = 0;     // количество отброшенных несобранных сообщений
+
+    // Пачку небольших сообщений раскладываем на отдельные сообщения
+    if (cbret >= (int) sizeof(MsgPacketHeader) &&
+        ((const MsgPacketHeader*) data)->magicNumber == MSG_BATCH_MAGIC)
+        return MsgConnProcessBatch(conn, data, cbret, pbuf);
+
     // Анализируем результаты приема пакета
     status = TRUE;
     if (cbret < 0) 
@@ -434,7 +2692,7 @@ BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
     else
     {
         // Проверяем корректность заголовка пакета
-        pkt = (MsgPacketHeader*) conn->pktBuf;
+        pkt = (const MsgPacketHeader*) data;
         if (pkt->magicNumber != MSG_PACKET_MAGIC)
         {
             printf("Corrupted packet received!\n");
@@ -452,6 +2710,18 @@ BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
             if (!buf)
             {
                 // Буфер не найден - нужно создавать новый буфер
+                // Отбрасываем сообщения, недостающие пакеты которых не
+                // пришли вовремя (например, потерялись датаграммы UDP)
+                if (conn->config.reassemblyTimeout > 0)
+                    expired = MsgListExpire(&conn->list,
+                        conn->config.reassemblyTimeout);
+                if (expired > 0)
+                {
+                    printf("%d incomplete message(s) expired!\n",
+                        (int) expired);
+                    conn->msgErrorCount += expired;
+                }
+
                 // Проверяем условие превышения порога буферов
                 if (MsgListGetLength(conn->list) > conn->config.maxListLength)
                 {
@@ -471,14 +2741,21 @@ BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
                 {
                     // Инициализируем созданный буфер по заголовку пакета
                     status = MsgBufferInitFromPkt(buf, pkt);
+                    MSG_TRACE_MARK(MsgTraceChunkFirst, pkt->msgIndex,
+                        pkt->chunkIndex);
+                    MSG_TRACE_BEGIN(MsgTraceReassembly, pkt->msgIndex,
+                        pkt->msgChunksCount);
                 }
             }
 
             if (status == TRUE)
             {
                 // Буфер готов - записываем пакет в буфер
-                MsgBufferPutPacket(buf, pkt, conn->pktBody);
+                MsgBufferPutPacket(buf, pkt,
+                    data + sizeof(MsgPacketHeader));
 
+                // Учитываем ответ на запрос синхронизации часов
+                MsgConnClockSample(conn, pkt);
             }
         }
     }
@@ -490,6 +2767,10 @@ BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
         // Проверяем, собрано ли полное сообщение
         if (MsgBufferIsFull(buf))
         {
+            MSG_TRACE_MARK(MsgTraceChunkLast, buf->msgIndex,
+                ((const MsgPacketHeader*) data)->chunkIndex);
+            MSG_TRACE_END(MsgTraceReassembly, buf->msgIndex, buf->size);
+
             // Проверяем контрольный код и размер сообщения
             msg = (MsgHeader*) buf->data;
             msg_size = MsgCalcSize(msg);
@@ -499,6 +2780,8 @@ BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
                 // Сообщение корректно!
                 msgIsReady = TRUE;
                 *pbuf = buf;  // возвращаем указатель на буфер сообщения
+                buf->recvTimeNs = MsgClockNs(conn->config.clock);
+                MsgConnDelivered(conn, buf);
             }
             else
             {
@@ -511,12 +2794,501 @@ BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
     // В случае проблем инкрементируем счетчик ошибок
     if (status == FALSE)
         conn->msgErrorCount++;
+    else if (cbret > 0)
+        MsgConnClockPing(conn);
 
     // Возвращаем признак готовности сообщения
     return msgIsReady;
 }
 
 
+// Функция принимает очередной пакет через io_uring, ожидая его не дольше
+// timeoutSec секунд (значение < 0 - без ограничения), и записывает в
+// *pdata адрес пакета. Прием выполняется одним запросом многократного
+// приема (multishot recv) в кольцо предоставленных ядру буферов, поэтому
+// системный вызов нужен только тогда, когда готовых пакетов нет.
+// Датаграмма занимает один буфер целиком, а поток TCP разбирается на
+// пакеты по mtu байт, причем пакет, целиком лежащий в буфере, не
+// копируется. Возвращает размер пакета, 0 (истекло время ожидания,
+// вызвана MsgConnWakeup или соединение сброшено) или -1 при ошибке.
+static int MsgConnUringNextPacket(MsgConn* conn, double timeoutSec,
+    const unsigned char** pdata)
+{
+    MsgUring* ring = NULL;
+    BOOL stream = (conn->config.connRole == MsgConnRoleTcpReceiver);
+    int sock = -1;
+    size_t mtu = conn->config.mtu;
+    double deadline = MsgConnNow() + timeoutSec;
+
+    for (;;)
+    {
+        // Очередь и сокет меняются при смене TCP соединения
+        ring = conn->uring;
+        if (!ring)
+            return -1;
+        sock = MsgConnReceiverSocket(conn);
+
+        // Выбираем пакет из непрочитанных данных приемного буфера
+        if (ring->recvLeft > 0)
+        {
+            if (!stream)
+            {
+                *pdata = ring->recvPtr;
+                int cbret = (int) ring->recvLeft;
+                ring->recvLeft = 0;
+                return cbret;
+            }
+            if (conn->pktFill == 0 && ring->recvLeft >= mtu &&
+                ((uintptr_t) ring->recvPtr & 7) == 0)
+            {
+                *pdata = ring->recvPtr;
+                ring->recvPtr += mtu;
+                ring->recvLeft -= mtu;
+                return (int) mtu;
+            }
+            size_t n = mtu - conn->pktFill;
+            if (n > ring->recvLeft)
+                n = ring->recvLeft;
+            memcpy(conn->pktBuf + conn->pktFill, ring->recvPtr, n);
+            conn->pktFill += n;
+            ring->recvPtr += n;
+            ring->recvLeft -= n;
+            if (conn->pktFill == mtu)
+            {
+                conn->pktFill = 0;
+                *pdata = conn->pktBuf;
+                return (int) mtu;
+            }
+            continue;
+        }
+
+        // Возвращаем прочитанный буфер ядру
+        if (ring->recvBid >= 0)
+        {
+            MsgUringRecycleBuffer(ring, (unsigned short) ring->recvBid);
+            ring->recvBid = -1;
+        }
+
+        // Запускаем многократный прием, если он не активен
+        if (!ring->recvArmed && sock >= 0)
+        {
+            struct io_uring_sqe* sqe = MsgUringGetSqe(ring);
+            assert(sqe != NULL);
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = sock;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = MSG_URING_BUF_GROUP;
+            sqe->user_data = MSG_CONN_URING_RECV;
+            ring->recvArmed = TRUE;
+        }
+
+        // Следим за дескриптором пробуждения
+        if (!ring->wakeArmed && conn->wakeFd >= 0)
+        {
+            struct io_uring_sqe* sqe = MsgUringGetSqe(ring);
+            assert(sqe != NULL);
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = conn->wakeFd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = MSG_CONN_URING_WAKE;
+            ring->wakeArmed = TRUE;
+        }
+
+        // Следим за подключениями отправителя TCP
+        if (stream && !ring->acceptArmed)
+        {
+            struct io_uring_sqe* sqe = MsgUringGetSqe(ring);
+            assert(sqe != NULL);
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = conn->uni.server.sockfd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = MSG_CONN_URING_ACCEPT;
+            ring->acceptArmed = TRUE;
+        }
+
+        // Берем готовый результат или ждем его до истечения времени
+        struct io_uring_cqe* cqe = MsgUringPeekCqe(ring);
+        if (!cqe)
+        {
+            double remaining = -1;
+            if (timeoutSec >= 0)
+            {
+                remaining = deadline - MsgConnNow();
+                if (remaining <= 0)
+                    remaining = 0;
+            }
+            if (MsgUringSubmit(ring, 1, remaining) < 0)
+                return -1;
+            cqe = MsgUringPeekCqe(ring);
+            if (!cqe)
+                return 0;  // пока нет новых данных
+        }
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        unsigned long long tag = cqe->user_data;
+        MsgUringCqeSeen(ring);
+
+        // Прием прерван функцией MsgConnWakeup
+        if (tag == MSG_CONN_URING_WAKE)
+        {
+            uint64_t value;
+            ring->wakeArmed = FALSE;
+            if (read(conn->wakeFd, &value, sizeof(value)) < 0)
+                value = 0;
+            return 0;
+        }
+
+        // Подключился отправитель (очередь будет пересоздана)
+        if (tag == MSG_CONN_URING_ACCEPT)
+        {
+            ring->acceptArmed = FALSE;
+            MsgConnAccept(conn);
+            continue;
+        }
+
+        if (!(flags & IORING_CQE_F_MORE))
+            ring->recvArmed = FALSE;
+        if (flags & IORING_CQE_F_BUFFER)
+        {
+            ring->recvBid = flags >> IORING_CQE_BUFFER_SHIFT;
+            ring->recvPtr = ring->bufMem + ring->recvBid * ring->bufSize;
+            ring->recvLeft = (res > 0) ? (size_t) res : 0;
+        }
+        if (res == -ENOBUFS)
+            continue;  // все буферы были заняты - перезапускаем прием
+        if (stream && res <= 0)
+        {
+            MsgConnReceiverLost(conn);  // очередь будет пересоздана
+            continue;
+        }
+        if (res < 0)
+            return -1;
+    }
+}
+
+
+// Функция читает без блокировки TCP соединение с номером s (0 - основное,
+// иначе полоса s - 1) в его буфер пакета. Возвращает размер пакета и
+// записывает в *pdata адрес пакета, если пакет принят полностью, 0 -
+// если данных пока нет, или -1, если соединение разорвано.
+static int MsgConnStreamRead(MsgConn* conn, size_t s,
+    const unsigned char** pdata)
+{
+    int sock = s ? conn->stripes.fds[s - 1] : conn->uni.server.newsockfd;
+    unsigned char* pkt = s ? conn->stripes.pkts[s - 1] : conn->pktBuf;
+    size_t* fill = s ? &conn->stripes.fills[s - 1] : &conn->pktFill;
+    size_t mtu = conn->config.mtu;
+
+    if (sock < 0)
+        return 0;  // соединение еще не подключено
+    for (;;)
+    {
+        ssize_t cbret = recv(sock, pkt + *fill, mtu - *fill, MSG_DONTWAIT);
+        if (cbret > 0)
+        {
+            *fill += cbret;
+            if (*fill < mtu)
+                continue;  // пакет принят не полностью
+            *fill = 0;
+            *pdata = pkt;
+            return (int) mtu;
+        }
+        if (cbret < 0 && errno == EINTR)
+            continue;
+        if (cbret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        return -1;
+    }
+}
+
+
+// Функция принимает очередной пакет из сокета в буфер пакета, ожидая его
+// не дольше timeoutSec секунд (значение < 0 - без ограничения), и
+// записывает в *pdata адрес пакета. Сокет читается без блокировки, а poll
+// вызывается только тогда, когда данных в сокете нет, так что при потоке
+// пакетов на пакет приходится один системный вызов. Полосы TCP соединения
+// читаются по очереди, начиная каждый раз со следующей. Возвращает размер
+// пакета, 0 (истекло время ожидания, вызвана MsgConnWakeup или соединение
+// сброшено) или -1 при ошибке.
+static int MsgConnSocketNextPacket(MsgConn* conn, double timeoutSec,
+    const unsigned char** pdata)
+{
+    BOOL stream = (conn->config.connRole == MsgConnRoleTcpReceiver);
+    int sock = -1;
+    size_t mtu = conn->config.mtu;
+    double deadline = MsgConnNow() + timeoutSec;
+    struct pollfd pfd[4 + MSG_CONN_STRIPES_MAX];
+    nfds_t nfds = 4;
+    ssize_t cbret = 0;
+
+    for (;;)
+    {
+        // Читаем доступные данные, не блокируясь
+        sock = MsgConnReceiverSocket(conn);
+        errno = EAGAIN;
+        if (stream)
+        {
+            size_t n = conn->stripes.count + 1;
+            cbret = 0;
+            for (size_t i = 0; i < n && cbret == 0; i++)
+            {
+                size_t s = (conn->stripes.next + i) % n;
+                cbret = MsgConnStreamRead(conn, s, pdata);
+                if (cbret > 0)
+                    conn->stripes.next = (s + 1) % n;
+            }
+            if (cbret > 0)
+                return (int) cbret;
+            if (cbret < 0)
+            {
+                MsgConnReceiverLost(conn);
+                continue;
+            }
+            errno = EAGAIN;
+        }
+        else
+        {
+            // Адрес отправителя запоминается только для локального сокета
+            BOOL local = (conn->config.connRole == MsgConnRoleLocalReceiver);
+            cbret = recvfrom(sock, conn->pktBuf, mtu, MSG_DONTWAIT,
+                local ? (struct sockaddr *) &conn->uni.serverLoc.client_name :
+                    NULL,
+                local ? &conn->uni.serverLoc.client_name_size : NULL);
+            *pdata = conn->pktBuf;
+            if (cbret > 0)
+                return (int) cbret;
+            if (cbret == 0)
+                continue;  // пустая датаграмма
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+
+        // Данных нет - ждем их или сигнала пробуждения
+        int waitMs = -1;
+        if (timeoutSec >= 0)
+        {
+            double remaining = deadline - MsgConnNow();
+            if (remaining <= 0)
+                return 0;
+            waitMs = (int) (remaining * 1000) + 1;
+        }
+        pfd[0].fd = sock;  // отрицательный дескриптор poll пропускает
+        pfd[0].events = POLLIN;
+        pfd[1].fd = conn->wakeFd;
+        pfd[1].events = POLLIN;
+        pfd[2].fd = stream ? conn->uni.server.sockfd : -1;
+        pfd[2].events = POLLIN;
+        pfd[3].fd = stream ? conn->uni.server.stripesockfd : -1;
+        pfd[3].events = POLLIN;
+        pfd[0].revents = pfd[1].revents = pfd[2].revents = 0;
+        pfd[3].revents = 0;
+        nfds = 4;
+        for (size_t i = 0; stream && i < conn->stripes.count; i++)
+        {
+            pfd[nfds].fd = conn->stripes.fds[i];
+            pfd[nfds].events = POLLIN;
+            pfd[nfds].revents = 0;
+            nfds++;
+        }
+        if (poll(pfd, nfds, waitMs) < 0)
+            return (errno == EINTR) ? 0 : -1;
+        if (pfd[1].revents & POLLIN)
+        {
+            uint64_t value;
+            if (read(conn->wakeFd, &value, sizeof(value)) < 0)
+                value = 0;
+            return 0;
+        }
+        if (pfd[2].revents & POLLIN)
+            MsgConnAccept(conn);
+        if (pfd[3].revents & POLLIN)
+            MsgConnAcceptStripe(conn);
+    }
+}
+
+
+// Функция ожидает следующее полностью принятое сообщение.
+BOOL MsgConnReceiveWait(MsgConn* conn, MsgBuffer** pbuf, double timeoutSec)
+{
+    double deadline = MsgConnNow() + timeoutSec;
+    const unsigned char* data = NULL; // адрес принятого пакета
+    int cbret = 0;          // количество принятых байт пакета
+
+    assert(pbuf != NULL);
+    assert(conn->pktBuf != NULL && conn->pktBody != NULL);
+
+    // Сначала выдаем сообщения уже принятой пачки
+    if (MsgConnBatchNext(conn, pbuf))
+        return TRUE;
+
+    for (;;)
+    {
+        double remaining = -1;
+        if (timeoutSec >= 0)
+        {
+            remaining = deadline - MsgConnNow();
+            if (remaining < 0)
+                remaining = 0;
+        }
+
+        // Принимаем очередной пакет
+        data = conn->pktBuf;
+        if (conn->uring)
+            cbret = MsgConnUringNextPacket(conn, remaining, &data);
+        else
+            cbret = MsgConnSocketNextPacket(conn, remaining, &data);
+        if (cbret == 0)
+            return FALSE;  // время истекло или прием прерван
+
+        // Обрабатываем пакет; выходим, когда собрано полное сообщение
+        if (MsgConnProcessPacket(conn, data, cbret, pbuf))
+            return TRUE;
+        if (cbret < 0)
+            return FALSE;
+    }
+}
+
+
+// Функция прерывает ожидание в MsgConnReceiveWait.
+void MsgConnWakeup(MsgConn* conn)
+{
+    uint64_t value = 1;
+
+    if (conn->wakeFd >= 0 && write(conn->wakeFd, &value, sizeof(value)) < 0)
+        printf("Unable to wake up receiver!\n");
+}
+
+
+// Функция получает сообщение через TCP-сокет
+BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf)
+{
+    int cbret = 0;          // количество принятых байт пакета
+
+    // Проверяем контрольный код структуры буфера сообщения
+    assert(pbuf != NULL);
+    assert(conn->pktBuf != NULL && conn->pktBody != NULL);
+
+    // Сначала выдаем сообщения уже принятой пачки
+    if (MsgConnBatchNext(conn, pbuf))
+        return TRUE;
+
+    // Принимаем пакет через io_uring, если выбран этот способ
+    if (conn->uring)
+    {
+        const unsigned char* data = NULL;
+        cbret = MsgConnUringNextPacket(conn, 2.0, &data);
+        return MsgConnProcessPacket(conn, data, cbret, pbuf);
+    }
+
+    // Обнуляем буфер пакета
+    bzero(conn->pktBuf, conn->config.mtu);
+
+    // Проверяем готовность новых данных в сокете (а для TCP - еще и
+    // подключение отправителя)
+    struct timeval timeout;
+    timeout.tv_sec = 2; // время ожидания в секундах
+    timeout.tv_usec = 0; // время ожидания в сек
+    int sock = -1;
+    int maxfd = -1;
+    fd_set socks;
+    FD_ZERO(&socks);
+    if (conn->config.connRole == MsgConnRoleTcpReceiver)
+    {
+        sock = conn->uni.server.newsockfd;
+        maxfd = conn->uni.server.sockfd;
+        FD_SET(maxfd, &socks);
+        if (conn->uni.server.stripesockfd >= 0)
+        {
+            FD_SET(conn->uni.server.stripesockfd, &socks);
+            if (conn->uni.server.stripesockfd > maxfd)
+                maxfd = conn->uni.server.stripesockfd;
+        }
+        for (size_t i = 0; i < conn->stripes.count; i++)
+            if (conn->stripes.fds[i] >= 0)
+            {
+                FD_SET(conn->stripes.fds[i], &socks);
+                if (conn->stripes.fds[i] > maxfd)
+                    maxfd = conn->stripes.fds[i];
+            }
+    }
+    else
+        sock = MsgConnReceiverSocket(conn);
+    if (sock >= 0)
+        FD_SET(sock, &socks);
+    if (sock > maxfd)
+        maxfd = sock;
+    if (select(maxfd + 1, &socks, NULL, NULL, &timeout) > 0)
+    {
+        // Принимаем подключение отправителя TCP
+        if (conn->config.connRole == MsgConnRoleTcpReceiver &&
+            FD_ISSET(conn->uni.server.sockfd, &socks))
+        {
+            MsgConnAccept(conn);
+            return FALSE;
+        }
+        if (conn->config.connRole == MsgConnRoleTcpReceiver &&
+            conn->uni.server.stripesockfd >= 0 &&
+            FD_ISSET(conn->uni.server.stripesockfd, &socks))
+        {
+            MsgConnAcceptStripe(conn);
+            return FALSE;
+        }
+
+        // Принимаем один пакет из сокета
+        switch (conn->config.connRole)
+        {
+        case MsgConnRoleTcpReceiver: // используем TCP сокет
+            // Выбираем соединение с данными: основное или одну из полос
+            for (size_t i = 0; (sock < 0 || !FD_ISSET(sock, &socks)) &&
+                i < conn->stripes.count; i++)
+                sock = conn->stripes.fds[i];
+            //cbret = read(conn->uni.server.newsockfd,
+            //    conn->pktBuf,
+            //    conn->config.mtu);
+            cbret = recv(sock,
+    	        conn->pktBuf,
+		        conn->config.mtu, 
+    	        MSG_WAITALL);
+            //printf("cbret = %d\n", cbret);
+            if (cbret <= 0)
+            {
+                // Соединение разорвано - ждем переподключения, сохраняя
+                // частично собранные сообщения
+                MsgConnReceiverLost(conn);
+                cbret = 0;
+            }
+            break;
+        case MsgConnRoleLocalReceiver: // используем локальный сокет
+            cbret = recvfrom(sock, 
+                conn->pktBuf, 
+                conn->config.mtu, 
+                0,
+                (struct sockaddr *) &conn->uni.serverLoc.client_name, 
+                &conn->uni.serverLoc.client_name_size);
+            break;
+        case MsgConnRoleMcastReceiver: // используем рассылку UDP
+            cbret = recvfrom(sock, conn->pktBuf, conn->config.mtu, 0,
+                NULL, NULL);
+            break;
+        default:
+            printf("Wrong connection type!\n");
+            cbret = -1;
+            assert(TRUE == FALSE);
+            break;
+        }
+    }
+    else
+    {
+        //printf("No data arrived!\n");
+        cbret = 0;
+    }
+
+    // Обрабатываем принятый пакет
+    return MsgConnProcessPacket(conn, conn->pktBuf, cbret, pbuf);
+}
+
+
 // Функция освобождает буфер сообщения и удаляет соответствующий
 // узел из списка буферов (нужно после обработки принятого сообщения
 // приложением). Вторым аргументом функции должен быть прямой указатель
@@ -525,6 +3297,8 @@ BOOL MsgConnBufferRelease(MsgConn* conn, MsgBuffer** pbuf)
 {
     // Проверяем контрольный код структуры буфера сообщения
     assert((*pbuf)->magicNumber == MSG_BUFFER_MAGIC);
+    MSG_TRACE_END(MsgTraceDelivered, (*pbuf)->msgIndex, 0);
+    MSG_TRACE_MARK(MsgTraceRelease, (*pbuf)->msgIndex, 0);
 
     if (MsgListDelete(&conn->list, (*pbuf)->msgIndex))
     {
@@ -535,3 +3309,42 @@ BOOL MsgConnBufferRelease(MsgConn* conn, MsgBuffer** pbuf)
         return FALSE;
 }
 
+
+// Функция возвращает буфер самого нового несобранного сообщения (новые
+// узлы добавляются в начало списка).
+const MsgBuffer* MsgConnIncomplete(const MsgConn* conn)
+{
+    for (const MsgList* node = conn->list; node; node = node->next)
+        if (!MsgBufferIsFull(&node->buf))
+            return &node->buf;
+    return NULL;
+}
+
+
+// Функция возвращает текущее время в наносекундах по часам соединения.
+uint64_t MsgConnTimestamp(const MsgConn* conn)
+{
+    return MsgClockNs(conn->config.clock);
+}
+
+
+// Функция вычисляет задержки доставки принятого сообщения.
+BOOL MsgConnGetLatency(const MsgConn* conn, const MsgBuffer* buf,
+    MsgConnLatency* latency)
+{
+    const MsgHeader* msg = (const MsgHeader*) buf->data;
+    const MsgClockSync* sync = &conn->clock.sync;
+
+    // Проверяем контрольный код структуры буфера сообщения
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    if (msg->timestampNs == 0 || buf->sendTimeNs == 0 ||
+        buf->recvTimeNs == 0)
+        return FALSE;
+    latency->senderNs = (int64_t) (buf->sendTimeNs - msg->timestampNs);
+    latency->networkNs = (int64_t) (buf->recvTimeNs -
+        MsgClockSyncToLocal(sync, buf->sendTimeNs));
+    latency->totalNs = latency->senderNs + latency->networkNs;
+    latency->synced = (sync->sampleCount > 0);
+    return TRUE;
+}
@@ -1,10 +1,14 @@
 // msg_conn.h: Функции и структуры для получения и отправки сообщений
 // между приложениями ISAAC и ROS.
 
+#ifndef MSG_CONN_H
+#define MSG_CONN_H
 
+#include <stdint.h>      // uint32_t
 #include <netinet/in.h>  // sockaddr_in (для TCP сокетов)
 #include <sys/un.h>      // sockaddr_un (для локальных сокетов)
 #include "msg_buf.h"   // работа со списками пакетов сообщения
+#include "msg_clock.h" // временные метки и смещение часов
 
 
 /* MsgConnType: Перечисление задает перечень сторон соединения по сокету. */
@@ -13,25 +17,347 @@ typedef enum MsgConnRoleEnum
     MsgConnRoleTcpSender,   // отправитель сообщений по TCP сокету
     MsgConnRoleTcpReceiver, // получатель сообщений по TCP сокету
     MsgConnRoleLocalSender, // отправитель сообщений через локальный сокет
-    MsgConnRoleLocalReceiver// получатель сообщений через локальный сокет
+    MsgConnRoleLocalReceiver,// получатель сообщений через локальный сокет
+    MsgConnRoleMcastSender, // отправитель многоадресной рассылки по UDP
+    MsgConnRoleMcastReceiver// получатель многоадресной рассылки по UDP
 } MsgConnRole;
 
 
+/* MsgConnEngine: Перечисление задает способ выполнения операций
+ * ввода-вывода через сокет. */
+typedef enum MsgConnEngineEnum
+{
+    MsgConnEngineSocket, // блокирующие вызовы write/sendto/recv/recvfrom
+    MsgConnEngineUring   // очередь запросов io_uring (Linux 6.0 и новее)
+} MsgConnEngine;
+
+
+/* MsgConnState: Перечисление задает состояние TCP соединения. */
+typedef enum MsgConnStateEnum
+{
+    MsgConnStateConnected,   // соединение установлено
+    MsgConnStateDisconnected,// соединения нет: отправитель ждет момента
+                             // следующей попытки, получатель - клиента
+    MsgConnStateConnecting,  // отправитель ждет завершения connect
+    MsgConnStateResuming,    // отправитель ждет сведений о возобновлении
+    MsgConnStateStriping     // отправитель ждет подключения полос
+} MsgConnState;
+
+
+// Контрольный код сведений о возобновлении сессии
+#define MSG_RESUME_MAGIC 0x5A55A5AA
+
+/* MsgResume: Сведения о возобновлении сессии, которые TCP получатель
+ * отправляет отправителю сразу после подключения. По ним отправитель
+ * повторяет только те сообщения, которые получатель еще не собрал. */
+typedef struct MsgResumeStruct
+{
+    size_t lastIndex;    // номер последнего полностью принятого сообщения
+    size_t delivered;    // 0, если получатель еще не собрал ни одного
+                         // сообщения (тогда lastIndex не имеет смысла)
+    size_t magicNumber;  // должно быть равно 0x5A55A5AA
+} MsgResume, *MsgResumePtr;
+
+
+// Контрольный код кредита на отправку
+#define MSG_CREDIT_MAGIC 0x5AA5A55A
+
+/* MsgCredit: Кредит на отправку, который локальный получатель передает
+ * отправителю датаграммой по обратному пути после сборки каждого
+ * сообщения. Счетчик в кредите накопительный, поэтому потеря одного
+ * кредита безвредна: следующий вернет отправителю и его сообщения. */
+typedef struct MsgCreditStruct
+{
+    size_t deliveredCount; // сколько сообщений получатель собрал
+    size_t magicNumber;  // должно быть равно 0x5AA5A55A
+} MsgCredit, *MsgCreditPtr;
+
+
+// Контрольный код запроса синхронизации часов
+#define MSG_PING_MAGIC 0x5AA55AA5
+
+/* MsgPing: Запрос синхронизации часов, который получатель периодически
+ * передает отправителю по обратному пути (по TCP соединению или
+ * датаграммой на именованный сокет локального отправителя). Отправитель
+ * отвечает на него в заголовке ближайшего пакета (поля echoTimeNs и
+ * echoHoldNs), а получатель по четырем меткам оценивает смещение часов
+ * отправителя (см. msg_clock.h). */
+typedef struct MsgPingStruct
+{
+    uint64_t timeNs;     // момент отправки запроса по часам получателя
+    size_t magicNumber;  // должно быть равно 0x5AA55AA5
+} MsgPing, *MsgPingPtr;
+
+
 /* MsgConnConfig: Системные настройки соединения. */ 
 typedef struct MsgConnConfigStruct
 {
     MsgConnRole connRole;// тип соединения со стороны приложения
     char servername[80]; // доменное имя сервера (для отправки сообщений)
+        /* Для многоадресной рассылки - адрес группы первого типа
+         * сообщений (например, 239.255.0.1): сообщения типа t рассылаются
+         * в группу с адресом, большим на t. */
     char clientname[80]; // доменное имя клиента
-    int portno;          // номер TCP порта
+        /* Для многоадресной рассылки - IP адрес сетевого интерфейса
+         * (например, 127.0.0.1 для проверки на одном компьютере); пустая
+         * строка - интерфейс по умолчанию. */
+    int portno;          // номер TCP порта (или UDP порта рассылки)
     size_t mtu;          // максимальный размер IP пакета
     size_t maxListLength;// предельно допустимая длина списка буферов
         /* В случае превышения этой длины происходит принудительная
          * очистка списка буферов во избежании переполнения памяти.
          * Используется только для приема сообщений. */
+    double targetLatency;// целевая задержка доставки сообщения в секундах
+        /* Используется только для отправки сообщений: если оценка
+         * задержки в очереди отправки превышает это значение, функция
+         * MsgConnReadyToSend предлагает пропустить кадр. Значение 0
+         * отключает адаптацию к пропускной способности канала. */
+    MsgConnEngine engine;// способ выполнения операций ввода-вывода
+    size_t zeroCopyMin;  // минимальный размер сообщения в байтах для
+        /* отправки без копирования в ядро (MSG_ZEROCOPY). Используется
+         * только TCP отправителем со способом MsgConnEngineSocket; сообщения
+         * меньшего размера отправляются обычным образом, так как для них
+         * закрепление страниц дороже копирования. Значение 0 отключает
+         * отправку без копирования. */
+    size_t resendDepth;  // сколько последних сообщений TCP отправитель
+        /* хранит для повторной отправки после восстановления соединения
+         * (хранятся ссылки на буферы, см. MsgBufferRetain). Значение 0
+         * отключает повторную отправку. */
+    unsigned mcastTypes; // маска типов сообщений (бит 1 << MsgType), на
+        /* группы которых подписывается получатель многоадресной рассылки.
+         * Значение 0 - все типы сообщений. */
+    double reassemblyTimeout; // сколько секунд получатель ждет недостающие
+        /* пакеты сообщения: по истечении этого времени несобранное
+         * сообщение отбрасывается (так многоадресная рассылка переживает
+         * потерю датаграмм). Значение 0 - ждать без ограничения. */
+    size_t streamCount;  // количество параллельных TCP соединений (полос)
+        /* Отправитель распределяет пакеты сообщения по полосам, и каждая
+         * полоса наращивает окно перегрузки независимо, что ускоряет
+         * передачу больших кадров по каналу с потерями. У получателя
+         * значение должно быть не меньше, чем у отправителя. Полосы
+         * подключаются к порту portno + 1, поэтому получатель отличает их
+         * от основного соединения (и от его повторного подключения) по
+         * порту. Значения 0 и 1 - одно соединение; полосы не используются
+         * со способом MsgConnEngineUring. */
+    double pacingRate;   // предельная скорость отправки, байт/с
+        /* Пакеты сообщения отправляются не быстрее этой скорости
+         * (маркерная корзина глубиной pacingBurst), так что большой кадр
+         * растягивается на интервал между кадрами, а не уходит одной
+         * пачкой, которая переполняет очередь получателя датаграмм или
+         * буферы беспроводного канала. TCP сокетам скорость также
+         * задается параметром SO_MAX_PACING_RATE (поровну на полосы),
+         * чтобы ядро распределяло во времени и байты внутри пакета.
+         * Значение 0 - без ограничения. */
+    size_t pacingBurst;  // глубина корзины ограничителя скорости в байтах
+        /* (сколько байт уходит подряд после паузы). Значение 0 - один
+         * пакет (mtu байт). */
+    size_t creditWindow; // сколько сообщений локальный отправитель может
+        /* передать, пока получатель их не собрал (управление потоком по
+         * кредитам). Получатель после сборки каждого сообщения (пачки
+         * сообщений - после выдачи последнего из них) возвращает
+         * отправителю кредит, а отправитель отбрасывает
+         * сообщение без кредита целиком еще до отправки, поэтому при
+         * перегрузке снижается частота кадров, а не теряются отдельные
+         * пакеты и не переполняется список буферов получателя. Окно
+         * сообщений должно помещаться в очередь сокета получателя, иначе
+         * отправитель все же блокируется. У получателя любое ненулевое
+         * значение включает отправку кредитов; получатель с кредитами
+         * использует только способ MsgConnEngineSocket. Значение 0
+         * отключает управление. */
+    MsgClock clock;      // часы временных меток пакетов и сообщений
+        /* (по умолчанию монотонные). Приложение-отправитель ставит метку
+         * захвата MsgHeader.timestampNs по тем же часам (см.
+         * MsgConnTimestamp). */
+    double clockSyncPeriod; // период синхронизации часов, с
+        /* Получатель TCP или локального соединения с этим периодом
+         * передает отправителю запрос MsgPing и по ответу уточняет
+         * смещение часов отправителя (clock.sync), так что задержки
+         * доставки (MsgConnGetLatency) имеют смысл и между разными
+         * машинами. Значение 0 - синхронизации нет, часы считаются
+         * общими. */
+    size_t coalesceSize; // порог объединения небольших сообщений, байт
+        /* TCP или локальный отправитель не отправляет сообщение, которое
+         * помещается в один пакет, сразу, а дописывает его в пачку (см.
+         * MsgBatchEntry), так что несколько сообщений уходят одним пакетом
+         * и одним системным вызовом. Пачка отправляется, когда в ней
+         * набралось coalesceSize байт, когда следующее сообщение в нее не
+         * помещается или когда истек срок coalesceDelay. Получатель
+         * раскладывает пачку на отдельные сообщения сам. Значение 0
+         * отключает объединение. */
+    double coalesceDelay;// сколько секунд сообщение может ждать в пачке
+        /* Срок проверяется при вызовах MsgConnSend и MsgConnFlush, поэтому
+         * приложение, которое перестало отправлять сообщения, должно
+         * вызывать MsgConnFlush. Значение 0 - сообщение ждет только
+         * заполнения пачки. */
 } MsgConnConfig, *MsgConnConfigPtr;
 
 
+/* MsgConnRate: Оценки состояния канала на стороне отправителя, которые
+ * обновляются после каждой отправки сообщения и при каждом вызове
+ * MsgConnReadyToSend по скорости опустошения очереди отправки сокета. */
+typedef struct MsgConnRateStruct
+{
+    double bandwidth;    // оценка пропускной способности канала, байт/с
+        /* Значение 0 означает, что оценка еще не получена. */
+    double queueDelay;   // оценка задержки в очереди отправки, с
+    size_t queueBytes;   // байт в очереди отправки после последней отправки
+    double lastUpdateTime; // момент последнего обновления оценок, с
+    size_t skipCount;    // количество кадров, пропущенных по совету
+                         // функции MsgConnReadyToSend
+} MsgConnRate, *MsgConnRatePtr;
+
+
+/* MsgConnPinned: Сообщение, отправленное без копирования. Память буфера
+ * сообщения и заголовки его пакетов удерживаются, пока ядро не сообщит о
+ * завершении всех вызовов sendmsg, передавших это сообщение. */
+typedef struct MsgConnPinnedStruct
+{
+    MsgBuffer ref;       // ссылка на память буфера сообщения
+    MsgPacketHeader* headers; // заголовки всех пакетов сообщения
+    uint32_t lastSeq;    // номер последнего вызова sendmsg для сообщения
+} MsgConnPinned, *MsgConnPinnedPtr;
+
+
+/* MsgConnZeroCopy: Состояние отправки без копирования (MSG_ZEROCOPY).
+ * Ядро нумерует вызовы sendmsg с флагом MSG_ZEROCOPY по порядку и
+ * сообщает о завершении диапазонов номеров через очередь ошибок сокета. */
+typedef struct MsgConnZeroCopyStruct
+{
+    BOOL enabled;        // отправка без копирования включена для сокета
+    uint32_t nextSeq;    // номер следующего вызова sendmsg
+    uint32_t doneSeq;    // все вызовы с меньшими номерами завершены
+    MsgConnPinned* pinned; // удерживаемые сообщения в порядке отправки
+    size_t pinnedCount;  // количество удерживаемых сообщений
+    size_t pinnedCapacity; // размер массива pinned
+    size_t copiedCount;  // сколько вызовов ядро все же выполнило с
+                         // копированием (тогда режим отключается)
+} MsgConnZeroCopy, *MsgConnZeroCopyPtr;
+
+
+/* MsgConnLink: Состояние восстановления TCP соединения. Обрыв не
+ * блокирует ни отправителя, ни получателя: отправитель переподключается
+ * в фоне при очередных вызовах MsgConnSend с экспоненциально растущей
+ * паузой между попытками, а получатель принимает новое подключение при
+ * очередном приеме, сохраняя частично собранные сообщения. */
+typedef struct MsgConnLinkStruct
+{
+    MsgConnState state;  // состояние соединения
+    double stateTime;    // момент перехода в текущее состояние, с
+    double retryTime;    // момент следующей попытки подключения, с
+    double backoff;      // текущая пауза между попытками, с
+    size_t reconnectCount; // сколько раз соединение было восстановлено
+    MsgResume resume;    // сведения о собранных сообщениях (у отправителя
+                         // - принятые, пока подключаются полосы)
+    MsgBuffer* history;  // кольцо последних отправленных сообщений
+                         // (config.resendDepth элементов, для отправителя)
+    size_t historyHead;  // индекс самого старого сообщения в кольце
+    size_t historyCount; // количество сообщений в кольце
+    size_t resentCount;  // сколько сообщений отправлено повторно
+} MsgConnLink, *MsgConnLinkPtr;
+
+
+/* MsgConnStripes: Дополнительные TCP соединения (полосы). Отправитель
+ * передает пакет сообщения с номером i по полосе i % n, где n - количество
+ * подключенных полос, а получатель принимает пакеты из всех полос и
+ * собирает из них сообщение. Основное соединение (uni.client.sockfd или
+ * uni.server.newsockfd) считается полосой 0 и в массивы не входит. */
+typedef struct MsgConnStripesStruct
+{
+    size_t count;        // количество дополнительных соединений
+    int* fds;            // их сокеты (-1 - соединения нет)
+    unsigned char** pkts;// для получателя: буферы пакетов по mtu байт
+    size_t* fills;       // для получателя: сколько байт пакета принято
+    size_t next;         // для получателя: полоса, с которой начинается
+                         // следующий опрос (чтобы полосы читались поровну)
+} MsgConnStripes, *MsgConnStripesPtr;
+
+
+/* MsgConnPacing: Состояние ограничителя скорости отправки (маркерная
+ * корзина, см. config.pacingRate). Запас байт пополняется со скоростью
+ * pacingRate, но не выше глубины корзины. Пакет отправляется, когда
+ * запас неотрицателен, и уменьшает запас на свой размер, поэтому запас
+ * может уйти в минус на один пакет. */
+typedef struct MsgConnPacingStruct
+{
+    double tokens;       // запас байт
+    double lastTime;     // момент последнего пополнения запаса, с
+    double waitTime;     // сколько секунд отправка ждала пополнения
+} MsgConnPacing, *MsgConnPacingPtr;
+
+
+/* MsgConnCredit: Состояние управления потоком по кредитам для
+ * локальных сокетов (см. config.creditWindow). */
+typedef struct MsgConnCreditStruct
+{
+    size_t inFlight;     // для отправителя: сколько отправленных сообщений
+                         // получатель еще не собрал
+    BOOL acked;          // для отправителя: кредит уже приходил
+    size_t ackCount;     // для отправителя: счетчик из последнего кредита
+    double grantTime;    // для отправителя: момент последнего кредита или
+                         // пробной отправки, с
+    size_t dropCount;    // для отправителя: сколько сообщений отброшено
+                         // без отправки из-за нехватки кредита
+    size_t deliveredCount; // для получателя: сколько сообщений собрано
+} MsgConnCredit, *MsgConnCreditPtr;
+
+
+/* MsgConnClock: Состояние синхронизации часов отправителя и получателя
+ * (см. config.clockSyncPeriod). */
+typedef struct MsgConnClockStruct
+{
+    MsgClockSync sync;   // для получателя: оценка смещения часов
+                         // отправителя относительно своих
+    double pingTime;     // для получателя: момент последнего запроса, с
+    size_t pingCount;    // для получателя: сколько запросов отправлено
+    uint64_t sampledEchoNs; // для получателя: метка запроса из последнего
+                         // учтенного ответа
+    uint64_t echoTimeNs; // для отправителя: метка запроса, ответ на
+                         // который еще не отправлен (0 - такого нет)
+    uint64_t echoRecvNs; // для отправителя: момент приема этого запроса
+                         // по своим часам
+} MsgConnClock, *MsgConnClockPtr;
+
+
+/* MsgConnLatency: Задержки доставки принятого сообщения в наносекундах
+ * (см. MsgConnGetLatency). */
+typedef struct MsgConnLatencyStruct
+{
+    int64_t totalNs;     // от захвата данных до сборки сообщения
+    int64_t senderNs;    // от захвата данных до завершения отправки
+                         // (по одним часам отправителя)
+    int64_t networkNs;   // от завершения отправки до сборки сообщения
+    BOOL synced;         // смещение часов отправителя оценено (иначе
+                         // часы считаются общими)
+} MsgConnLatency, *MsgConnLatencyPtr;
+
+
+/* MsgConnBatch: Состояние объединения небольших сообщений в пачки (см.
+ * config.coalesceSize). Отправитель собирает пачку в буфере пакета
+ * соединения (pktBuf). */
+typedef struct MsgConnBatchStruct
+{
+    double firstTime;    // для отправителя: момент добавления в пачку
+                         // первого сообщения, с
+    size_t packetCount;  // для отправителя: сколько пачек отправлено
+    size_t msgCount;     // для отправителя: сколько сообщений отправлено в
+                         // пачках
+    MsgList* pending;    // для получателя: сообщения принятой пачки, еще
+                         // не выданные приложению (цепочка узлов)
+} MsgConnBatch, *MsgConnBatchPtr;
+
+
+/* MsgConnCursor: Положение в сообщении, которое отправляется по частям
+ * функцией MsgConnSendNonBlocking. */
+typedef struct MsgConnCursorStruct
+{
+    size_t chunkIndex;   // номер текущего фрагмента сообщения
+    size_t pktOffset;    // сколько байт текущего пакета уже передано
+    MsgPacketHeader pkt; // заголовок текущего пакета (заполняется, когда
+                         // пакет начинается, чтобы его части, переданные
+                         // разными вызовами, принадлежали одному заголовку)
+} MsgConnCursor, *MsgConnCursorPtr;
+
+
 /* MsgConn: Структура представляет объект соединения через TCP-сокет */
 typedef struct MsgConnStruct
 {
@@ -40,7 +366,21 @@ typedef struct MsgConnStruct
                          // (всегда = NULL для отправителя)
     unsigned char* pktBuf; // буфер пакета размером config.mtu байт
     unsigned char* pktBody;// указатель на тело пакета в буфере пакета
+    size_t pktFill;      // сколько байт пакета TCP уже принято в буфер
+                         // пакета (пакет пришел по частям)
     size_t msgErrorCount;// количество сбойных сообщений
+    MsgConnRate rate;    // оценки состояния канала (для отправителя)
+    struct MsgUringStruct* uring; // очередь io_uring (NULL, если
+                         // выбран способ MsgConnEngineSocket)
+    MsgConnZeroCopy zc;  // отправка без копирования (для TCP отправителя)
+    int wakeFd;          // дескриптор eventfd для прерывания ожидания в
+                         // MsgConnReceiveWait (для получателя, иначе -1)
+    MsgConnLink link;    // восстановление TCP соединения после обрыва
+    MsgConnStripes stripes; // дополнительные TCP соединения (полосы)
+    MsgConnCredit credit;// управление потоком по кредитам (локальные сокеты)
+    MsgConnPacing pacing;// ограничитель скорости отправки
+    MsgConnClock clock;  // синхронизация часов отправителя и получателя
+    MsgConnBatch batch;  // объединение небольших сообщений в пачки
 
     // Состояние текущего TCP соединения
     union 
@@ -58,6 +398,8 @@ typedef struct MsgConnStruct
             int sockfd;        // сокет для обнаружения входящих подключений
             struct sockaddr_in serv_addr; // IP адрес сервера
             int newsockfd;     // сокет для нового подключенного клиента
+            int stripesockfd;  // сокет для подключений полос (порт
+                               // portno + 1, -1 - полос нет)
             struct sockaddr_in cli_addr; // IP адрес клиента
         } server;
         struct 
@@ -74,6 +416,14 @@ typedef struct MsgConnStruct
             struct sockaddr_un client_name; // имя клиента
             socklen_t client_name_size; // длина имени клиента
         } serverLoc;
+        struct
+        {
+            // Для отправителя и получателя многоадресной рассылки UDP
+            int sockfd;        // сокет UDP
+            struct sockaddr_in group_addr; // адрес группы первого типа
+            struct sockaddr_in dest_addr;  // адрес группы отправляемого
+                                           // сообщения (для отправителя)
+        } mcast;
     } uni;
 
 } MsgConn, *MsgConnPtr;
@@ -85,16 +435,90 @@ extern BOOL MsgConnInit(MsgConn* conn, const MsgConnConfig* cfg);
 // Функция разрывает соединение
 extern void MsgConnFree(MsgConn* conn);
 
-// Функция отправляет сообщение через TCP-сокет
+// Функция отправляет сообщение через TCP-сокет. Если TCP соединение
+// потеряно, то функция не блокируется, а делает очередной шаг его
+// восстановления и возвращает FALSE, пока соединение не восстановлено.
+// Локальный отправитель без кредита (см. config.creditWindow) не
+// отправляет сообщение и возвращает FALSE.
 extern BOOL MsgConnSend(MsgConn* conn, const MsgBuffer* buf);
 
+// Функция отправляет накопленную пачку небольших сообщений (см.
+// config.coalesceSize). Если force = FALSE, то пачка отправляется, только
+// если истек срок config.coalesceDelay; приложение вызывает функцию так в
+// своем цикле, чтобы сообщения не задерживались, когда новых нет.
+// Возвращает FALSE при ошибке отправки.
+extern BOOL MsgConnFlush(MsgConn* conn, BOOL force);
+
+// Функция отправляет пакеты сообщения, начиная с положения cursor, пока
+// сокет принимает их без блокировки, и сдвигает cursor. Возвращает 1,
+// если сообщение передано полностью, 0 - если сокет заполнен или TCP
+// соединение еще восстанавливается, у локального отправителя нет
+// кредита на сообщение или ограничитель скорости (config.pacingRate)
+// задерживает очередной пакет (тогда отправку нужно продолжить
+// позже с того же положения), и -1 при ошибке (тогда cursor сброшен, и
+// после восстановления TCP соединения сообщение отправляется заново).
+// Функция не использует io_uring, отправку без копирования, повторную
+// отправку сообщений, объединение сообщений в пачки и полосы (только
+// основное соединение).
+extern int MsgConnSendNonBlocking(MsgConn* conn, const MsgBuffer* buf,
+    MsgConnCursor* cursor);
+
+// Функция сообщает, успеет ли новое сообщение дойти до получателя за
+// время config.targetLatency при текущей загрузке канала. Если функция
+// вернула FALSE, то отправителю лучше пропустить текущий кадр. Локальный
+// отправитель с кредитами (см. config.creditWindow) получает FALSE, если
+// у него нет кредита на новое сообщение.
+extern BOOL MsgConnReadyToSend(MsgConn* conn);
+
+// Функция оценивает, сколько байт можно отправить, чтобы сообщение
+// дошло до получателя за время config.targetLatency. По этой оценке
+// приложение выбирает степень прореживания облака или разрешение кадра.
+// Если оценка еще не получена или адаптация отключена, то функция
+// возвращает (size_t)-1.
+extern size_t MsgConnSendBudget(const MsgConn* conn);
+
 // Функция получает сообщение через TCP-сокет
 extern BOOL MsgConnReceive(MsgConn* conn, MsgBuffer** pbuf);
 
+// Функция ожидает следующее полностью принятое сообщение не дольше
+// timeoutSec секунд (значение < 0 - без ограничения) и возвращает TRUE,
+// если сообщение собрано (тогда *pbuf указывает на его буфер). Пакеты
+// принимаются в цикле внутри функции без лишних системных вызовов на
+// каждый пакет. Функция возвращает FALSE по истечении времени, после
+// вызова MsgConnWakeup, прерывания сигналом или ошибки приема. Не следует
+// чередовать ее вызовы с вызовами MsgConnReceive для одного соединения.
+extern BOOL MsgConnReceiveWait(MsgConn* conn, MsgBuffer** pbuf,
+    double timeoutSec);
+
+// Функция прерывает ожидание в MsgConnReceiveWait (если ожидания нет, то
+// прерывает следующее). Ее можно вызывать из другого потока или из
+// обработчика сигнала, например для остановки приложения.
+extern void MsgConnWakeup(MsgConn* conn);
+
 // Функция освобождает буфер сообщения и удаляет соответствующий
 // узел из списка буферов (нужно после обработки принятого сообщения
 // приложением). Вторым аргументом функции должен быть прямой указатель
-// на буфер в списке буферов!
+// на буфер в списке буферов! Функция вызывается в потоке приема; для
+// обработки сообщений в другом потоке см. MsgRingPublish (msg_ring.h).
 extern BOOL MsgConnBufferRelease(MsgConn* conn, MsgBuffer** pbuf);
 
+// Функция возвращает указатель на буфер самого нового еще не собранного
+// сообщения в списке буферов получателя или NULL, если такого нет. Уже
+// принятую часть сообщения можно показывать до его сборки (см.
+// MsgCloudReceivedPoints). Буфер принадлежит соединению и действителен
+// только до следующего вызова функций приема.
+extern const MsgBuffer* MsgConnIncomplete(const MsgConn* conn);
+
+// Функция возвращает текущее время в наносекундах по часам соединения
+// (config.clock): им отправитель ставит метку захвата данных
+// MsgHeader.timestampNs.
+extern uint64_t MsgConnTimestamp(const MsgConn* conn);
+
+// Функция вычисляет задержки доставки принятого сообщения buf по меткам
+// захвата, завершения отправки и сборки, переводя часы отправителя в
+// часы получателя по оценке их смещения. Возвращает FALSE, если у
+// сообщения нет нужных меток.
+extern BOOL MsgConnGetLatency(const MsgConn* conn, const MsgBuffer* buf,
+    MsgConnLatency* latency);
 
+#endif // MSG_CONN_H
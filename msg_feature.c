@@ -0,0 +1,131 @@
+// msg_feature.c: Реализация функций для формирования и чтения сообщений
+// типа MsgTypeFeatures с особыми точками кадра.
+//
+
+#include <string.h>      // memcpy(), memmove()
+#include <assert.h>
+#include "msg_feature.h"
+
+
+// Функция заполняет указатели на столбцы особых точек в памяти data
+// (сразу за заголовком сообщения) для count точек.
+static void MsgFeatureLayout(MsgFeatureColumns* cols, unsigned char* data,
+    size_t count, size_t descriptorSize)
+{
+    cols->count = count;
+    cols->descriptorSize = descriptorSize;
+    cols->x = (float*) data;
+    cols->y = cols->x + count;
+    cols->size = cols->y + count;
+    cols->angle = cols->size + count;
+    cols->response = cols->angle + count;
+    cols->octave = (int32_t*) (cols->response + count);
+    cols->descriptors = (unsigned char*) (cols->octave + count);
+}
+
+
+// Функция возвращает размер дескриптора заданного вида в байтах.
+size_t MsgFeatureDescriptorSize(MsgDescriptorType type)
+{
+    switch (type)
+    {
+    case MsgDescriptorOrb:
+        return 32;
+    case MsgDescriptorBrisk:
+        return 64;
+    case MsgDescriptorAkaze:
+        return 61;
+    default:
+        return 0;
+    }
+}
+
+
+// Функция записывает указатели на столбцы особых точек сообщения.
+BOOL MsgFeatureGetColumns(const MsgBuffer* buf, MsgFeatureColumns* cols)
+{
+    const MsgHeader* msg = (const MsgHeader*) buf->data;
+    size_t elem_size = 0;  // размер одной точки во всех столбцах
+
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    if (buf->size < sizeof(MsgHeader) ||
+        msg->magicNumber != MSG_HEADER_MAGIC ||
+        msg->type != MsgTypeFeatures)
+        return FALSE;
+
+    // Количество точек и размер дескриптора пришли из сети: проверяем их
+    // так, чтобы произведение не могло переполниться
+    if (msg->uni.features.descriptorSize > MSG_DESCRIPTOR_SIZE_MAX)
+        return FALSE;
+    elem_size = 5 * sizeof(float) + sizeof(int32_t) +
+        msg->uni.features.descriptorSize;
+    if (msg->uni.features.count >
+        (buf->size - sizeof(MsgHeader)) / elem_size ||
+        MsgCalcSize(msg) > buf->size)
+        return FALSE;
+    MsgFeatureLayout(cols, buf->data + sizeof(MsgHeader),
+        msg->uni.features.count, msg->uni.features.descriptorSize);
+    return TRUE;
+}
+
+
+// Функция начинает сообщение с особыми точками прямо в буфере отправки.
+BOOL MsgFeatureBuild(MsgBuffer* buf, const MsgHeader* msg, size_t maxCount,
+    size_t mtu, MsgBufferPool* pool, MsgFeatureColumns* cols)
+{
+    MsgHeader hdr = *msg;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypeFeatures);
+    assert(pool == NULL || pool->mtu == mtu);
+
+    hdr.uni.features.count = maxCount;
+    if (pool ? !MsgBufferInitPooled(buf, &hdr, pool) :
+        !MsgBufferInit(buf, &hdr, mtu))
+        return FALSE;
+    memcpy(buf->data, &hdr, sizeof(MsgHeader));
+    MsgFeatureLayout(cols, buf->data + sizeof(MsgHeader), maxCount,
+        hdr.uni.features.descriptorSize);
+    return TRUE;
+}
+
+
+// Функция завершает сообщение, начатое функцией MsgFeatureBuild.
+void MsgFeatureBuildFinish(MsgBuffer* buf, size_t count)
+{
+    MsgHeader* msg = (MsgHeader*) buf->data;
+    MsgFeatureColumns src, dst;
+    size_t msg_size = 0;
+
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    assert(msg->type == MsgTypeFeatures);
+    assert(count <= msg->uni.features.count);
+
+    // Столбцы сдвигаются только к началу сообщения, поэтому их можно
+    // переносить по порядку
+    MsgFeatureLayout(&src, buf->data + sizeof(MsgHeader),
+        msg->uni.features.count, msg->uni.features.descriptorSize);
+    MsgFeatureLayout(&dst, buf->data + sizeof(MsgHeader), count,
+        msg->uni.features.descriptorSize);
+    if (count < src.count)
+    {
+        memmove(dst.y, src.y, count * sizeof(float));
+        memmove(dst.size, src.size, count * sizeof(float));
+        memmove(dst.angle, src.angle, count * sizeof(float));
+        memmove(dst.response, src.response, count * sizeof(float));
+        memmove(dst.octave, src.octave, count * sizeof(int32_t));
+        memmove(dst.descriptors, src.descriptors,
+            count * src.descriptorSize);
+    }
+
+    // Сокращаем сообщение до фактического количества точек (память
+    // буфера остается прежней)
+    msg->uni.features.count = count;
+    msg_size = MsgCalcSize(msg);
+    buf->chunksCount = (msg_size + buf->chunkSizeMax - 1) / buf->chunkSizeMax;
+    buf->size = buf->chunksCount * buf->chunkSizeMax;
+
+    // Обнуляем дополнение последнего фрагмента: там могли остаться
+    // незаполненные зарезервированные данные или данные прошлого сообщения
+    memset(buf->data + msg_size, 0, buf->size - msg_size);
+}
@@ -0,0 +1,66 @@
+// msg_feature.h: Функции для формирования и чтения сообщений типа
+// MsgTypeFeatures с особыми точками кадра и их двоичными дескрипторами.
+//
+// Сообщение хранит точки по столбцам: за заголовком сообщения следуют
+// массивы x, y, size, angle, response (по count чисел float) и octave (по
+// count чисел int32), а за ними count дескрипторов по descriptorSize байт
+// подряд. Каждое поле всех точек лежит в памяти сплошным массивом, поэтому
+// его можно обрабатывать векторными командами, а дескрипторы сравнивать
+// прямо в буфере сообщения без копирования.
+
+#ifndef MSG_FEATURE_H
+#define MSG_FEATURE_H
+
+#include <stddef.h>      // size_t
+#include <stdint.h>      // int32_t
+#include "msg_buf.h"   // заголовок и буфер сообщения
+
+
+/* MsgFeatureColumns: Структура представляет столбцы особых точек в буфере
+ * сообщения типа MsgTypeFeatures. Указатели ссылаются прямо в память
+ * буфера и действительны, пока буфер не освобожден. Поля точек следуют
+ * соглашениям OpenCV (cv::KeyPoint). */
+typedef struct MsgFeatureColumnsStruct
+{
+    size_t count;          // количество особых точек
+    size_t descriptorSize; // размер дескриптора в байтах
+    float* x;              // координаты точек в пикселях кадра
+    float* y;
+    float* size;           // диаметр окрестности точки в пикселях
+    float* angle;          // направление точки в градусах (-1 - не задано)
+    float* response;       // отклик детектора (сила точки)
+    int32_t* octave;       // уровень пирамиды изображений
+    unsigned char* descriptors; // дескрипторы: дескриптор точки i
+        /* начинается с байта i * descriptorSize */
+} MsgFeatureColumns, *MsgFeatureColumnsPtr;
+
+
+// Функция возвращает размер дескриптора вида type в байтах (0 для
+// MsgDescriptorOther, размер которого задает приложение).
+extern size_t MsgFeatureDescriptorSize(MsgDescriptorType type);
+
+// Функция записывает в cols указатели на столбцы особых точек сообщения в
+// буфере buf. Возвращает FALSE, если это не сообщение типа
+// MsgTypeFeatures, размер дескриптора в заголовке больше
+// MSG_DESCRIPTOR_SIZE_MAX или буфер короче, чем требует заголовок.
+extern BOOL MsgFeatureGetColumns(const MsgBuffer* buf,
+    MsgFeatureColumns* cols);
+
+// Функция начинает сообщение не более чем с maxCount особыми точками прямо
+// в буфере отправки buf (буфер инициализируется так же, как в функции
+// MsgCloudBuild), записывает в него заголовок msg и заполняет cols
+// указателями на столбцы в буфере. Приложение записывает точки и
+// дескрипторы прямо в столбцы, а затем вызывает MsgFeatureBuildFinish.
+// При ошибке функция возвращает FALSE.
+extern BOOL MsgFeatureBuild(MsgBuffer* buf, const MsgHeader* msg,
+    size_t maxCount, size_t mtu, MsgBufferPool* pool,
+    MsgFeatureColumns* cols);
+
+// Функция завершает сообщение, начатое функцией MsgFeatureBuild:
+// записывает в заголовок фактическое количество точек count (не больше
+// зарезервированного), сдвигает столбцы вплотную друг к другу и
+// отбрасывает лишние пакеты сообщения.
+extern void MsgFeatureBuildFinish(MsgBuffer* buf, size_t count);
+
+
+#endif // MSG_FEATURE_H
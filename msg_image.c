@@ -0,0 +1,423 @@
+// msg_image.c: Реализация функций для преобразования кадров видеокамеры
+// из сообщений типа MsgTypeImage на принимающей стороне.
+//
+// Перевод YUV в RGB выполняется по формулам ITU-R BT.601 (ограниченный
+// диапазон) в целочисленной арифметике с 6 битами дробной части, так что
+// векторный (SSSE3, NEON) и скалярный варианты дают одинаковый результат.
+//
+
+#include <string.h>      // memcpy()
+#include <assert.h>
+#include "msg_image.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>   // SSE2, SSSE3
+#define MSG_IMAGE_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MSG_IMAGE_NEON
+#endif
+
+
+// Функция ограничивает значение диапазоном байта.
+static unsigned char MsgClampByte(int value)
+{
+    return (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+
+// ------------------------ Преобразование YUV в RGB ------------------------
+
+// Функция переводит пиксели строки YUV 4:2:0 в RGB, начиная с пикселя x0.
+// Отсчеты цветности берутся с шагом cstep байт (2 для NV12, 1 для I420).
+static void MsgYuvRowToRGBScalar(const unsigned char* yrow,
+    const unsigned char* urow, const unsigned char* vrow, size_t cstep,
+    unsigned char* dst, size_t x0, size_t width)
+{
+    for (size_t x = x0; x < width; x++)
+    {
+        int yy = 74 * ((int) yrow[x] - 16);
+        int u = (int) urow[(x / 2) * cstep] - 128;
+        int v = (int) vrow[(x / 2) * cstep] - 128;
+        dst[3*x + 0] = MsgClampByte((yy + 102 * v) >> 6);
+        dst[3*x + 1] = MsgClampByte((yy - 25 * u - 52 * v) >> 6);
+        dst[3*x + 2] = MsgClampByte((yy + 129 * u) >> 6);
+    }
+}
+
+
+#ifdef MSG_IMAGE_X86
+
+// Функция вычисляет каналы R, G, B для 8 пикселей (16-битные элементы).
+__attribute__((target("ssse3")))
+static void MsgYuv8ToRGB(__m128i y, __m128i u, __m128i v,
+    __m128i* r, __m128i* g, __m128i* b)
+{
+    __m128i yy = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)),
+        _mm_set1_epi16(74));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    // Насыщение при сложении срабатывает только для значений > 255
+    *r = _mm_srai_epi16(_mm_adds_epi16(yy,
+        _mm_mullo_epi16(v, _mm_set1_epi16(102))), 6);
+    *g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yy,
+        _mm_mullo_epi16(u, _mm_set1_epi16(25))),
+        _mm_mullo_epi16(v, _mm_set1_epi16(52))), 6);
+    *b = _mm_srai_epi16(_mm_adds_epi16(yy,
+        _mm_mullo_epi16(u, _mm_set1_epi16(129))), 6);
+}
+
+
+// Функция переводит строку YUV в RGB по 16 пикселей за итерацию и
+// возвращает количество обработанных пикселей. Каждая запись в память
+// захватывает 4 лишних байта следующего пикселя, поэтому за последним
+// обрабатываемым блоком в строке должно оставаться не менее 2 пикселей.
+__attribute__((target("ssse3")))
+static size_t MsgYuvRowToRGBSsse3(const unsigned char* yrow,
+    const unsigned char* urow, const unsigned char* vrow, BOOL interleaved,
+    unsigned char* dst, size_t width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+        12, 13, 14, -1, -1, -1, -1);
+    size_t x = 0;
+
+    for (x = 0; x + 18 <= width; x += 16)
+    {
+        __m128i yb = _mm_loadu_si128((const __m128i*) (yrow + x));
+        __m128i u, v, r0, g0, b0, r1, g1, b1;
+        if (interleaved)
+        {
+            __m128i uv = _mm_loadu_si128((const __m128i*) (urow + x));
+            u = _mm_and_si128(uv, _mm_set1_epi16(0x00FF));
+            v = _mm_srli_epi16(uv, 8);
+        }
+        else
+        {
+            u = _mm_unpacklo_epi8(
+                _mm_loadl_epi64((const __m128i*) (urow + x / 2)), zero);
+            v = _mm_unpacklo_epi8(
+                _mm_loadl_epi64((const __m128i*) (vrow + x / 2)), zero);
+        }
+
+        // Каждый отсчет цветности относится к двум соседним пикселям
+        MsgYuv8ToRGB(_mm_unpacklo_epi8(yb, zero),
+            _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v),
+            &r0, &g0, &b0);
+        MsgYuv8ToRGB(_mm_unpackhi_epi8(yb, zero),
+            _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v),
+            &r1, &g1, &b1);
+        __m128i r = _mm_packus_epi16(r0, r1);
+        __m128i g = _mm_packus_epi16(g0, g1);
+        __m128i b = _mm_packus_epi16(b0, b1);
+
+        // Собираем пиксели RGBX и сжимаем их до RGB
+        __m128i rgLo = _mm_unpacklo_epi8(r, g);
+        __m128i rgHi = _mm_unpackhi_epi8(r, g);
+        __m128i bxLo = _mm_unpacklo_epi8(b, zero);
+        __m128i bxHi = _mm_unpackhi_epi8(b, zero);
+        unsigned char* out = dst + 3 * x;
+        _mm_storeu_si128((__m128i*) (out + 0), _mm_shuffle_epi8(
+            _mm_unpacklo_epi16(rgLo, bxLo), pack));
+        _mm_storeu_si128((__m128i*) (out + 12), _mm_shuffle_epi8(
+            _mm_unpackhi_epi16(rgLo, bxLo), pack));
+        _mm_storeu_si128((__m128i*) (out + 24), _mm_shuffle_epi8(
+            _mm_unpacklo_epi16(rgHi, bxHi), pack));
+        _mm_storeu_si128((__m128i*) (out + 36), _mm_shuffle_epi8(
+            _mm_unpackhi_epi16(rgHi, bxHi), pack));
+    }
+    return x;
+}
+
+#endif // MSG_IMAGE_X86
+
+
+#ifdef MSG_IMAGE_NEON
+
+// Функция вычисляет каналы R, G, B для 8 пикселей (16-битные элементы).
+static void MsgYuv8ToRGB(int16x8_t y, int16x8_t u, int16x8_t v,
+    uint8x8_t* r, uint8x8_t* g, uint8x8_t* b)
+{
+    int16x8_t yy = vmulq_n_s16(vsubq_s16(y, vdupq_n_s16(16)), 74);
+    u = vsubq_s16(u, vdupq_n_s16(128));
+    v = vsubq_s16(v, vdupq_n_s16(128));
+    *r = vqmovun_s16(vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(v, 102)), 6));
+    *g = vqmovun_s16(vshrq_n_s16(vqsubq_s16(vqsubq_s16(yy,
+        vmulq_n_s16(u, 25)), vmulq_n_s16(v, 52)), 6));
+    *b = vqmovun_s16(vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(u, 129)), 6));
+}
+
+
+// Функция переводит строку YUV в RGB по 16 пикселей за итерацию и
+// возвращает количество обработанных пикселей.
+static size_t MsgYuvRowToRGBNeon(const unsigned char* yrow,
+    const unsigned char* urow, const unsigned char* vrow, BOOL interleaved,
+    unsigned char* dst, size_t width)
+{
+    size_t x = 0;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+        uint8x16_t yb = vld1q_u8(yrow + x);
+        uint8x8_t u8, v8;
+        uint8x16x3_t rgb;
+        uint8x8_t r0, g0, b0, r1, g1, b1;
+        if (interleaved)
+        {
+            uint8x8x2_t uv = vld2_u8(urow + x);
+            u8 = uv.val[0];
+            v8 = uv.val[1];
+        }
+        else
+        {
+            u8 = vld1_u8(urow + x / 2);
+            v8 = vld1_u8(vrow + x / 2);
+        }
+
+        // Каждый отсчет цветности относится к двум соседним пикселям
+        uint8x8x2_t uu = vzip_u8(u8, u8);
+        uint8x8x2_t vv = vzip_u8(v8, v8);
+        MsgYuv8ToRGB(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(yb))),
+            vreinterpretq_s16_u16(vmovl_u8(uu.val[0])),
+            vreinterpretq_s16_u16(vmovl_u8(vv.val[0])), &r0, &g0, &b0);
+        MsgYuv8ToRGB(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(yb))),
+            vreinterpretq_s16_u16(vmovl_u8(uu.val[1])),
+            vreinterpretq_s16_u16(vmovl_u8(vv.val[1])), &r1, &g1, &b1);
+        rgb.val[0] = vcombine_u8(r0, r1);
+        rgb.val[1] = vcombine_u8(g0, g1);
+        rgb.val[2] = vcombine_u8(b0, b1);
+        vst3q_u8(dst + 3 * x, rgb);
+    }
+    return x;
+}
+
+#endif // MSG_IMAGE_NEON
+
+
+// Функция переводит кадр YUV 4:2:0 (NV12 или I420) в RGB.
+static void MsgYuvToRGB(const MsgHeader* msg, const unsigned char* src,
+    unsigned char* rgb)
+{
+    size_t width = msg->uni.image.width;
+    size_t height = msg->uni.image.height;
+    size_t cw = (width + 1) / 2;   // размеры плоскостей цветности
+    size_t ch = (height + 1) / 2;
+    BOOL interleaved = (msg->uni.image.format == MsgImageFormatNV12);
+    const unsigned char* uplane = src + width * height;
+    const unsigned char* vplane = interleaved ? uplane + 1 : uplane + cw * ch;
+    size_t cstride = interleaved ? 2 * cw : cw; // шаг строк цветности
+    size_t cstep = interleaved ? 2 : 1;
+
+    for (size_t y = 0; y < height; y++)
+    {
+        const unsigned char* yrow = src + y * width;
+        const unsigned char* urow = uplane + (y / 2) * cstride;
+        const unsigned char* vrow = vplane + (y / 2) * cstride;
+        unsigned char* dst = rgb + 3 * y * width;
+        size_t x = 0;
+
+#if defined(MSG_IMAGE_X86)
+        if (__builtin_cpu_supports("ssse3"))
+            x = MsgYuvRowToRGBSsse3(yrow, urow, vrow, interleaved, dst, width);
+#elif defined(MSG_IMAGE_NEON)
+        x = MsgYuvRowToRGBNeon(yrow, urow, vrow, interleaved, dst, width);
+#endif
+        MsgYuvRowToRGBScalar(yrow, urow, vrow, cstep, dst, x, width);
+    }
+}
+
+
+// --------------------- Восстановление цвета по Байеру ---------------------
+
+// Функция восстанавливает цветное изображение по кадру с матрицы Байера
+// билинейной интерполяцией. На границах кадра соседние пиксели берутся
+// зеркально, что сохраняет чередование цветов матрицы.
+static BOOL MsgBayerToRGB(const MsgHeader* msg, const unsigned char* src,
+    unsigned char* rgb)
+{
+    size_t width = msg->uni.image.width;
+    size_t height = msg->uni.image.height;
+    size_t rx = 0, ry = 0;  // положение красного пикселя в ячейке 2x2
+
+    switch (msg->uni.image.format)
+    {
+    case MsgImageFormatBayerRGGB: rx = 0; ry = 0; break;
+    case MsgImageFormatBayerGRBG: rx = 1; ry = 0; break;
+    case MsgImageFormatBayerGBRG: rx = 0; ry = 1; break;
+    case MsgImageFormatBayerBGGR: rx = 1; ry = 1; break;
+    default:
+        return FALSE;
+    }
+    if (width < 2 || height < 2)
+        return FALSE;
+
+    for (size_t y = 0; y < height; y++)
+    {
+        const unsigned char* up = src + (y > 0 ? y - 1 : 1) * width;
+        const unsigned char* mid = src + y * width;
+        const unsigned char* dn = src + (y + 1 < height ? y + 1 : y - 1) * width;
+        unsigned char* dst = rgb + 3 * y * width;
+
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t l = (x > 0) ? x - 1 : 1;
+            size_t r = (x + 1 < width) ? x + 1 : x - 1;
+            int c = mid[x];
+            int cross = (up[x] + dn[x] + mid[l] + mid[r] + 2) >> 2;
+            int diag = (up[l] + up[r] + dn[l] + dn[r] + 2) >> 2;
+            int horz = (mid[l] + mid[r] + 1) >> 1;
+            int vert = (up[x] + dn[x] + 1) >> 1;
+            BOOL redRow = ((y & 1) == ry);
+            BOOL redCol = ((x & 1) == rx);
+
+            if (redRow && redCol)        // красный пиксель
+            {
+                dst[3*x + 0] = c; dst[3*x + 1] = cross; dst[3*x + 2] = diag;
+            }
+            else if (!redRow && !redCol) // синий пиксель
+            {
+                dst[3*x + 0] = diag; dst[3*x + 1] = cross; dst[3*x + 2] = c;
+            }
+            else if (redRow)             // зеленый в строке с красным
+            {
+                dst[3*x + 0] = horz; dst[3*x + 1] = c; dst[3*x + 2] = vert;
+            }
+            else                         // зеленый в строке с синим
+            {
+                dst[3*x + 0] = vert; dst[3*x + 1] = c; dst[3*x + 2] = horz;
+            }
+        }
+    }
+    return TRUE;
+}
+
+
+// ----------------------- Функции из msg_image.h ---------------------------
+
+
+// Функция возвращает указатель на начало пикселей кадра в буфере
+// сообщения.
+void* MsgImagePixels(const MsgBuffer* buf)
+{
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    return buf->data + sizeof(MsgHeader);
+}
+
+
+// Функция начинает сообщение с кадром прямо в буфере отправки.
+unsigned char* MsgImageBuild(MsgBuffer* buf, const MsgHeader* msg,
+    size_t mtu, MsgBufferPool* pool, size_t* pitch)
+{
+    size_t width = msg->uni.image.width;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypeImage);
+    assert(pool == NULL || pool->mtu == mtu);
+
+    // Шаг строк: пиксели кадра в сообщении идут без выравнивания строк
+    switch (msg->uni.image.format)
+    {
+    case MsgImageFormatRGB:
+        *pitch = 3 * width;
+        break;
+    case MsgImageFormatRGBA:
+        *pitch = 4 * width;
+        break;
+    case MsgImageFormatDepth16:
+        *pitch = 2 * width;
+        break;
+    default:  // 1 байт на пиксель (для YUV 4:2:0 - в плоскости яркости)
+        *pitch = width;
+        break;
+    }
+
+    if (pool ? !MsgBufferInitPooled(buf, msg, pool) :
+        !MsgBufferInit(buf, msg, mtu))
+        return NULL;
+    memcpy(buf->data, msg, sizeof(MsgHeader));
+    return (unsigned char*) MsgImagePixels(buf);
+}
+
+
+// Функция переводит кадр из формата сообщения в цветное изображение RGB.
+BOOL MsgImageToRGB(const MsgHeader* msg, const unsigned char* src,
+    unsigned char* rgb)
+{
+    size_t npix = 0;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypeImage);
+
+    npix = msg->uni.image.width * msg->uni.image.height;
+    switch (msg->uni.image.format)
+    {
+    case MsgImageFormatGray:
+        for (size_t i = 0; i < npix; i++)
+            rgb[3*i + 0] = rgb[3*i + 1] = rgb[3*i + 2] = src[i];
+        return TRUE;
+    case MsgImageFormatRGB:
+        memcpy(rgb, src, 3 * npix);
+        return TRUE;
+    case MsgImageFormatRGBA:
+        for (size_t i = 0; i < npix; i++)
+            memcpy(rgb + 3*i, src + 4*i, 3);
+        return TRUE;
+    case MsgImageFormatNV12:
+    case MsgImageFormatI420:
+        MsgYuvToRGB(msg, src, rgb);
+        return TRUE;
+    case MsgImageFormatBayerRGGB:
+    case MsgImageFormatBayerBGGR:
+    case MsgImageFormatBayerGRBG:
+    case MsgImageFormatBayerGBRG:
+        return MsgBayerToRGB(msg, src, rgb);
+    default:
+        // Карта глубины и неизвестные форматы не переводятся в RGB
+        return FALSE;
+    }
+}
+
+
+// Функция переводит карту глубины в массив значений float в метрах.
+BOOL MsgImageDepthToFloat(const MsgHeader* msg, const uint16_t* src,
+    float* meters)
+{
+    size_t npix = 0;
+    size_t i = 0;
+    float scale = 0;
+
+    assert(msg->magicNumber == MSG_HEADER_MAGIC);
+    assert(msg->type == MsgTypeImage);
+
+    if (msg->uni.image.format != MsgImageFormatDepth16)
+        return FALSE;
+    npix = msg->uni.image.width * msg->uni.image.height;
+    scale = (float) msg->uni.image.depthScale;
+
+#if defined(MSG_IMAGE_X86) && defined(__SSE2__)
+    __m128 s = _mm_set1_ps(scale);
+    __m128i zero = _mm_setzero_si128();
+    for (i = 0; i + 8 <= npix; i += 8)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(d, zero));
+        _mm_storeu_ps(meters + i, _mm_mul_ps(lo, s));
+        _mm_storeu_ps(meters + i + 4, _mm_mul_ps(hi, s));
+    }
+#elif defined(MSG_IMAGE_NEON)
+    for (i = 0; i + 8 <= npix; i += 8)
+    {
+        uint16x8_t d = vld1q_u16(src + i);
+        vst1q_f32(meters + i,
+            vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(d))), scale));
+        vst1q_f32(meters + i + 4,
+            vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(d))), scale));
+    }
+#endif
+
+    // Оставшиеся пиксели переводим по одному
+    for (; i < npix; i++)
+        meters[i] = scale * src[i];
+    return TRUE;
+}
@@ -0,0 +1,42 @@
+// msg_image.h: Функции для формирования сообщений типа MsgTypeImage на
+// отправляющей стороне и для преобразования кадров видеокамеры из таких
+// сообщений на принимающей стороне.
+
+#ifndef MSG_IMAGE_H
+#define MSG_IMAGE_H
+
+#include <stddef.h>      // size_t
+#include <stdint.h>      // uint16_t
+#include "msg_buf.h"   // заголовок и буфер сообщения
+
+
+// Функция возвращает указатель на начало пикселей кадра в буфере
+// сообщения (сразу после заголовка сообщения).
+extern void* MsgImagePixels(const MsgBuffer* buf);
+
+// Функция начинает сообщение с кадром прямо в буфере отправки buf (буфер
+// инициализируется так же, как в функции MsgCloudBuild), записывает в
+// него заголовок msg и возвращает указатель на первую строку пикселей
+// кадра, а в *pitch записывает шаг между строками в байтах. Для форматов
+// NV12 и I420 указатель и шаг относятся к плоскости яркости, а плоскости
+// цветности следуют сразу за ней. Приложение (или драйвер камеры)
+// записывает пиксели прямо в буфер. При ошибке функция возвращает NULL.
+extern unsigned char* MsgImageBuild(MsgBuffer* buf, const MsgHeader* msg,
+    size_t mtu, MsgBufferPool* pool, size_t* pitch);
+
+// Функция переводит кадр из формата msg->uni.image.format в цветное
+// изображение RGB (3 байта на пиксель, строки без выравнивания).
+// Поддерживаются форматы Gray, RGB, RGBA, NV12, I420 и все варианты
+// матрицы Байера (восстановление цвета билинейной интерполяцией).
+// Для карты глубины и неизвестных форматов функция возвращает FALSE.
+extern BOOL MsgImageToRGB(const MsgHeader* msg, const unsigned char* src,
+    unsigned char* rgb);
+
+// Функция переводит карту глубины формата MsgImageFormatDepth16 в массив
+// значений float в метрах с учетом msg->uni.image.depthScale. Нулевые
+// (недостоверные) значения глубины остаются нулевыми.
+extern BOOL MsgImageDepthToFloat(const MsgHeader* msg, const uint16_t* src,
+    float* meters);
+
+
+#endif // MSG_IMAGE_H
@@ -0,0 +1,678 @@
+// msg_map.c: Реализация функций для накопления глобальной карты из
+// принятых облаков точек.
+//
+// Вставка облака идет в два прохода. Сначала потоки делят точки облака
+// поровну, переводят их в систему карты и вычисляют ключи и номера частей
+// их ячеек. Затем каждый поток вставляет в свою часть карты точки, которые
+// в нее попали, поэтому части не требуют блокировок.
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // malloc(), free()
+#include <string.h>      // bzero(), memset()
+#include <math.h>        // isfinite(), sqrt()
+#include <pthread.h>     // потоки вставки
+#include <assert.h>
+#include "msg_map.h"
+#include "msg_cloud.h"
+
+// Предельное количество потоков вставки
+#define MSG_MAP_THREADS_MAX 64
+
+// Смещение индекса ячейки, переводящее его в беззнаковый 21-битный код
+#define MSG_MAP_BIAS (1 << 20)
+#define MSG_MAP_MASK ((1 << 21) - 1)
+
+// Начальные размеры хеш-таблицы и массива ячеек части
+#define MSG_MAP_TABLE_MIN 4096
+#define MSG_MAP_VOXELS_MIN 1024
+
+// Предельное количество точек в сумме ячейки: дальше центр масс ячейки
+// становится скользящим средним и следует за новыми наблюдениями
+#define MSG_MAP_COUNT_MAX 1024
+
+// Количество интервалов гистограммы возраста ячеек при удалении
+#define MSG_MAP_AGE_BINS 256
+
+// Номер части, отмечающий точку с недопустимыми координатами
+#define MSG_MAP_NO_SHARD 0xFF
+
+
+/* MsgMapTask: Структура описывает вставку облака в карту. */
+typedef struct MsgMapTaskStruct
+{
+    MsgMap* map;           // карта
+    const float* xyz;      // точки облака в его системе
+    size_t npts;           // количество точек
+    BOOL transform;        // нужно ли переводить точки в систему карты
+    float rot[9];          // матрица поворота (по строкам)
+    float trans[3];        // сдвиг
+} MsgMapTask;
+
+
+/* MsgMapWorker: Структура описывает долю работы одного потока. */
+typedef struct MsgMapWorkerStruct
+{
+    MsgMapTask* task;      // вставка облака
+    size_t index;          // номер потока (и его части карты)
+    int phase;             // проход вставки (0 - ключи, 1 - части)
+} MsgMapWorker;
+
+
+// Функция вычисляет индекс ячейки сетки по координате точки.
+static uint64_t MsgMapIndex(float value, float invLeaf)
+{
+    float v = value * invLeaf;
+    long i = 0;
+
+    // Ограничиваем индекс допустимым диапазоном и округляем вниз
+    if (v < -MSG_MAP_BIAS) v = -MSG_MAP_BIAS;
+    if (v > MSG_MAP_BIAS - 1) v = MSG_MAP_BIAS - 1;
+    i = (long) v;
+    if (v < i) i--;
+    return (uint64_t) (i + MSG_MAP_BIAS) & MSG_MAP_MASK;
+}
+
+
+// Функция упаковывает индексы ячейки по трем осям в ключ.
+static uint64_t MsgMapKey(uint64_t ix, uint64_t iy, uint64_t iz)
+{
+    return ix | (iy << 21) | (iz << 42);
+}
+
+
+// Функция перемешивает разряды ключа ячейки. Старшие разряды результата
+// задают часть карты, средние - позицию в хеш-таблице части, так что
+// внутри части ячейки распределены по всей таблице.
+static uint64_t MsgMapMix(uint64_t key)
+{
+    return key * 0x9E3779B97F4A7C15ull;
+}
+
+
+// Функция вычисляет номер части карты для ключа ячейки.
+static size_t MsgMapShardOf(const MsgMap* map, uint64_t key)
+{
+    return (size_t) (MsgMapMix(key) >> 56) % map->shardCount;
+}
+
+
+// Функция вычисляет начальную позицию ячейки в хеш-таблице части.
+static size_t MsgMapHash(uint64_t key, size_t capacity)
+{
+    return (size_t) (MsgMapMix(key) >> 16) & (capacity - 1);
+}
+
+
+// Функция заполняет хеш-таблицу части заново по массиву ключей ячеек.
+static void MsgMapShardRehash(MsgMapShard* shard)
+{
+    memset(shard->table, 0, shard->capacity * sizeof(MsgMapEntry));
+    for (size_t i = 0; i < shard->count; i++)
+    {
+        size_t pos = MsgMapHash(shard->keys[i], shard->capacity);
+        while (shard->table[pos].slot != 0)
+            pos = (pos + 1) & (shard->capacity - 1);
+        shard->table[pos].key = shard->keys[i];
+        shard->table[pos].slot = (uint32_t) (i + 1);
+    }
+}
+
+
+// Функция увеличивает хеш-таблицу части вдвое.
+static BOOL MsgMapShardGrowTable(MsgMapShard* shard)
+{
+    size_t capacity = shard->capacity ? 2 * shard->capacity
+        : MSG_MAP_TABLE_MIN;
+    MsgMapEntry* table = (MsgMapEntry*) malloc(capacity *
+        sizeof(MsgMapEntry));
+
+    if (!table)
+        return FALSE;
+    free(shard->table);
+    shard->table = table;
+    shard->capacity = capacity;
+    MsgMapShardRehash(shard);
+    return TRUE;
+}
+
+
+// Функция увеличивает массивы ячеек части вдвое, но не больше limit.
+static BOOL MsgMapShardGrowVoxels(MsgMapShard* shard, size_t limit)
+{
+    size_t maxCount = shard->maxCount ? 2 * shard->maxCount
+        : MSG_MAP_VOXELS_MIN;
+    MsgMapVoxel* voxels = NULL;
+    uint64_t* keys = NULL;
+
+    if (maxCount > limit)
+        maxCount = limit;
+    voxels = (MsgMapVoxel*) realloc(shard->voxels,
+        maxCount * sizeof(MsgMapVoxel));
+    if (!voxels)
+        return FALSE;
+    shard->voxels = voxels;
+    keys = (uint64_t*) realloc(shard->keys, maxCount * sizeof(uint64_t));
+    if (!keys)
+        return FALSE;
+    shard->keys = keys;
+    shard->maxCount = maxCount;
+    return TRUE;
+}
+
+
+// Функция удаляет из части не меньше четверти ячеек, дольше всего не
+// обновлявшихся (но не ячейки текущего облака stamp). Возвращает
+// количество удаленных ячеек.
+static size_t MsgMapShardEvict(MsgMapShard* shard, uint32_t stamp)
+{
+    size_t hist[MSG_MAP_AGE_BINS];
+    size_t target = shard->count / 4;
+    size_t above = 0;
+    size_t kept = 0;
+    uint32_t threshold = MSG_MAP_AGE_BINS - 1;
+
+    // Строим гистограмму возраста ячеек и находим наименьший возраст,
+    // начиная с которого ячеек не меньше четверти
+    memset(hist, 0, sizeof(hist));
+    for (size_t i = 0; i < shard->count; i++)
+    {
+        uint32_t age = stamp - shard->voxels[i].stamp;
+        hist[age < MSG_MAP_AGE_BINS ? age : MSG_MAP_AGE_BINS - 1]++;
+    }
+    for (; threshold > 1; threshold--)
+    {
+        above += hist[threshold];
+        if (above >= target)
+            break;
+    }
+
+    // Сжимаем массивы ячеек и перестраиваем хеш-таблицу
+    for (size_t i = 0; i < shard->count; i++)
+        if (stamp - shard->voxels[i].stamp < threshold)
+        {
+            shard->voxels[kept] = shard->voxels[i];
+            shard->keys[kept] = shard->keys[i];
+            kept++;
+        }
+    if (kept == shard->count)
+        return 0;
+    above = shard->count - kept;
+    shard->count = kept;
+    MsgMapShardRehash(shard);
+    shard->evictedCount += above;
+    return above;
+}
+
+
+// Функция добавляет точку p в ячейку key части карты, создавая ячейку при
+// необходимости. Часть содержит не больше limit ячеек. Возвращает FALSE,
+// если ячейку некуда добавить.
+static BOOL MsgMapShardInsert(MsgMapShard* shard, uint64_t key,
+    const float* p, uint32_t stamp, size_t limit)
+{
+    MsgMapVoxel* voxel = NULL;
+    size_t pos = 0;
+
+    // Заполняем хеш-таблицу не больше чем наполовину
+    if (2 * (shard->count + 1) > shard->capacity &&
+        !MsgMapShardGrowTable(shard))
+        return FALSE;
+
+    pos = MsgMapHash(key, shard->capacity);
+    while (shard->table[pos].slot != 0 && shard->table[pos].key != key)
+        pos = (pos + 1) & (shard->capacity - 1);
+
+    if (shard->table[pos].slot != 0)
+    {
+        // Повторное наблюдение ячейки уточняет ее центр масс
+        voxel = &shard->voxels[shard->table[pos].slot - 1];
+        if (voxel->count >= MSG_MAP_COUNT_MAX)
+        {
+            float k = (float) (MSG_MAP_COUNT_MAX - 1) / MSG_MAP_COUNT_MAX;
+            voxel->sum[0] *= k;
+            voxel->sum[1] *= k;
+            voxel->sum[2] *= k;
+        }
+        else
+            voxel->count++;
+        voxel->sum[0] += p[0];
+        voxel->sum[1] += p[1];
+        voxel->sum[2] += p[2];
+        voxel->stamp = stamp;
+        return TRUE;
+    }
+
+    // Новая ячейка: при переполнении части освобождаем место за счет
+    // старых ячеек и ищем позицию заново
+    if (shard->count >= limit)
+    {
+        if (shard->fullStamp == stamp || MsgMapShardEvict(shard, stamp) == 0)
+        {
+            shard->fullStamp = stamp;
+            return FALSE;
+        }
+        pos = MsgMapHash(key, shard->capacity);
+        while (shard->table[pos].slot != 0)
+            pos = (pos + 1) & (shard->capacity - 1);
+    }
+    if (shard->count == shard->maxCount &&
+        !MsgMapShardGrowVoxels(shard, limit))
+        return FALSE;
+
+    voxel = &shard->voxels[shard->count];
+    voxel->sum[0] = p[0];
+    voxel->sum[1] = p[1];
+    voxel->sum[2] = p[2];
+    voxel->count = 1;
+    voxel->stamp = stamp;
+    shard->keys[shard->count] = key;
+    shard->count++;
+    shard->table[pos].key = key;
+    shard->table[pos].slot = (uint32_t) shard->count;
+    return TRUE;
+}
+
+
+// Функция выполняет долю потока в проходе вставки облака.
+static void* MsgMapWork(void* arg)
+{
+    MsgMapWorker* worker = (MsgMapWorker*) arg;
+    MsgMapTask* task = worker->task;
+    MsgMap* map = task->map;
+    float invLeaf = 1.0f / map->leafSize;
+
+    if (worker->phase == 0)
+    {
+        // Переводим свою долю точек в систему карты и вычисляем ячейки
+        size_t begin = task->npts * worker->index / map->shardCount;
+        size_t end = task->npts * (worker->index + 1) / map->shardCount;
+        const float* r = task->rot;
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const float* p = task->xyz + 3 * i;
+            float* w = map->world + 3 * i;
+            uint64_t key = 0;
+
+            if (task->transform)
+            {
+                w[0] = r[0] * p[0] + r[1] * p[1] + r[2] * p[2] + task->trans[0];
+                w[1] = r[3] * p[0] + r[4] * p[1] + r[5] * p[2] + task->trans[1];
+                w[2] = r[6] * p[0] + r[7] * p[1] + r[8] * p[2] + task->trans[2];
+            }
+            else
+            {
+                w[0] = p[0];
+                w[1] = p[1];
+                w[2] = p[2];
+            }
+            if (!isfinite(w[0]) || !isfinite(w[1]) || !isfinite(w[2]))
+            {
+                map->pointShards[i] = MSG_MAP_NO_SHARD;
+                continue;
+            }
+            key = MsgMapKey(MsgMapIndex(w[0], invLeaf),
+                MsgMapIndex(w[1], invLeaf), MsgMapIndex(w[2], invLeaf));
+            map->pointKeys[i] = key;
+            map->pointShards[i] = (unsigned char) MsgMapShardOf(map, key);
+        }
+    }
+    else
+    {
+        // Вставляем в свою часть карты попавшие в нее точки
+        MsgMapShard* shard = &map->shards[worker->index];
+        size_t limit = map->maxVoxels / map->shardCount;
+
+        if (limit < 1)
+            limit = 1;
+        for (size_t i = 0; i < task->npts; i++)
+            if (map->pointShards[i] == worker->index &&
+                !MsgMapShardInsert(shard, map->pointKeys[i],
+                    map->world + 3 * i, map->stamp, limit))
+                shard->droppedCount++;
+    }
+    return NULL;
+}
+
+
+// Функция выполняет проход phase вставки облака всеми потоками. Если
+// поток не удалось запустить, его доля выполняется в текущем потоке.
+static void MsgMapRun(MsgMapTask* task, int phase)
+{
+    MsgMap* map = task->map;
+    MsgMapWorker workers[MSG_MAP_THREADS_MAX];
+    pthread_t threads[MSG_MAP_THREADS_MAX];
+    BOOL started[MSG_MAP_THREADS_MAX];
+
+    for (size_t i = 0; i < map->shardCount; i++)
+    {
+        workers[i].task = task;
+        workers[i].index = i;
+        workers[i].phase = phase;
+        started[i] = (i > 0) &&
+            pthread_create(&threads[i], NULL, MsgMapWork, &workers[i]) == 0;
+    }
+    for (size_t i = 0; i < map->shardCount; i++)
+        if (!started[i])
+            MsgMapWork(&workers[i]);
+    for (size_t i = 1; i < map->shardCount; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+}
+
+
+// Функция увеличивает служебные массивы карты до npts точек.
+static BOOL MsgMapReserve(MsgMap* map, size_t npts)
+{
+    float* decoded = NULL;
+    float* world = NULL;
+    uint64_t* keys = NULL;
+    unsigned char* shards = NULL;
+
+    if (npts <= map->scratchSize)
+        return TRUE;
+    decoded = (float*) malloc(npts * 3 * sizeof(float));
+    world = (float*) malloc(npts * 3 * sizeof(float));
+    keys = (uint64_t*) malloc(npts * sizeof(uint64_t));
+    shards = (unsigned char*) malloc(npts);
+    if (!decoded || !world || !keys || !shards)
+    {
+        free(decoded);
+        free(world);
+        free(keys);
+        free(shards);
+        return FALSE;
+    }
+    free(map->decoded);
+    free(map->world);
+    free(map->pointKeys);
+    free(map->pointShards);
+    map->decoded = decoded;
+    map->world = world;
+    map->pointKeys = keys;
+    map->pointShards = shards;
+    map->scratchSize = npts;
+    return TRUE;
+}
+
+
+// Функция инициализирует пустую карту.
+BOOL MsgMapInit(MsgMap* map, float leafSize, size_t maxVoxels,
+    size_t threadCount)
+{
+    bzero(map, sizeof(MsgMap));
+    if (leafSize <= 0.0f)
+    {
+        printf("Wrong map voxel size!\n");
+        return FALSE;
+    }
+    if (maxVoxels < 1 || maxVoxels >= UINT32_MAX)
+    {
+        printf("Wrong map voxel limit!\n");
+        return FALSE;
+    }
+    if (threadCount < 1 || threadCount > MSG_MAP_THREADS_MAX)
+    {
+        printf("Wrong number of map threads (1 to %d)!\n",
+            MSG_MAP_THREADS_MAX);
+        return FALSE;
+    }
+    map->shards = (MsgMapShard*) calloc(threadCount, sizeof(MsgMapShard));
+    if (!map->shards)
+    {
+        printf("Unable to allocate map!\n");
+        return FALSE;
+    }
+    map->leafSize = leafSize;
+    map->maxVoxels = maxVoxels;
+    map->shardCount = threadCount;
+    return TRUE;
+}
+
+
+// Функция освобождает память, выделенную картой.
+void MsgMapFree(MsgMap* map)
+{
+    for (size_t i = 0; i < map->shardCount; i++)
+    {
+        free(map->shards[i].table);
+        free(map->shards[i].voxels);
+        free(map->shards[i].keys);
+    }
+    free(map->shards);
+    free(map->decoded);
+    free(map->world);
+    free(map->pointKeys);
+    free(map->pointShards);
+    bzero(map, sizeof(MsgMap));
+}
+
+
+// Функция вставляет в карту облако из собранного сообщения.
+BOOL MsgMapInsertCloud(MsgMap* map, const MsgBuffer* buf)
+{
+    const MsgHeader* msg = (const MsgHeader*) buf->data;
+
+    if (!buf->data || !MsgBufferIsFull(buf) ||
+        buf->size < sizeof(MsgHeader) ||
+        msg->magicNumber != MSG_HEADER_MAGIC ||
+        msg->type != MsgTypePointCloud || MsgCalcSize(msg) > buf->size)
+    {
+        printf("Wrong point cloud message for map!\n");
+        return FALSE;
+    }
+
+    // Служебные массивы резервируются до декодирования, чтобы
+    // MsgMapInsertPoints не перевыделила массив decoded
+    if (!MsgMapReserve(map, msg->uni.cloud.npts))
+    {
+        printf("Unable to allocate map buffers!\n");
+        return FALSE;
+    }
+    MsgCloudDecode(msg, buf->data + sizeof(MsgHeader), map->decoded);
+    return MsgMapInsertPoints(map, map->decoded, msg->uni.cloud.npts,
+        msg->uni.cloud.translation, msg->uni.cloud.rotation);
+}
+
+
+// Функция вставляет в карту точки, переводя их в систему карты.
+BOOL MsgMapInsertPoints(MsgMap* map, const float* xyz, size_t npts,
+    const double* translation, const double* rotation)
+{
+    MsgMapTask task;
+
+    assert(map->shards != NULL);
+    if (!MsgMapReserve(map, npts))
+    {
+        printf("Unable to allocate map buffers!\n");
+        return FALSE;
+    }
+    bzero(&task, sizeof(task));
+    task.map = map;
+    task.xyz = xyz;
+    task.npts = npts;
+
+    // Матрица поворота по единичному кватерниону (x, y, z, w)
+    if (rotation)
+    {
+        double x = rotation[0], y = rotation[1], z = rotation[2];
+        double w = rotation[3];
+        double norm = sqrt(x * x + y * y + z * z + w * w);
+
+        if (norm <= 0.0)
+        {
+            printf("Wrong cloud orientation!\n");
+            return FALSE;
+        }
+        x /= norm; y /= norm; z /= norm; w /= norm;
+        task.rot[0] = (float) (1 - 2 * (y * y + z * z));
+        task.rot[1] = (float) (2 * (x * y - z * w));
+        task.rot[2] = (float) (2 * (x * z + y * w));
+        task.rot[3] = (float) (2 * (x * y + z * w));
+        task.rot[4] = (float) (1 - 2 * (x * x + z * z));
+        task.rot[5] = (float) (2 * (y * z - x * w));
+        task.rot[6] = (float) (2 * (x * z - y * w));
+        task.rot[7] = (float) (2 * (y * z + x * w));
+        task.rot[8] = (float) (1 - 2 * (x * x + y * y));
+        task.transform = TRUE;
+    }
+    else
+        task.rot[0] = task.rot[4] = task.rot[8] = 1.0f;
+    if (translation)
+    {
+        for (size_t k = 0; k < 3; k++)
+            task.trans[k] = (float) translation[k];
+        task.transform = TRUE;
+    }
+
+    // Номер облака 0 не используется: он отмечает незаполненную часть
+    map->stamp++;
+    if (map->stamp == 0)
+        map->stamp++;
+    MsgMapRun(&task, 0);
+    MsgMapRun(&task, 1);
+
+    map->evictedCount = 0;
+    map->droppedCount = 0;
+    for (size_t i = 0; i < map->shardCount; i++)
+    {
+        map->evictedCount += map->shards[i].evictedCount;
+        map->droppedCount += map->shards[i].droppedCount;
+    }
+    return TRUE;
+}
+
+
+// Функция возвращает количество ячеек карты.
+size_t MsgMapCount(const MsgMap* map)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < map->shardCount; i++)
+        count += map->shards[i].count;
+    return count;
+}
+
+
+// Функция ищет ячейку key в карте.
+static const MsgMapVoxel* MsgMapFind(const MsgMap* map, uint64_t key)
+{
+    const MsgMapShard* shard = &map->shards[MsgMapShardOf(map, key)];
+    size_t pos = 0;
+
+    if (shard->capacity == 0)
+        return NULL;
+    pos = MsgMapHash(key, shard->capacity);
+    while (shard->table[pos].slot != 0)
+    {
+        if (shard->table[pos].key == key)
+            return &shard->voxels[shard->table[pos].slot - 1];
+        pos = (pos + 1) & (shard->capacity - 1);
+    }
+    return NULL;
+}
+
+
+// Функция проверяет, попадает ли центр масс ячейки в область запроса
+// (параллелепипед [minv, maxv] и, если center не NULL, шар радиуса
+// sqrt(r2)), и записывает его в массив xyz, если там есть место.
+static void MsgMapCollect(const MsgMapVoxel* voxel, const float* minv,
+    const float* maxv, const float* center, float r2, float* xyz,
+    size_t maxPts, size_t* found)
+{
+    float c[3];
+
+    for (size_t k = 0; k < 3; k++)
+    {
+        c[k] = voxel->sum[k] / (float) voxel->count;
+        if (c[k] < minv[k] || c[k] > maxv[k])
+            return;
+    }
+    if (center)
+    {
+        float dx = c[0] - center[0];
+        float dy = c[1] - center[1];
+        float dz = c[2] - center[2];
+        if (dx * dx + dy * dy + dz * dz > r2)
+            return;
+    }
+    if (*found < maxPts)
+    {
+        xyz[3 * *found + 0] = c[0];
+        xyz[3 * *found + 1] = c[1];
+        xyz[3 * *found + 2] = c[2];
+    }
+    (*found)++;
+}
+
+
+// Функция выполняет запрос к карте. Центр масс ячейки лежит внутри нее,
+// поэтому для небольшой области проверяются только ячейки, которые ее
+// пересекают, а для области, содержащей больше ячеек сетки, чем их есть
+// в карте, - все ячейки карты.
+static size_t MsgMapQuery(const MsgMap* map, const float* minv,
+    const float* maxv, const float* center, float r2, float* xyz,
+    size_t maxPts)
+{
+    float invLeaf = 1.0f / map->leafSize;
+    uint64_t lo[3], hi[3];
+    double cells = 1.0;
+    size_t found = 0;
+
+    for (size_t k = 0; k < 3; k++)
+    {
+        if (!(minv[k] <= maxv[k]))
+            return 0;
+        lo[k] = MsgMapIndex(minv[k], invLeaf);
+        hi[k] = MsgMapIndex(maxv[k], invLeaf);
+        cells *= (double) (hi[k] - lo[k] + 1);
+    }
+
+    if (cells <= (double) MsgMapCount(map))
+    {
+        for (uint64_t iz = lo[2]; iz <= hi[2]; iz++)
+            for (uint64_t iy = lo[1]; iy <= hi[1]; iy++)
+                for (uint64_t ix = lo[0]; ix <= hi[0]; ix++)
+                {
+                    const MsgMapVoxel* voxel = MsgMapFind(map,
+                        MsgMapKey(ix, iy, iz));
+                    if (voxel)
+                        MsgMapCollect(voxel, minv, maxv, center, r2, xyz,
+                            maxPts, &found);
+                }
+        return found;
+    }
+
+    for (size_t i = 0; i < map->shardCount; i++)
+        for (size_t j = 0; j < map->shards[i].count; j++)
+            MsgMapCollect(&map->shards[i].voxels[j], minv, maxv, center, r2,
+                xyz, maxPts, &found);
+    return found;
+}
+
+
+// Функция находит ячейки карты в параллелепипеде.
+size_t MsgMapQueryBox(const MsgMap* map, const float* minv,
+    const float* maxv, float* xyz, size_t maxPts)
+{
+    return MsgMapQuery(map, minv, maxv, NULL, 0.0f, xyz, maxPts);
+}
+
+
+// Функция находит ячейки карты в шаре.
+size_t MsgMapQueryRadius(const MsgMap* map, const float* center,
+    float radius, float* xyz, size_t maxPts)
+{
+    float minv[3], maxv[3];
+
+    if (radius < 0.0f)
+        return 0;
+    for (size_t k = 0; k < 3; k++)
+    {
+        minv[k] = center[k] - radius;
+        maxv[k] = center[k] + radius;
+    }
+    return MsgMapQuery(map, minv, maxv, center, radius * radius, xyz,
+        maxPts);
+}
@@ -0,0 +1,109 @@
+// msg_map.h: Функции для накопления глобальной карты из принятых облаков
+// точек на стороне получателя.
+//
+// Карта хранит точки в ячейках (вокселях) сетки с ребром leafSize: точки,
+// попавшие в одну ячейку, сливаются в ее центр масс, так что повторные
+// наблюдения одного места не увеличивают карту. Ячейки лежат в хеш-
+// таблицах с открытой адресацией, разбитых на части по хешу ячейки, и
+// облако вставляется в части параллельно несколькими потоками. Стоимость
+// вставки пропорциональна количеству новых точек, а не размеру карты.
+// Размер карты ограничен: при переполнении части из нее удаляются ячейки,
+// которые дольше всего не обновлялись.
+
+#ifndef MSG_MAP_H
+#define MSG_MAP_H
+
+#include <stddef.h>      // size_t
+#include <stdint.h>      // uint32_t, uint64_t
+#include "msg_buf.h"   // заголовок и буфер сообщения
+
+
+/* MsgMapEntry: Структура представляет элемент хеш-таблицы ячеек карты. */
+typedef struct MsgMapEntryStruct
+{
+    uint64_t key;          // упакованные индексы ячейки по трем осям
+    uint32_t slot;         // номер ячейки в массиве voxels + 1 (0 - пусто)
+} MsgMapEntry, *MsgMapEntryPtr;
+
+
+/* MsgMapVoxel: Структура представляет ячейку карты. */
+typedef struct MsgMapVoxelStruct
+{
+    float sum[3];          // сумма координат точек ячейки
+    uint32_t count;        // количество точек в сумме
+    uint32_t stamp;        // номер облака, последним обновившего ячейку
+} MsgMapVoxel, *MsgMapVoxelPtr;
+
+
+/* MsgMapShard: Структура представляет часть карты, которую при вставке
+ * облака заполняет один поток. */
+typedef struct MsgMapShardStruct
+{
+    size_t capacity;       // размер хеш-таблицы (степень двойки)
+    MsgMapEntry* table;    // хеш-таблица ячеек
+    size_t count;          // количество ячеек
+    size_t maxCount;       // размер массивов voxels и keys в ячейках
+    MsgMapVoxel* voxels;   // ячейки части
+    uint64_t* keys;        // ключи ячеек (для запросов и перестроения)
+    uint32_t fullStamp;    // номер облака, ячейки которого одни заполнили
+                           // часть (удалять из нее нечего)
+    size_t evictedCount;   // сколько ячеек удалено при переполнении
+    size_t droppedCount;   // сколько точек не вошло в переполненную часть
+} MsgMapShard, *MsgMapShardPtr;
+
+
+/* MsgMap: Структура представляет глобальную карту. */
+typedef struct MsgMapStruct
+{
+    float leafSize;        // размер ребра ячейки в метрах
+    size_t maxVoxels;      // предельное количество ячеек карты
+    size_t shardCount;     // количество частей и потоков вставки
+    MsgMapShard* shards;   // части карты
+    uint32_t stamp;        // номер последнего вставленного облака
+    size_t scratchSize;    // размер служебных массивов в точках
+    float* decoded;        // координаты точек облака в его системе
+    float* world;          // координаты точек в системе карты
+    uint64_t* pointKeys;   // ключи ячеек точек
+    unsigned char* pointShards; // номера частей точек
+    size_t evictedCount;   // сколько ячеек удалено при переполнении
+    size_t droppedCount;   // сколько точек не вошло в переполненную карту
+} MsgMap, *MsgMapPtr;
+
+
+// Функция инициализирует пустую карту с ячейками размером leafSize метров
+// не более чем из maxVoxels ячеек, облака в которую вставляются
+// threadCount потоками (от 1 до 64).
+extern BOOL MsgMapInit(MsgMap* map, float leafSize, size_t maxVoxels,
+    size_t threadCount);
+
+// Функция освобождает память, выделенную картой.
+extern void MsgMapFree(MsgMap* map);
+
+// Функция вставляет в карту облако из собранного сообщения buf типа
+// MsgTypePointCloud, переводя точки в систему карты по положению камеры
+// из заголовка сообщения (rotation - кватернион x, y, z, w).
+extern BOOL MsgMapInsertCloud(MsgMap* map, const MsgBuffer* buf);
+
+// Функция вставляет в карту npts точек xyz (по 3 числа float на точку),
+// переводя их в систему карты поворотом rotation (кватернион x, y, z, w)
+// и сдвигом translation. Значения NULL - точки уже в системе карты.
+extern BOOL MsgMapInsertPoints(MsgMap* map, const float* xyz, size_t npts,
+    const double* translation, const double* rotation);
+
+// Функция возвращает количество ячеек карты.
+extern size_t MsgMapCount(const MsgMap* map);
+
+// Функция находит ячейки карты, центры масс которых лежат в
+// параллелепипеде [minv, maxv], и записывает не более maxPts центров в
+// массив xyz (по 3 числа float). Возвращает количество найденных ячеек.
+extern size_t MsgMapQueryBox(const MsgMap* map, const float* minv,
+    const float* maxv, float* xyz, size_t maxPts);
+
+// Функция находит ячейки карты, центры масс которых лежат в шаре радиуса
+// radius с центром center, и записывает не более maxPts центров в массив
+// xyz. Возвращает количество найденных ячеек.
+extern size_t MsgMapQueryRadius(const MsgMap* map, const float* center,
+    float radius, float* xyz, size_t maxPts);
+
+
+#endif // MSG_MAP_H
@@ -0,0 +1,279 @@
+// msg_pub.c: Реализация функций для рассылки сообщений нескольким
+// подписчикам.
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // malloc(), free()
+#include <string.h>      // memmove()
+#include <time.h>        // clock_gettime()
+#include <poll.h>        // poll()
+#include <assert.h>
+#include "msg_pub.h"
+
+// Как часто (в миллисекундах) повторяется отправка подписчикам, готовность
+// которых нельзя дождаться через poll: локальным (сокет датаграмм не
+// сообщает о заполнении очереди получателя), тем, с кем TCP соединение
+// восстанавливается, и тем, чью отправку задерживает ограничитель
+// скорости
+#define MSG_PUBLISHER_RETRY_MS 5
+
+
+// Функция возвращает текущее время по монотонным часам в секундах.
+static double MsgPublisherNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+// Функция удаляет первое сообщение из очереди подписчика.
+static void MsgSubscriberPop(MsgSubscriber* sub)
+{
+    MsgBufferFree(&sub->queue[sub->head]);
+    sub->head = (sub->head + 1) % sub->queueLength;
+    sub->count--;
+    sub->cursor.chunkIndex = 0;
+    sub->cursor.pktOffset = 0;
+}
+
+
+// Функция ставит ссылку на сообщение в очередь подписчика, а если очередь
+// заполнена, то отбрасывает сообщение по правилу подписчика. Сообщение,
+// отправка которого уже начата, не отбрасывается: иначе поток TCP
+// рассогласуется.
+static void MsgSubscriberPush(MsgSubscriber* sub, const MsgBuffer* shared)
+{
+    BOOL started = (sub->cursor.chunkIndex > 0 || sub->cursor.pktOffset > 0);
+
+    // Сообщение уже разбито на пакеты, поэтому размер пакета подписчика
+    // должен совпадать с размером пакета сообщения
+    if (shared->chunkSizeMax + sizeof(MsgPacketHeader) !=
+        sub->conn.config.mtu)
+    {
+        printf("Message packet size does not match subscriber MTU!\n");
+        sub->dropCount++;
+        return;
+    }
+
+    if (sub->count == sub->queueLength)
+    {
+        sub->dropCount++;
+        if (sub->policy == MsgDropNewest || (started && sub->count == 1))
+            return;  // отбрасываем новое сообщение
+        if (!started)
+        {
+            MsgBufferFree(&sub->queue[sub->head]);
+            sub->head = (sub->head + 1) % sub->queueLength;
+        }
+        else
+        {
+            // Отбрасываем второе сообщение, а начатое переносим на его
+            // место, так что оно остается первым в очереди
+            size_t next = (sub->head + 1) % sub->queueLength;
+            MsgBufferFree(&sub->queue[next]);
+            sub->queue[next] = sub->queue[sub->head];
+            sub->head = next;
+        }
+        sub->count--;
+    }
+    if (MsgBufferRetain(shared,
+        &sub->queue[(sub->head + sub->count) % sub->queueLength]))
+        sub->count++;
+}
+
+
+// Функция отправляет подписчику сообщения из его очереди, пока сокет
+// принимает их без блокировки.
+static void MsgSubscriberDrain(MsgSubscriber* sub)
+{
+    while (sub->count > 0)
+    {
+        int ret = MsgConnSendNonBlocking(&sub->conn,
+            &sub->queue[sub->head], &sub->cursor);
+        if (ret == 0)
+            break;  // сокет заполнен - продолжим позже
+        if (ret < 0)
+        {
+            // TCP сообщение отправится заново после восстановления
+            // соединения, а локальное (получатель недоступен) отбрасываем
+            if (sub->conn.config.connRole == MsgConnRoleTcpSender)
+                break;
+            MsgSubscriberPop(sub);
+            sub->dropCount++;
+            continue;
+        }
+        MsgSubscriberPop(sub);
+        sub->sentCount++;
+    }
+}
+
+
+// Функция инициализирует издателя без подписчиков.
+void MsgPublisherInit(MsgPublisher* pub)
+{
+    pub->subs = NULL;
+    pub->count = 0;
+    pub->capacity = 0;
+}
+
+
+// Функция освобождает издателя и разрывает соединения с подписчиками.
+void MsgPublisherFree(MsgPublisher* pub)
+{
+    while (pub->count > 0)
+        MsgPublisherUnsubscribe(pub, pub->subs[pub->count - 1]);
+    free(pub->subs);
+    pub->subs = NULL;
+    pub->capacity = 0;
+}
+
+
+// Функция добавляет подписчика.
+MsgSubscriber* MsgPublisherSubscribe(MsgPublisher* pub,
+    const MsgConnConfig* cfg, size_t queueLength, MsgDropPolicy policy)
+{
+    MsgConnConfig subCfg = *cfg;
+    MsgSubscriber* sub = NULL;
+
+    assert(queueLength > 0);
+    if (cfg->connRole != MsgConnRoleTcpSender &&
+        cfg->connRole != MsgConnRoleLocalSender &&
+        cfg->connRole != MsgConnRoleMcastSender)
+    {
+        printf("Subscriber connection must have a sender role!\n");
+        return NULL;
+    }
+
+    // Очереди хранит сам издатель, а отправка идет без блокировки,
+    // поэтому io_uring, отправка без копирования и повторная отправка
+    // сообщений для подписчиков не используются
+    subCfg.engine = MsgConnEngineSocket;
+    subCfg.zeroCopyMin = 0;
+    subCfg.resendDepth = 0;
+
+    // Расширяем массив подписчиков
+    if (pub->count == pub->capacity)
+    {
+        size_t capacity = pub->capacity ? 2 * pub->capacity : 4;
+        MsgSubscriber** subs = (MsgSubscriber**) realloc(pub->subs,
+            capacity * sizeof(MsgSubscriber*));
+        if (!subs)
+        {
+            printf("Unable to allocate subscriber list!\n");
+            return NULL;
+        }
+        pub->subs = subs;
+        pub->capacity = capacity;
+    }
+
+    // Создаем подписчика и устанавливаем соединение с ним
+    sub = (MsgSubscriber*) calloc(1, sizeof(MsgSubscriber));
+    if (sub)
+        sub->queue = (MsgBuffer*) calloc(queueLength, sizeof(MsgBuffer));
+    if (!sub || !sub->queue)
+    {
+        printf("Unable to allocate subscriber!\n");
+        free(sub);
+        return NULL;
+    }
+    if (!MsgConnInit(&sub->conn, &subCfg))
+    {
+        printf("Failed to connect to subscriber!\n");
+        free(sub->queue);
+        free(sub);
+        return NULL;
+    }
+    sub->policy = policy;
+    sub->queueLength = queueLength;
+    pub->subs[pub->count++] = sub;
+    return sub;
+}
+
+
+// Функция удаляет подписчика и разрывает соединение с ним.
+void MsgPublisherUnsubscribe(MsgPublisher* pub, MsgSubscriber* sub)
+{
+    size_t i = 0;
+
+    for (i = 0; i < pub->count && pub->subs[i] != sub; i++)
+        ;
+    assert(i < pub->count);
+    memmove(pub->subs + i, pub->subs + i + 1,
+        (pub->count - i - 1) * sizeof(MsgSubscriber*));
+    pub->count--;
+
+    while (sub->count > 0)
+        MsgSubscriberPop(sub);
+    MsgConnFree(&sub->conn);
+    free(sub->queue);
+    free(sub);
+}
+
+
+// Функция ставит сообщение в очереди всех подписчиков.
+BOOL MsgPublisherPublish(MsgPublisher* pub, const MsgBuffer* buf)
+{
+    MsgBuffer shared;   // ссылка издателя на единственную копию сообщения
+
+    // Буфер без счетчика ссылок (например, воспроизводимой сессии)
+    // копируем один раз для всех подписчиков
+    if (!MsgBufferRetain(buf, &shared) && !MsgBufferClone(&shared, buf))
+    {
+        printf("Unable to share message buffer!\n");
+        return FALSE;
+    }
+    for (size_t i = 0; i < pub->count; i++)
+        MsgSubscriberPush(pub->subs[i], &shared);
+    MsgBufferFree(&shared);  // очереди подписчиков держат свои ссылки
+
+    MsgPublisherFlush(pub, 0);
+    return TRUE;
+}
+
+
+// Функция продолжает отправку из очередей подписчиков.
+BOOL MsgPublisherFlush(MsgPublisher* pub, double timeoutSec)
+{
+    double deadline = MsgPublisherNow() + timeoutSec;
+    struct pollfd pfd[pub->count + 1]; // сокеты TCP подписчиков
+
+    for (;;)
+    {
+        BOOL empty = TRUE;  // все очереди пусты
+        BOOL retry = FALSE; // есть подписчики, которых нельзя ждать poll
+        nfds_t nfds = 0;
+
+        // Отправляем каждому подписчику, сколько примет его сокет
+        for (size_t i = 0; i < pub->count; i++)
+        {
+            MsgSubscriber* sub = pub->subs[i];
+            MsgSubscriberDrain(sub);
+            if (sub->count == 0)
+                continue;
+            empty = FALSE;
+            if (sub->conn.config.connRole == MsgConnRoleTcpSender &&
+                sub->conn.link.state == MsgConnStateConnected &&
+                sub->conn.config.pacingRate <= 0)
+            {
+                pfd[nfds].fd = sub->conn.uni.client.sockfd;
+                pfd[nfds].events = POLLOUT;
+                pfd[nfds].revents = 0;
+                nfds++;
+            }
+            else
+                retry = TRUE;
+        }
+        if (empty)
+            return TRUE;
+
+        // Ждем, пока сокеты освободятся, но не дольше оставшегося времени
+        double remaining = deadline - MsgPublisherNow();
+        if (remaining <= 0)
+            return FALSE;
+        int waitMs = (int) (remaining * 1000) + 1;
+        if (retry && waitMs > MSG_PUBLISHER_RETRY_MS)
+            waitMs = MSG_PUBLISHER_RETRY_MS;
+        poll(pfd, nfds, waitMs);
+    }
+}
@@ -0,0 +1,81 @@
+// msg_pub.h: Функции для рассылки сообщений нескольким подписчикам.
+//
+// Издатель хранит одну копию каждого сообщения (ссылки на буфер, см.
+// MsgBufferRetain) и ставит ссылку в очередь каждого подписчика. Очереди
+// опустошаются без блокировки, каждая в своем темпе, поэтому медленный
+// подписчик не задерживает остальных: при переполнении его очереди
+// сообщения отбрасываются по выбранному для него правилу.
+
+#ifndef MSG_PUB_H
+#define MSG_PUB_H
+
+#include <stddef.h>      // size_t
+#include "msg_conn.h"  // соединение с подписчиком
+
+
+/* MsgDropPolicy: Перечисление задает, какое сообщение отбрасывается при
+ * переполнении очереди подписчика. */
+typedef enum MsgDropPolicyEnum
+{
+    MsgDropOldest, // самое старое сообщение, отправка которого еще не
+                   // начата (подписчик получает самые свежие кадры)
+    MsgDropNewest  // новое сообщение (подписчик получает кадры подряд)
+} MsgDropPolicy;
+
+
+/* MsgSubscriber: Структура представляет подписчика издателя: соединение
+ * с ним и очередь ссылок на сообщения, ожидающие отправки. */
+typedef struct MsgSubscriberStruct
+{
+    MsgConn conn;         // соединение с подписчиком (роль отправителя)
+    MsgDropPolicy policy; // правило отбрасывания сообщений
+    size_t queueLength;   // предельная длина очереди
+    MsgBuffer* queue;     // кольцо ссылок на сообщения в очереди
+    size_t head;          // индекс первого сообщения в кольце
+    size_t count;         // количество сообщений в очереди
+    MsgConnCursor cursor; // положение отправки в первом сообщении
+    size_t sentCount;     // сколько сообщений отправлено подписчику
+    size_t dropCount;     // сколько сообщений отброшено для подписчика
+} MsgSubscriber, *MsgSubscriberPtr;
+
+
+/* MsgPublisher: Структура представляет издателя сообщений. */
+typedef struct MsgPublisherStruct
+{
+    MsgSubscriber** subs; // массив подписчиков
+    size_t count;         // количество подписчиков
+    size_t capacity;      // размер массива подписчиков
+} MsgPublisher, *MsgPublisherPtr;
+
+
+// Функция инициализирует издателя без подписчиков.
+extern void MsgPublisherInit(MsgPublisher* pub);
+
+// Функция освобождает издателя и разрывает соединения со всеми
+// подписчиками (неотправленные сообщения отбрасываются).
+extern void MsgPublisherFree(MsgPublisher* pub);
+
+// Функция добавляет подписчика, с которым устанавливается соединение по
+// настройкам cfg (роль отправителя: TCP, локальный сокет или рассылка),
+// с очередью из queueLength сообщений и правилом отбрасывания policy.
+// Размер пакета (mtu) всех подписчиков должен совпадать с размером пакета,
+// на который разбиты публикуемые сообщения.
+// Возвращает указатель на подписчика или NULL при ошибке.
+extern MsgSubscriber* MsgPublisherSubscribe(MsgPublisher* pub,
+    const MsgConnConfig* cfg, size_t queueLength, MsgDropPolicy policy);
+
+// Функция удаляет подписчика и разрывает соединение с ним.
+extern void MsgPublisherUnsubscribe(MsgPublisher* pub, MsgSubscriber* sub);
+
+// Функция ставит сообщение в очереди всех подписчиков и отправляет то,
+// что сокеты принимают без блокировки. Буфер buf после вызова можно
+// освободить функцией MsgBufferFree: издатель удерживает свою ссылку.
+extern BOOL MsgPublisherPublish(MsgPublisher* pub, const MsgBuffer* buf);
+
+// Функция продолжает отправку из очередей подписчиков и ждет не дольше
+// timeoutSec секунд, пока все очереди не опустеют (значение 0 - только
+// отправить без ожидания). Возвращает TRUE, если все очереди пусты.
+extern BOOL MsgPublisherFlush(MsgPublisher* pub, double timeoutSec);
+
+
+#endif // MSG_PUB_H
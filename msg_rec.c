@@ -0,0 +1,415 @@
+// msg_rec.c: Реализация функций для записи принятых сообщений в файл
+// сессии и для последующего воспроизведения сессии.
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // malloc(), realloc(), free()
+#include <string.h>      // memcpy(), strncpy()
+#include <time.h>        // clock_gettime(), clock_nanosleep()
+#include <unistd.h>      // ftruncate(), pwrite(), close()
+#include <fcntl.h>       // open()
+#include <sys/mman.h>    // mmap(), munmap()
+#include <sys/stat.h>    // fstat()
+#include <assert.h>
+#include "msg_rec.h"
+
+
+// Функция возвращает текущее время по монотонным часам в наносекундах.
+static uint64_t MsgRecordNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+// Функция округляет размер вверх до границы 8 байт.
+static size_t MsgRecordAlign(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+
+// Функция формирует имя файла сегмента с заданным номером.
+static void MsgRecordSegmentName(char* path, size_t pathSize,
+    const char* baseName, size_t segmentNo)
+{
+    snprintf(path, pathSize, "%s.%04zu.rec", baseName, segmentNo);
+}
+
+
+// ------------------------------ Запись сессии -----------------------------
+
+
+// Функция создает новый сегмент размером не меньше minSize байт и
+// отображает его в память.
+static BOOL MsgRecorderOpenSegment(MsgRecorder* rec, size_t minSize)
+{
+    char path[300];
+    MsgRecordFileHeader hdr;
+
+    MsgRecordSegmentName(path, sizeof(path), rec->baseName, rec->segmentNo);
+    rec->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (rec->fd < 0)
+    {
+        printf("Unable to create record file %s!\n", path);
+        return FALSE;
+    }
+
+    rec->mapSize = rec->segmentSize;
+    if (rec->mapSize < minSize + sizeof(MsgRecordFileHeader))
+        rec->mapSize = minSize + sizeof(MsgRecordFileHeader);
+    if (ftruncate(rec->fd, rec->mapSize) < 0)
+    {
+        printf("Unable to resize record file %s!\n", path);
+        close(rec->fd);
+        rec->fd = -1;
+        return FALSE;
+    }
+    rec->map = (unsigned char*) mmap(NULL, rec->mapSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0);
+    if (rec->map == MAP_FAILED)
+    {
+        printf("Unable to map record file %s!\n", path);
+        rec->map = NULL;
+        close(rec->fd);
+        rec->fd = -1;
+        return FALSE;
+    }
+
+    hdr.magicNumber = MSG_RECORD_FILE_MAGIC;
+    hdr.version = MSG_RECORD_VERSION;
+    memcpy(rec->map, &hdr, sizeof(hdr));
+    rec->used = sizeof(hdr);
+    rec->indexCount = 0;
+    return TRUE;
+}
+
+
+// Функция обрезает текущий сегмент по последней записи, дописывает в
+// него индекс записей и закрывает файл.
+static void MsgRecorderCloseSegment(MsgRecorder* rec)
+{
+    MsgRecordFooter footer;
+    size_t indexSize = rec->indexCount * sizeof(MsgRecordEntry);
+    BOOL status = TRUE;
+
+    if (rec->fd < 0)
+        return;
+
+    munmap(rec->map, rec->mapSize);
+    rec->map = NULL;
+    footer.indexOffset = rec->used;
+    footer.count = rec->indexCount;
+    footer.magicNumber = MSG_RECORD_FOOTER_MAGIC;
+    if (ftruncate(rec->fd, rec->used) < 0)
+        status = FALSE;
+    else if (pwrite(rec->fd, rec->index, indexSize, rec->used) !=
+        (ssize_t) indexSize)
+        status = FALSE;
+    else if (pwrite(rec->fd, &footer, sizeof(footer), rec->used + indexSize)
+        != (ssize_t) sizeof(footer))
+        status = FALSE;
+    if (!status)
+        printf("Unable to write record index!\n");
+    close(rec->fd);
+    rec->fd = -1;
+    rec->segmentNo++;
+}
+
+
+// Функция открывает запись сессии с заданным именем и предельным
+// размером сегмента.
+BOOL MsgRecorderInit(MsgRecorder* rec, const char* baseName,
+    size_t segmentSize)
+{
+    strncpy(rec->baseName, baseName, sizeof(rec->baseName));
+    rec->baseName[sizeof(rec->baseName) - 1] = '\0';
+    rec->segmentSize = segmentSize;
+    rec->segmentNo = 0;
+    rec->fd = -1;
+    rec->map = NULL;
+    rec->mapSize = 0;
+    rec->used = 0;
+    rec->index = NULL;
+    rec->indexCount = 0;
+    rec->indexCapacity = 0;
+    return MsgRecorderOpenSegment(rec, 0);
+}
+
+
+// Функция дописывает в сессию полностью принятое сообщение.
+BOOL MsgRecorderWrite(MsgRecorder* rec, const MsgBuffer* buf)
+{
+    const MsgHeader* msg = (const MsgHeader*) buf->data;
+    MsgRecordHeader hdr;
+    MsgRecordEntry* entry = NULL;
+    size_t need = 0;   // сколько места в сегменте займет запись
+
+    // Проверяем контрольные коды буфера и заголовка сообщения
+    assert(buf->magicNumber == MSG_BUFFER_MAGIC);
+    if (msg->magicNumber != MSG_HEADER_MAGIC)
+        return FALSE;
+
+    hdr.magicNumber = MSG_RECORD_MAGIC;
+    hdr.msgIndex = buf->msgIndex;
+    hdr.timestampNs = MsgRecordNow();
+    hdr.size = MsgCalcSize(msg);
+    assert(hdr.size <= buf->size);
+    need = sizeof(hdr) + MsgRecordAlign(hdr.size);
+
+    // Переходим к новому сегменту, если запись не помещается в текущий
+    if (rec->fd >= 0 && rec->used + need > rec->mapSize)
+        MsgRecorderCloseSegment(rec);
+    if (rec->fd < 0 && !MsgRecorderOpenSegment(rec, need))
+        return FALSE;
+
+    // Расширяем индекс записей сегмента
+    if (rec->indexCount == rec->indexCapacity)
+    {
+        size_t capacity = rec->indexCapacity ? 2 * rec->indexCapacity : 64;
+        entry = (MsgRecordEntry*) realloc(rec->index,
+            capacity * sizeof(MsgRecordEntry));
+        if (!entry)
+            return FALSE;
+        rec->index = entry;
+        rec->indexCapacity = capacity;
+    }
+    entry = rec->index + rec->indexCount++;
+    entry->offset = rec->used;
+    entry->msgIndex = hdr.msgIndex;
+    entry->timestampNs = hdr.timestampNs;
+    entry->size = hdr.size;
+
+    // Копируем заголовок записи и сообщение прямо в отображение сегмента
+    memcpy(rec->map + rec->used, &hdr, sizeof(hdr));
+    memcpy(rec->map + rec->used + sizeof(hdr), buf->data, hdr.size);
+    rec->used += need;
+    return TRUE;
+}
+
+
+// Функция записывает индекс текущего сегмента и закрывает запись сессии.
+void MsgRecorderFree(MsgRecorder* rec)
+{
+    MsgRecorderCloseSegment(rec);
+    free(rec->index);
+    rec->index = NULL;
+    rec->indexCount = 0;
+    rec->indexCapacity = 0;
+}
+
+
+// -------------------------- Воспроизведение сессии ------------------------
+
+
+// Функция собирает индекс сегмента последовательным чтением записей
+// (для сегментов, запись которых прервалась до записи индекса).
+static BOOL MsgReplayerScan(MsgReplayer* rep, size_t fileSize)
+{
+    size_t offset = sizeof(MsgRecordFileHeader);
+    size_t capacity = 0;
+    MsgRecordEntry* entries = NULL;
+
+    rep->count = 0;
+    while (offset + sizeof(MsgRecordHeader) <= fileSize)
+    {
+        const MsgRecordHeader* hdr =
+            (const MsgRecordHeader*) (rep->map + offset);
+        if (hdr->magicNumber != MSG_RECORD_MAGIC ||
+            offset + sizeof(MsgRecordHeader) + hdr->size > fileSize)
+            break;
+        if (rep->count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            entries = (MsgRecordEntry*) realloc(rep->scanIndex,
+                capacity * sizeof(MsgRecordEntry));
+            if (!entries)
+                return FALSE;
+            rep->scanIndex = entries;
+        }
+        rep->scanIndex[rep->count].offset = offset;
+        rep->scanIndex[rep->count].msgIndex = hdr->msgIndex;
+        rep->scanIndex[rep->count].timestampNs = hdr->timestampNs;
+        rep->scanIndex[rep->count].size = hdr->size;
+        rep->count++;
+        offset += sizeof(MsgRecordHeader) + MsgRecordAlign(hdr->size);
+    }
+    rep->index = rep->scanIndex;
+    return TRUE;
+}
+
+
+// Функция отображает в память очередной сегмент сессии. За концом файла
+// резервируется mtu байт, заполненных нулями, так как при отправке
+// последний фрагмент сообщения считывается целиком.
+static BOOL MsgReplayerOpenSegment(MsgReplayer* rep)
+{
+    char path[300];
+    struct stat st;
+    int fd = -1;
+    long page = sysconf(_SC_PAGESIZE);
+    const MsgRecordFileHeader* hdr = NULL;
+    const MsgRecordFooter* footer = NULL;
+
+    MsgRecordSegmentName(path, sizeof(path), rep->baseName, rep->segmentNo);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FALSE;  // сегментов больше нет
+    if (fstat(fd, &st) < 0 ||
+        (size_t) st.st_size < sizeof(MsgRecordFileHeader))
+    {
+        printf("Wrong record file %s!\n", path);
+        close(fd);
+        return FALSE;
+    }
+
+    rep->mapSize = (st.st_size + rep->mtu + page - 1) / page * page;
+    rep->map = (unsigned char*) mmap(NULL, rep->mapSize, PROT_READ,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (rep->map == MAP_FAILED ||
+        mmap(rep->map, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+            fd, 0) == MAP_FAILED)
+    {
+        printf("Unable to map record file %s!\n", path);
+        if (rep->map != MAP_FAILED)
+            munmap(rep->map, rep->mapSize);
+        rep->map = NULL;
+        close(fd);
+        return FALSE;
+    }
+    close(fd);
+
+    hdr = (const MsgRecordFileHeader*) rep->map;
+    if (hdr->magicNumber != MSG_RECORD_FILE_MAGIC ||
+        hdr->version != MSG_RECORD_VERSION)
+    {
+        printf("Wrong record file %s!\n", path);
+        munmap(rep->map, rep->mapSize);
+        rep->map = NULL;
+        return FALSE;
+    }
+
+    // Берем индекс из конца файла, а если его нет - читаем записи подряд
+    footer = (const MsgRecordFooter*) (rep->map + st.st_size -
+        sizeof(MsgRecordFooter));
+    if ((size_t) st.st_size >= sizeof(MsgRecordFileHeader) +
+            sizeof(MsgRecordFooter) &&
+        footer->magicNumber == MSG_RECORD_FOOTER_MAGIC &&
+        footer->indexOffset + footer->count * sizeof(MsgRecordEntry) +
+            sizeof(MsgRecordFooter) == (size_t) st.st_size)
+    {
+        rep->index = (const MsgRecordEntry*) (rep->map + footer->indexOffset);
+        rep->count = footer->count;
+    }
+    else if (!MsgReplayerScan(rep, st.st_size))
+    {
+        munmap(rep->map, rep->mapSize);
+        rep->map = NULL;
+        return FALSE;
+    }
+    rep->pos = 0;
+    return TRUE;
+}
+
+
+// Функция закрывает текущий сегмент сессии.
+static void MsgReplayerCloseSegment(MsgReplayer* rep)
+{
+    if (rep->map)
+        munmap(rep->map, rep->mapSize);
+    rep->map = NULL;
+    rep->mapSize = 0;
+    rep->index = NULL;
+    rep->count = 0;
+    rep->pos = 0;
+}
+
+
+// Функция открывает сессию для воспроизведения.
+BOOL MsgReplayerInit(MsgReplayer* rep, const char* baseName,
+    size_t mtu, BOOL realTime)
+{
+    assert(mtu > sizeof(MsgPacketHeader));
+
+    strncpy(rep->baseName, baseName, sizeof(rep->baseName));
+    rep->baseName[sizeof(rep->baseName) - 1] = '\0';
+    rep->mtu = mtu;
+    rep->realTime = realTime;
+    rep->segmentNo = 0;
+    rep->map = NULL;
+    rep->mapSize = 0;
+    rep->index = NULL;
+    rep->scanIndex = NULL;
+    rep->count = 0;
+    rep->pos = 0;
+    rep->firstTimestampNs = 0;
+    rep->startTimeNs = 0;
+    if (!MsgReplayerOpenSegment(rep))
+    {
+        printf("Unable to open session %s!\n", baseName);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Функция заполняет буфер buf очередным сообщением сессии.
+BOOL MsgReplayerNext(MsgReplayer* rep, MsgBuffer* buf)
+{
+    const MsgRecordEntry* entry = NULL;
+    size_t chunkSize = rep->mtu - sizeof(MsgPacketHeader);
+
+    // Переходим к следующему сегменту, если текущий закончился
+    while (rep->map == NULL || rep->pos >= rep->count)
+    {
+        if (rep->map)
+        {
+            MsgReplayerCloseSegment(rep);
+            rep->segmentNo++;
+        }
+        if (!MsgReplayerOpenSegment(rep))
+            return FALSE;
+    }
+    entry = rep->index + rep->pos++;
+
+    // Выдерживаем исходный интервал между сообщениями
+    if (rep->startTimeNs == 0)
+    {
+        rep->startTimeNs = MsgRecordNow();
+        rep->firstTimestampNs = entry->timestampNs;
+    }
+    else if (rep->realTime && entry->timestampNs > rep->firstTimestampNs)
+    {
+        uint64_t due = rep->startTimeNs +
+            (entry->timestampNs - rep->firstTimestampNs);
+        struct timespec ts;
+        ts.tv_sec = due / 1000000000ull;
+        ts.tv_nsec = due % 1000000000ull;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    // Заполняем буфер по аналогии с MsgBufferInit, но без выделения памяти
+    buf->msgIndex = entry->msgIndex;
+    buf->chunksCount = (entry->size + chunkSize - 1) / chunkSize;
+    buf->chunkSizeMax = chunkSize;
+    buf->size = buf->chunksCount * chunkSize;
+    buf->status = NULL;
+    buf->data = rep->map + entry->offset + sizeof(MsgRecordHeader);
+    buf->refCount = NULL;
+    buf->pool = NULL;
+    buf->sendTimeNs = 0;
+    buf->recvTimeNs = 0;
+    buf->batched = FALSE;
+    buf->magicNumber = MSG_BUFFER_MAGIC;
+    return TRUE;
+}
+
+
+// Функция закрывает воспроизведение сессии.
+void MsgReplayerFree(MsgReplayer* rep)
+{
+    MsgReplayerCloseSegment(rep);
+    free(rep->scanIndex);
+    rep->scanIndex = NULL;
+}
@@ -0,0 +1,134 @@
+// msg_rec.h: Функции для записи принятых сообщений в файл сессии и для
+// последующего воспроизведения сессии.
+//
+// Сессия записывается в несколько файлов-сегментов с именами вида
+// <имя сессии>.0000.rec, <имя сессии>.0001.rec и т.д. Сегмент состоит из
+// заголовка файла, последовательности записей (заголовок записи и само
+// сообщение: заголовок сообщения и тело) и индекса записей с завершающей
+// структурой MsgRecordFooter в конце файла. Если запись сессии прервалась
+// аварийно и индекса нет, то записи сегмента читаются последовательно.
+
+#ifndef MSG_REC_H
+#define MSG_REC_H
+
+#include <stddef.h>      // size_t
+#include <stdint.h>      // uint64_t
+#include "msg_buf.h"   // заголовок и буфер сообщения
+
+// Контрольные коды заголовков файла, записи и индекса
+#define MSG_RECORD_FILE_MAGIC   0x5AA5A55A
+#define MSG_RECORD_MAGIC        0x5A5AA5A5
+#define MSG_RECORD_FOOTER_MAGIC 0xA55A5AA5
+
+// Версия формата файла сессии
+#define MSG_RECORD_VERSION 1
+
+
+/* MsgRecordFileHeader: Структура представляет заголовок файла-сегмента. */
+typedef struct MsgRecordFileHeaderStruct
+{
+    size_t magicNumber;   // должно быть равно 0x5AA5A55A
+    size_t version;       // версия формата файла
+} MsgRecordFileHeader, *MsgRecordFileHeaderPtr;
+
+
+/* MsgRecordHeader: Структура представляет заголовок одной записи, за
+ * которым в файле следует сообщение размером size байт (с выравниванием
+ * начала следующей записи на 8 байт). */
+typedef struct MsgRecordHeaderStruct
+{
+    size_t magicNumber;   // должно быть равно 0x5A5AA5A5
+    size_t msgIndex;      // порядковый номер сообщения от начала сессии
+    uint64_t timestampNs; // момент записи по монотонным часам, нс
+    size_t size;          // размер (заголовок+тело) сообщения в байтах
+} MsgRecordHeader, *MsgRecordHeaderPtr;
+
+
+/* MsgRecordEntry: Структура представляет элемент индекса записей. */
+typedef struct MsgRecordEntryStruct
+{
+    size_t offset;        // смещение заголовка записи от начала файла
+    size_t msgIndex;      // порядковый номер сообщения от начала сессии
+    uint64_t timestampNs; // момент записи по монотонным часам, нс
+    size_t size;          // размер (заголовок+тело) сообщения в байтах
+} MsgRecordEntry, *MsgRecordEntryPtr;
+
+
+/* MsgRecordFooter: Структура завершает файл-сегмент и указывает на
+ * индекс записей, расположенный непосредственно перед ней. */
+typedef struct MsgRecordFooterStruct
+{
+    size_t indexOffset;   // смещение индекса от начала файла
+    size_t count;         // количество записей в индексе
+    size_t magicNumber;   // должно быть равно 0xA55A5AA5
+} MsgRecordFooter, *MsgRecordFooterPtr;
+
+
+/* MsgRecorder: Структура представляет объект записи сессии. Текущий
+ * сегмент отображается в память, и сообщение копируется в него один
+ * раз, без промежуточных буферов. */
+typedef struct MsgRecorderStruct
+{
+    char baseName[256];   // имя сессии (путь к файлам без суффикса)
+    size_t segmentSize;   // предельный размер сегмента в байтах
+    size_t segmentNo;     // номер текущего сегмента
+    int fd;               // файл текущего сегмента (-1, если не открыт)
+    unsigned char* map;   // отображение текущего сегмента в память
+    size_t mapSize;       // размер отображения в байтах
+    size_t used;          // сколько байт сегмента уже занято записями
+    MsgRecordEntry* index;// индекс записей текущего сегмента
+    size_t indexCount;    // количество записей в индексе
+    size_t indexCapacity; // сколько записей помещается в массив индекса
+} MsgRecorder, *MsgRecorderPtr;
+
+
+/* MsgReplayer: Структура представляет объект воспроизведения сессии.
+ * Сегменты отображаются в память, и буферы сообщений указывают прямо
+ * в отображение, так что сообщения отправляются без копирования. */
+typedef struct MsgReplayerStruct
+{
+    char baseName[256];   // имя сессии (путь к файлам без суффикса)
+    size_t mtu;           // максимальный размер пакета при отправке
+    BOOL realTime;        // воспроизводить с исходными интервалами
+    size_t segmentNo;     // номер текущего сегмента
+    unsigned char* map;   // отображение текущего сегмента в память
+    size_t mapSize;       // размер отображения (с запасом на фрагмент)
+    const MsgRecordEntry* index; // индекс записей текущего сегмента
+    MsgRecordEntry* scanIndex;   // индекс, собранный при чтении сегмента
+        // без завершающей структуры (иначе NULL)
+    size_t count;         // количество записей в индексе
+    size_t pos;           // номер следующей записи в индексе
+    uint64_t firstTimestampNs; // метка времени первой записи сессии
+    uint64_t startTimeNs; // момент начала воспроизведения
+} MsgReplayer, *MsgReplayerPtr;
+
+
+// Функция открывает запись сессии с заданным именем и предельным
+// размером сегмента.
+extern BOOL MsgRecorderInit(MsgRecorder* rec, const char* baseName,
+    size_t segmentSize);
+
+// Функция дописывает в сессию полностью принятое сообщение.
+extern BOOL MsgRecorderWrite(MsgRecorder* rec, const MsgBuffer* buf);
+
+// Функция записывает индекс текущего сегмента и закрывает запись сессии.
+extern void MsgRecorderFree(MsgRecorder* rec);
+
+
+// Функция открывает сессию для воспроизведения. Параметр mtu задает
+// разбивку сообщений на пакеты, как в MsgBufferInit. Если realTime = TRUE,
+// то сообщения выдаются с исходными интервалами между ними, иначе - сразу.
+extern BOOL MsgReplayerInit(MsgReplayer* rep, const char* baseName,
+    size_t mtu, BOOL realTime);
+
+// Функция заполняет буфер buf очередным сообщением сессии и возвращает
+// FALSE, если сессия закончилась. Буфер указывает в отображение файла и
+// действителен до следующего вызова функции. Его нельзя освобождать
+// функцией MsgBufferFree, а массив состояний фрагментов у него не задан.
+extern BOOL MsgReplayerNext(MsgReplayer* rep, MsgBuffer* buf);
+
+// Функция закрывает воспроизведение сессии.
+extern void MsgReplayerFree(MsgReplayer* rep);
+
+
+#endif // MSG_REC_H
@@ -0,0 +1,184 @@
+// msg_ring.c: Реализация функций для передачи собранных сообщений из
+// потока приема в поток обработки без блокировок.
+//
+// Писатель кольца публикует элемент записью tail с семантикой release
+// после записи элемента, читатель освобождает место записью head. Каждая
+// сторона хранит копию индекса другой стороны и перечитывает его только
+// тогда, когда по копии кольцо выглядит полным (пустым), поэтому в
+// обычном режиме строки кэша не переходят между ядрами на каждый элемент.
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // calloc(), free()
+#include <string.h>      // bzero()
+#include <assert.h>
+#include "msg_ring.h"
+#include "msg_trace.h"   // временная шкала обработки сообщений
+
+
+// Функция выделяет кольцо на size элементов (степень двойки).
+static BOOL MsgRingQueueInit(MsgRingQueue* q, size_t size)
+{
+    bzero(q, sizeof(MsgRingQueue));
+    q->slots = (MsgList**) calloc(size, sizeof(MsgList*));
+    if (!q->slots)
+        return FALSE;
+    q->mask = size - 1;
+    return TRUE;
+}
+
+
+// Функция писателя: добавляет узел в кольцо. Возвращает FALSE, если
+// кольцо заполнено.
+static BOOL MsgRingPush(MsgRingQueue* q, MsgList* node)
+{
+    size_t tail = q->tail;  // tail изменяет только писатель
+
+    if (tail - q->headCache > q->mask)
+    {
+        q->headCache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (tail - q->headCache > q->mask)
+            return FALSE;
+    }
+    q->slots[tail & q->mask] = node;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+
+// Функция читателя: извлекает узел из кольца. Возвращает NULL, если
+// кольцо пусто.
+static MsgList* MsgRingPop(MsgRingQueue* q)
+{
+    size_t head = q->head;  // head изменяет только читатель
+    MsgList* node = NULL;
+
+    if (head == q->tailCache)
+    {
+        q->tailCache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head == q->tailCache)
+            return NULL;
+    }
+    node = q->slots[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return node;
+}
+
+
+// Функция создает кольца.
+BOOL MsgRingInit(MsgRing* ring, size_t capacity)
+{
+    size_t size = 1;
+
+    bzero(ring, sizeof(MsgRing));
+    if (capacity < 1)
+    {
+        printf("Wrong message ring capacity!\n");
+        return FALSE;
+    }
+    while (size < capacity)
+        size *= 2;
+
+    // Сообщений у потребителя не больше size, поэтому кольцо возврата
+    // того же размера никогда не переполняется
+    if (!MsgRingQueueInit(&ring->ready, size) ||
+        !MsgRingQueueInit(&ring->done, size))
+    {
+        printf("Unable to allocate message ring!\n");
+        free(ring->ready.slots);
+        free(ring->done.slots);
+        bzero(ring, sizeof(MsgRing));
+        return FALSE;
+    }
+    ring->capacity = size;
+    return TRUE;
+}
+
+
+// Функция освобождает кольца и все сообщения в них.
+void MsgRingFree(MsgRing* ring)
+{
+    MsgList* node = NULL;
+
+    if (ring->ready.slots)
+        while ((node = MsgRingPop(&ring->ready)) != NULL)
+            MsgListNodeFree(node);
+    if (ring->done.slots)
+        MsgRingReclaim(ring);
+    free(ring->ready.slots);
+    free(ring->done.slots);
+    bzero(ring, sizeof(MsgRing));
+}
+
+
+// Функция передает собранное сообщение потребителю.
+BOOL MsgRingPublish(MsgRing* ring, MsgConn* conn, MsgBuffer** pbuf)
+{
+    MsgBuffer* buf = *pbuf;
+
+    assert(buf != NULL && buf->magicNumber == MSG_BUFFER_MAGIC);
+
+    // Сначала освобождаем место за счет возвращенных сообщений
+    MsgRingReclaim(ring);
+    if (ring->outstanding >= ring->capacity)
+        return FALSE;
+    if (!MsgListUnlink(&conn->list, buf))
+    {
+        printf("Message is not in the connection list!\n");
+        return FALSE;
+    }
+    if (!MsgRingPush(&ring->ready, (MsgList*) buf))
+    {
+        // Не случается: кольцо вмещает все сообщения потребителя
+        assert(TRUE == FALSE);
+        MsgListNodeFree((MsgList*) buf);
+        *pbuf = NULL;
+        return FALSE;
+    }
+    ring->outstanding++;
+    *pbuf = NULL;
+    return TRUE;
+}
+
+
+// Функция освобождает сообщения, возвращенные потребителем.
+size_t MsgRingReclaim(MsgRing* ring)
+{
+    MsgList* node = NULL;
+    size_t count = 0;
+
+    while ((node = MsgRingPop(&ring->done)) != NULL)
+    {
+        MsgListNodeFree(node);
+        count++;
+    }
+    ring->outstanding -= count;
+    return count;
+}
+
+
+// Функция забирает очередное сообщение.
+BOOL MsgRingTake(MsgRing* ring, MsgBuffer** pbuf)
+{
+    MsgList* node = MsgRingPop(&ring->ready);
+
+    assert(pbuf != NULL);
+    *pbuf = node ? &node->buf : NULL;  // узел начинается с буфера
+    return node != NULL;
+}
+
+
+// Функция возвращает обработанное сообщение производителю.
+void MsgRingRelease(MsgRing* ring, MsgBuffer** pbuf)
+{
+    assert(*pbuf != NULL && (*pbuf)->magicNumber == MSG_BUFFER_MAGIC);
+    MSG_TRACE_END(MsgTraceDelivered, (*pbuf)->msgIndex, 0);
+    MSG_TRACE_MARK(MsgTraceRelease, (*pbuf)->msgIndex, 0);
+
+    if (!MsgRingPush(&ring->done, (MsgList*) *pbuf))
+    {
+        // Не случается: у потребителя не больше capacity сообщений
+        assert(TRUE == FALSE);
+    }
+    *pbuf = NULL;
+}
@@ -0,0 +1,86 @@
+// msg_ring.h: Функции для передачи собранных сообщений из потока приема
+// в поток обработки без блокировок.
+//
+// Поток приема (производитель) исключает собранное сообщение из списка
+// буферов соединения и кладет владеющую ссылку на него (указатель на
+// буфер узла списка) в кольцо готовых сообщений. Поток обработки
+// (потребитель) забирает сообщения из этого кольца, а обработанные
+// возвращает через второе кольцо. Память возвращенных сообщений
+// освобождает производитель, поэтому пул буферов и распределитель памяти
+// используются только в потоке приема. Кольца рассчитаны ровно на одного
+// производителя и одного потребителя и не требуют мьютексов.
+
+#ifndef MSG_RING_H
+#define MSG_RING_H
+
+#include <stddef.h>      // size_t
+#include "msg_conn.h"  // соединение получателя
+
+// Размер строки кэша: индексы производителя и потребителя лежат в разных
+// строках, чтобы их запись на одном ядре не вытесняла строку у другого
+#define MSG_RING_CACHE_LINE 64
+
+
+/* MsgRingQueue: Структура представляет кольцо указателей на узлы списка
+ * буферов с одним писателем и одним читателем. */
+typedef struct MsgRingQueueStruct
+{
+    MsgList** slots;      // элементы кольца
+    size_t mask;          // размер кольца - 1 (размер - степень двойки)
+    // Поля писателя
+    size_t tail __attribute__((aligned(MSG_RING_CACHE_LINE)));
+                          // сколько элементов записано
+    size_t headCache;     // последнее прочитанное значение head
+    // Поля читателя
+    size_t head __attribute__((aligned(MSG_RING_CACHE_LINE)));
+                          // сколько элементов прочитано
+    size_t tailCache;     // последнее прочитанное значение tail
+} MsgRingQueue, *MsgRingQueuePtr;
+
+
+/* MsgRing: Структура представляет пару колец для передачи сообщений
+ * потребителю и их возврата производителю. */
+typedef struct MsgRingStruct
+{
+    MsgRingQueue ready;   // собранные сообщения для потребителя
+    MsgRingQueue done;    // обработанные сообщения для освобождения
+    size_t capacity;      // предельное количество сообщений у потребителя
+    size_t outstanding;   // сколько сообщений передано и не освобождено
+                          // (изменяет только производитель)
+} MsgRing, *MsgRingPtr;
+
+
+// Функция создает кольца, в которых у потребителя одновременно находится
+// не больше capacity сообщений (округляется вверх до степени двойки).
+extern BOOL MsgRingInit(MsgRing* ring, size_t capacity);
+
+// Функция освобождает кольца и все сообщения в них. Вызывается после
+// остановки обоих потоков; сообщения, которые потребитель забрал и не
+// вернул, должны быть освобождены им самим (MsgListNodeFree, см.
+// MsgListUnlink).
+extern void MsgRingFree(MsgRing* ring);
+
+// Функция производителя: исключает собранное сообщение *pbuf (указатель,
+// полученный от MsgConnReceive или MsgConnReceiveWait) из списка буферов
+// соединения conn и передает его потребителю. При успехе *pbuf
+// обнуляется. Если у потребителя уже capacity сообщений, то функция
+// возвращает FALSE, а сообщение остается в списке соединения (его можно
+// передать позже или освободить функцией MsgConnBufferRelease).
+extern BOOL MsgRingPublish(MsgRing* ring, MsgConn* conn, MsgBuffer** pbuf);
+
+// Функция производителя: освобождает сообщения, возвращенные
+// потребителем, и возвращает их количество. Вызывается регулярно в цикле
+// приема (ее вызывает и MsgRingPublish).
+extern size_t MsgRingReclaim(MsgRing* ring);
+
+// Функция потребителя: забирает очередное сообщение без ожидания и
+// записывает в *pbuf указатель на его буфер. Возвращает FALSE, если
+// кольцо пусто.
+extern BOOL MsgRingTake(MsgRing* ring, MsgBuffer** pbuf);
+
+// Функция потребителя: возвращает обработанное сообщение производителю
+// для освобождения и обнуляет *pbuf.
+extern void MsgRingRelease(MsgRing* ring, MsgBuffer** pbuf);
+
+
+#endif // MSG_RING_H
@@ -0,0 +1,389 @@
+// msg_shard.c: Реализация функций для многопоточного приема датаграмм.
+//
+// Разделяемый сокет читают все потоки, а не каждый свой сокет с
+// SO_REUSEPORT: ядро распределяет по таким сокетам только одиночные
+// датаграммы, а датаграммы рассылки получает каждый сокет группы.
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // malloc(), free()
+#include <string.h>      // bzero()
+#include <errno.h>
+#include <time.h>        // clock_gettime()
+#include <poll.h>        // poll()
+#include <sys/socket.h>  // recv()
+#include <assert.h>
+#include "msg_shard.h"
+#include "msg_trace.h"   // временная шкала приема
+
+// Предельное количество потоков приема
+#define MSG_SHARD_THREADS_MAX 64
+
+
+// Функция увеличивает счетчик сбойных сообщений получателя (его
+// изменяют все потоки приема).
+static void MsgShardError(MsgShardReceiver* rcv, size_t count)
+{
+    __atomic_fetch_add(&rcv->msgErrorCount, count, __ATOMIC_RELAXED);
+}
+
+
+// Функция ставит собранное сообщение в очередь по возрастанию номеров и
+// будит ожидающего получателя. Если очередь переполнена, то отбрасывается
+// сообщение с наименьшим номером.
+static void MsgShardPushReady(MsgShardReceiver* rcv, MsgList* node)
+{
+    MsgList** pos = &rcv->ready;
+
+    pthread_mutex_lock(&rcv->readyLock);
+    while (*pos && (*pos)->buf.msgIndex < node->buf.msgIndex)
+        pos = &(*pos)->next;
+    node->next = *pos;
+    *pos = node;
+    rcv->readyCount++;
+    if (rcv->readyCount > rcv->conn.config.maxListLength)
+    {
+        printf("Ready message queue overrun!\n");
+        node = rcv->ready;
+        rcv->ready = node->next;
+        rcv->readyCount--;
+        MsgListNodeFree(node);
+        MsgShardError(rcv, 1);
+    }
+    pthread_cond_signal(&rcv->readyCond);
+    pthread_mutex_unlock(&rcv->readyLock);
+}
+
+
+// Функция раскладывает пачку небольших сообщений размером size байт на
+// сообщения и ставит их в очередь собранных.
+static void MsgShardProcessBatch(MsgShardReceiver* rcv,
+    const unsigned char* data, size_t size)
+{
+    const MsgPacketHeader* pkt = (const MsgPacketHeader*) data;
+    uint64_t now = MsgClockNs(rcv->conn.config.clock);
+    MsgList* node = NULL;
+    MsgList* next = NULL;
+
+    if (size != pkt->chunkSize + sizeof(MsgPacketHeader) ||
+        !(node = MsgBatchSplit(pkt, data + sizeof(MsgPacketHeader))))
+    {
+        printf("Corrupted message batch received!\n");
+        MsgShardError(rcv, 1);
+        return;
+    }
+    for (; node; node = next)
+    {
+        next = node->next;
+        node->buf.recvTimeNs = now;
+        MSG_TRACE_MARK(MsgTraceChunkLast, node->buf.msgIndex, 0);
+        MSG_TRACE_BEGIN(MsgTraceDelivered, node->buf.msgIndex, 0);
+        MsgShardPushReady(rcv, node);
+    }
+}
+
+
+// Функция записывает принятый пакет размером size байт в сообщение
+// в таблице его части и переносит собранное сообщение в очередь.
+static void MsgShardProcessPacket(MsgShardReceiver* rcv,
+    const unsigned char* data, size_t size)
+{
+    const MsgPacketHeader* pkt = (const MsgPacketHeader*) data;
+    const MsgConnConfig* cfg = &rcv->conn.config;
+    MsgShard* shard = NULL;
+    MsgBuffer* buf = NULL;
+    MsgList* node = NULL;
+    size_t expired = 0;
+
+    // Пачку небольших сообщений сразу раскладываем на собранные сообщения
+    if (size >= sizeof(MsgPacketHeader) &&
+        pkt->magicNumber == MSG_BATCH_MAGIC)
+    {
+        MsgShardProcessBatch(rcv, data, size);
+        return;
+    }
+
+    // Проверяем корректность заголовка пакета
+    if (size < sizeof(MsgPacketHeader) ||
+        pkt->magicNumber != MSG_PACKET_MAGIC ||
+        size != pkt->chunkSize + sizeof(MsgPacketHeader))
+    {
+        printf("Corrupted packet received!\n");
+        MsgShardError(rcv, 1);
+        return;
+    }
+
+    shard = &rcv->shards[pkt->msgIndex % rcv->shardCount];
+    pthread_mutex_lock(&shard->lock);
+    buf = MsgListFind(shard->list, pkt->msgIndex);
+    if (!buf)
+    {
+        // Отбрасываем сообщения части, недостающие пакеты которых не
+        // пришли вовремя, и ограничиваем длину ее списка
+        if (cfg->reassemblyTimeout > 0)
+            expired = MsgListExpire(&shard->list, cfg->reassemblyTimeout);
+        if (expired > 0)
+        {
+            printf("%d incomplete message(s) expired!\n", (int) expired);
+            MsgShardError(rcv, expired);
+        }
+        if (MsgListGetLength(shard->list) > cfg->maxListLength)
+        {
+            printf("Message bufer list overrun!\n");
+            MsgListClear(&shard->list);
+        }
+
+        // Создаем буфер нового сообщения
+        buf = MsgListCreate(&shard->list);
+        if (!buf || !MsgBufferInitFromPkt(buf, pkt))
+        {
+            printf("Unable to create message buffer!\n");
+            if (buf)
+            {
+                node = (MsgList*) buf;
+                MsgListUnlink(&shard->list, buf);
+                free(buf->status);
+                free(buf->data);
+                free(node);
+            }
+            pthread_mutex_unlock(&shard->lock);
+            MsgShardError(rcv, 1);
+            return;
+        }
+        MSG_TRACE_MARK(MsgTraceChunkFirst, pkt->msgIndex, pkt->chunkIndex);
+        MSG_TRACE_BEGIN(MsgTraceReassembly, pkt->msgIndex,
+            pkt->msgChunksCount);
+    }
+    MsgBufferPutPacket(buf, pkt, data + sizeof(MsgPacketHeader));
+
+    // Собранное сообщение проверяем и переносим в очередь (узел списка
+    // начинается с буфера сообщения)
+    if (MsgBufferIsFull(buf))
+    {
+        const MsgHeader* msg = (const MsgHeader*) buf->data;
+        node = (MsgList*) buf;
+        MsgListUnlink(&shard->list, buf);
+        pthread_mutex_unlock(&shard->lock);
+        MSG_TRACE_MARK(MsgTraceChunkLast, buf->msgIndex, pkt->chunkIndex);
+        MSG_TRACE_END(MsgTraceReassembly, buf->msgIndex, buf->size);
+        if (MsgCalcSize(msg) <= buf->size &&
+            msg->magicNumber == MSG_HEADER_MAGIC)
+        {
+            buf->recvTimeNs = MsgClockNs(rcv->conn.config.clock);
+            MSG_TRACE_BEGIN(MsgTraceDelivered, buf->msgIndex, 0);
+            MsgShardPushReady(rcv, node);
+        }
+        else
+        {
+            printf("Corrupted message received!\n");
+            MsgBufferFree(buf);
+            free(node);
+            MsgShardError(rcv, 1);
+        }
+        return;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+
+// Функция потока приема: читает датаграммы из сокета получателя без
+// блокировки, пока они есть, а затем ждет новых данных или сигнала
+// завершения.
+static void* MsgShardThread(void* arg)
+{
+    MsgShardReceiver* rcv = (MsgShardReceiver*) arg;
+    size_t mtu = rcv->conn.config.mtu;
+    int sock = (rcv->conn.config.connRole == MsgConnRoleMcastReceiver) ?
+        rcv->conn.uni.mcast.sockfd : rcv->conn.uni.serverLoc.sockfd;
+    unsigned char* pkt = (unsigned char*) malloc(mtu);
+    struct pollfd pfd[2];
+
+    if (!pkt)
+    {
+        printf("Unable to allocate packet buffer!\n");
+        return NULL;
+    }
+    while (!__atomic_load_n(&rcv->stop, __ATOMIC_ACQUIRE))
+    {
+        ssize_t cbret = recv(sock, pkt, mtu, MSG_DONTWAIT);
+        if (cbret > 0)
+        {
+            MsgShardProcessPacket(rcv, pkt, (size_t) cbret);
+            continue;
+        }
+        if (cbret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR)
+        {
+            printf("ERROR reading from socket!\n");
+            MsgShardError(rcv, 1);
+        }
+
+        // Дескриптор пробуждения не читаем: сигнал завершения должны
+        // увидеть все потоки
+        pfd[0].fd = sock;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = rcv->conn.wakeFd;
+        pfd[1].events = POLLIN;
+        pfd[0].revents = pfd[1].revents = 0;
+        poll(pfd, 2, -1);
+    }
+    free(pkt);
+    return NULL;
+}
+
+
+// Функция создает получателя и запускает потоки приема.
+BOOL MsgShardReceiverInit(MsgShardReceiver* rcv, const MsgConnConfig* cfg,
+    size_t threadCount)
+{
+    MsgConnConfig rcvCfg = *cfg;
+    pthread_condattr_t attr;
+
+    if (cfg->connRole != MsgConnRoleMcastReceiver &&
+        cfg->connRole != MsgConnRoleLocalReceiver)
+    {
+        printf("Sharded receiver requires a datagram receiver role!\n");
+        return FALSE;
+    }
+    if (cfg->creditWindow > 0)
+    {
+        // Потоки приема не запоминают адрес отправителя для кредитов
+        printf("Sharded receiver does not support credit flow control!\n");
+        return FALSE;
+    }
+    if (threadCount < 1 || threadCount > MSG_SHARD_THREADS_MAX)
+    {
+        printf("Wrong number of receive threads (1 to %d)!\n",
+            MSG_SHARD_THREADS_MAX);
+        return FALSE;
+    }
+
+    // Сокет читают сами потоки приема, поэтому io_uring не используется
+    bzero(rcv, sizeof(MsgShardReceiver));
+    rcvCfg.engine = MsgConnEngineSocket;
+    if (!MsgConnInit(&rcv->conn, &rcvCfg))
+        return FALSE;
+
+    rcv->shardCount = threadCount;
+    rcv->shards = (MsgShard*) calloc(threadCount, sizeof(MsgShard));
+    rcv->threads = (pthread_t*) calloc(threadCount, sizeof(pthread_t));
+    if (!rcv->shards || !rcv->threads)
+    {
+        printf("Unable to allocate receive threads!\n");
+        free(rcv->shards);
+        free(rcv->threads);
+        MsgConnFree(&rcv->conn);
+        return FALSE;
+    }
+    for (size_t i = 0; i < threadCount; i++)
+        pthread_mutex_init(&rcv->shards[i].lock, NULL);
+    pthread_mutex_init(&rcv->readyLock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rcv->readyCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // Запускаем потоки приема
+    for (rcv->threadCount = 0; rcv->threadCount < threadCount;
+        rcv->threadCount++)
+        if (pthread_create(&rcv->threads[rcv->threadCount], NULL,
+            MsgShardThread, rcv) != 0)
+        {
+            printf("Unable to start receive thread!\n");
+            MsgShardReceiverFree(rcv);
+            return FALSE;
+        }
+    return TRUE;
+}
+
+
+// Функция останавливает потоки приема и освобождает получателя.
+void MsgShardReceiverFree(MsgShardReceiver* rcv)
+{
+    // Останавливаем потоки приема
+    __atomic_store_n(&rcv->stop, 1, __ATOMIC_RELEASE);
+    MsgConnWakeup(&rcv->conn);
+    for (size_t i = 0; i < rcv->threadCount; i++)
+        pthread_join(rcv->threads[i], NULL);
+    rcv->threadCount = 0;
+    MsgConnFree(&rcv->conn);
+
+    // Освобождаем несобранные и собранные сообщения
+    for (size_t i = 0; i < rcv->shardCount; i++)
+    {
+        MsgListClear(&rcv->shards[i].list);
+        pthread_mutex_destroy(&rcv->shards[i].lock);
+    }
+    MsgListClear(&rcv->ready);
+    rcv->readyCount = 0;
+    pthread_cond_destroy(&rcv->readyCond);
+    pthread_mutex_destroy(&rcv->readyLock);
+    free(rcv->shards);
+    free(rcv->threads);
+    rcv->shards = NULL;
+    rcv->threads = NULL;
+    rcv->shardCount = 0;
+}
+
+
+// Функция ожидает очередное собранное сообщение.
+BOOL MsgShardReceiveWait(MsgShardReceiver* rcv, MsgBuffer** pbuf,
+    double timeoutSec)
+{
+    struct timespec deadline;
+    MsgList* node = NULL;
+
+    assert(pbuf != NULL);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeoutSec > 0)
+    {
+        deadline.tv_sec += (time_t) timeoutSec;
+        deadline.tv_nsec += (long) ((timeoutSec - (time_t) timeoutSec) *
+            1.0e9);
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&rcv->readyLock);
+    while (!rcv->ready)
+    {
+        if (timeoutSec < 0)
+            pthread_cond_wait(&rcv->readyCond, &rcv->readyLock);
+        else if (pthread_cond_timedwait(&rcv->readyCond, &rcv->readyLock,
+            &deadline) == ETIMEDOUT)
+            break;
+    }
+    node = rcv->ready;
+    if (node)
+    {
+        rcv->ready = node->next;
+        rcv->readyCount--;
+        node->next = NULL;
+        __atomic_add_fetch(&rcv->heldCount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&rcv->readyLock);
+
+    *pbuf = node ? &node->buf : NULL;
+    return node != NULL;
+}
+
+
+// Функция освобождает буфер сообщения, полученный от MsgShardReceiveWait.
+void MsgShardBufferRelease(MsgShardReceiver* rcv, MsgBuffer** pbuf)
+{
+    MsgList* node = (MsgList*) *pbuf;  // узел начинается с буфера
+
+    // Буфер должен быть выдан этим получателем и еще не освобожден
+    assert(node->buf.magicNumber == MSG_BUFFER_MAGIC);
+    assert(node->next == NULL);
+    assert(__atomic_load_n(&rcv->heldCount, __ATOMIC_RELAXED) > 0);
+    __atomic_sub_fetch(&rcv->heldCount, 1, __ATOMIC_RELAXED);
+
+    MSG_TRACE_END(MsgTraceDelivered, node->buf.msgIndex, 0);
+    MSG_TRACE_MARK(MsgTraceRelease, node->buf.msgIndex, 0);
+    MsgListNodeFree(node);
+    *pbuf = NULL;
+}
@@ -0,0 +1,76 @@
+// msg_shard.h: Функции для многопоточного приема датаграмм.
+//
+// Несколько потоков читают сокет получателя датаграмм (многоадресной
+// рассылки или локального), и каждая датаграмма достается одному из них.
+// Сборка сообщений разбита на части: пакет записывается в таблицу части
+// с номером msgIndex % shardCount, так что пакеты одного сообщения
+// попадают в одну таблицу, а разные сообщения собираются параллельно на
+// разных ядрах. Собранные сообщения ставятся в общую очередь по
+// возрастанию номеров. Порядок выдачи сообщений лишь приблизительный:
+// если сообщение собрано позже следующего за ним и получатель уже забрал
+// следующее из очереди, то сообщения выдаются не по порядку (а потерянные
+// номера пропускаются), поэтому приложение, которому важен порядок,
+// сверяет номера msgIndex само.
+
+#ifndef MSG_SHARD_H
+#define MSG_SHARD_H
+
+#include <stddef.h>      // size_t
+#include <pthread.h>     // потоки приема и их синхронизация
+#include "msg_conn.h"  // соединение получателя
+
+
+/* MsgShard: Структура представляет часть таблицы сборки сообщений. */
+typedef struct MsgShardStruct
+{
+    pthread_mutex_t lock; // защищает список сообщений части
+    MsgList* list;        // несобранные сообщения части
+} MsgShard, *MsgShardPtr;
+
+
+/* MsgShardReceiver: Структура представляет многопоточного получателя
+ * датаграмм. */
+typedef struct MsgShardReceiverStruct
+{
+    MsgConn conn;         // соединение получателя (роль получателя
+                          // рассылки или локального получателя)
+    size_t shardCount;    // количество частей таблицы и потоков приема
+    MsgShard* shards;     // части таблицы сборки
+    pthread_t* threads;   // потоки приема
+    size_t threadCount;   // сколько потоков запущено
+    int stop;             // признак завершения потоков приема
+    pthread_mutex_t readyLock; // защищает очередь собранных сообщений
+    pthread_cond_t readyCond;  // сигнал о новом собранном сообщении
+    MsgList* ready;       // собранные сообщения по возрастанию номеров
+    size_t readyCount;    // длина очереди собранных сообщений
+    size_t heldCount;     // сколько выданных сообщений приложение еще не
+                          // освободило
+    size_t msgErrorCount; // количество сбойных сообщений
+} MsgShardReceiver, *MsgShardReceiverPtr;
+
+
+// Функция создает получателя по настройкам cfg (роль получателя рассылки
+// или локального получателя) и запускает threadCount потоков приема.
+// Длина очереди собранных сообщений и каждой части таблицы ограничена
+// значением cfg->maxListLength. Способ ввода-вывода всегда
+// MsgConnEngineSocket; управление потоком по кредитам (cfg->creditWindow)
+// не поддерживается.
+extern BOOL MsgShardReceiverInit(MsgShardReceiver* rcv,
+    const MsgConnConfig* cfg, size_t threadCount);
+
+// Функция останавливает потоки приема, разрывает соединение и
+// освобождает все сообщения, в том числе несобранные.
+extern void MsgShardReceiverFree(MsgShardReceiver* rcv);
+
+// Функция ожидает не дольше timeoutSec секунд (значение < 0 - без
+// ограничения) очередное собранное сообщение и записывает в *pbuf
+// указатель на его буфер. После обработки буфер освобождается функцией
+// MsgShardBufferRelease. Возвращает FALSE, если время ожидания истекло.
+extern BOOL MsgShardReceiveWait(MsgShardReceiver* rcv, MsgBuffer** pbuf,
+    double timeoutSec);
+
+// Функция освобождает буфер сообщения, полученный от MsgShardReceiveWait.
+extern void MsgShardBufferRelease(MsgShardReceiver* rcv, MsgBuffer** pbuf);
+
+
+#endif // MSG_SHARD_H
@@ -0,0 +1,234 @@
+// msg_trace.c: Реализация функций для записи временной шкалы отправки,
+// приема и сборки сообщений в формате Chrome trace.
+//
+// Запись события в кольцо своего потока стоит одного чтения часов и
+// нескольких записей в память: кольцо создается при первом событии
+// потока, а индекс читателя перечитывается, только когда по его копии
+// кольцо выглядит заполненным. Кольца не освобождаются до завершения
+// процесса, так как поток может записать событие в любой момент.
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // calloc()
+#include <stdint.h>      // uint64_t, uint32_t
+#include <time.h>        // clock_gettime(), nanosleep()
+#include <unistd.h>      // getpid(), syscall()
+#include <sys/syscall.h> // SYS_gettid
+#include <pthread.h>     // поток сброса событий
+#include "msg_trace.h"
+
+// Количество событий в кольце потока (степень двойки)
+#define MSG_TRACE_RING_EVENTS 16384
+
+// Период сброса событий в файл, мс
+#define MSG_TRACE_FLUSH_MS 10
+
+
+/* MsgTraceEvent: Структура представляет событие временной шкалы. */
+typedef struct MsgTraceEventStruct
+{
+    uint64_t timeNs;     // момент события по монотонным часам, нс
+    uint64_t msgIndex;   // номер сообщения
+    uint32_t arg;        // аргумент события (номер пакета и т. п.)
+    uint16_t type;       // тип события (MsgTraceType)
+    char phase;          // фаза события ('b', 'e' или 'n')
+} MsgTraceEvent;
+
+
+/* MsgTraceRing: Структура представляет кольцо событий одного потока. */
+typedef struct MsgTraceRingStruct
+{
+    MsgTraceEvent events[MSG_TRACE_RING_EVENTS]; // события
+    size_t head;         // сколько событий записано (пишет поток-владелец)
+    size_t tailCache;    // последнее прочитанное владельцем значение tail
+    size_t tail;         // сколько событий сброшено (пишет поток сброса)
+    size_t dropCount;    // сколько событий отброшено
+    unsigned tid;        // системный номер потока-владельца
+    struct MsgTraceRingStruct* next; // следующее кольцо в списке
+} MsgTraceRing;
+
+
+// Названия типов событий на временной шкале
+static const char* msgTraceNames[MsgTraceTypeCount] =
+{
+    "compose", "packetize", "chunk write", "first chunk", "last chunk",
+    "reassembly", "delivered", "release"
+};
+
+static int msgTraceActive = 0;       // идет ли запись событий
+static int msgTraceStopping = 0;     // признак завершения потока сброса
+static pthread_mutex_t msgTraceLock = PTHREAD_MUTEX_INITIALIZER;
+static MsgTraceRing* msgTraceRings = NULL; // кольца всех потоков
+static __thread MsgTraceRing* msgTraceLocal = NULL; // кольцо потока
+static FILE* msgTraceFile = NULL;    // файл временной шкалы
+static BOOL msgTraceFirst = TRUE;    // в файл еще не записано событий
+static pthread_t msgTraceThread;     // поток сброса событий
+
+
+// Функция создает кольцо событий текущего потока и добавляет его в
+// список колец.
+static MsgTraceRing* MsgTraceRegister(void)
+{
+    MsgTraceRing* ring = (MsgTraceRing*) calloc(1, sizeof(MsgTraceRing));
+
+    if (!ring)
+        return NULL;
+    ring->tid = (unsigned) syscall(SYS_gettid);
+    pthread_mutex_lock(&msgTraceLock);
+    ring->next = msgTraceRings;
+    __atomic_store_n(&msgTraceRings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&msgTraceLock);
+    msgTraceLocal = ring;
+    return ring;
+}
+
+
+// Функция записывает событие в кольцо текущего потока.
+void MsgTraceRecord(MsgTraceType type, char phase, size_t msgIndex,
+    size_t arg)
+{
+    MsgTraceRing* ring = msgTraceLocal;
+    MsgTraceEvent* event = NULL;
+    struct timespec ts;
+    size_t head = 0;
+
+    if (!__atomic_load_n(&msgTraceActive, __ATOMIC_RELAXED))
+        return;
+    if (!ring && !(ring = MsgTraceRegister()))
+        return;
+
+    head = ring->head;  // head изменяет только поток-владелец
+    if (head - ring->tailCache >= MSG_TRACE_RING_EVENTS)
+    {
+        ring->tailCache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tailCache >= MSG_TRACE_RING_EVENTS)
+        {
+            __atomic_fetch_add(&ring->dropCount, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    event = &ring->events[head & (MSG_TRACE_RING_EVENTS - 1)];
+    event->timeNs = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    event->msgIndex = msgIndex;
+    event->arg = (uint32_t) arg;
+    event->type = (uint16_t) type;
+    event->phase = phase;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+// Функция переносит накопленные события всех колец в файл.
+static void MsgTraceDrain(void)
+{
+    MsgTraceRing* ring = __atomic_load_n(&msgTraceRings, __ATOMIC_ACQUIRE);
+    int pid = (int) getpid();
+
+    for (; ring; ring = ring->next)
+    {
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = ring->tail;  // tail изменяет только поток сброса
+
+        for (; tail != head; tail++)
+        {
+            const MsgTraceEvent* event =
+                &ring->events[tail & (MSG_TRACE_RING_EVENTS - 1)];
+            fprintf(msgTraceFile, "%s\n{\"name\":\"%s\",\"cat\":\"msg\","
+                "\"ph\":\"%c\",\"id\":%llu,\"ts\":%.3f,\"pid\":%d,"
+                "\"tid\":%u,\"args\":{\"msgIndex\":%llu,\"arg\":%u}}",
+                msgTraceFirst ? "" : ",",
+                msgTraceNames[event->type % MsgTraceTypeCount],
+                event->phase, (unsigned long long) event->msgIndex,
+                event->timeNs * 1.0e-3, pid, ring->tid,
+                (unsigned long long) event->msgIndex, event->arg);
+            msgTraceFirst = FALSE;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+
+// Функция потока сброса: периодически переносит события в файл.
+static void* MsgTraceFlushThread(void* arg)
+{
+    struct timespec ts;
+
+    (void) arg;
+    ts.tv_sec = 0;
+    ts.tv_nsec = MSG_TRACE_FLUSH_MS * 1000000L;
+    while (!__atomic_load_n(&msgTraceStopping, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&ts, NULL);
+        MsgTraceDrain();
+    }
+    return NULL;
+}
+
+
+// Функция начинает запись временной шкалы.
+BOOL MsgTraceStart(const char* path)
+{
+    pthread_mutex_lock(&msgTraceLock);
+    if (msgTraceFile)
+    {
+        pthread_mutex_unlock(&msgTraceLock);
+        printf("Trace is already being recorded!\n");
+        return FALSE;
+    }
+    msgTraceFile = fopen(path, "w");
+    if (!msgTraceFile)
+    {
+        pthread_mutex_unlock(&msgTraceLock);
+        printf("Unable to open trace file %s!\n", path);
+        return FALSE;
+    }
+    fprintf(msgTraceFile, "[");
+    msgTraceFirst = TRUE;
+    __atomic_store_n(&msgTraceStopping, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&msgTraceThread, NULL, MsgTraceFlushThread, NULL) != 0)
+    {
+        printf("Unable to start trace flush thread!\n");
+        fclose(msgTraceFile);
+        msgTraceFile = NULL;
+        pthread_mutex_unlock(&msgTraceLock);
+        return FALSE;
+    }
+    __atomic_store_n(&msgTraceActive, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&msgTraceLock);
+    return TRUE;
+}
+
+
+// Функция останавливает запись временной шкалы.
+void MsgTraceStop(void)
+{
+    pthread_mutex_lock(&msgTraceLock);
+    if (!msgTraceFile)
+    {
+        pthread_mutex_unlock(&msgTraceLock);
+        return;
+    }
+    __atomic_store_n(&msgTraceActive, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&msgTraceStopping, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&msgTraceLock);
+
+    pthread_join(msgTraceThread, NULL);
+    pthread_mutex_lock(&msgTraceLock);
+    MsgTraceDrain();
+    fprintf(msgTraceFile, "\n]\n");
+    fclose(msgTraceFile);
+    msgTraceFile = NULL;
+    pthread_mutex_unlock(&msgTraceLock);
+}
+
+
+// Функция возвращает количество отброшенных событий.
+size_t MsgTraceDropCount(void)
+{
+    MsgTraceRing* ring = __atomic_load_n(&msgTraceRings, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+
+    for (; ring; ring = ring->next)
+        count += __atomic_load_n(&ring->dropCount, __ATOMIC_RELAXED);
+    return count;
+}
@@ -0,0 +1,75 @@
+// msg_trace.h: Функции для записи временной шкалы отправки, приема и
+// сборки сообщений в формате Chrome trace (chrome://tracing, Perfetto).
+//
+// События записываются макросами MSG_TRACE_BEGIN, MSG_TRACE_END и
+// MSG_TRACE_MARK в кольцо потока, который их порождает (кольцо без
+// блокировок с одним писателем и одним читателем), а отдельный поток сброса
+// периодически переносит их в файл JSON. Все события сообщения связаны
+// номером msgIndex (асинхронные события Chrome с идентификатором, равным
+// номеру), так что интервалы отправки, приема и обработки одного кадра
+// видны на общей шкале, даже если их записали разные потоки.
+//
+// Запись событий включается при компиляции определением MSG_TRACE
+// (например, make -f MakefileClient CFLAGS="-g -I. -DMSG_TRACE"). Без
+// него макросы ничего не делают и не порождают кода.
+
+#ifndef MSG_TRACE_H
+#define MSG_TRACE_H
+
+#include <stddef.h>      // size_t
+#include "msg_buf.h"   // BOOL
+
+
+/* MsgTraceType: Перечисление задает тип события временной шкалы. */
+typedef enum MsgTraceTypeEnum
+{
+    MsgTraceCompose,     // интервал: приложение составляет сообщение
+    MsgTracePacketize,   // интервал: отправка сообщения по пакетам
+    MsgTraceChunkWrite,  // интервал: запись пакета (или порции пакетов)
+                         // в сокет, аргумент - номер первого пакета
+    MsgTraceChunkFirst,  // отметка: принят первый пакет сообщения
+    MsgTraceChunkLast,   // отметка: принят последний пакет сообщения
+    MsgTraceReassembly,  // интервал: от первого пакета до сборки
+    MsgTraceDelivered,   // интервал: от сборки до освобождения приложением
+    MsgTraceRelease,     // отметка: приложение освободило сообщение
+    MsgTraceTypeCount    // количество типов событий
+} MsgTraceType;
+
+
+#ifdef MSG_TRACE
+#define MSG_TRACE_BEGIN(type, msgIndex, arg) \
+    MsgTraceRecord((type), 'b', (msgIndex), (arg))
+#define MSG_TRACE_END(type, msgIndex, arg) \
+    MsgTraceRecord((type), 'e', (msgIndex), (arg))
+#define MSG_TRACE_MARK(type, msgIndex, arg) \
+    MsgTraceRecord((type), 'n', (msgIndex), (arg))
+#else
+#define MSG_TRACE_BEGIN(type, msgIndex, arg) ((void) 0)
+#define MSG_TRACE_END(type, msgIndex, arg)   ((void) 0)
+#define MSG_TRACE_MARK(type, msgIndex, arg)  ((void) 0)
+#endif
+
+
+// Функция начинает запись временной шкалы в файл path и запускает поток
+// сброса событий. До ее вызова и после MsgTraceStop события не
+// записываются.
+extern BOOL MsgTraceStart(const char* path);
+
+// Функция останавливает запись: переносит в файл оставшиеся события и
+// закрывает его.
+extern void MsgTraceStop(void);
+
+// Функция записывает событие type с фазой phase ('b' - начало интервала,
+// 'e' - его конец, 'n' - отметка) для сообщения msgIndex с аргументом arg
+// в кольцо текущего потока. Если кольцо заполнено, событие отбрасывается.
+// Вызывается через макросы MSG_TRACE_BEGIN, MSG_TRACE_END и
+// MSG_TRACE_MARK.
+extern void MsgTraceRecord(MsgTraceType type, char phase, size_t msgIndex,
+    size_t arg);
+
+// Функция возвращает количество событий, отброшенных из-за заполнения
+// колец потоков.
+extern size_t MsgTraceDropCount(void);
+
+
+#endif // MSG_TRACE_H
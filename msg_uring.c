@@ -0,0 +1,274 @@
+// msg_uring.c: Минимальная обертка над интерфейсом io_uring ядра Linux
+// для отправки и приема пакетов сообщений (без библиотеки liburing).
+//
+// При разработке использовалась документация по io_uring:
+// https://kernel.dk/io_uring.pdf
+//
+
+#include <stdio.h>
+#include <stdlib.h>      // malloc(), free()
+#include <string.h>      // memset()
+#include <errno.h>
+#include <unistd.h>      // syscall(), close(), sysconf()
+#include <time.h>        // struct timespec
+#include <sys/mman.h>    // mmap(), munmap()
+#include <sys/syscall.h> // __NR_io_uring_*
+#include <linux/time_types.h> // struct __kernel_timespec
+#include <assert.h>
+#include "msg_uring.h"
+
+
+// Обертки над системными вызовами io_uring
+static int MsgUringSetup(unsigned entries, struct io_uring_params* p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int MsgUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+    unsigned flags, void* arg, size_t argSize)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+        flags, arg, argSize);
+}
+
+static int MsgUringRegister(int fd, unsigned opcode, void* arg,
+    unsigned nrArgs)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+
+// Функция создает io_uring с кольцом отправки из entries запросов.
+BOOL MsgUringInit(MsgUring* ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(MsgUring));
+    memset(&p, 0, sizeof(p));
+    ring->recvBid = -1;
+    ring->fd = MsgUringSetup(entries, &p);
+    if (ring->fd < 0)
+    {
+        printf("Unable to create io_uring!\n");
+        return FALSE;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        printf("io_uring is too old (no timeout support)!\n");
+        close(ring->fd);
+        ring->fd = -1;
+        return FALSE;
+    }
+    ring->entries = p.sq_entries;
+
+    // Отображаем в память кольца отправки и завершения
+    ring->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesMapSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqMap = (unsigned char*) mmap(NULL, ring->sqMapSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQ_RING);
+    ring->cqMap = (unsigned char*) mmap(NULL, ring->cqMapSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqesMapSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQES);
+    if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED ||
+        ring->sqes == MAP_FAILED)
+    {
+        printf("Unable to map io_uring!\n");
+        if (ring->sqMap == MAP_FAILED) ring->sqMap = NULL;
+        if (ring->cqMap == MAP_FAILED) ring->cqMap = NULL;
+        if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+        MsgUringFree(ring);
+        return FALSE;
+    }
+    ring->sqHead = (unsigned*) (ring->sqMap + p.sq_off.head);
+    ring->sqTail = (unsigned*) (ring->sqMap + p.sq_off.tail);
+    ring->sqMask = (unsigned*) (ring->sqMap + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (ring->sqMap + p.sq_off.array);
+    ring->cqHead = (unsigned*) (ring->cqMap + p.cq_off.head);
+    ring->cqTail = (unsigned*) (ring->cqMap + p.cq_off.tail);
+    ring->cqMask = (unsigned*) (ring->cqMap + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (ring->cqMap + p.cq_off.cqes);
+    ring->sqLocalTail = *ring->sqTail;
+
+    // Выделяем служебные массивы для отправки пакетов
+    ring->sendHdrs = (MsgPacketHeader*) malloc(
+        ring->entries * sizeof(MsgPacketHeader));
+    ring->sendIov = (struct iovec*) malloc(
+        2 * ring->entries * sizeof(struct iovec));
+    ring->sendMsgs = (struct msghdr*) calloc(ring->entries,
+        sizeof(struct msghdr));
+    if (!ring->sendHdrs || !ring->sendIov || !ring->sendMsgs)
+    {
+        printf("Unable to allocate io_uring send arrays!\n");
+        MsgUringFree(ring);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+// Функция создает кольцо предоставленных ядру приемных буферов.
+BOOL MsgUringInitBuffers(MsgUring* ring, unsigned count, size_t bufSize)
+{
+    struct io_uring_buf_reg reg;
+    long page = sysconf(_SC_PAGESIZE);
+
+    assert(count > 0 && (count & (count - 1)) == 0 && count <= 32768);
+
+    // Размер буфера выравниваем, чтобы заголовки пакетов в буферах
+    // были выровнены по границе 8 байт
+    ring->bufSize = (bufSize + 63) & ~(size_t) 63;
+    ring->bufCount = count;
+    ring->bufRingSize = (count * sizeof(struct io_uring_buf) + page - 1) /
+        page * page;
+    ring->bufRing = (struct io_uring_buf_ring*) mmap(NULL, ring->bufRingSize,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->bufMem = (unsigned char*) malloc(count * ring->bufSize);
+    if (ring->bufRing == MAP_FAILED || !ring->bufMem)
+    {
+        printf("Unable to allocate io_uring buffers!\n");
+        if (ring->bufRing == MAP_FAILED) ring->bufRing = NULL;
+        return FALSE;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) ring->bufRing;
+    reg.ring_entries = count;
+    reg.bgid = MSG_URING_BUF_GROUP;
+    if (MsgUringRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        printf("Unable to register io_uring buffer ring!\n");
+        return FALSE;
+    }
+
+    // Передаем ядру все буферы
+    ring->bufTail = 0;
+    for (unsigned i = 0; i < count; i++)
+        MsgUringRecycleBuffer(ring, (unsigned short) i);
+    return TRUE;
+}
+
+
+// Функция освобождает io_uring и все связанные с ним ресурсы.
+void MsgUringFree(MsgUring* ring)
+{
+    if (ring->sqMap) munmap(ring->sqMap, ring->sqMapSize);
+    if (ring->cqMap) munmap(ring->cqMap, ring->cqMapSize);
+    if (ring->sqes) munmap(ring->sqes, ring->sqesMapSize);
+    if (ring->fd >= 0) close(ring->fd);  // снимает и регистрацию буферов
+    if (ring->bufRing) munmap(ring->bufRing, ring->bufRingSize);
+    free(ring->bufMem);
+    free(ring->sendHdrs);
+    free(ring->sendIov);
+    free(ring->sendMsgs);
+    memset(ring, 0, sizeof(MsgUring));
+    ring->fd = -1;
+    ring->recvBid = -1;
+}
+
+
+// Функция возвращает очередной свободный запрос кольца отправки.
+struct io_uring_sqe* MsgUringGetSqe(MsgUring* ring)
+{
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe* sqe = NULL;
+
+    if (ring->sqLocalTail - head >= ring->entries)
+        return NULL;  // кольцо заполнено
+    unsigned idx = ring->sqLocalTail & *ring->sqMask;
+    sqe = ring->sqes + idx;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[idx] = idx;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+
+// Функция передает ядру подготовленные запросы и ожидает их завершения.
+int MsgUringSubmit(MsgUring* ring, unsigned waitNr, double timeoutSec)
+{
+    // Передаем и запросы, опубликованные ранее, но еще не принятые ядром
+    // (ядро могло принять лишь часть запросов при прошлом вызове)
+    unsigned toSubmit = ring->sqLocalTail -
+        __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    int ret = 0;
+
+    // Публикуем новые запросы для ядра
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+
+    memset(&arg, 0, sizeof(arg));
+    if (waitNr > 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeoutSec >= 0)
+        {
+            ts.tv_sec = (long long) timeoutSec;
+            ts.tv_nsec = (long long) ((timeoutSec - ts.tv_sec) * 1.0e9);
+            arg.ts = (unsigned long) &ts;
+        }
+    }
+    ret = MsgUringEnter(ring->fd, toSubmit, waitNr, flags,
+        (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+        (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+
+    // Истечение времени ожидания и прерывание сигналом не считаются
+    // ошибкой (ядро прерывает только ожидание, но не передачу запросов)
+    if (ret < 0 && (errno == ETIME || errno == EINTR))
+        ret = 0;
+    return ret;
+}
+
+
+// Функция отзывает запросы, которые еще не приняты ядром. Запросы
+// читаются ядром только внутри io_uring_enter (без потока SQPOLL), поэтому
+// хвост кольца отправки можно безопасно вернуть к его голове.
+unsigned MsgUringDiscard(MsgUring* ring)
+{
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned count = ring->sqLocalTail - head;
+
+    ring->sqLocalTail = head;
+    __atomic_store_n(ring->sqTail, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+
+// Функция возвращает очередной завершенный запрос или NULL.
+struct io_uring_cqe* MsgUringPeekCqe(MsgUring* ring)
+{
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return NULL;
+    return ring->cqes + (head & *ring->cqMask);
+}
+
+
+// Функция отмечает завершенный запрос как обработанный.
+void MsgUringCqeSeen(MsgUring* ring)
+{
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+
+// Функция возвращает приемный буфер с номером bid в кольцо буферов.
+void MsgUringRecycleBuffer(MsgUring* ring, unsigned short bid)
+{
+    struct io_uring_buf* buf =
+        &ring->bufRing->bufs[ring->bufTail & (ring->bufCount - 1)];
+
+    buf->addr = (unsigned long) (ring->bufMem + bid * ring->bufSize);
+    buf->len = (unsigned) ring->bufSize;
+    buf->bid = bid;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
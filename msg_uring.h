@@ -0,0 +1,98 @@
+// msg_uring.h: Минимальная обертка над интерфейсом io_uring ядра Linux
+// для отправки и приема пакетов сообщений (без библиотеки liburing).
+
+#ifndef MSG_URING_H
+#define MSG_URING_H
+
+#include <stddef.h>      // size_t
+#include <sys/socket.h>  // struct msghdr
+#include <sys/uio.h>     // struct iovec
+#include <linux/io_uring.h>
+#include "msg_buf.h"   // заголовок пакета сообщения
+
+
+/* MsgUring: Структура представляет кольца отправки (SQ) и завершения (CQ)
+ * io_uring, кольцо предоставленных приемных буферов и служебные массивы
+ * для отправки пакетов одного пакета запросов. */
+typedef struct MsgUringStruct
+{
+    int fd;                 // дескриптор io_uring
+    unsigned entries;       // размер кольца отправки
+    // Кольцо отправки запросов (SQ)
+    unsigned char* sqMap;   // отображение кольца в память
+    size_t sqMapSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes; // массив запросов
+    size_t sqesMapSize;
+    unsigned sqLocalTail;   // хвост кольца с учетом неотправленных запросов
+    // Кольцо завершенных запросов (CQ)
+    unsigned char* cqMap;
+    size_t cqMapSize;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    // Кольцо предоставленных ядру приемных буферов
+    struct io_uring_buf_ring* bufRing;
+    size_t bufRingSize;     // размер памяти под кольцо буферов
+    unsigned char* bufMem;  // память всех приемных буферов
+    size_t bufSize;         // размер одного приемного буфера
+    unsigned bufCount;      // количество приемных буферов (степень двойки)
+    unsigned short bufTail; // локальная копия хвоста кольца буферов
+    // Служебные массивы для отправки (по одному элементу на запрос)
+    MsgPacketHeader* sendHdrs; // заголовки отправляемых пакетов
+    struct iovec* sendIov;     // по два фрагмента на пакет
+    struct msghdr* sendMsgs;   // описания отправляемых пакетов
+    // Состояние многократного приема (multishot recv)
+    BOOL recvArmed;         // запрос приема активен в ядре
+    int recvBid;            // номер текущего приемного буфера (-1 - нет)
+    const unsigned char* recvPtr; // непрочитанные данные текущего буфера
+    size_t recvLeft;        // количество непрочитанных байт
+    BOOL wakeArmed;         // запрос ожидания пробуждения активен в ядре
+    BOOL acceptArmed;       // запрос ожидания подключения активен в ядре
+} MsgUring, *MsgUringPtr;
+
+
+// Номер группы предоставленных буферов для приема
+#define MSG_URING_BUF_GROUP 1
+
+
+// Функция создает io_uring с кольцом отправки из entries запросов.
+extern BOOL MsgUringInit(MsgUring* ring, unsigned entries);
+
+// Функция создает кольцо из count предоставленных ядру приемных буферов
+// размером bufSize байт каждый и регистрирует его в io_uring.
+extern BOOL MsgUringInitBuffers(MsgUring* ring, unsigned count,
+    size_t bufSize);
+
+// Функция освобождает io_uring и все связанные с ним ресурсы.
+extern void MsgUringFree(MsgUring* ring);
+
+// Функция возвращает очередной свободный запрос кольца отправки
+// (обнуленный) или NULL, если кольцо заполнено.
+extern struct io_uring_sqe* MsgUringGetSqe(MsgUring* ring);
+
+// Функция передает ядру все подготовленные запросы и ожидает, пока не
+// завершится не менее waitNr запросов, но не дольше timeoutSec секунд
+// (значение timeoutSec < 0 означает ожидание без ограничения времени).
+// Возвращает количество переданных запросов или -1 при ошибке.
+extern int MsgUringSubmit(MsgUring* ring, unsigned waitNr, double timeoutSec);
+
+// Функция отзывает подготовленные запросы, которые ядро еще не приняло
+// (например, после ошибки MsgUringSubmit). Возвращает их количество.
+extern unsigned MsgUringDiscard(MsgUring* ring);
+
+// Функция возвращает очередной завершенный запрос или NULL.
+extern struct io_uring_cqe* MsgUringPeekCqe(MsgUring* ring);
+
+// Функция отмечает завершенный запрос как обработанный.
+extern void MsgUringCqeSeen(MsgUring* ring);
+
+// Функция возвращает приемный буфер с номером bid в кольцо буферов.
+extern void MsgUringRecycleBuffer(MsgUring* ring, unsigned short bid);
+
+
+#endif // MSG_URING_H
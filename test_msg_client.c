@@ -5,14 +5,17 @@
 //   gcc test_msg_client.c msg_conn.c msg_buf.c -o test_msg_client
 //
 
-#include <sys/time.h>    // gettimeofday()
 #include <unistd.h>      // usleep()
 #include <signal.h>      // signal()
 #include <stdlib.h>      // atoi()
 #include <string.h>      // memcpy()
 #include <math.h>        // sin(), cos(), M_PI
 #include <stdio.h>
+#include <arpa/inet.h>   // inet_pton()
 #include "msg_conn.h"
+#include "msg_cloud.h"
+#include "msg_rec.h"
+#include "msg_trace.h"
 
 
 // composeMsgCloud: Создаем тестовое сообщение с облаком точек.
@@ -20,6 +23,7 @@
 // Исходные данные:
 //   buf   - указатель на стуктуру неинициализированного буфера
 //   mtu   - максимальный размер одного пакета сообщения
+//   pool  - пул памяти для буферов сообщений
 //   index - порядковый номер сообщения (от начала сессии)
 //   Vsize - размер поля по оси X
 //   Wsize - размер поля по оси Y
@@ -28,12 +32,10 @@
 // Возвращаемые данные:
 //   записываются в поля структуры buf.
 //
-BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index, 
-    float step, float Vsize, float Wsize)
+BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, MsgBufferPool* pool,
+    size_t index, float step, float Vsize, float Wsize)
 {
-    BOOL status;
     MsgHeader msg;
-    struct timeval time;
     float Vij = 0;  // вспомогательные переменные для 
     float Wij = 0;  // расчета координат облака точек
     float* ptr = NULL;
@@ -42,12 +44,9 @@ BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index,
     size_t Vn = Vsize / step; // кол-во точек по одной оси
     size_t Wn = Wsize / step; // кол-во точек по другой оси
 
-    // Определяем текущее системное время
-    gettimeofday(&time, NULL);
-
     // Создаем заголовок сообщения
     msg.index = index;
-    msg.timestampNs = time.tv_sec * 1.0e9 + time.tv_usec * 1.0e3;
+    msg.timestampNs = MsgClockNs(MsgClockMonotonic); // момент захвата
     msg.type = MsgTypePointCloud;
     msg.uni.cloud.trackerState = 1;
     msg.uni.cloud.integralState = 1;
@@ -60,18 +59,21 @@ BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index,
     msg.uni.cloud.rotation[2] = sin(0.5 * angleRad);
     msg.uni.cloud.rotation[3] = cos(0.5 * angleRad);
     msg.uni.cloud.npts = Vn * Wn;
+    msg.uni.cloud.pointFormat = MsgPointFormatFloat32;
+    msg.uni.cloud.pointOrder = MsgPointOrderMemory;
+    msg.uni.cloud.attributes = 0; // только координаты точек
+    msg.uni.cloud.origin[0] = 0;
+    msg.uni.cloud.origin[1] = 0;
+    msg.uni.cloud.origin[2] = 0;
+    msg.uni.cloud.scale = 1.0;
     msg.magicNumber = MSG_HEADER_MAGIC;
 
-    // Выделяем буфер для сообщения
-    status = MsgBufferInit(buf, &msg, mtu);
+    // Берем буфер для сообщения из пула (заголовок записывается в него)
+    ptr = (float*) MsgCloudBuild(buf, &msg, Vn * Wn, mtu, pool);
 
-    if (status)
+    if (ptr)
     {
-        // Записываем заголовок сообщения в буфер сообщения
-        memcpy(buf->data, &msg, sizeof(MsgHeader));
-
-        // Записываем координаты облака точек в буфер сообщения
-        ptr = (float*) (buf->data + sizeof(MsgHeader));
+        // Записываем координаты облака точек прямо в буфер сообщения
         for (size_t i = 0; i < Vn; i++)
         {
             Vij = -0.5f * Vsize + step * i;
@@ -83,12 +85,13 @@ BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index,
                 *ptr++ = Wij;
             }
         }
+        MsgCloudBuildFinish(buf, Vn * Wn);
     }
     else
     {
         printf("Failed to init message buffer!\n");
     }
-    return status;
+    return ptr != NULL;
 }
 
 
@@ -107,6 +110,10 @@ int main(int argc, char *argv[])
     MsgConn conn;       // объект соединения
     MsgBuffer buf;      // буфер сообщения
     size_t index = 0;   // счетчик сообщений
+    MsgReplayer rep;    // воспроизведение записанной сессии
+    BOOL replaying = FALSE;
+    MsgBufferPool pool; // пул памяти для буферов сообщений
+    struct in_addr group; // адрес группы многоадресной рассылки
 
     // Регистрируем функцию обработки сигнала
     //signal(SIGINT, signal_handler);
@@ -121,16 +128,29 @@ int main(int argc, char *argv[])
     {
        printf("Missing command line arguments!\n");
        printf("Usage:\n");
-       printf("   %s hostname port\n", argv[0]);
+       printf("   %s hostname|group port [session]\n", argv[0]);
        return -1;
     }
 
     // Инициализируем структуру конфигурации соединения
+    // (неиспользуемые поля оставляем нулевыми)
+    bzero(&cfg, sizeof(MsgConnConfig));
     cfg.connRole = MsgConnRoleTcpSender;
     strncpy(cfg.servername, argv[1], sizeof(cfg.servername));
     cfg.portno = atoi(argv[2]);
     cfg.mtu = 1460*10;      // максимальный размер одного пакета
     cfg.maxListLength = 10; // максимальная длина очереди сообщений
+    cfg.targetLatency = 0.2;// целевая задержка доставки сообщения
+    cfg.zeroCopyMin = 16 << 10; // сообщения от 16 КБ - без копирования
+    cfg.resendDepth = 8;    // сообщения для повтора после обрыва связи
+
+    // Вместо имени хоста может быть задан адрес группы рассылки
+    if (inet_pton(AF_INET, argv[1], &group) == 1 &&
+        IN_MULTICAST(ntohl(group.s_addr)))
+    {
+        cfg.connRole = MsgConnRoleMcastSender;
+        cfg.mtu = 1472;     // датаграмма без IP фрагментации в Ethernet
+    }
 
     // Инициализируем объект соединения
     if (!MsgConnInit(&conn, &cfg))
@@ -139,16 +159,66 @@ int main(int argc, char *argv[])
         return -1;
     }
     printf("Talking to host %s port %d...\n", cfg.servername, cfg.portno);
+#ifdef MSG_TRACE
+    MsgTraceStart("client_trace.json");
+#endif
+
+    // Создаем пул памяти для буферов сообщений (сообщения до 256 КБ; часть
+    // буферов удерживается соединением для повторной отправки)
+    if (!MsgBufferPoolInit(&pool, 256 << 10, cfg.mtu, 16))
+    {
+        printf("Failed to init buffer pool!\n");
+        MsgConnFree(&conn);
+        return -1;
+    }
+
+    // Открываем записанную сессию, если задано ее имя
+    if (argc > 3)
+    {
+        replaying = MsgReplayerInit(&rep, argv[3], cfg.mtu, TRUE);
+        if (!replaying)
+        {
+            MsgConnFree(&conn);
+            MsgBufferPoolFree(&pool);
+            return -1;
+        }
+    }
 
     // В цикле отправляем несколько сообщений
     index = 0;
     while (/*index < 1000 &&*/ !needToExit)
     {
+        // Отправляем сообщения сессии с исходными интервалами без
+        // копирования (буфер указывает прямо в файл сессии)
+        if (replaying)
+        {
+            if (!MsgReplayerNext(&rep, &buf))
+                break;
+            if (MsgConnSend(&conn, &buf))
+                printf("Message no. %04d was replayed!\n", (int)buf.msgIndex);
+            else
+                printf("Message no. %04d failed to send!\n", (int)buf.msgIndex);
+            continue;
+        }
+
         // Делаем паузу перед отправкой нового сообщения
         usleep(330000);
 
+        // Пропускаем кадр, если канал не успевает передавать сообщения
+        if (!MsgConnReadyToSend(&conn))
+        {
+            printf("Message no. %04d skipped: queue delay %.3f s!\n",
+                (int)index, conn.rate.queueDelay);
+            index++;
+            continue;
+        }
+
         // Составляем новое сообщение
-        if (composeMsgCloud(&buf, cfg.mtu, index, 0.1, 4.0, 6.0))
+        MSG_TRACE_BEGIN(MsgTraceCompose, index, 0);
+        BOOL composed = composeMsgCloud(&buf, cfg.mtu, &pool, index,
+            0.1, 4.0, 6.0);
+        MSG_TRACE_END(MsgTraceCompose, index, composed);
+        if (composed)
         {
             // Отправляем сообщение
             if (MsgConnSend(&conn, &buf))
@@ -172,7 +242,13 @@ int main(int argc, char *argv[])
     }
 
     // Завершаем работу приложения
+#ifdef MSG_TRACE
+    MsgTraceStop();
+#endif
+    if (replaying)
+        MsgReplayerFree(&rep);
     MsgConnFree(&conn);
+    MsgBufferPoolFree(&pool);
     return 0;
 }
 
@@ -5,7 +5,6 @@
 //   gcc test_msg_client.c msg_conn.c msg_buf.c -o test_msg_client
 //
 
-#include <sys/time.h>    // gettimeofday()
 #include <unistd.h>      // usleep()
 #include <signal.h>      // signal()
 #include <stdlib.h>      // atoi()
@@ -32,7 +31,6 @@ BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index,
 {
     BOOL status;
     MsgHeader msg;
-    struct timeval time;
     float Vij = 0;  // вспомогательные переменные для 
     float Wij = 0;  // расчета координат облака точек
     float* ptr = NULL;
@@ -41,12 +39,9 @@ BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index,
     size_t Vn = Vsize / step; // кол-во точек по одной оси
     size_t Wn = Wsize / step; // кол-во точек по другой оси
 
-    // Определяем текущее системное время
-    gettimeofday(&time, NULL);
-
     // Создаем заголовок сообщения
     msg.index = index;
-    msg.timestampNs = time.tv_sec * 1.0e9 + time.tv_usec * 1.0e3;
+    msg.timestampNs = MsgClockNs(MsgClockMonotonic); // момент захвата
     msg.type = MsgTypePointCloud;
     msg.uni.cloud.trackerState = 1;
     msg.uni.cloud.integralState = 1;
@@ -58,6 +53,13 @@ BOOL composeMsgCloud(MsgBuffer* buf, size_t mtu, size_t index,
     msg.uni.cloud.rotation[2] = 0;
     msg.uni.cloud.rotation[3] = 1;
     msg.uni.cloud.npts = Vn * Wn;
+    msg.uni.cloud.pointFormat = MsgPointFormatFloat32;
+    msg.uni.cloud.pointOrder = MsgPointOrderMemory;
+    msg.uni.cloud.attributes = 0; // только координаты точек
+    msg.uni.cloud.origin[0] = 0;
+    msg.uni.cloud.origin[1] = 0;
+    msg.uni.cloud.origin[2] = 0;
+    msg.uni.cloud.scale = 1.0;
     msg.magicNumber = MSG_HEADER_MAGIC;
 
     // Выделяем буфер для сообщения
@@ -119,6 +121,8 @@ int main(int argc, char *argv[])
     }
 
     // Инициализируем структуру конфигурации соединения
+    // (неиспользуемые поля оставляем нулевыми)
+    bzero(&cfg, sizeof(MsgConnConfig));
     cfg.connRole = MsgConnRoleLocalSender;
     strncpy(cfg.servername, argv[1], sizeof(cfg.servername));
     strncpy(cfg.clientname, argv[2], sizeof(cfg.clientname));
@@ -0,0 +1,915 @@
+// test_msg_proxy.c: Программа-посредник для испытаний протокола передачи
+// сообщений в условиях, близких к беспроводной сети.
+//
+// Посредник принимает пакеты отправителя (test_msg_client или
+// test_msg_client_local), вносит в поток пакетов задержку, джиттер,
+// потери, перестановки и дублирование, ограничивает пропускную
+// способность и передает пакеты получателю. Искажения применяются к
+// целым пакетам протокола (MsgPacketHeader и фрагмент), поэтому и в TCP
+// потоке получатель видит корректные пакеты, но не все и не по порядку.
+// Данные в обратном направлении (кредиты, сведения о возобновлении
+// сессии) передаются без искажений. Как и сам локальный сокет, посредник
+// ждет места в очереди сокета получателя и на это время перестает
+// принимать пакеты отправителя (с ключом -o пакеты, которые не поместились
+// в эту очередь, теряются). Раз в секунду программа печатает входную и
+// выходную скорость, счетчики искажений и задержку пакетов.
+//
+// Компиляция:
+//   make -f MakefileProxy
+//
+// Примеры:
+//   ./test_msg_server 5000
+//   ./test_msg_proxy -p wifi tcp 5001 localhost 5000
+//   ./test_msg_client localhost 5001
+//
+//   ./test_msg_server_local /tmp/server.sock
+//   ./test_msg_proxy -l 2 -r 1 local /tmp/proxy.sock /tmp/server.sock
+//   ./test_msg_client_local /tmp/proxy.sock /tmp/client.sock
+//
+
+#include <unistd.h>      // close(), unlink(), getopt()
+#include <signal.h>      // signal()
+#include <stdlib.h>      // atoi(), atof(), malloc(), drand48()
+#include <string.h>      // memcpy(), strcmp()
+#include <stddef.h>      // offsetof
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>        // clock_gettime()
+#include <poll.h>        // poll()
+#include <fcntl.h>       // fcntl() (неблокирующие сокеты)
+#include <netdb.h>       // getaddrinfo()
+#include <sys/socket.h>
+#include <sys/un.h>      // sockaddr_un (для локальных сокетов)
+#include <netinet/in.h>  // sockaddr_in (для TCP сокетов)
+#include "msg_buf.h"     // MsgPacketHeader
+
+// Наибольший размер пакета, который принимает посредник
+#define PROXY_PACKET_MAX (1 << 17)
+
+// Сколько байт может ожидать отправки в TCP сокет получателя, прежде
+// чем посредник перестанет читать сокет отправителя
+#define PROXY_OUTPUT_MAX (4 << 20)
+
+
+/* ProxyFaults: Структура задает искажения потока пакетов. */
+typedef struct ProxyFaultsStruct
+{
+    double delay;        // задержка доставки пакета, с
+    double jitter;       // наибольшее отклонение задержки, с
+    double loss;         // вероятность потери пакета
+    double reorder;      // вероятность перестановки пакета
+    double duplicate;    // вероятность дублирования пакета
+    double bandwidth;    // пропускная способность, байт/с (0 - без предела)
+    size_t queueLimit;   // размер очереди перед узким местом, байт
+                         // (0 - без предела)
+    BOOL rxOverflow;     // терять пакеты, не поместившиеся в очередь
+                         // локального сокета получателя (иначе ждать)
+} ProxyFaults;
+
+
+/* ProxyProfile: Структура представляет именованный набор искажений. */
+typedef struct ProxyProfileStruct
+{
+    const char* name;    // имя профиля
+    ProxyFaults faults;  // искажения профиля
+} ProxyProfile;
+
+
+// Профили искажений: типичные условия сети Wi-Fi
+static const ProxyProfile proxyProfiles[] =
+{
+    { "clean",          { 0.0,   0.0,   0.0,   0.0,   0.0,   0.0,    0 } },
+    { "wifi",           { 0.003, 0.002, 0.002, 0.002, 0.001, 12.5e6, 256 << 10 } },
+    { "wifi-poor",      { 0.015, 0.010, 0.02,  0.01,  0.005, 2.5e6,  128 << 10 } },
+    { "wifi-congested", { 0.040, 0.030, 0.05,  0.02,  0.01,  0.625e6, 64 << 10 } },
+};
+
+
+/* ProxyPacket: Структура представляет пакет в очереди посредника. */
+typedef struct ProxyPacketStruct
+{
+    double arrival;      // момент приема пакета
+    double release;      // момент передачи пакета получателю
+    size_t seq;          // порядковый номер постановки в очередь
+    size_t size;         // размер пакета в байтах
+    unsigned char data[];// пакет
+} ProxyPacket;
+
+
+/* ProxyStats: Структура представляет счетчики посредника. */
+typedef struct ProxyStatsStruct
+{
+    size_t inPackets;    // принято пакетов
+    size_t inBytes;      // принято байт
+    size_t outPackets;   // передано пакетов
+    size_t outBytes;     // передано байт
+    size_t lost;         // потеряно пакетов
+    size_t duplicated;   // продублировано пакетов
+    size_t reordered;    // переставлено пакетов
+    size_t queueDrops;   // отброшено из-за переполнения очереди
+    size_t rxDrops;      // не принято получателем (очередь сокета полна)
+    double delaySum;     // суммарная задержка переданных пакетов, с
+    double delayMax;     // наибольшая задержка пакета, с
+} ProxyStats;
+
+
+/* Proxy: Структура представляет состояние посредника. */
+typedef struct ProxyStruct
+{
+    ProxyFaults faults;  // искажения потока пакетов
+    ProxyPacket** heap;  // очередь пакетов (пирамида по моменту передачи)
+    size_t count;        // количество пакетов в очереди
+    size_t capacity;     // размер массива очереди
+    size_t seq;          // счетчик постановок в очередь
+    double linkFree;     // момент освобождения узкого места
+    double lastRelease;  // момент передачи последнего непереставленного
+                         // пакета (задержка не меняет порядок пакетов)
+    ProxyStats stats;    // счетчики с начала работы
+    ProxyStats last;     // счетчики на момент предыдущего отчета
+    double start;        // момент запуска
+    double lastReport;   // момент предыдущего отчета
+} Proxy;
+
+
+// Функция для обработки сигнала Ctrl+C (для остановки приложения)
+BOOL needToExit = FALSE;
+void signal_handler(int signum)
+{
+    needToExit = TRUE;
+}
+
+
+// Функция возвращает текущее время по монотонным часам в секундах.
+static double proxyNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+
+// Функция возвращает TRUE с вероятностью p.
+static BOOL proxyChance(double p)
+{
+    return p > 0.0 && drand48() < p;
+}
+
+
+// Функция сравнивает пакеты по моменту передачи (при равенстве - по
+// порядку постановки в очередь).
+static BOOL proxyEarlier(const ProxyPacket* a, const ProxyPacket* b)
+{
+    return a->release < b->release ||
+        (a->release == b->release && a->seq < b->seq);
+}
+
+
+// Функция добавляет пакет в очередь.
+static BOOL proxyHeapPush(Proxy* proxy, ProxyPacket* pkt)
+{
+    size_t i = proxy->count;
+
+    if (proxy->count == proxy->capacity)
+    {
+        size_t capacity = proxy->capacity ? 2 * proxy->capacity : 256;
+        ProxyPacket** heap = (ProxyPacket**) realloc(proxy->heap,
+            capacity * sizeof(ProxyPacket*));
+        if (!heap)
+            return FALSE;
+        proxy->heap = heap;
+        proxy->capacity = capacity;
+    }
+    for (; i > 0 && proxyEarlier(pkt, proxy->heap[(i - 1) / 2]);
+        i = (i - 1) / 2)
+        proxy->heap[i] = proxy->heap[(i - 1) / 2];
+    proxy->heap[i] = pkt;
+    proxy->count++;
+    return TRUE;
+}
+
+
+// Функция извлекает из очереди пакет с наименьшим моментом передачи.
+static ProxyPacket* proxyHeapPop(Proxy* proxy)
+{
+    ProxyPacket* top = proxy->heap[0];
+    ProxyPacket* last = proxy->heap[--proxy->count];
+    size_t i = 0;
+
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= proxy->count)
+            break;
+        if (child + 1 < proxy->count &&
+            proxyEarlier(proxy->heap[child + 1], proxy->heap[child]))
+            child++;
+        if (!proxyEarlier(proxy->heap[child], last))
+            break;
+        proxy->heap[i] = proxy->heap[child];
+        i = child;
+    }
+    if (proxy->count > 0)
+        proxy->heap[i] = last;
+    return top;
+}
+
+
+// Функция удаляет все пакеты из очереди.
+static void proxyClear(Proxy* proxy)
+{
+    while (proxy->count > 0)
+        free(proxyHeapPop(proxy));
+    proxy->linkFree = 0.0;
+    proxy->lastRelease = 0.0;
+}
+
+
+// Функция принимает пакет отправителя: вносит искажения и ставит пакет
+// (или его копии) в очередь на передачу получателю.
+static void proxyEnqueue(Proxy* proxy, const unsigned char* data,
+    size_t size, double now)
+{
+    const ProxyFaults* f = &proxy->faults;
+    int copies = 1;
+
+    proxy->stats.inPackets++;
+    proxy->stats.inBytes += size;
+    if (proxyChance(f->loss))
+    {
+        proxy->stats.lost++;
+        return;
+    }
+    if (proxyChance(f->duplicate))
+    {
+        proxy->stats.duplicated++;
+        copies = 2;
+    }
+
+    for (int c = 0; c < copies; c++)
+    {
+        ProxyPacket* pkt = NULL;
+        double release = now;
+
+        // Узкое место передает пакеты по очереди со скоростью bandwidth,
+        // а не поместившиеся в его очередь пакеты отбрасываются
+        if (proxy->linkFree < now)
+            proxy->linkFree = now;
+        if (f->bandwidth > 0.0)
+        {
+            double backlog = (proxy->linkFree - now) * f->bandwidth;
+            if (f->queueLimit > 0 && backlog + size > f->queueLimit)
+            {
+                proxy->stats.queueDrops++;
+                continue;
+            }
+            proxy->linkFree += size / f->bandwidth;
+        }
+
+        // Задержка с джиттером не меняет порядок пакетов, кроме
+        // специально переставляемых: они задерживаются дольше и
+        // пропускают вперед следующие пакеты
+        release = proxy->linkFree + f->delay +
+            f->jitter * (2.0 * drand48() - 1.0);
+        if (release < proxy->linkFree)
+            release = proxy->linkFree;
+        if (proxyChance(f->reorder))
+        {
+            proxy->stats.reordered++;
+            release += 2.0 * f->jitter + 0.002;
+        }
+        else
+        {
+            if (release < proxy->lastRelease)
+                release = proxy->lastRelease;
+            proxy->lastRelease = release;
+        }
+
+        pkt = (ProxyPacket*) malloc(sizeof(ProxyPacket) + size);
+        if (!pkt)
+        {
+            proxy->stats.queueDrops++;
+            continue;
+        }
+        pkt->arrival = now;
+        pkt->release = release;
+        pkt->seq = proxy->seq++;
+        pkt->size = size;
+        memcpy(pkt->data, data, size);
+        if (!proxyHeapPush(proxy, pkt))
+        {
+            free(pkt);
+            proxy->stats.queueDrops++;
+        }
+    }
+}
+
+
+// Функция возвращает очередной пакет, момент передачи которого наступил,
+// или NULL.
+static ProxyPacket* proxyNextDue(Proxy* proxy, double now)
+{
+    if (proxy->count == 0 || proxy->heap[0]->release > now)
+        return NULL;
+    return proxyHeapPop(proxy);
+}
+
+
+// Функция учитывает пакет, переданный получателю.
+static void proxyDelivered(Proxy* proxy, const ProxyPacket* pkt, double now)
+{
+    double delay = now - pkt->arrival;
+
+    proxy->stats.outPackets++;
+    proxy->stats.outBytes += pkt->size;
+    proxy->stats.delaySum += delay;
+    if (delay > proxy->stats.delayMax)
+        proxy->stats.delayMax = delay;
+}
+
+
+// Функция возвращает время ожидания poll в миллисекундах: до передачи
+// очередного пакета (если посредник не ждет места у получателя) или до
+// следующего отчета.
+static int proxyTimeout(const Proxy* proxy, double now, BOOL blocked)
+{
+    double wait = proxy->lastReport + 1.0 - now;
+
+    if (!blocked && proxy->count > 0 &&
+        proxy->heap[0]->release - now < wait)
+        wait = proxy->heap[0]->release - now;
+    if (wait <= 0.0)
+        return 0;
+    return (int) (wait * 1000.0) + 1;
+}
+
+
+// Функция печатает счетчики s, накопленные за interval секунд, с
+// задержкой пакетов, переданных после отчета base.
+static void proxyPrintStats(const ProxyStats* s, const ProxyStats* base,
+    double interval, const char* title)
+{
+    size_t out = s->outPackets - base->outPackets;
+
+    printf("%s in %7.2f Mbit/s, out %7.2f Mbit/s, packets %zu/%zu, "
+        "lost %zu, dup %zu, reordered %zu, queue drops %zu, rx drops %zu, "
+        "delay avg %.1f ms\n", title,
+        (s->inBytes - base->inBytes) * 8.0e-6 / interval,
+        (s->outBytes - base->outBytes) * 8.0e-6 / interval,
+        s->inPackets - base->inPackets, out,
+        s->lost - base->lost, s->duplicated - base->duplicated,
+        s->reordered - base->reordered, s->queueDrops - base->queueDrops,
+        s->rxDrops - base->rxDrops,
+        out ? (s->delaySum - base->delaySum) * 1000.0 / out : 0.0);
+}
+
+
+// Функция печатает отчет, если с предыдущего прошла секунда.
+static void proxyReport(Proxy* proxy, double now)
+{
+    char title[32];
+
+    if (now - proxy->lastReport < 1.0)
+        return;
+    if (proxy->stats.inPackets > proxy->last.inPackets ||
+        proxy->count > 0)
+    {
+        snprintf(title, sizeof(title), "%7.1f s:", now - proxy->start);
+        proxyPrintStats(&proxy->stats, &proxy->last,
+            now - proxy->lastReport, title);
+    }
+    proxy->last = proxy->stats;
+    proxy->lastReport = now;
+}
+
+
+// Функция переводит сокет в неблокирующий режим.
+static void proxyNonBlocking(int sock)
+{
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+}
+
+
+// Функция создает локальный сокет датаграмм с именем path.
+static int proxyLocalSocket(const char* path, struct sockaddr_un* name)
+{
+    int sock = socket(AF_LOCAL, SOCK_DGRAM, 0);
+
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    bzero(name, sizeof(*name));
+    name->sun_family = AF_LOCAL;
+    strncpy(name->sun_path, path, sizeof(name->sun_path) - 1);
+    unlink(path);
+    if (bind(sock, (struct sockaddr*) name, sizeof(*name)) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    proxyNonBlocking(sock);
+    return sock;
+}
+
+
+// Функция работы посредника между локальными сокетами датаграмм: пакеты
+// отправителя передаются получателю serverPath с искажениями, а
+// датаграммы получателя (кредиты) - отправителю без искажений. Получателю
+// посредник пишет через отдельный сокет proxyPath.fwd, подключенный к
+// нему: poll такого сокета сообщает, есть ли место в очереди получателя.
+static int proxyRunLocal(Proxy* proxy, const char* proxyPath,
+    const char* serverPath)
+{
+    struct sockaddr_un self, fwdName, server, client, from;
+    socklen_t clientLen = 0;
+    char fwdPath[sizeof(self.sun_path)];
+    unsigned char* data = (unsigned char*) malloc(PROXY_PACKET_MAX);
+    int sock = proxyLocalSocket(proxyPath, &self); // сокет для отправителя
+    int fwd = -1;           // сокет для получателя
+    ProxyPacket* held = NULL; // пакет, ждущий места в очереди получателя
+
+    snprintf(fwdPath, sizeof(fwdPath), "%s.fwd", proxyPath);
+    if (sock >= 0)
+        fwd = proxyLocalSocket(fwdPath, &fwdName);
+    bzero(&server, sizeof(server));
+    server.sun_family = AF_LOCAL;
+    strncpy(server.sun_path, serverPath, sizeof(server.sun_path) - 1);
+    if (fwd >= 0 &&
+        connect(fwd, (struct sockaddr*) &server, sizeof(server)) < 0)
+    {
+        perror("connect");
+        close(fwd);
+        fwd = -1;
+        unlink(fwdPath);
+    }
+    if (fwd < 0 || !data)
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+            unlink(proxyPath);
+        }
+        free(data);
+        return -1;
+    }
+    printf("Forwarding %s -> %s...\n", proxyPath, serverPath);
+
+    while (!needToExit)
+    {
+        struct pollfd pfd[2];
+        ssize_t cbret = 0;
+        double now = proxyNow();
+
+        // Пока пакет ждет места у получателя, пакеты отправителя не
+        // читаем: его очередь заполнится, и он будет ждать так же, как
+        // без посредника
+        pfd[0].fd = sock;
+        pfd[0].events = held ? 0 : POLLIN;
+        pfd[1].fd = fwd;
+        pfd[1].events = POLLIN | (held ? POLLOUT : 0);
+        if (poll(pfd, 2, proxyTimeout(proxy, now, held != NULL)) < 0 &&
+            errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        // Читаем все принятые пакеты отправителя
+        while (!held)
+        {
+            socklen_t fromLen = sizeof(from);
+
+            // У отправителя без имени сокета адрес не заполняется, поэтому
+            // имя предыдущего отправителя не должно остаться в from
+            bzero(&from, sizeof(from));
+            cbret = recvfrom(sock, data, PROXY_PACKET_MAX, 0,
+                (struct sockaddr*) &from, &fromLen);
+            if (cbret < 0)
+                break;
+            if (fromLen > offsetof(struct sockaddr_un, sun_path))
+            {
+                client = from;
+                clientLen = fromLen;
+            }
+            proxyEnqueue(proxy, data, cbret, proxyNow());
+        }
+
+        // Передаем отправителю датаграммы получателя
+        while ((cbret = recv(fwd, data, PROXY_PACKET_MAX, 0)) >= 0)
+            if (clientLen > 0)
+                sendto(sock, data, cbret, MSG_DONTWAIT,
+                    (struct sockaddr*) &client, clientLen);
+
+        // Передаем пакеты, момент передачи которых наступил. Пакет, для
+        // которого нет места в очереди получателя, ждет (или теряется с
+        // ключом -o), а после перезапуска получателя сокет подключается
+        // к нему заново
+        now = proxyNow();
+        while (held || (held = proxyNextDue(proxy, now)) != NULL)
+        {
+            cbret = send(fwd, held->data, held->size, MSG_DONTWAIT);
+            if (cbret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+                !proxy->faults.rxOverflow)
+                break;
+            if (cbret < 0 && errno == ECONNREFUSED)
+                connect(fwd, (struct sockaddr*) &server, sizeof(server));
+            if (cbret == (ssize_t) held->size)
+                proxyDelivered(proxy, held, now);
+            else
+                proxy->stats.rxDrops++;
+            free(held);
+            held = NULL;
+        }
+        proxyReport(proxy, now);
+    }
+
+    free(held);
+    close(fwd);
+    unlink(fwdPath);
+    close(sock);
+    unlink(proxyPath);
+    free(data);
+    return 0;
+}
+
+
+// Функция подключается к получателю host:port.
+static int proxyConnect(const char* host, const char* port)
+{
+    struct addrinfo hints, *res = NULL, *ai = NULL;
+    int sock = -1;
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+    {
+        printf("Unable to resolve host %s!\n", host);
+        return -1;
+    }
+    for (ai = res; ai && sock < 0; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock >= 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) < 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (sock < 0)
+        printf("Unable to connect to %s:%s!\n", host, port);
+    return sock;
+}
+
+
+// Функция создает TCP сокет, ожидающий подключений на порту port.
+static int proxyListen(int port)
+{
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        listen(sock, 1) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+// Функция выделяет из принятого TCP потока целые пакеты и ставит их в
+// очередь. Возвращает количество обработанных байт или -1, если поток
+// не состоит из пакетов протокола.
+static ssize_t proxyParseStream(Proxy* proxy, const unsigned char* data,
+    size_t size)
+{
+    size_t offset = 0;
+
+    while (size - offset >= sizeof(MsgPacketHeader))
+    {
+        MsgPacketHeader hdr;
+        size_t pktSize = 0;
+
+        memcpy(&hdr, data + offset, sizeof(hdr));
+        if ((hdr.magicNumber != MSG_PACKET_MAGIC &&
+            hdr.magicNumber != MSG_BATCH_MAGIC) ||
+            hdr.chunkSize > PROXY_PACKET_MAX - sizeof(MsgPacketHeader))
+            return -1;
+        pktSize = sizeof(MsgPacketHeader) + hdr.chunkSize;
+        if (size - offset < pktSize)
+            break;
+        proxyEnqueue(proxy, data + offset, pktSize, proxyNow());
+        offset += pktSize;
+    }
+    return offset;
+}
+
+
+// Функция работы TCP посредника: принимает подключение отправителя на
+// порту port, подключается к получателю host:serverPort и передает ему
+// пакеты отправителя с искажениями, а отправителю - данные получателя без
+// искажений. После отключения отправителя пакеты очереди дожидаются
+// передачи, и посредник ждет следующего подключения.
+static int proxyRunTcp(Proxy* proxy, int port, const char* host,
+    const char* serverPort)
+{
+    int lsock = proxyListen(port);
+    int client = -1;        // сокет отправителя
+    int server = -1;        // сокет получателя
+    unsigned char* in = (unsigned char*) malloc(2 * PROXY_PACKET_MAX);
+    size_t inLen = 0;       // байт потока отправителя в буфере in
+    unsigned char* out = NULL; // пакеты для передачи получателю
+    size_t outLen = 0, outCap = 0; // байт в буфере out и его размер
+    unsigned char back[4096]; // данные получателя для отправителя
+
+    if (lsock < 0 || !in)
+    {
+        free(in);
+        return -1;
+    }
+    printf("Forwarding port %d -> %s:%s...\n", port, host, serverPort);
+
+    while (!needToExit)
+    {
+        struct pollfd pfd[3];
+        int nfds = 0, ic = -1, is = -1, il = -1;
+        ProxyPacket* pkt = NULL;
+        double now = proxyNow();
+
+        // Ждем подключения, только если сеанс не идет
+        if (client < 0 && server < 0)
+        {
+            il = nfds++;
+            pfd[il].fd = lsock;
+            pfd[il].events = POLLIN;
+        }
+        if (client >= 0)
+        {
+            ic = nfds++;
+            pfd[ic].fd = client;
+            pfd[ic].events = outLen < PROXY_OUTPUT_MAX ? POLLIN : 0;
+        }
+        if (server >= 0)
+        {
+            is = nfds++;
+            pfd[is].fd = server;
+            pfd[is].events = POLLIN | (outLen > 0 ? POLLOUT : 0);
+        }
+        if (poll(pfd, nfds, proxyTimeout(proxy, now, FALSE)) < 0 &&
+            errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        // Начинаем сеанс
+        if (il >= 0 && (pfd[il].revents & POLLIN))
+        {
+            client = accept(lsock, NULL, NULL);
+            if (client >= 0)
+            {
+                server = proxyConnect(host, serverPort);
+                if (server < 0)
+                {
+                    close(client);
+                    client = -1;
+                }
+                else
+                {
+                    printf("Sender connected\n");
+                    proxyNonBlocking(client);
+                    proxyNonBlocking(server);
+                }
+            }
+            continue;
+        }
+
+        // Читаем поток отправителя и выделяем из него пакеты
+        if (ic >= 0 && (pfd[ic].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t cbret = recv(client, in + inLen,
+                2 * PROXY_PACKET_MAX - inLen, 0);
+            ssize_t used = 0;
+            if (cbret > 0)
+            {
+                inLen += cbret;
+                used = proxyParseStream(proxy, in, inLen);
+                if (used < 0)
+                {
+                    printf("Corrupted packet stream from sender!\n");
+                    cbret = 0;
+                }
+                else
+                {
+                    memmove(in, in + used, inLen - used);
+                    inLen -= used;
+                }
+            }
+            if (cbret == 0 || (cbret < 0 && errno != EAGAIN &&
+                errno != EINTR))
+            {
+                printf("Sender disconnected\n");
+                close(client);
+                client = -1;
+                inLen = 0;
+            }
+        }
+
+        // Передаем отправителю данные получателя
+        if (is >= 0 && (pfd[is].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t cbret = recv(server, back, sizeof(back), 0);
+            if (cbret > 0 && client >= 0)
+                send(client, back, cbret, MSG_NOSIGNAL);
+            if (cbret == 0 || (cbret < 0 && errno != EAGAIN &&
+                errno != EINTR))
+            {
+                printf("Receiver disconnected\n");
+                close(server);
+                server = -1;
+                if (client >= 0)
+                    close(client);
+                client = -1;
+                inLen = outLen = 0;
+                proxyClear(proxy);
+            }
+        }
+
+        // Переносим в буфер получателя пакеты, момент передачи которых
+        // наступил (задержка учитывается до записи в сокет)
+        now = proxyNow();
+        while ((pkt = proxyNextDue(proxy, now)) != NULL)
+        {
+            if (server >= 0 && outLen + pkt->size > outCap)
+            {
+                size_t cap = outCap ? outCap : PROXY_PACKET_MAX;
+                while (cap < outLen + pkt->size)
+                    cap *= 2;
+                unsigned char* p = (unsigned char*) realloc(out, cap);
+                if (p)
+                {
+                    out = p;
+                    outCap = cap;
+                }
+            }
+            if (server >= 0 && outLen + pkt->size <= outCap)
+            {
+                memcpy(out + outLen, pkt->data, pkt->size);
+                outLen += pkt->size;
+                proxyDelivered(proxy, pkt, now);
+            }
+            else
+                proxy->stats.rxDrops++;
+            free(pkt);
+        }
+        if (server >= 0 && outLen > 0)
+        {
+            ssize_t cbret = send(server, out, outLen,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (cbret > 0)
+            {
+                memmove(out, out + cbret, outLen - cbret);
+                outLen -= cbret;
+            }
+        }
+
+        // Завершаем сеанс, когда отправитель отключился и все его пакеты
+        // переданы получателю
+        if (client < 0 && server >= 0 && proxy->count == 0 && outLen == 0)
+        {
+            close(server);
+            server = -1;
+            proxy->linkFree = proxy->lastRelease = 0.0;
+        }
+        proxyReport(proxy, now);
+    }
+
+    if (client >= 0)
+        close(client);
+    if (server >= 0)
+        close(server);
+    close(lsock);
+    free(in);
+    free(out);
+    return 0;
+}
+
+
+// Функция печатает подсказку по запуску программы.
+static void proxyUsage(const char* prog)
+{
+    printf("Usage:\n");
+    printf("   %s [options] tcp port serverhost serverport\n", prog);
+    printf("   %s [options] local proxysocket serversocket\n", prog);
+    printf("Options (applied in order, so a profile goes first):\n");
+    printf("   -p profile  clean, wifi, wifi-poor or wifi-congested\n");
+    printf("   -d ms       delay\n");
+    printf("   -j ms       jitter (delay +/- jitter, order is kept)\n");
+    printf("   -l percent  packet loss\n");
+    printf("   -r percent  packet reordering\n");
+    printf("   -u percent  packet duplication\n");
+    printf("   -b Mbit/s   bandwidth cap (0 - unlimited)\n");
+    printf("   -q KB       bottleneck queue size (0 - unlimited)\n");
+    printf("   -o          local: drop packets the receiver's socket queue "
+        "can't take\n");
+    printf("   -s seed     random seed\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    Proxy proxy;        // состояние посредника
+    ProxyFaults* f = &proxy.faults;
+    const char* prog = argv[0];
+    double elapsed = 0.0;
+    int status = 0;
+    int opt = 0;
+
+    // Регистрируем функцию обработки сигнала
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Анализируем параметры командной строки
+    bzero(&proxy, sizeof(proxy));
+    srand48(time(NULL));
+    while ((opt = getopt(argc, argv, "p:d:j:l:r:u:b:q:os:")) != -1)
+    {
+        size_t i = 0;
+        switch (opt)
+        {
+        case 'p':
+            for (i = 0; i < sizeof(proxyProfiles) / sizeof(proxyProfiles[0]);
+                i++)
+                if (strcmp(optarg, proxyProfiles[i].name) == 0)
+                    break;
+            if (i == sizeof(proxyProfiles) / sizeof(proxyProfiles[0]))
+            {
+                printf("Unknown profile %s!\n", optarg);
+                return -1;
+            }
+            *f = proxyProfiles[i].faults;
+            break;
+        case 'd': f->delay = atof(optarg) * 1.0e-3; break;
+        case 'j': f->jitter = atof(optarg) * 1.0e-3; break;
+        case 'l': f->loss = atof(optarg) * 0.01; break;
+        case 'r': f->reorder = atof(optarg) * 0.01; break;
+        case 'u': f->duplicate = atof(optarg) * 0.01; break;
+        case 'b': f->bandwidth = atof(optarg) * 1.0e6 / 8.0; break;
+        case 'q': f->queueLimit = (size_t) (atof(optarg) * 1024.0); break;
+        case 'o': f->rxOverflow = TRUE; break;
+        case 's': srand48(atol(optarg)); break;
+        default:
+            proxyUsage(prog);
+            return -1;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (!((argc == 4 && strcmp(argv[0], "tcp") == 0) ||
+        (argc == 3 && strcmp(argv[0], "local") == 0)))
+    {
+        printf("Missing or extra command line arguments!\n");
+        proxyUsage(prog);
+        return -1;
+    }
+    printf("Delay %.1f ms, jitter %.1f ms, loss %.2f%%, reorder %.2f%%, "
+        "duplicate %.2f%%, bandwidth %.2f Mbit/s, queue %zu KB%s\n",
+        f->delay * 1000.0, f->jitter * 1000.0, f->loss * 100.0,
+        f->reorder * 100.0, f->duplicate * 100.0,
+        f->bandwidth * 8.0e-6, f->queueLimit >> 10,
+        f->rxOverflow ? ", receiver overflow drops" : "");
+
+    // Пересылаем пакеты до нажатия Ctrl+C
+    proxy.start = proxy.lastReport = proxyNow();
+    if (argc == 4)
+        status = proxyRunTcp(&proxy, atoi(argv[1]), argv[2], argv[3]);
+    else
+        status = proxyRunLocal(&proxy, argv[1], argv[2]);
+
+    // Печатаем итоговые счетчики
+    elapsed = proxyNow() - proxy.start;
+    bzero(&proxy.last, sizeof(proxy.last));
+    proxyPrintStats(&proxy.stats, &proxy.last,
+        elapsed > 0.0 ? elapsed : 1.0, "Total:");
+    printf("Max delay %.1f ms\n", proxy.stats.delayMax * 1000.0);
+    proxyClear(&proxy);
+    free(proxy.heap);
+    return status;
+}
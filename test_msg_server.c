@@ -10,15 +10,23 @@
 #include <stdlib.h>      // atoi()
 #include <string.h>      // strncpy()
 #include <stdio.h>
+#include <arpa/inet.h>   // inet_pton()
 #include "msg_conn.h"
+#include "msg_rec.h"
+#include "msg_trace.h"
 
 
+// Объект соединения (глобальный, чтобы обработчик сигнала мог прервать
+// ожидание сообщения)
+MsgConn conn;
+
 // Функция для обработки сигнала Ctrl+C (для остановки приложения)
 BOOL needToExit = FALSE;
 void signal_handler(int signum)
 {
     printf("Stopping application...\n");
     needToExit = TRUE;
+    MsgConnWakeup(&conn);
 }
 
 // Функция вычисления наименьшего из двух чисел
@@ -31,9 +39,12 @@ size_t min(size_t x, size_t y)
 int main(int argc, char *argv[])
 {
     MsgConnConfig cfg;  // конфигурация соединения
-    MsgConn conn;       // объект соединения
     MsgBuffer* pbuf = NULL; // указатель на буфер сообщения
     size_t index = 0;   // счетчик сообщений
+    MsgRecorder rec;    // запись принятых сообщений в файл сессии
+    BOOL recording = FALSE;
+    struct in_addr group; // адрес группы многоадресной рассылки
+    const char* groupName = NULL;
 
     // Регистрируем функцию обработки сигнала
     //signal(SIGINT, signal_handler);
@@ -43,21 +54,40 @@ int main(int argc, char *argv[])
     sigemptyset( &a.sa_mask );
     sigaction( SIGINT, &a, NULL );
 
-    // Анализируем параметры командной строки
-    if (argc != 2)
+    // Анализируем параметры командной строки (первым параметром может
+    // быть задан адрес группы многоадресной рассылки)
+    if (argc > 2 && inet_pton(AF_INET, argv[1], &group) == 1 &&
+        IN_MULTICAST(ntohl(group.s_addr)))
+    {
+        groupName = argv[1];
+        argc--;
+        argv++;
+    }
+    if (argc < 2 || argc > 3)
     {
        printf("Missing or extra command line arguments!\n");
        printf("Usage:\n");
-       printf("   %s port\n", argv[0]);
+       printf("   %s [group] port [session]\n", argv[0]);
        return -1;
     }
 
     // Инициализируем структуру конфигурации соединения
+    // (неиспользуемые поля оставляем нулевыми)
+    bzero(&cfg, sizeof(MsgConnConfig));
     cfg.connRole = MsgConnRoleTcpReceiver;
     strncpy(cfg.servername, "localhost", sizeof("localhost"));
     cfg.portno = atoi(argv[1]);
     cfg.mtu = 1460*10;      // максимальный размер одного IP пакета
     cfg.maxListLength = 10; // максимальная длина очереди сообщений
+    cfg.clockSyncPeriod = 1.0; // синхронизация часов раз в секунду
+    if (groupName)
+    {
+        cfg.connRole = MsgConnRoleMcastReceiver;
+        strncpy(cfg.servername, groupName, sizeof(cfg.servername) - 1);
+        cfg.servername[sizeof(cfg.servername) - 1] = '\0';
+        cfg.mtu = 1472;     // датаграмма без IP фрагментации в Ethernet
+        cfg.reassemblyTimeout = 0.5; // сообщения с потерями отбрасываются
+    }
 
     // Инициализируем объект соединения
     if (!MsgConnInit(&conn, &cfg))
@@ -66,12 +96,32 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // Открываем запись сессии, если задано ее имя
+    if (argc == 3)
+    {
+        recording = MsgRecorderInit(&rec, argv[2], 256 << 20);
+        if (!recording)
+            printf("Failed to start recording session %s!\n", argv[2]);
+    }
+
+#ifdef MSG_TRACE
+    MsgTraceStart("server_trace.json");
+#endif
+
     // В цикле принимаем сообщения
     while (!needToExit)
     {
-        if (MsgConnReceive(&conn, &pbuf))
+        if (MsgConnReceiveWait(&conn, &pbuf, 1.0))
         {
-            printf("Message no. %04d received!\n", (int)pbuf->msgIndex);
+            MsgConnLatency lat;
+            if (MsgConnGetLatency(&conn, pbuf, &lat))
+                printf("Message no. %04d received! Latency %.2f ms "
+                    "(sender %.2f ms, network %.2f ms%s)\n",
+                    (int)pbuf->msgIndex, lat.totalNs * 1.0e-6,
+                    lat.senderNs * 1.0e-6, lat.networkNs * 1.0e-6,
+                    lat.synced ? "" : ", clocks not synced");
+            else
+                printf("Message no. %04d received!\n", (int)pbuf->msgIndex);
             MsgHeader* msg = (MsgHeader*) pbuf->data;
             size_t npts = msg->uni.cloud.npts;
             float* ptr = (float*) (pbuf->data + sizeof(MsgHeader));
@@ -83,13 +133,21 @@ int main(int argc, char *argv[])
             	//    ptr[0], ptr[1], ptr[2]);
             	ptr += 3;
             }
+            // Записываем сообщение в файл сессии
+            if (recording && !MsgRecorderWrite(&rec, pbuf))
+                printf("Failed to record message no. %04d!\n",
+                    (int)pbuf->msgIndex);
             // Удаляем обработанное сообщение из списка
             MsgConnBufferRelease(&conn, &pbuf);
-            usleep(50000);
         }
     }
 
     // Завершаем работу приложения
+#ifdef MSG_TRACE
+    MsgTraceStop();
+#endif
+    if (recording)
+        MsgRecorderFree(&rec);
     MsgConnFree(&conn);
     return 0;
 }
@@ -13,12 +13,17 @@
 #include "msg_conn.h"
 
 
+// Объект соединения (глобальный, чтобы обработчик сигнала мог прервать
+// ожидание сообщения)
+MsgConn conn;
+
 // Функция для обработки сигнала Ctrl+C (для остановки приложения)
 BOOL needToExit = FALSE;
 void signal_handler(int signum)
 {
     printf("Stopping application...\n");
     needToExit = TRUE;
+    MsgConnWakeup(&conn);
 }
 
 // Функция вычисления наименьшего из двух чисел
@@ -31,7 +36,6 @@ size_t min(size_t x, size_t y)
 int main(int argc, char *argv[])
 {
     MsgConnConfig cfg;  // конфигурация соединения
-    MsgConn conn;       // объект соединения
     MsgBuffer* pbuf = NULL; // указатель на буфер сообщения
     size_t index = 0;   // счетчик сообщений
 
@@ -48,11 +52,14 @@ int main(int argc, char *argv[])
     }
 
     // Инициализируем структуру конфигурации соединения
+    // (неиспользуемые поля оставляем нулевыми)
+    bzero(&cfg, sizeof(MsgConnConfig));
     cfg.connRole = MsgConnRoleLocalReceiver;
     strncpy(cfg.servername, argv[1], sizeof(cfg.servername));
     cfg.portno = -1;
     cfg.mtu = 65536; //1460*10;      // максимальный размер одного IP пакета
     cfg.maxListLength = 10; // максимальная длина очереди сообщений
+    cfg.clockSyncPeriod = 1.0; // синхронизация часов раз в секунду
 
     // Инициализируем объект соединения
     if (!MsgConnInit(&conn, &cfg))
@@ -65,9 +72,17 @@ int main(int argc, char *argv[])
     // В цикле принимаем сообщения
     while (!needToExit)
     {
-        if (MsgConnReceive(&conn, &pbuf))
+        if (MsgConnReceiveWait(&conn, &pbuf, 1.0))
         {
-            printf("Message no. %04d received!\n", (int)pbuf->msgIndex);
+            MsgConnLatency lat;
+            if (MsgConnGetLatency(&conn, pbuf, &lat))
+                printf("Message no. %04d received! Latency %.2f ms "
+                    "(sender %.2f ms, network %.2f ms%s)\n",
+                    (int)pbuf->msgIndex, lat.totalNs * 1.0e-6,
+                    lat.senderNs * 1.0e-6, lat.networkNs * 1.0e-6,
+                    lat.synced ? "" : ", clocks not synced");
+            else
+                printf("Message no. %04d received!\n", (int)pbuf->msgIndex);
             MsgHeader* msg = (MsgHeader*) pbuf->data;
             size_t npts = msg->uni.cloud.npts;
             float* ptr = (float*) (pbuf->data + sizeof(MsgHeader));
@@ -81,7 +96,6 @@ int main(int argc, char *argv[])
             }
             // Удаляем обработанное сообщение из списка
             MsgConnBufferRelease(&conn, &pbuf);
-            usleep(50000);
         }
     }
 